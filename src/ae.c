@@ -48,7 +48,11 @@
 #include "config.h"
 
 /* Include the best multiplexing layer supported by this system.
- * The following should be ordered by performances, descending. */
+ * The following should be ordered by performances, descending. The io_uring
+ * backend is only used when explicitly requested at build time. */
+#ifdef HAVE_IO_URING
+#include "ae_iouring.c"
+#else
 #ifdef HAVE_EVPORT
 #include "ae_evport.c"
 #else
@@ -62,6 +66,7 @@
         #endif
     #endif
 #endif
+#endif
 
 
 aeEventLoop *aeCreateEventLoop(int setsize) {
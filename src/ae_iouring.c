@@ -0,0 +1,480 @@
+/* Linux io_uring(7) based ae.c module
+ *
+ * Copyright (c) 2024, Sider Contributors
+ * All rights reserved.
+ *
+ * Sidertribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Sidertributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Sidertributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Sider nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Every monitored fd has a one-shot IORING_OP_POLL_ADD request in flight.
+ * aeApiAddEvent() and aeApiDelEvent() just mark the fd as dirty (the only
+ * exception is an fd that is no longer monitored, see aeApiDelEvent()).
+ * Before waiting, aeApiPoll() turns all the dirty fds into POLL_REMOVE /
+ * POLL_ADD submissions, that are handed to the kernel by the same
+ * io_uring_enter(2) call used to wait for completions. So a loop iteration
+ * costs a single system call no matter how many clients changed their
+ * interest set, while with epoll every change is an epoll_ctl(2).
+ *
+ * A fired poll request is re-armed on the next iteration, which gives the
+ * same level triggered semantics of the other backends. Requests are tagged
+ * with a per fd generation so that completions of requests that were
+ * removed (or belong to a closed and reused fd) are recognized and ignored.
+ *
+ * The kernel refuses new submissions with EBUSY while completions are stuck
+ * in its overflow list, so the completions are also reaped when submitting:
+ * they are stored per fd and returned by the next aeApiPoll().
+ *
+ * Unlike epoll_ctl(2), the state kept here is not thread safe by itself,
+ * while the events of an IO thread event loop can be changed by the main
+ * thread: so the state is protected by a mutex, that is not held while
+ * waiting in the kernel.
+ *
+ * Forked children share the ring with the parent, so they never submit
+ * anything to it: they don't run the event loop, and the owner pid is checked
+ * in the only other place where SQEs are submitted.
+ *
+ * Only the readiness notification goes through the ring: the sockets are
+ * still read and written by the connection layer with the usual system
+ * calls. */
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+
+#define AE_IOURING_ENTRIES 4096
+/* user_data of POLL_REMOVE requests, whose completions are ignored. */
+#define AE_IOURING_REMOVE_TAG UINT64_MAX
+/* Flag of the reaped[] array, so that fds reaped with no event are tracked
+ * as well. */
+#define AE_IOURING_REAPED (1<<7)
+
+typedef struct aeApiState {
+    int ringfd;
+    pid_t pid;                  /* Process owning the ring. */
+    pthread_mutex_t lock;
+    /* Submission ring. */
+    void *sq_ring;
+    size_t sq_ring_size;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_entries, *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned sq_pending;        /* SQEs queued but not yet submitted. */
+    /* Completion ring. */
+    void *cq_ring;
+    size_t cq_ring_size;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    /* Per fd state, indexed by fd. */
+    unsigned char *mask;        /* AE mask the fd is monitored for. */
+    unsigned char *armed;       /* AE mask of the poll request in flight. */
+    unsigned char *dirty;       /* Is the fd in the dirty list? */
+    uint32_t *gen;              /* Generation of the poll request. */
+    int *dirty_fds;             /* fds whose poll request must be updated. */
+    int dirty_count;
+    unsigned char *reaped;      /* AE mask of the completions reaped. */
+    int *reaped_fds;            /* fds with reaped completions to return. */
+    int reaped_count;
+    int setsize;
+} aeApiState;
+
+static int aeApiUringSetup(unsigned entries, struct io_uring_params *p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int aeApiUringEnter(int ringfd, unsigned to_submit,
+                           unsigned min_complete, unsigned flags,
+                           void *arg, size_t argsz)
+{
+    return (int) syscall(__NR_io_uring_enter, ringfd, to_submit,
+                         min_complete, flags, arg, argsz);
+}
+
+/* Move the completions found in the CQ ring to the reaped fds, making room
+ * for new ones. The poll request of a reaped fd is no longer in flight, it
+ * is re-armed when the fd is returned by aeApiPoll(). */
+static void aeApiReap(aeApiState *state) {
+    unsigned head = *state->cq_head;
+    unsigned tail = __atomic_load_n(state->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &state->cqes[head & *state->cq_mask];
+        uint64_t data = cqe->user_data;
+        int res = cqe->res;
+
+        head++;
+        if (data == AE_IOURING_REMOVE_TAG) continue;
+        int fd = (int)(uint32_t)data;
+        uint32_t gen = data >> 32;
+        if (fd >= state->setsize || gen != state->gen[fd] ||
+            !state->armed[fd]) continue;
+
+        state->armed[fd] = 0;
+        state->gen[fd]++;
+        if (!state->reaped[fd]) {
+            state->reaped[fd] = AE_IOURING_REAPED;
+            state->reaped_fds[state->reaped_count++] = fd;
+        }
+        if (res <= 0) continue;
+
+        int mask = 0;
+        if (res & POLLIN) mask |= AE_READABLE;
+        if (res & POLLOUT) mask |= AE_WRITABLE;
+        if (res & POLLERR) mask |= AE_WRITABLE|AE_READABLE;
+        if (res & POLLHUP) mask |= AE_WRITABLE|AE_READABLE;
+        state->reaped[fd] |= mask;
+    }
+    __atomic_store_n(state->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* Submit the queued SQEs without waiting for completions. */
+static void aeApiSubmit(aeApiState *state) {
+    unsigned flags = 0;
+
+    while (state->sq_pending) {
+        int ret = aeApiUringEnter(state->ringfd, state->sq_pending, 0, flags,
+                                  NULL, 0);
+        if (ret > 0) {
+            state->sq_pending -= ret;
+        } else if (ret == -1 && (errno == EINTR || errno == EAGAIN)) {
+            continue;
+        } else if (ret == -1 && errno == EBUSY) {
+            /* The CQ ring is full and the kernel is holding completions
+             * back: reap the ring and let the kernel flush them into it
+             * on the next attempt. */
+            aeApiReap(state);
+            flags = IORING_ENTER_GETEVENTS;
+            continue;
+        } else {
+            panic("aeApiSubmit: io_uring_enter returned %d, %s", ret,
+                  ret == -1 ? strerror(errno) : "no SQE consumed");
+        }
+    }
+}
+
+/* Return a free SQE, flushing the submission ring to the kernel if it is
+ * full. The SQE is published by aeApiCommitSqe(). */
+static struct io_uring_sqe *aeApiGetSqe(aeApiState *state) {
+    unsigned tail = *state->sq_tail;
+    unsigned head = __atomic_load_n(state->sq_head, __ATOMIC_ACQUIRE);
+
+    if (tail - head >= *state->sq_entries) aeApiSubmit(state);
+    struct io_uring_sqe *sqe = &state->sqes[tail & *state->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+static void aeApiCommitSqe(aeApiState *state, struct io_uring_sqe *sqe) {
+    unsigned tail = *state->sq_tail;
+    unsigned idx = tail & *state->sq_mask;
+
+    state->sq_array[idx] = sqe - state->sqes;
+    __atomic_store_n(state->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    state->sq_pending++;
+}
+
+static void aeApiMarkDirty(aeApiState *state, int fd) {
+    if (state->dirty[fd]) return;
+    state->dirty[fd] = 1;
+    state->dirty_fds[state->dirty_count++] = fd;
+}
+
+/* Queue the removal of the poll request in flight for 'fd'. */
+static void aeApiQueueRemove(aeApiState *state, int fd) {
+    struct io_uring_sqe *sqe = aeApiGetSqe(state);
+
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = ((uint64_t)state->gen[fd] << 32) | (uint32_t)fd;
+    sqe->user_data = AE_IOURING_REMOVE_TAG;
+    aeApiCommitSqe(state, sqe);
+    state->armed[fd] = 0;
+    state->gen[fd]++;
+}
+
+/* Bring the poll requests of all the dirty fds in sync with the mask they
+ * are monitored for. */
+static void aeApiSyncDirty(aeApiState *state) {
+    for (int j = 0; j < state->dirty_count; j++) {
+        int fd = state->dirty_fds[j];
+        int mask = state->mask[fd];
+
+        state->dirty[fd] = 0;
+        /* A poll request in flight may refer to a file that was closed
+         * in the meantime and whose fd got reused, so it is always
+         * replaced, even if the mask did not change. */
+        if (state->armed[fd]) aeApiQueueRemove(state, fd);
+        if (mask == AE_NONE) continue;
+
+        uint32_t events = 0;
+        if (mask & AE_READABLE) events |= POLLIN;
+        if (mask & AE_WRITABLE) events |= POLLOUT;
+        struct io_uring_sqe *sqe = aeApiGetSqe(state);
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fd;
+        sqe->poll32_events = events;
+        sqe->user_data = ((uint64_t)state->gen[fd] << 32) | (uint32_t)fd;
+        aeApiCommitSqe(state, sqe);
+        state->armed[fd] = mask;
+    }
+    state->dirty_count = 0;
+}
+
+static void aeApiUnmap(aeApiState *state) {
+    if (state->sqes) munmap(state->sqes, state->sqes_size);
+    if (state->cq_ring) munmap(state->cq_ring, state->cq_ring_size);
+    if (state->sq_ring) munmap(state->sq_ring, state->sq_ring_size);
+}
+
+static int aeApiCreate(aeEventLoop *eventLoop) {
+    aeApiState *state = zcalloc(sizeof(aeApiState));
+    struct io_uring_params p;
+
+    if (!state) return -1;
+    memset(&p, 0, sizeof(p));
+    /* Every fd can have at most a poll and a remove completion pending. */
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = AE_IOURING_ENTRIES * 2;
+    state->ringfd = aeApiUringSetup(AE_IOURING_ENTRIES, &p);
+    if (state->ringfd == -1) {
+        zfree(state);
+        return -1;
+    }
+    /* The timeout passed to io_uring_enter(2) requires IORING_FEAT_EXT_ARG,
+     * and completions must not be dropped when the CQ ring overflows. */
+    if (!(p.features & IORING_FEAT_EXT_ARG) ||
+        !(p.features & IORING_FEAT_NODROP))
+    {
+        close(state->ringfd);
+        zfree(state);
+        errno = ENOSYS;
+        return -1;
+    }
+    anetCloexec(state->ringfd);
+    state->pid = getpid();
+
+    state->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    state->cq_ring_size = p.cq_off.cqes +
+                          p.cq_entries * sizeof(struct io_uring_cqe);
+    state->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    state->sq_ring = mmap(NULL, state->sq_ring_size, PROT_READ|PROT_WRITE,
+                          MAP_SHARED|MAP_POPULATE, state->ringfd,
+                          IORING_OFF_SQ_RING);
+    state->cq_ring = mmap(NULL, state->cq_ring_size, PROT_READ|PROT_WRITE,
+                          MAP_SHARED|MAP_POPULATE, state->ringfd,
+                          IORING_OFF_CQ_RING);
+    state->sqes = mmap(NULL, state->sqes_size, PROT_READ|PROT_WRITE,
+                       MAP_SHARED|MAP_POPULATE, state->ringfd,
+                       IORING_OFF_SQES);
+    if (state->sq_ring == MAP_FAILED) state->sq_ring = NULL;
+    if (state->cq_ring == MAP_FAILED) state->cq_ring = NULL;
+    if (state->sqes == MAP_FAILED) state->sqes = NULL;
+    if (!state->sq_ring || !state->cq_ring || !state->sqes) {
+        int saved_errno = errno;
+        aeApiUnmap(state);
+        close(state->ringfd);
+        zfree(state);
+        errno = saved_errno;
+        return -1;
+    }
+
+    char *sq = state->sq_ring, *cq = state->cq_ring;
+    state->sq_head = (unsigned *)(sq + p.sq_off.head);
+    state->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    state->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    state->sq_entries = (unsigned *)(sq + p.sq_off.ring_entries);
+    state->sq_array = (unsigned *)(sq + p.sq_off.array);
+    state->cq_head = (unsigned *)(cq + p.cq_off.head);
+    state->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    state->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    state->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    pthread_mutex_init(&state->lock, NULL);
+    state->mask = zcalloc(eventLoop->setsize);
+    state->armed = zcalloc(eventLoop->setsize);
+    state->dirty = zcalloc(eventLoop->setsize);
+    state->gen = zcalloc(sizeof(uint32_t)*eventLoop->setsize);
+    state->dirty_fds = zmalloc(sizeof(int)*eventLoop->setsize);
+    state->reaped = zcalloc(eventLoop->setsize);
+    state->reaped_fds = zmalloc(sizeof(int)*eventLoop->setsize);
+    state->setsize = eventLoop->setsize;
+    eventLoop->apidata = state;
+    return 0;
+}
+
+static int aeApiResize(aeEventLoop *eventLoop, int setsize) {
+    aeApiState *state = eventLoop->apidata;
+    int oldsize = eventLoop->setsize;
+
+    pthread_mutex_lock(&state->lock);
+    /* When shrinking, the fds above the new size are no longer monitored,
+     * but may still have a poll request in flight that must be removed. */
+    if (setsize < oldsize) aeApiSyncDirty(state);
+
+    state->mask = zrealloc(state->mask, setsize);
+    state->armed = zrealloc(state->armed, setsize);
+    state->dirty = zrealloc(state->dirty, setsize);
+    state->gen = zrealloc(state->gen, sizeof(uint32_t)*setsize);
+    state->dirty_fds = zrealloc(state->dirty_fds, sizeof(int)*setsize);
+    state->reaped = zrealloc(state->reaped, setsize);
+    state->reaped_fds = zrealloc(state->reaped_fds, sizeof(int)*setsize);
+    if (setsize > oldsize) {
+        memset(state->mask+oldsize, 0, setsize-oldsize);
+        memset(state->armed+oldsize, 0, setsize-oldsize);
+        memset(state->dirty+oldsize, 0, setsize-oldsize);
+        memset(state->gen+oldsize, 0, sizeof(uint32_t)*(setsize-oldsize));
+        memset(state->reaped+oldsize, 0, setsize-oldsize);
+    } else {
+        /* ae.c refuses to shrink below the highest fd in use, so the
+         * reaped fds above the new size are no longer monitored. */
+        int j = 0;
+        for (int i = 0; i < state->reaped_count; i++) {
+            if (state->reaped_fds[i] < setsize)
+                state->reaped_fds[j++] = state->reaped_fds[i];
+        }
+        state->reaped_count = j;
+    }
+    state->setsize = setsize;
+    pthread_mutex_unlock(&state->lock);
+    return 0;
+}
+
+static void aeApiFree(aeEventLoop *eventLoop) {
+    aeApiState *state = eventLoop->apidata;
+
+    aeApiUnmap(state);
+    close(state->ringfd);
+    pthread_mutex_destroy(&state->lock);
+    zfree(state->mask);
+    zfree(state->armed);
+    zfree(state->dirty);
+    zfree(state->gen);
+    zfree(state->dirty_fds);
+    zfree(state->reaped);
+    zfree(state->reaped_fds);
+    zfree(state);
+}
+
+static int aeApiAddEvent(aeEventLoop *eventLoop, int fd, int mask) {
+    aeApiState *state = eventLoop->apidata;
+
+    pthread_mutex_lock(&state->lock);
+    mask |= state->mask[fd]; /* Merge old events */
+    if (mask != state->mask[fd]) {
+        state->mask[fd] = mask;
+        aeApiMarkDirty(state, fd);
+    }
+    pthread_mutex_unlock(&state->lock);
+    return 0;
+}
+
+static void aeApiDelEvent(aeEventLoop *eventLoop, int fd, int delmask) {
+    aeApiState *state = eventLoop->apidata;
+    int mask;
+
+    pthread_mutex_lock(&state->lock);
+    mask = state->mask[fd] & (~delmask);
+    if (mask != state->mask[fd]) {
+        state->mask[fd] = mask;
+        aeApiMarkDirty(state, fd);
+        /* Don't return reaped events the fd is no longer monitored for, the
+         * fd may be closed and reused before the next aeApiPoll(). */
+        if (state->reaped[fd]) state->reaped[fd] &= ~delmask;
+
+        /* A poll request holds a reference to the file, so when the fd is
+         * no longer monitored (usually because it is about to be closed)
+         * the request is removed right away: otherwise the socket would
+         * survive close(2) until the next aeApiPoll(), and a listening
+         * socket would keep its port busy. */
+        if (mask == AE_NONE && state->armed[fd] && getpid() == state->pid) {
+            aeApiQueueRemove(state, fd);
+            aeApiSubmit(state);
+        }
+    }
+    pthread_mutex_unlock(&state->lock);
+}
+
+static int aeApiPoll(aeEventLoop *eventLoop, struct timeval *tvp) {
+    aeApiState *state = eventLoop->apidata;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned head, tail, to_submit, wait_nr;
+    int ret, numevents = 0;
+
+    memset(&arg, 0, sizeof(arg));
+    if (tvp) {
+        ts.tv_sec = tvp->tv_sec;
+        ts.tv_nsec = tvp->tv_usec * 1000;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+    }
+
+    /* Submit the pending changes and wait for at least a completion, unless
+     * some are already there, or this is a non blocking poll. The SQEs are
+     * consumed by the kernel in order, so if another thread submits while
+     * we wait, it just submits some of ours instead of its own. */
+    pthread_mutex_lock(&state->lock);
+    aeApiSyncDirty(state);
+    to_submit = state->sq_pending;
+    state->sq_pending = 0;
+    head = *state->cq_head;
+    tail = __atomic_load_n(state->cq_tail, __ATOMIC_ACQUIRE);
+    wait_nr = (head == tail && state->reaped_count == 0 &&
+               !(tvp && tvp->tv_sec == 0 && tvp->tv_usec == 0));
+    pthread_mutex_unlock(&state->lock);
+
+    ret = aeApiUringEnter(state->ringfd, to_submit, wait_nr,
+                          IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG,
+                          &arg, sizeof(arg));
+    if (ret == -1 && errno != ETIME && errno != EINTR &&
+        errno != EAGAIN && errno != EBUSY)
+    {
+        panic("aeApiPoll: io_uring_enter, %s", strerror(errno));
+    }
+
+    pthread_mutex_lock(&state->lock);
+    if (ret < (int)to_submit) state->sq_pending += to_submit - (ret > 0 ? ret : 0);
+    aeApiReap(state);
+    for (int j = 0; j < state->reaped_count; j++) {
+        int fd = state->reaped_fds[j];
+        int mask = state->reaped[fd] & ~AE_IOURING_REAPED;
+
+        /* The request is one-shot: re-arm it on the next iteration if the
+         * fd is still monitored. */
+        state->reaped[fd] = 0;
+        aeApiMarkDirty(state, fd);
+        if (!mask) continue;
+        eventLoop->fired[numevents].fd = fd;
+        eventLoop->fired[numevents].mask = mask;
+        numevents++;
+    }
+    state->reaped_count = 0;
+    pthread_mutex_unlock(&state->lock);
+
+    return numevents;
+}
+
+static char *aeApiName(void) {
+    return "io_uring";
+}
@@ -31,6 +31,7 @@
 #include "bio.h"
 #include "rio.h"
 #include "functions.h"
+#include "lzf.h"
 
 #include <signal.h>
 #include <fcntl.h>
@@ -40,6 +41,13 @@
 #include <sys/resource.h>
 #include <sys/wait.h>
 #include <sys/param.h>
+#include <pthread.h>
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 
 void freeClientArgv(client *c);
 off_t getAppendOnlyFileSize(sds filename, int *status);
@@ -51,6 +59,377 @@ aofManifest *aofLoadManifestFromFile(sds am_filepath);
 void aofManifestFreeAndUpdate(aofManifest *am);
 void aof_background_fsync_and_close(int fd);
 
+/* ----------------------------------------------------------------------------
+ * Binary AOF format
+ *
+ * With aof-incr-format set to binary, new INCR files are written in a compact
+ * binary format instead of RESP. The file starts with AOF_BINARY_MAGIC and is
+ * a sequence of blocks, each one holding the commands flushed together:
+ *
+ *   <type:1 byte> <length:varint> <stored length:varint> <data> <crc64:8 bytes>
+ *
+ * The type is the AOF_COMPRESSION_* used for the data (the block is kept raw
+ * when compression doesn't help), the length is the one of the decompressed
+ * data, and the checksum covers the stored bytes. Blocks are atomic: a block
+ * that was not fully written is detected and truncated as a whole.
+ *
+ * The commands of a block are encoded as the number of arguments followed by
+ * the arguments. The command name is encoded as a varint ID: zero defines a
+ * new name, which follows as a string, and the next ID to be used for it;
+ * names are defined again in every block, so that blocks can be decoded on
+ * their own. Other arguments start with a varint header: integers are
+ * encoded as 1 followed by the zigzag varint of the value, strings as their
+ * length shifted by one, followed by the bytes.
+ * ------------------------------------------------------------------------- */
+
+#define AOF_BINARY_MAGIC "SDRBAOF1"
+#define AOF_BINARY_MAGIC_LEN 8
+#define AOF_BINARY_BLOCK_MAX (1ULL<<32) /* Sanity limit of the block length. */
+#define AOF_BINARY_COMPRESS_MIN 64 /* Smaller blocks are not compressed. */
+#define AOF_BINARY_ZSTD_LEVEL 1
+
+/* Names of the commands defined so far in the block being encoded. */
+static struct {
+    sds *names;
+    int numnames;
+    int size;
+} aofBinaryNames;
+
+static sds aofBinaryCatVarint(sds s, uint64_t v) {
+    unsigned char buf[10];
+    int len = 0;
+
+    do {
+        buf[len] = v & 0x7f;
+        v >>= 7;
+        if (v) buf[len] |= 0x80;
+        len++;
+    } while (v);
+    return sdscatlen(s,buf,len);
+}
+
+static int aofBinaryGetVarint(const unsigned char **p, const unsigned char *end, uint64_t *v) {
+    uint64_t val = 0;
+
+    for (int shift = 0; *p < end && shift < 64; shift += 7) {
+        unsigned char byte = *(*p)++;
+        val |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *v = val;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int aofBinaryReadVarint(FILE *fp, uint64_t *v) {
+    uint64_t val = 0;
+    int c;
+
+    for (int shift = 0; shift < 64; shift += 7) {
+        if ((c = getc(fp)) == EOF) return 0;
+        val |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            *v = val;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Return the format of the INCR files created from now on. Timestamp
+ * annotations are only supported by the RESP format. */
+static int aofNewIncrFormat(void) {
+    return server.aof_timestamp_enabled ? AOF_FORMAT_RESP : server.aof_incr_format;
+}
+
+/* Append the command to the block being encoded. */
+static sds aofBinaryCatCommand(sds buf, int argc, robj **argv) {
+    buf = aofBinaryCatVarint(buf,argc);
+    for (int j = 0; j < argc; j++) {
+        robj *o = argv[j];
+        long long value;
+
+        if (j == 0) {
+            o = getDecodedObject(o);
+            size_t len = sdslen(o->ptr);
+            int id;
+            for (id = 0; id < aofBinaryNames.numnames; id++) {
+                sds name = aofBinaryNames.names[id];
+                if (sdslen(name) == len && !memcmp(name,o->ptr,len)) break;
+            }
+            if (id < aofBinaryNames.numnames) {
+                buf = aofBinaryCatVarint(buf,id+1);
+            } else {
+                if (aofBinaryNames.numnames == aofBinaryNames.size) {
+                    aofBinaryNames.size = aofBinaryNames.size ? aofBinaryNames.size*2 : 16;
+                    aofBinaryNames.names = zrealloc(aofBinaryNames.names,
+                        sizeof(sds)*aofBinaryNames.size);
+                }
+                aofBinaryNames.names[aofBinaryNames.numnames++] = sdsnewlen(o->ptr,len);
+                buf = aofBinaryCatVarint(buf,0);
+                buf = aofBinaryCatVarint(buf,len);
+                buf = sdscatlen(buf,o->ptr,len);
+            }
+            decrRefCount(o);
+        } else if (o->encoding == OBJ_ENCODING_INT ||
+                   (sdslen(o->ptr) <= LONG_STR_SIZE &&
+                    string2ll(o->ptr,sdslen(o->ptr),&value)))
+        {
+            if (o->encoding == OBJ_ENCODING_INT) value = (long)o->ptr;
+            buf = aofBinaryCatVarint(buf,1);
+            buf = aofBinaryCatVarint(buf,((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+        } else {
+            buf = aofBinaryCatVarint(buf,(uint64_t)sdslen(o->ptr) << 1);
+            buf = sdscatlen(buf,o->ptr,sdslen(o->ptr));
+        }
+    }
+    return buf;
+}
+
+/* Compress 'len' bytes of 's' in 'out', returning the compressed length, or
+ * 0 if the data doesn't fit in 'outlen' bytes. */
+static size_t aofBinaryCompress(int type, const char *s, size_t len, char *out, size_t outlen) {
+    switch(type) {
+    case AOF_COMPRESSION_LZF:
+        return lzf_compress(s,len,out,outlen);
+#ifdef HAVE_LZ4
+    case AOF_COMPRESSION_LZ4:
+        if (len > LZ4_MAX_INPUT_SIZE) return 0;
+        return LZ4_compress_default(s,out,len,outlen);
+#endif
+#ifdef HAVE_ZSTD
+    case AOF_COMPRESSION_ZSTD: {
+        size_t ret = ZSTD_compress(out,outlen,s,len,AOF_BINARY_ZSTD_LEVEL);
+        return ZSTD_isError(ret) ? 0 : ret;
+    }
+#endif
+    default:
+        return 0;
+    }
+}
+
+static int aofBinaryDecompress(int type, const char *c, size_t clen, char *out, size_t len) {
+    switch(type) {
+    case AOF_COMPRESSION_LZF:
+        return lzf_decompress(c,clen,out,len) == len ? C_OK : C_ERR;
+#ifdef HAVE_LZ4
+    case AOF_COMPRESSION_LZ4:
+        if (clen > INT_MAX || len > INT_MAX) return C_ERR;
+        return LZ4_decompress_safe(c,out,clen,len) == (int)len ? C_OK : C_ERR;
+#endif
+#ifdef HAVE_ZSTD
+    case AOF_COMPRESSION_ZSTD: {
+        size_t ret = ZSTD_decompress(out,len,c,clen);
+        return (!ZSTD_isError(ret) && ret == len) ? C_OK : C_ERR;
+    }
+#endif
+    default:
+        return C_ERR;
+    }
+}
+
+/* Turn the commands accumulated in server.aof_block into a block appended to
+ * the AOF buffer. Called before the buffer is written. */
+static void aofBinaryCloseBlock(void) {
+    sds data = server.aof_block;
+    size_t len = sdslen(data), stored = len;
+    int type = AOF_COMPRESSION_NO;
+    char *compressed = NULL;
+
+    if (len == 0) return;
+
+    if (server.aof_binary_compression != AOF_COMPRESSION_NO &&
+        len >= AOF_BINARY_COMPRESS_MIN)
+    {
+        /* Only keep the compressed data if it saves something. */
+        size_t outlen = len-1;
+        compressed = zmalloc(outlen);
+        size_t clen = aofBinaryCompress(server.aof_binary_compression,
+                                        data,len,compressed,outlen);
+        if (clen) {
+            type = server.aof_binary_compression;
+            stored = clen;
+        }
+    }
+
+    const char *bytes = type == AOF_COMPRESSION_NO ? data : compressed;
+    uint64_t crc = crc64(0,(const unsigned char*)bytes,stored);
+    memrev64ifbe(&crc);
+    unsigned char t = type;
+    server.aof_buf = sdscatlen(server.aof_buf,&t,1);
+    server.aof_buf = aofBinaryCatVarint(server.aof_buf,len);
+    server.aof_buf = aofBinaryCatVarint(server.aof_buf,stored);
+    server.aof_buf = sdscatlen(server.aof_buf,bytes,stored);
+    server.aof_buf = sdscatlen(server.aof_buf,&crc,sizeof(crc));
+    zfree(compressed);
+
+    /* Reuse the block buffer when it is small enough, like the AOF buffer. */
+    if (sdsalloc(data) < 4000) {
+        sdsclear(data);
+    } else {
+        sdsfree(data);
+        server.aof_block = sdsempty();
+    }
+    for (int j = 0; j < aofBinaryNames.numnames; j++)
+        sdsfree(aofBinaryNames.names[j]);
+    aofBinaryNames.numnames = 0;
+}
+
+/* The binary counterpart of feedAppendOnlyFile(). */
+static void aofBinaryFeed(int dictid, robj **argv, int argc) {
+    size_t oldlen = sdslen(server.aof_block);
+
+    if (server.aof_state != AOF_ON &&
+        !(server.aof_state == AOF_WAIT_REWRITE && server.child_type == CHILD_TYPE_AOF))
+    {
+        return;
+    }
+
+    if (dictid != -1 && dictid != server.aof_selected_db) {
+        robj *selectargv[2];
+        selectargv[0] = createStringObject("SELECT",6);
+        selectargv[1] = createStringObjectFromLongLong(dictid);
+        server.aof_block = aofBinaryCatCommand(server.aof_block,2,selectargv);
+        decrRefCount(selectargv[0]);
+        decrRefCount(selectargv[1]);
+        server.aof_selected_db = dictid;
+    }
+    server.aof_block = aofBinaryCatCommand(server.aof_block,argc,argv);
+    server.aof_fed_offset += sdslen(server.aof_block)-oldlen;
+}
+
+/* Drop the commands of the block being encoded. */
+static void aofBinaryDiscardBlock(void) {
+    sdsclear(server.aof_block);
+    for (int j = 0; j < aofBinaryNames.numnames; j++)
+        sdsfree(aofBinaryNames.names[j]);
+    aofBinaryNames.numnames = 0;
+}
+
+/* Write the header of a new binary INCR file. */
+static int aofBinaryWriteMagic(int fd) {
+    if (write(fd,AOF_BINARY_MAGIC,AOF_BINARY_MAGIC_LEN) != AOF_BINARY_MAGIC_LEN) {
+        serverLog(LL_WARNING,"Can't write the header of the binary AOF: %s",
+            errno ? strerror(errno) : "short write");
+        return C_ERR;
+    }
+    return C_OK;
+}
+
+/* Return 1 if the file starts with the header of the binary format, leaving
+ * the file after it, or 0 after seeking the file back to where it was. */
+int aofBinaryReadMagic(FILE *fp) {
+    char magic[AOF_BINARY_MAGIC_LEN];
+    off_t pos = ftello(fp);
+
+    if (fread(magic,1,sizeof(magic),fp) == sizeof(magic) &&
+        !memcmp(magic,AOF_BINARY_MAGIC,sizeof(magic)))
+    {
+        return 1;
+    }
+    clearerr(fp);
+    fseeko(fp,pos,SEEK_SET);
+    return 0;
+}
+
+/* Read the next block of a binary file. Returns 1 when a block was read, 0 at
+ * the end of the file, and -1 on errors: a truncated block if feof(fp), I/O
+ * errors if ferror(fp), and an invalid block otherwise. */
+int aofBinaryReadBlock(FILE *fp, aofBinaryBlock *b) {
+    uint64_t len, stored, crc;
+    int type;
+    char *data = NULL;
+
+    aofBinaryBlockFree(b);
+    if ((type = getc(fp)) == EOF) return (feof(fp) && !ferror(fp)) ? 0 : -1;
+    if (!aofBinaryReadVarint(fp,&len) || !aofBinaryReadVarint(fp,&stored)) return -1;
+    if (type > AOF_COMPRESSION_ZSTD || len > AOF_BINARY_BLOCK_MAX ||
+        stored > AOF_BINARY_BLOCK_MAX ||
+        (type == AOF_COMPRESSION_NO && stored != len)) return -1;
+
+    data = zmalloc(stored ? stored : 1);
+    if ((stored && fread(data,stored,1,fp) != 1) ||
+        fread(&crc,sizeof(crc),1,fp) != 1) goto err;
+    memrev64ifbe(&crc);
+    if (crc != crc64(0,(unsigned char*)data,stored)) goto err;
+
+    if (type == AOF_COMPRESSION_NO) {
+        b->payload = sdsnewlen(data,len);
+    } else {
+        b->payload = sdsnewlen(SDS_NOINIT,len);
+        if (aofBinaryDecompress(type,data,stored,b->payload,len) == C_ERR) goto err;
+    }
+    zfree(data);
+    return 1;
+
+err:
+    zfree(data);
+    aofBinaryBlockFree(b);
+    return -1;
+}
+
+/* Decode the next command of the block in 'argv', an array of 'argc' strings
+ * owned by the caller. Returns 1 if a command was decoded, 0 at the end of
+ * the block, and -1 if the block is invalid. */
+int aofBinaryNextCommand(aofBinaryBlock *b, int *argc, sds **argv) {
+    const unsigned char *p, *end;
+    uint64_t count, v;
+    sds *args = NULL;
+    uint64_t j = 0;
+
+    if (b->payload == NULL || b->pos == sdslen(b->payload)) return 0;
+    p = (unsigned char*)b->payload + b->pos;
+    end = (unsigned char*)b->payload + sdslen(b->payload);
+    if (!aofBinaryGetVarint(&p,end,&count) || count == 0 ||
+        count > (uint64_t)(end-p)+1) return -1;
+
+    args = zmalloc(sizeof(sds)*count);
+    for (j = 0; j < count; j++) {
+        if (!aofBinaryGetVarint(&p,end,&v)) goto err;
+        if (j == 0) {
+            if (v == 0) {
+                /* A new name, which gets the next ID. */
+                if (!aofBinaryGetVarint(&p,end,&v) || v > (uint64_t)(end-p)) goto err;
+                args[j] = sdsnewlen(p,v);
+                p += v;
+                b->names = zrealloc(b->names,sizeof(sds)*(b->numnames+1));
+                b->names[b->numnames++] = sdsdup(args[j]);
+            } else {
+                if (v > (uint64_t)b->numnames) goto err;
+                args[j] = sdsdup(b->names[v-1]);
+            }
+        } else if (v & 1) {
+            if (v != 1 || !aofBinaryGetVarint(&p,end,&v)) goto err;
+            args[j] = sdsfromlonglong((long long)((v >> 1) ^ (~(v & 1) + 1)));
+        } else {
+            v >>= 1;
+            if (v > (uint64_t)(end-p)) goto err;
+            args[j] = sdsnewlen(p,v);
+            p += v;
+        }
+    }
+    b->pos = (char*)p - b->payload;
+    *argc = count;
+    *argv = args;
+    return 1;
+
+err:
+    while (j--) sdsfree(args[j]);
+    zfree(args);
+    return -1;
+}
+
+void aofBinaryBlockFree(aofBinaryBlock *b) {
+    sdsfree(b->payload);
+    for (int j = 0; j < b->numnames; j++) sdsfree(b->names[j]);
+    zfree(b->names);
+    b->payload = NULL;
+    b->pos = 0;
+    b->names = NULL;
+    b->numnames = 0;
+}
+
 /* ----------------------------------------------------------------------------
  * AOF Manifest file implementation.
  *
@@ -94,6 +473,7 @@ void aof_background_fsync_and_close(int fd);
 #define AOF_MANIFEST_KEY_FILE_NAME   "file"
 #define AOF_MANIFEST_KEY_FILE_SEQ    "seq"
 #define AOF_MANIFEST_KEY_FILE_TYPE   "type"
+#define AOF_MANIFEST_KEY_FILE_FORMAT "format"
 
 /* Create an empty aofInfo. */
 aofInfo *aofInfoCreate(void) {
@@ -114,6 +494,7 @@ aofInfo *aofInfoDup(aofInfo *orig) {
     ai->file_name = sdsdup(orig->file_name);
     ai->file_seq = orig->file_seq;
     ai->file_type = orig->file_type;
+    ai->file_format = orig->file_format;
     return ai;
 }
 
@@ -124,10 +505,15 @@ sds aofInfoFormat(sds buf, aofInfo *ai) {
     if (sdsneedsrepr(ai->file_name))
         filename_repr = sdscatrepr(sdsempty(), ai->file_name, sdslen(ai->file_name));
 
-    sds ret = sdscatprintf(buf, "%s %s %s %lld %s %c\n",
+    sds ret = sdscatprintf(buf, "%s %s %s %lld %s %c",
         AOF_MANIFEST_KEY_FILE_NAME, filename_repr ? filename_repr : ai->file_name,
         AOF_MANIFEST_KEY_FILE_SEQ, ai->file_seq,
         AOF_MANIFEST_KEY_FILE_TYPE, ai->file_type);
+    /* The format is only recorded for binary files, so that the manifests
+     * of RESP only setups are unchanged. */
+    if (ai->file_format == AOF_FORMAT_BINARY)
+        ret = sdscatprintf(ret, " %s binary", AOF_MANIFEST_KEY_FILE_FORMAT);
+    ret = sdscatlen(ret, "\n", 1);
     sdsfree(filename_repr);
 
     return ret;
@@ -184,7 +570,8 @@ sds getTempAofManifestFileName(void) {
  *
  * Where "file", "seq" and "type" are keywords that describe the next value,
  * [filename] and [sequence] describe file name and order, and [type] is one
- * of 'b' (base), 'h' (history) or 'i' (incr).
+ * of 'b' (base), 'h' (history) or 'i' (incr). INCR files in the binary format
+ * have two more fields: "format" "binary".
  *
  * The base file, if exists, will always be first, followed by history files,
  * and incremental files.
@@ -323,6 +710,9 @@ aofManifest *aofLoadManifestFromFile(sds am_filepath) {
                 ai->file_seq = atoll(argv[i+1]);
             } else if (!strcasecmp(argv[i], AOF_MANIFEST_KEY_FILE_TYPE)) {
                 ai->file_type = (argv[i+1])[0];
+            } else if (!strcasecmp(argv[i], AOF_MANIFEST_KEY_FILE_FORMAT)) {
+                ai->file_format = !strcasecmp(argv[i+1], "binary") ?
+                                  AOF_FORMAT_BINARY : AOF_FORMAT_RESP;
             }
             /* else if (!strcasecmp(argv[i], AOF_MANIFEST_KEY_OTHER)) {} */
         }
@@ -458,6 +848,7 @@ sds getNewIncrAofName(aofManifest *am) {
     ai->file_name = sdscatprintf(sdsempty(), "%s.%lld%s%s", server.aof_filename,
                         ++am->curr_incr_file_seq, INCR_FILE_SUFFIX, AOF_FORMAT_SUFFIX);
     ai->file_seq = am->curr_incr_file_seq;
+    ai->file_format = aofNewIncrFormat();
     listAddNodeTail(am->incr_aof_list, ai);
     am->dirty = 1;
     return ai->file_name;
@@ -758,6 +1149,15 @@ void aofOpenIfNeededOnServerStart(void) {
     }
 
     server.aof_last_incr_size = getAppendOnlyFileSize(aof_name, NULL);
+
+    /* Keep appending in the format of the file, and write the header of new
+     * binary files. */
+    aofInfo *ai = listNodeValue(listLast(server.aof_manifest->incr_aof_list));
+    server.aof_binary = ai->file_format == AOF_FORMAT_BINARY;
+    if (server.aof_binary && server.aof_last_incr_size == 0) {
+        if (aofBinaryWriteMagic(server.aof_fd) == C_ERR) exit(1);
+        server.aof_last_incr_size = AOF_BINARY_MAGIC_LEN;
+    }
     server.aof_last_incr_fsync_offset = server.aof_last_incr_size;
 
     if (incr_aof_len) {
@@ -792,6 +1192,7 @@ int openNewIncrAofForAppend(void) {
     int newfd = -1;
     aofManifest *temp_am = NULL;
     sds new_aof_name = NULL;
+    int binary = aofNewIncrFormat() == AOF_FORMAT_BINARY;
 
     /* Only open new INCR AOF when AOF enabled. */
     if (server.aof_state == AOF_OFF) return C_OK;
@@ -813,6 +1214,7 @@ int openNewIncrAofForAppend(void) {
             new_aof_name, strerror(errno));
         goto cleanup;
     }
+    if (binary && aofBinaryWriteMagic(newfd) == C_ERR) goto cleanup;
 
     if (temp_am) {
         /* Persist AOF Manifest. */
@@ -836,9 +1238,11 @@ int openNewIncrAofForAppend(void) {
         server.aof_last_fsync = server.unixtime;
     }
     server.aof_fd = newfd;
+    server.aof_binary = binary;
+    if (binary) server.aof_current_size += AOF_BINARY_MAGIC_LEN;
 
     /* Reset the aof_last_incr_size. */
-    server.aof_last_incr_size = 0;
+    server.aof_last_incr_size = binary ? AOF_BINARY_MAGIC_LEN : 0;
     /* Reset the aof_last_incr_fsync_offset. */
     server.aof_last_incr_fsync_offset = 0;
     /* Update `server.aof_manifest`. */
@@ -969,6 +1373,7 @@ void stopAppendOnly(void) {
     killAppendOnlyChild();
     sdsfree(server.aof_buf);
     server.aof_buf = sdsempty();
+    aofBinaryDiscardBlock();
 }
 
 /* Called when the user switches from "appendonly no" to "appendonly yes"
@@ -1042,6 +1447,390 @@ ssize_t aofWrite(int fd, const char *buf, size_t len) {
     return totwritten;
 }
 
+/* Check the outcome of writing 'len' bytes of the AOF buffer, where 'err' is
+ * the errno of a failed write. On failure the error is logged, a short write
+ * is removed from the file if possible, and C_ERR is returned with 'nwritten'
+ * set to the number of bytes that are left in the file (or -1 if none). */
+#define AOF_WRITE_LOG_ERROR_RATE 30 /* Seconds between errors logging. */
+static int aofCheckWrite(ssize_t *nwritten, size_t len, int err) {
+    if (*nwritten != (ssize_t)len) {
+        static time_t last_write_error_log = 0;
+        int can_log = 0;
+
+        /* Limit logging rate to 1 line per AOF_WRITE_LOG_ERROR_RATE seconds. */
+        if ((server.unixtime - last_write_error_log) > AOF_WRITE_LOG_ERROR_RATE) {
+            can_log = 1;
+            last_write_error_log = server.unixtime;
+        }
+
+        /* Log the AOF write error and record the error code. */
+        if (*nwritten == -1) {
+            if (can_log) {
+                serverLog(LL_WARNING,"Error writing to the AOF file: %s",
+                    strerror(err));
+            }
+            server.aof_last_write_errno = err;
+        } else {
+            if (can_log) {
+                serverLog(LL_WARNING,"Short write while writing to "
+                                       "the AOF file: (nwritten=%lld, "
+                                       "expected=%lld)",
+                                       (long long)*nwritten,
+                                       (long long)len);
+            }
+
+            if (ftruncate(server.aof_fd, server.aof_last_incr_size) == -1) {
+                if (can_log) {
+                    serverLog(LL_WARNING, "Could not remove short write "
+                             "from the append-only file.  Sider may refuse "
+                             "to load the AOF the next time it starts.  "
+                             "ftruncate: %s", strerror(errno));
+                }
+            } else {
+                /* If the ftruncate() succeeded we can set nwritten to
+                 * -1 since there is no longer partial data into the AOF. */
+                *nwritten = -1;
+            }
+            server.aof_last_write_errno = ENOSPC;
+        }
+
+        /* Handle the AOF write error. */
+        if (server.aof_fsync == AOF_FSYNC_ALWAYS) {
+            /* We can't recover when the fsync policy is ALWAYS since the reply
+             * for the client is already in the output buffers (both writes and
+             * reads), and the changes to the db can't be rolled back. Since we
+             * have a contract with the user that on acknowledged or observed
+             * writes are is synced on disk, we must exit. */
+            serverLog(LL_WARNING,"Can't recover from AOF write error when the AOF fsync policy is 'always'. Exiting...");
+            exit(1);
+        }
+
+        /* Recover from failed write leaving data into the buffer. However
+         * set an error to stop accepting writes as long as the error
+         * condition is not cleared. */
+        server.aof_last_write_status = C_ERR;
+        return C_ERR;
+    }
+
+    /* Successful write(2). If AOF was in error state, restore the
+     * OK state and log the event. */
+    if (server.aof_last_write_status == C_ERR) {
+        serverLog(LL_NOTICE,
+            "AOF write error looks solved, Sider can write again.");
+        server.aof_last_write_status = C_OK;
+    }
+    return C_OK;
+}
+
+/* -----------------------------------------------------------------------------
+ * AOF writer thread
+ *
+ * With aof-writer-thread enabled the write(2) of the AOF buffer, and the
+ * fsync required by the policy, are performed by a dedicated thread, so that
+ * the main thread keeps serving clients while the disk is busy.
+ *
+ * A single batch is in flight at any time. The main thread hands the whole
+ * AOF buffer off to the writer by swapping it with an empty one and flipping
+ * the batch state: no lock is held while the writer works. Commands executed
+ * while a batch is being written accumulate in the AOF buffer, and are handed
+ * off together once the writer is done (group commit), so with a slow disk
+ * the number of writes and fsyncs drops as the load grows.
+ *
+ * When the writer is done it wakes the event loop with a pipe, and the main
+ * thread applies the outcome (sizes, errors, fsynced offsets, latency) on
+ * the next flushAppendOnlyFile() call, exactly as the synchronous code would.
+ *
+ * With appendfsync always a reply can't be sent before the commands it may
+ * depend on are fsynced. Every client remembers the AOF offset at the end of
+ * its last command, and its replies are held in the pending writes list
+ * until the writer fsynced up to that offset (see aofClientWaitsFsync()).
+ * -------------------------------------------------------------------------- */
+
+#define AOF_WRITER_IDLE 0   /* No batch, the writer is waiting. */
+#define AOF_WRITER_QUEUED 1 /* A batch was handed off to the writer. */
+#define AOF_WRITER_DONE 2   /* The batch was written, not collected yet. */
+
+typedef struct aofWriterBatch {
+    /* Set by the main thread when handing the batch off. */
+    int fd;
+    sds buf;                /* May be empty if only a fsync is needed. */
+    int fsync;              /* Fsync the file after the write. */
+    int policy;             /* Fsync policy when the batch was handed off. */
+    int flush_sleep;        /* See aof_flush_sleep. */
+    long long reploff;      /* Replication offset covered by the batch. */
+    long long aofoff;       /* AOF offset covered by the batch. */
+    monotime queued;        /* Handoff time. */
+    /* Set by the writer. */
+    ssize_t nwritten;
+    int write_errno;
+    int fsync_errno;        /* Zero if the fsync succeeded. */
+    monotime queue_us, write_us, fsync_us;
+} aofWriterBatch;
+
+static struct {
+    int started;
+    pthread_t thread;
+    pthread_mutex_t mutex;  /* Only used to sleep on the conditions. */
+    pthread_cond_t queued_cond;
+    pthread_cond_t done_cond;
+    siderAtomic int state;  /* AOF_WRITER_* */
+    aofWriterBatch batch;
+    sds spare;              /* Buffer of the last batch, to be reused. */
+    int notify_pipe[2];     /* Wakes the event loop when a batch is done. */
+} aofWriter;
+
+static void *aofWriterMain(void *arg) {
+    aofWriterBatch *b = &aofWriter.batch;
+    sigset_t sigset;
+    int state;
+    UNUSED(arg);
+
+    sider_set_thread_title("aof_writer");
+    siderSetCpuAffinity(server.bio_cpulist);
+    makeThreadKillable();
+
+    /* Only the main thread should receive the watchdog signal. */
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGALRM);
+    if (pthread_sigmask(SIG_BLOCK, &sigset, NULL))
+        serverLog(LL_WARNING,
+            "Warning: can't mask SIGALRM in the AOF writer thread: %s", strerror(errno));
+
+    while(1) {
+        pthread_mutex_lock(&aofWriter.mutex);
+        while (1) {
+            atomicGetWithSync(aofWriter.state, state);
+            if (state == AOF_WRITER_QUEUED) break;
+            pthread_cond_wait(&aofWriter.queued_cond, &aofWriter.mutex);
+        }
+        pthread_mutex_unlock(&aofWriter.mutex);
+
+        monotime start = getMonotonicUs();
+        b->queue_us = start - b->queued;
+        if (b->flush_sleep && sdslen(b->buf)) usleep(b->flush_sleep);
+        b->nwritten = aofWrite(b->fd, b->buf, sdslen(b->buf));
+        b->write_errno = errno;
+        monotime written = getMonotonicUs();
+        b->write_us = written - start;
+        b->fsync_errno = 0;
+        b->fsync_us = 0;
+        if (b->fsync && b->nwritten == (ssize_t)sdslen(b->buf)) {
+            if (sider_fsync(b->fd) == -1) b->fsync_errno = errno;
+            b->fsync_us = getMonotonicUs() - written;
+        }
+
+        pthread_mutex_lock(&aofWriter.mutex);
+        atomicSetWithSync(aofWriter.state, AOF_WRITER_DONE);
+        pthread_cond_signal(&aofWriter.done_cond);
+        pthread_mutex_unlock(&aofWriter.mutex);
+        if (write(aofWriter.notify_pipe[1], "A", 1) != 1) {
+            /* The pipe is full: the event loop is going to wake up anyway. */
+        }
+    }
+    return NULL;
+}
+
+/* Drain the notifications of the writer. The batch itself is collected by
+ * flushAppendOnlyFile(), called in beforeSleep(). */
+static void aofWriterNotified(aeEventLoop *el, int fd, void *privdata, int mask) {
+    char buf[128];
+    UNUSED(el);
+    UNUSED(privdata);
+    UNUSED(mask);
+
+    while (read(fd, buf, sizeof(buf)) > 0);
+}
+
+static int aofWriterStart(void) {
+    if (aofWriter.started) return C_OK;
+
+    if (anetPipe(aofWriter.notify_pipe, O_CLOEXEC|O_NONBLOCK, O_CLOEXEC|O_NONBLOCK) == -1) {
+        serverLog(LL_WARNING, "Can't create the AOF writer pipe: %s", strerror(errno));
+        return C_ERR;
+    }
+    if (aeCreateFileEvent(server.el, aofWriter.notify_pipe[0], AE_READABLE,
+                          aofWriterNotified, NULL) == AE_ERR)
+    {
+        serverLog(LL_WARNING, "Can't register the AOF writer pipe in the event loop");
+        goto error;
+    }
+    pthread_mutex_init(&aofWriter.mutex, NULL);
+    pthread_cond_init(&aofWriter.queued_cond, NULL);
+    pthread_cond_init(&aofWriter.done_cond, NULL);
+    atomicSetWithSync(aofWriter.state, AOF_WRITER_IDLE);
+    if (pthread_create(&aofWriter.thread, NULL, aofWriterMain, NULL) != 0) {
+        serverLog(LL_WARNING, "Can't create the AOF writer thread: %s", strerror(errno));
+        aeDeleteFileEvent(server.el, aofWriter.notify_pipe[0], AE_READABLE);
+        goto error;
+    }
+    aofWriter.started = 1;
+    return C_OK;
+
+error:
+    close(aofWriter.notify_pipe[0]);
+    close(aofWriter.notify_pipe[1]);
+    return C_ERR;
+}
+
+/* Apply the outcome of the batch, if the writer is done with it. */
+static void aofWriterCollect(void) {
+    aofWriterBatch *b = &aofWriter.batch;
+    int state;
+
+    atomicGetWithSync(aofWriter.state, state);
+    if (state != AOF_WRITER_DONE) return;
+
+    server.stat_aof_writer_batches++;
+    server.stat_aof_writer_queue_usec += b->queue_us;
+    server.stat_aof_writer_write_usec += b->write_us;
+    server.stat_aof_writer_fsync_usec += b->fsync_us;
+    latencyAddSampleIfNeeded("aof-writer-queue", (mstime_t)(b->queue_us/1000));
+    latencyAddSampleIfNeeded("aof-writer-write", (mstime_t)(b->write_us/1000));
+    if (b->fsync) latencyAddSampleIfNeeded("aof-writer-fsync", (mstime_t)(b->fsync_us/1000));
+
+    ssize_t nwritten = b->nwritten;
+    if (aofCheckWrite(&nwritten,sdslen(b->buf),b->write_errno) == C_ERR) {
+        /* Put what was not written back in front of the AOF buffer, the
+         * next batch is going to retry. */
+        if (nwritten > 0) {
+            server.aof_current_size += nwritten;
+            server.aof_last_incr_size += nwritten;
+            sdsrange(b->buf,nwritten,-1);
+        }
+        b->buf = sdscatsds(b->buf, server.aof_buf);
+        sdsfree(server.aof_buf);
+        server.aof_buf = b->buf;
+    } else {
+        server.aof_current_size += nwritten;
+        server.aof_last_incr_size += nwritten;
+        server.stat_aof_writer_bytes += nwritten;
+
+        if (b->fsync && b->fsync_errno) {
+            if (b->policy == AOF_FSYNC_ALWAYS) {
+                serverLog(LL_WARNING,"Can't persist AOF for fsync error when the "
+                  "AOF fsync policy is 'always': %s. Exiting...", strerror(b->fsync_errno));
+                exit(1);
+            }
+            int last_status;
+            atomicGet(server.aof_bio_fsync_status,last_status);
+            atomicSet(server.aof_bio_fsync_status,C_ERR);
+            atomicSet(server.aof_bio_fsync_errno,b->fsync_errno);
+            if (last_status == C_OK) {
+                serverLog(LL_WARNING,
+                    "Fail to fsync the AOF file: %s",strerror(b->fsync_errno));
+            }
+        } else if (b->fsync) {
+            atomicSet(server.aof_bio_fsync_status,C_OK);
+            server.aof_last_incr_fsync_offset = server.aof_last_incr_size;
+            server.aof_fsynced_offset = b->aofoff;
+            atomicSet(server.fsynced_reploff_pending, b->reploff);
+        } else if (b->policy == AOF_FSYNC_ALWAYS) {
+            /* The fsync was skipped because of no-appendfsync-on-rewrite:
+             * the replies should not wait for it. */
+            server.aof_fsynced_offset = b->aofoff;
+        }
+
+        /* Keep the buffer for the next handoff if it is small enough, see
+         * flushAppendOnlyFile(). */
+        if (sdslen(b->buf)+sdsavail(b->buf) < 4000 && !aofWriter.spare) {
+            sdsclear(b->buf);
+            aofWriter.spare = b->buf;
+        } else {
+            sdsfree(b->buf);
+        }
+    }
+    b->buf = NULL;
+    atomicSetWithSync(aofWriter.state, AOF_WRITER_IDLE);
+}
+
+/* Wait for the writer to be done with the batch in flight, if any, and
+ * collect it. */
+static void aofWriterWait(void) {
+    int state;
+
+    pthread_mutex_lock(&aofWriter.mutex);
+    while (1) {
+        atomicGetWithSync(aofWriter.state, state);
+        if (state != AOF_WRITER_QUEUED) break;
+        pthread_cond_wait(&aofWriter.done_cond, &aofWriter.mutex);
+    }
+    pthread_mutex_unlock(&aofWriter.mutex);
+    aofWriterCollect();
+}
+
+static void aofWriterHandOff(int fsync) {
+    aofWriterBatch *b = &aofWriter.batch;
+
+    b->fd = server.aof_fd;
+    b->buf = server.aof_buf;
+    b->fsync = fsync;
+    b->policy = server.aof_fsync;
+    b->flush_sleep = server.aof_flush_sleep;
+    b->reploff = server.master_repl_offset;
+    b->aofoff = server.aof_fed_offset;
+    b->queued = getMonotonicUs();
+    server.aof_buf = aofWriter.spare ? aofWriter.spare : sdsempty();
+    aofWriter.spare = NULL;
+    if (fsync) server.aof_last_fsync = server.unixtime;
+
+    pthread_mutex_lock(&aofWriter.mutex);
+    atomicSetWithSync(aofWriter.state, AOF_WRITER_QUEUED);
+    pthread_cond_signal(&aofWriter.queued_cond);
+    pthread_mutex_unlock(&aofWriter.mutex);
+}
+
+/* Called by flushAppendOnlyFile(): returns 1 if the flush was handled by the
+ * writer thread, or 0 if the AOF buffer should be written synchronously,
+ * which is the case of forced flushes, and once the writer was disabled.
+ * Either way no batch is left in flight when 0 is returned, so the caller
+ * is free to write the AOF or to replace its file descriptor. */
+static int aofWriterFlush(int force) {
+    int state, fsync = 0;
+
+    if (server.aof_writer_thread && aofWriterStart() == C_ERR) return 0;
+
+    if (force || !server.aof_writer_thread) {
+        aofWriterWait();
+        return 0;
+    }
+
+    aofWriterCollect();
+    atomicGetWithSync(aofWriter.state, state);
+    if (state != AOF_WRITER_IDLE) return 1; /* The buffer keeps growing. */
+    aofBinaryCloseBlock();
+
+    /* Don't fsync if no-appendfsync-on-rewrite is set to yes and there are
+     * children doing I/O in the background. */
+    if (!(server.aof_no_fsync_on_rewrite && hasActiveChildProcess())) {
+        fsync = server.aof_fsync == AOF_FSYNC_ALWAYS ||
+                (server.aof_fsync == AOF_FSYNC_EVERYSEC &&
+                 server.unixtime > server.aof_last_fsync);
+    }
+
+    /* With an empty buffer there may still be a fsync to do, or replies
+     * waiting for one after the fsync policy was changed to always. */
+    if (sdslen(server.aof_buf) == 0 &&
+        !(fsync && server.aof_last_incr_fsync_offset != server.aof_last_incr_size) &&
+        !(server.aof_fsync == AOF_FSYNC_ALWAYS &&
+          server.aof_fsynced_offset != server.aof_fed_offset))
+    {
+        return 1;
+    }
+
+    aofWriterHandOff(fsync);
+    return 1;
+}
+
+/* Return 1 if the replies of the client should be held back because with
+ * appendfsync always they may depend on commands the writer thread didn't
+ * fsync yet. */
+int aofClientWaitsFsync(client *c) {
+    return server.aof_writer_thread &&
+           server.aof_state == AOF_ON &&
+           server.aof_fsync == AOF_FSYNC_ALWAYS &&
+           c->aof_woff > server.aof_fsynced_offset;
+}
+
 /* Write the append only file buffer on disk.
  *
  * Since we are required to write the AOF before replying to the client,
@@ -1060,12 +1849,16 @@ ssize_t aofWrite(int fd, const char *buf, size_t len) {
  *
  * However if force is set to 1 we'll write regardless of the background
  * fsync. */
-#define AOF_WRITE_LOG_ERROR_RATE 30 /* Seconds between errors logging. */
 void flushAppendOnlyFile(int force) {
     ssize_t nwritten;
-    int sync_in_progress = 0;
+    int sync_in_progress = 0, write_errno;
     mstime_t latency;
 
+    /* With the writer thread the buffer is usually handed off to it. */
+    if ((server.aof_writer_thread || aofWriter.started) && aofWriterFlush(force))
+        return;
+    aofBinaryCloseBlock();
+
     if (sdslen(server.aof_buf) == 0) {
         /* Check if we need to do fsync even the aof buffer is empty,
          * because previously in AOF_FSYNC_EVERYSEC mode, fsync is
@@ -1127,6 +1920,7 @@ void flushAppendOnlyFile(int force) {
 
     latencyStartMonitor(latency);
     nwritten = aofWrite(server.aof_fd,server.aof_buf,sdslen(server.aof_buf));
+    write_errno = errno;
     latencyEndMonitor(latency);
     /* We want to capture different events for delayed writes:
      * when the delay happens with a pending fsync, or with a saving child
@@ -1145,79 +1939,15 @@ void flushAppendOnlyFile(int force) {
     /* We performed the write so reset the postponed flush sentinel to zero. */
     server.aof_flush_postponed_start = 0;
 
-    if (nwritten != (ssize_t)sdslen(server.aof_buf)) {
-        static time_t last_write_error_log = 0;
-        int can_log = 0;
-
-        /* Limit logging rate to 1 line per AOF_WRITE_LOG_ERROR_RATE seconds. */
-        if ((server.unixtime - last_write_error_log) > AOF_WRITE_LOG_ERROR_RATE) {
-            can_log = 1;
-            last_write_error_log = server.unixtime;
-        }
-
-        /* Log the AOF write error and record the error code. */
-        if (nwritten == -1) {
-            if (can_log) {
-                serverLog(LL_WARNING,"Error writing to the AOF file: %s",
-                    strerror(errno));
-            }
-            server.aof_last_write_errno = errno;
-        } else {
-            if (can_log) {
-                serverLog(LL_WARNING,"Short write while writing to "
-                                       "the AOF file: (nwritten=%lld, "
-                                       "expected=%lld)",
-                                       (long long)nwritten,
-                                       (long long)sdslen(server.aof_buf));
-            }
-
-            if (ftruncate(server.aof_fd, server.aof_last_incr_size) == -1) {
-                if (can_log) {
-                    serverLog(LL_WARNING, "Could not remove short write "
-                             "from the append-only file.  Sider may refuse "
-                             "to load the AOF the next time it starts.  "
-                             "ftruncate: %s", strerror(errno));
-                }
-            } else {
-                /* If the ftruncate() succeeded we can set nwritten to
-                 * -1 since there is no longer partial data into the AOF. */
-                nwritten = -1;
-            }
-            server.aof_last_write_errno = ENOSPC;
-        }
-
-        /* Handle the AOF write error. */
-        if (server.aof_fsync == AOF_FSYNC_ALWAYS) {
-            /* We can't recover when the fsync policy is ALWAYS since the reply
-             * for the client is already in the output buffers (both writes and
-             * reads), and the changes to the db can't be rolled back. Since we
-             * have a contract with the user that on acknowledged or observed
-             * writes are is synced on disk, we must exit. */
-            serverLog(LL_WARNING,"Can't recover from AOF write error when the AOF fsync policy is 'always'. Exiting...");
-            exit(1);
-        } else {
-            /* Recover from failed write leaving data into the buffer. However
-             * set an error to stop accepting writes as long as the error
-             * condition is not cleared. */
-            server.aof_last_write_status = C_ERR;
-
-            /* Trim the sds buffer if there was a partial write, and there
-             * was no way to undo it with ftruncate(2). */
-            if (nwritten > 0) {
-                server.aof_current_size += nwritten;
-                server.aof_last_incr_size += nwritten;
-                sdsrange(server.aof_buf,nwritten,-1);
-            }
-            return; /* We'll try again on the next call... */
-        }
-    } else {
-        /* Successful write(2). If AOF was in error state, restore the
-         * OK state and log the event. */
-        if (server.aof_last_write_status == C_ERR) {
-            serverLog(LL_NOTICE,
-                "AOF write error looks solved, Sider can write again.");
-            server.aof_last_write_status = C_OK;
+    if (aofCheckWrite(&nwritten,sdslen(server.aof_buf),write_errno) == C_ERR) {
+        /* Trim the sds buffer if there was a partial write, and there
+         * was no way to undo it with ftruncate(2). */
+        if (nwritten > 0) {
+            server.aof_current_size += nwritten;
+            server.aof_last_incr_size += nwritten;
+            sdsrange(server.aof_buf,nwritten,-1);
         }
+        return; /* We'll try again on the next call... */
     }
     server.aof_current_size += nwritten;
     server.aof_last_incr_size += nwritten;
@@ -1254,6 +1984,7 @@ try_fsync:
         latencyAddSampleIfNeeded("aof-fsync-always",latency);
         server.aof_last_incr_fsync_offset = server.aof_last_incr_size;
         server.aof_last_fsync = server.unixtime;
+        server.aof_fsynced_offset = server.aof_fed_offset;
         atomicSet(server.fsynced_reploff_pending, server.master_repl_offset);
     } else if (server.aof_fsync == AOF_FSYNC_EVERYSEC &&
                server.unixtime > server.aof_last_fsync) {
@@ -1318,10 +2049,16 @@ sds genAofTimestampAnnotationIfNeeded(int force) {
  * argc   - Number of values in argv
  */
 void feedAppendOnlyFile(int dictid, robj **argv, int argc) {
-    sds buf = sdsempty();
+    sds buf;
 
     serverAssert(dictid == -1 || (dictid >= 0 && dictid < server.dbnum));
 
+    if (server.aof_binary) {
+        aofBinaryFeed(dictid,argv,argc);
+        return;
+    }
+    buf = sdsempty();
+
     /* Feed timestamp if needed */
     if (server.aof_timestamp_enabled) {
         sds ts = genAofTimestampAnnotationIfNeeded(0);
@@ -1353,6 +2090,7 @@ void feedAppendOnlyFile(int dictid, robj **argv, int argc) {
         (server.aof_state == AOF_WAIT_REWRITE && server.child_type == CHILD_TYPE_AOF))
     {
         server.aof_buf = sdscatlen(server.aof_buf, buf, sdslen(buf));
+        server.aof_fed_offset += sdslen(buf);
     }
 
     sdsfree(buf);
@@ -1400,7 +2138,8 @@ int loadSingleAppendOnlyFile(char *filename) {
     off_t valid_up_to = 0; /* Offset of latest well-formed command loaded. */
     off_t valid_before_multi = 0; /* Offset before MULTI command loaded. */
     off_t last_progress_report_size = 0;
-    int ret = AOF_OK;
+    int ret = AOF_OK, binary = 0;
+    aofBinaryBlock block = {0};
 
     sds aof_filepath = makePath(server.aof_dirname, filename);
     FILE *fp = fopen(aof_filepath, "r");
@@ -1439,6 +2178,8 @@ int loadSingleAppendOnlyFile(char *filename) {
     if (fread(sig,1,5,fp) != 5 || memcmp(sig,"REDIS",5) != 0) {
         /* Not in RDB format, seek back at 0 offset. */
         if (fseek(fp,0,SEEK_SET) == -1) goto readerr;
+        /* Binary INCR files are loaded block by block. */
+        if ((binary = aofBinaryReadMagic(fp))) valid_up_to = ftello(fp);
     } else {
         /* RDB format. Pass loading the RDB functions. */
         rio rdb;
@@ -1465,7 +2206,7 @@ int loadSingleAppendOnlyFile(char *filename) {
         }
     }
 
-    /* Read the actual AOF file, in REPL format, command by command. */
+    /* Read the actual AOF file, in REPL or binary format, command by command. */
     while(1) {
         int argc, j;
         unsigned long len;
@@ -1482,55 +2223,77 @@ int loadSingleAppendOnlyFile(char *filename) {
             processEventsWhileBlocked();
             processModuleLoadingProgressEvent(1);
         }
-        if (fgets(buf,sizeof(buf),fp) == NULL) {
-            if (feof(fp)) {
-                break;
-            } else {
-                goto readerr;
+        if (binary) {
+            sds *args;
+            int res = aofBinaryNextCommand(&block,&argc,&args);
+            if (res == 0) {
+                /* All the commands of the block were loaded. */
+                if (server.aof_load_truncated) valid_up_to = ftello(fp);
+                res = aofBinaryReadBlock(fp,&block);
+                if (res == 0) break;
+                if (res == 1) continue;
+                if (feof(fp) || ferror(fp)) goto readerr;
+                goto fmterr;
             }
-        }
-        if (buf[0] == '#') continue; /* Skip annotations */
-        if (buf[0] != '*') goto fmterr;
-        if (buf[1] == '\0') goto readerr;
-        argc = atoi(buf+1);
-        if (argc < 1) goto fmterr;
-        if ((size_t)argc > SIZE_MAX / sizeof(robj*)) goto fmterr;
-
-        /* Load the next command in the AOF as our fake client
-         * argv. */
-        argv = zmalloc(sizeof(robj*)*argc);
-        fakeClient->argc = argc;
-        fakeClient->argv = argv;
-        fakeClient->argv_len = argc;
-
-        for (j = 0; j < argc; j++) {
-            /* Parse the argument len. */
-            char *readres = fgets(buf,sizeof(buf),fp);
-            if (readres == NULL || buf[0] != '$') {
-                fakeClient->argc = j; /* Free up to j-1. */
-                freeClientArgv(fakeClient);
-                if (readres == NULL)
+            if (res == -1) goto fmterr;
+
+            argv = zmalloc(sizeof(robj*)*argc);
+            for (j = 0; j < argc; j++) argv[j] = createObject(OBJ_STRING,args[j]);
+            zfree(args);
+            fakeClient->argc = argc;
+            fakeClient->argv = argv;
+            fakeClient->argv_len = argc;
+        } else {
+            if (fgets(buf,sizeof(buf),fp) == NULL) {
+                if (feof(fp)) {
+                    break;
+                } else {
                     goto readerr;
-                else
-                    goto fmterr;
-            }
-            len = strtol(buf+1,NULL,10);
-
-            /* Read it into a string object. */
-            argsds = sdsnewlen(SDS_NOINIT,len);
-            if (len && fread(argsds,len,1,fp) == 0) {
-                sdsfree(argsds);
-                fakeClient->argc = j; /* Free up to j-1. */
-                freeClientArgv(fakeClient);
-                goto readerr;
+                }
             }
-            argv[j] = createObject(OBJ_STRING,argsds);
+            if (buf[0] == '#') continue; /* Skip annotations */
+            if (buf[0] != '*') goto fmterr;
+            if (buf[1] == '\0') goto readerr;
+            argc = atoi(buf+1);
+            if (argc < 1) goto fmterr;
+            if ((size_t)argc > SIZE_MAX / sizeof(robj*)) goto fmterr;
+
+            /* Load the next command in the AOF as our fake client
+             * argv. */
+            argv = zmalloc(sizeof(robj*)*argc);
+            fakeClient->argc = argc;
+            fakeClient->argv = argv;
+            fakeClient->argv_len = argc;
+
+            for (j = 0; j < argc; j++) {
+                /* Parse the argument len. */
+                char *readres = fgets(buf,sizeof(buf),fp);
+                if (readres == NULL || buf[0] != '$') {
+                    fakeClient->argc = j; /* Free up to j-1. */
+                    freeClientArgv(fakeClient);
+                    if (readres == NULL)
+                        goto readerr;
+                    else
+                        goto fmterr;
+                }
+                len = strtol(buf+1,NULL,10);
+
+                /* Read it into a string object. */
+                argsds = sdsnewlen(SDS_NOINIT,len);
+                if (len && fread(argsds,len,1,fp) == 0) {
+                    sdsfree(argsds);
+                    fakeClient->argc = j; /* Free up to j-1. */
+                    freeClientArgv(fakeClient);
+                    goto readerr;
+                }
+                argv[j] = createObject(OBJ_STRING,argsds);
 
-            /* Discard CRLF. */
-            if (fread(buf,2,1,fp) == 0) {
-                fakeClient->argc = j+1; /* Free up to j. */
-                freeClientArgv(fakeClient);
-                goto readerr;
+                /* Discard CRLF. */
+                if (fread(buf,2,1,fp) == 0) {
+                    fakeClient->argc = j+1; /* Free up to j. */
+                    freeClientArgv(fakeClient);
+                    goto readerr;
+                }
             }
         }
 
@@ -1570,7 +2333,7 @@ int loadSingleAppendOnlyFile(char *filename) {
         /* Clean up. Command code may have changed argv/argc so we use the
          * argv/argc of the client instead of the local variables. */
         freeClientArgv(fakeClient);
-        if (server.aof_load_truncated) valid_up_to = ftello(fp);
+        if (server.aof_load_truncated && !binary) valid_up_to = ftello(fp);
         if (server.key_load_delay)
             debugDelay(server.key_load_delay);
     }
@@ -1638,6 +2401,7 @@ fmterr: /* Format error. */
 
 cleanup:
     if (fakeClient) freeClient(fakeClient);
+    aofBinaryBlockFree(&block);
     server.current_client = old_cur_client;
     server.executing_client = old_exec_client;
     fclose(fp);
@@ -2233,7 +2997,7 @@ werr:
 }
 
 int rewriteAppendOnlyFileRio(rio *aof) {
-    dictIterator *di = NULL;
+    dbIterator dbit, *iter = NULL;
     dictEntry *de;
     int j;
     long key_count = 0;
@@ -2251,16 +3015,16 @@ int rewriteAppendOnlyFileRio(rio *aof) {
     for (j = 0; j < server.dbnum; j++) {
         char selectcmd[] = "*2\r\n$6\r\nSELECT\r\n";
         siderDb *db = server.db+j;
-        dict *d = db->dict;
-        if (dictSize(d) == 0) continue;
-        di = dictGetSafeIterator(d);
+        if (dbSize(db, DB_MAIN) == 0) continue;
+        dbInitIterator(&dbit, db, DB_MAIN);
+        iter = &dbit;
 
         /* SELECT the new DB */
         if (rioWrite(aof,selectcmd,sizeof(selectcmd)-1) == 0) goto werr;
         if (rioWriteBulkLongLong(aof,j) == 0) goto werr;
 
         /* Iterate this DB writing every entry */
-        while((de = dictNext(di)) != NULL) {
+        while((de = dbIteratorNext(iter)) != NULL) {
             sds keystr;
             robj key, *o;
             long long expiretime;
@@ -2325,13 +3089,13 @@ int rewriteAppendOnlyFileRio(rio *aof) {
             if (server.rdb_key_save_delay)
                 debugDelay(server.rdb_key_save_delay);
         }
-        dictReleaseIterator(di);
-        di = NULL;
+        dbResetIterator(iter);
+        iter = NULL;
     }
     return C_OK;
 
 werr:
-    if (di) dictReleaseIterator(di);
+    if (iter) dbResetIterator(iter);
     return C_ERR;
 }
 
@@ -2629,8 +3393,11 @@ void backgroundRewriteDoneHandler(int exitcode, int bysignal) {
             /* Get temporary incr aof name. */
             sds temp_incr_aof_name = getTempIncrAofName();
             sds temp_incr_filepath = makePath(server.aof_dirname, temp_incr_aof_name);
-            /* Get next new incr aof name. */
+            /* Get next new incr aof name, in the format the temporary file
+             * was created with. */
             sds new_incr_filename = getNewIncrAofName(temp_am);
+            aofInfo *incr_info = listNodeValue(listLast(temp_am->incr_aof_list));
+            incr_info->file_format = server.aof_binary ? AOF_FORMAT_BINARY : AOF_FORMAT_RESP;
             new_incr_filepath = makePath(server.aof_dirname, new_incr_filename);
             latencyStartMonitor(latency);
             if (rename(temp_incr_filepath, new_incr_filepath) == -1) {
@@ -2732,6 +3499,7 @@ cleanup:
     if (server.aof_state == AOF_WAIT_REWRITE) {
         sdsfree(server.aof_buf);
         server.aof_buf = sdsempty();
+        aofBinaryDiscardBlock();
         aofDelTempIncrAofFile();
     }
     server.aof_rewrite_time_last = time(NULL)-server.aof_rewrite_time_start;
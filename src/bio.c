@@ -26,6 +26,13 @@
  * least-recently-inserted to the most-recently-inserted (older jobs processed
  * first).
  *
+ * The lazyfree jobs are the exception: they are handled by a pool of
+ * "lazyfree-threads" workers, each with its own queue, since the order in which
+ * objects are released doesn't matter. The jobs created by the main thread are
+ * batched, and handed to the workers once per event loop iteration, spread
+ * across their queues. A worker that runs out of jobs steals half of the jobs
+ * of the queue of another worker of the pool before going to sleep.
+ *
  * Currently there is no way for the creator of the job to be notified about
  * the completion of the operation, this will only be added when/if needed.
  *
@@ -69,20 +76,34 @@ static char* bio_worker_title[] = {
     "bio_lazy_free",
 };
 
-#define BIO_WORKER_NUM (sizeof(bio_worker_title) / sizeof(*bio_worker_title))
+/* The lazyfree pool is made of the last workers, starting from the one of
+ * the "bio_lazy_free" title. */
+#define BIO_LAZY_FREE_WORKER 2
+#define BIO_MAX_WORKERS (BIO_LAZY_FREE_WORKER + BIO_LAZY_FREE_MAX_THREADS)
+#define BIO_LAZY_FREE_BATCH_MAX 1024
 
 static unsigned int bio_job_to_worker[] = {
     [BIO_CLOSE_FILE] = 0,
     [BIO_AOF_FSYNC] = 1,
     [BIO_CLOSE_AOF] = 1,
-    [BIO_LAZY_FREE] = 2,
+    [BIO_LAZY_FREE] = BIO_LAZY_FREE_WORKER,
 };
 
-static pthread_t bio_threads[BIO_WORKER_NUM];
-static pthread_mutex_t bio_mutex[BIO_WORKER_NUM];
-static pthread_cond_t bio_newjob_cond[BIO_WORKER_NUM];
-static list *bio_jobs[BIO_WORKER_NUM];
-static unsigned long bio_jobs_counter[BIO_NUM_OPS] = {0};
+static unsigned long bio_worker_num = 0;
+static pthread_t bio_threads[BIO_MAX_WORKERS];
+static pthread_mutex_t bio_mutex[BIO_MAX_WORKERS];
+static pthread_cond_t bio_newjob_cond[BIO_MAX_WORKERS];
+static list *bio_jobs[BIO_MAX_WORKERS];
+static siderAtomic unsigned long bio_jobs_counter[BIO_NUM_OPS];
+
+/* Per worker stats of the lazyfree pool. */
+static siderAtomic unsigned long long bio_jobs_processed[BIO_MAX_WORKERS];
+static siderAtomic unsigned long long bio_jobs_stolen[BIO_MAX_WORKERS];
+
+/* Lazyfree jobs created by the main thread, not yet handed to the pool. */
+static union bio_job *bio_lazy_free_batch[BIO_LAZY_FREE_BATCH_MAX];
+static unsigned long bio_lazy_free_batch_len = 0;
+static unsigned long bio_lazy_free_next_worker = 0;
 
 /* This structure represents a background Job. It is only used locally to this
  * file as the API does not expose the internals at all. */
@@ -123,7 +144,8 @@ void bioInit(void) {
     unsigned long j;
 
     /* Initialization of state vars and objects */
-    for (j = 0; j < BIO_WORKER_NUM; j++) {
+    bio_worker_num = BIO_LAZY_FREE_WORKER + server.lazyfree_threads;
+    for (j = 0; j < bio_worker_num; j++) {
         pthread_mutex_init(&bio_mutex[j],NULL);
         pthread_cond_init(&bio_newjob_cond[j],NULL);
         bio_jobs[j] = listCreate();
@@ -139,7 +161,7 @@ void bioInit(void) {
     /* Ready to spawn our threads. We use the single argument the thread
      * function accepts in order to pass the job ID the thread is
      * responsible for. */
-    for (j = 0; j < BIO_WORKER_NUM; j++) {
+    for (j = 0; j < bio_worker_num; j++) {
         void *arg = (void*)(unsigned long) j;
         if (pthread_create(&thread,&attr,bioProcessBackgroundJobs,arg) != 0) {
             serverLog(LL_WARNING, "Fatal: Can't initialize Background Jobs. Error message: %s", strerror(errno));
@@ -154,11 +176,32 @@ void bioSubmitJob(int type, bio_job *job) {
     unsigned long worker = bio_job_to_worker[type];
     pthread_mutex_lock(&bio_mutex[worker]);
     listAddNodeTail(bio_jobs[worker],job);
-    bio_jobs_counter[type]++;
+    atomicIncr(bio_jobs_counter[type],1);
     pthread_cond_signal(&bio_newjob_cond[worker]);
     pthread_mutex_unlock(&bio_mutex[worker]);
 }
 
+/* Hand the batched lazyfree jobs to the workers of the pool, in chunks of
+ * consecutive jobs so that every queue is locked once. This is called by the
+ * main thread before sleeping, or when the batch is full. */
+void bioFlushLazyFreeJobs(void) {
+    unsigned long j = 0;
+    unsigned long pool = server.lazyfree_threads;
+    unsigned long chunk = (bio_lazy_free_batch_len + pool - 1) / pool;
+
+    while (j < bio_lazy_free_batch_len) {
+        unsigned long worker = BIO_LAZY_FREE_WORKER + bio_lazy_free_next_worker;
+        bio_lazy_free_next_worker = (bio_lazy_free_next_worker + 1) % pool;
+
+        pthread_mutex_lock(&bio_mutex[worker]);
+        for (unsigned long k = 0; k < chunk && j < bio_lazy_free_batch_len; k++)
+            listAddNodeTail(bio_jobs[worker],bio_lazy_free_batch[j++]);
+        pthread_cond_signal(&bio_newjob_cond[worker]);
+        pthread_mutex_unlock(&bio_mutex[worker]);
+    }
+    bio_lazy_free_batch_len = 0;
+}
+
 void bioCreateLazyFreeJob(lazy_free_fn free_fn, int arg_count, ...) {
     va_list valist;
     /* Allocate memory for the job structure and all required
@@ -171,7 +214,18 @@ void bioCreateLazyFreeJob(lazy_free_fn free_fn, int arg_count, ...) {
         job->free_args.free_args[i] = va_arg(valist, void *);
     }
     va_end(valist);
-    bioSubmitJob(BIO_LAZY_FREE, job);
+
+    /* The jobs created by other threads, like the modules ones, are not
+     * batched since the batch is only accessed by the main thread. */
+    if (!pthread_equal(pthread_self(),server.main_thread_id)) {
+        bioSubmitJob(BIO_LAZY_FREE, job);
+        return;
+    }
+    job->header.type = BIO_LAZY_FREE;
+    atomicIncr(bio_jobs_counter[BIO_LAZY_FREE],1);
+    bio_lazy_free_batch[bio_lazy_free_batch_len++] = job;
+    if (bio_lazy_free_batch_len == BIO_LAZY_FREE_BATCH_MAX)
+        bioFlushLazyFreeJobs();
 }
 
 void bioCreateCloseJob(int fd, int need_fsync, int need_reclaim_cache) {
@@ -202,15 +256,55 @@ void bioCreateFsyncJob(int fd, long long offset, int need_reclaim_cache) {
     bioSubmitJob(BIO_AOF_FSYNC, job);
 }
 
+/* Called by a worker of the lazyfree pool with an empty queue: move half of
+ * the jobs of the queue of another worker to the queue of this worker. The
+ * first job of a queue is never stolen, since it may be being processed.
+ * Returns 1 if some jobs were stolen.
+ *
+ * The lock of the worker is held, so the lock of the other workers is only
+ * tried, in order to avoid a deadlock with a worker stealing at the same
+ * time. */
+static int bioStealLazyFreeJobs(unsigned long worker) {
+    unsigned long pool = server.lazyfree_threads;
+    unsigned long self = worker - BIO_LAZY_FREE_WORKER;
+
+    for (unsigned long j = 1; j < pool; j++) {
+        unsigned long victim = BIO_LAZY_FREE_WORKER + (self + j) % pool;
+        if (pthread_mutex_trylock(&bio_mutex[victim]) != 0) continue;
+
+        unsigned long len = listLength(bio_jobs[victim]);
+        unsigned long steal = len / 2;
+        for (unsigned long k = 0; k < steal; k++) {
+            listNode *ln = listLast(bio_jobs[victim]);
+            listAddNodeHead(bio_jobs[worker],ln->value);
+            listDelNode(bio_jobs[victim],ln);
+        }
+        pthread_mutex_unlock(&bio_mutex[victim]);
+        if (steal) {
+            atomicIncr(bio_jobs_stolen[worker],steal);
+            return 1;
+        }
+    }
+    return 0;
+}
+
 void *bioProcessBackgroundJobs(void *arg) {
     bio_job *job;
     unsigned long worker = (unsigned long) arg;
+    int lazyfree_pool = worker >= BIO_LAZY_FREE_WORKER;
     sigset_t sigset;
 
     /* Check that the worker is within the right interval. */
-    serverAssert(worker < BIO_WORKER_NUM);
-
-    sider_set_thread_title(bio_worker_title[worker]);
+    serverAssert(worker < bio_worker_num);
+
+    if (!lazyfree_pool || worker == BIO_LAZY_FREE_WORKER) {
+        sider_set_thread_title(bio_worker_title[worker]);
+    } else {
+        char title[16];
+        snprintf(title,sizeof(title),"bio_lazy_free_%lu",
+                 worker - BIO_LAZY_FREE_WORKER);
+        sider_set_thread_title(title);
+    }
 
     siderSetCpuAffinity(server.bio_cpulist);
 
@@ -230,6 +324,7 @@ void *bioProcessBackgroundJobs(void *arg) {
 
         /* The loop always starts with the lock hold. */
         if (listLength(bio_jobs[worker]) == 0) {
+            if (lazyfree_pool && bioStealLazyFreeJobs(worker)) continue;
             pthread_cond_wait(&bio_newjob_cond[worker], &bio_mutex[worker]);
             continue;
         }
@@ -294,31 +389,62 @@ void *bioProcessBackgroundJobs(void *arg) {
          * jobs to process we'll block again in pthread_cond_wait(). */
         pthread_mutex_lock(&bio_mutex[worker]);
         listDelNode(bio_jobs[worker], ln);
-        bio_jobs_counter[job_type]--;
+        atomicDecr(bio_jobs_counter[job_type],1);
+        if (lazyfree_pool) atomicIncr(bio_jobs_processed[worker],1);
         pthread_cond_signal(&bio_newjob_cond[worker]);
     }
 }
 
 /* Return the number of pending jobs of the specified type. */
 unsigned long bioPendingJobsOfType(int type) {
-    unsigned int worker = bio_job_to_worker[type];
-
-    pthread_mutex_lock(&bio_mutex[worker]);
-    unsigned long val = bio_jobs_counter[type];
-    pthread_mutex_unlock(&bio_mutex[worker]);
-
+    unsigned long val;
+    atomicGet(bio_jobs_counter[type],val);
     return val;
 }
 
 /* Wait for the job queue of the worker for jobs of specified type to become empty. */
 void bioDrainWorker(int job_type) {
     unsigned long worker = bio_job_to_worker[job_type];
+    unsigned long last = worker;
 
-    pthread_mutex_lock(&bio_mutex[worker]);
-    while (listLength(bio_jobs[worker]) > 0) {
-        pthread_cond_wait(&bio_newjob_cond[worker], &bio_mutex[worker]);
+    /* All the queues of the lazyfree pool must be drained. The jobs may move
+     * between the queues while waiting, so wait until none is pending. */
+    if (job_type == BIO_LAZY_FREE) {
+        bioFlushLazyFreeJobs();
+        last = bio_worker_num - 1;
+    }
+    do {
+        for (unsigned long j = worker; j <= last; j++) {
+            pthread_mutex_lock(&bio_mutex[j]);
+            while (listLength(bio_jobs[j]) > 0) {
+                pthread_cond_wait(&bio_newjob_cond[j], &bio_mutex[j]);
+            }
+            pthread_mutex_unlock(&bio_mutex[j]);
+        }
+    } while (job_type == BIO_LAZY_FREE && bioPendingJobsOfType(job_type));
+}
+
+/* Append the stats of the workers of the lazyfree pool to the INFO string. */
+sds bioGenLazyFreeInfoString(sds info) {
+    for (unsigned long j = BIO_LAZY_FREE_WORKER; j < bio_worker_num; j++) {
+        unsigned long long processed, stolen;
+        atomicGet(bio_jobs_processed[j],processed);
+        atomicGet(bio_jobs_stolen[j],stolen);
+        pthread_mutex_lock(&bio_mutex[j]);
+        unsigned long pending = listLength(bio_jobs[j]);
+        pthread_mutex_unlock(&bio_mutex[j]);
+        info = sdscatprintf(info,
+            "lazyfree_thread_%lu:processed=%llu,stolen=%llu,pending=%lu\r\n",
+            j - BIO_LAZY_FREE_WORKER, processed, stolen, pending);
+    }
+    return info;
+}
+
+void bioResetLazyFreeStats(void) {
+    for (unsigned long j = BIO_LAZY_FREE_WORKER; j < bio_worker_num; j++) {
+        atomicSet(bio_jobs_processed[j],0);
+        atomicSet(bio_jobs_stolen[j],0);
     }
-    pthread_mutex_unlock(&bio_mutex[worker]);
 }
 
 /* Kill the running bio threads in an unclean way. This function should be
@@ -329,7 +455,7 @@ void bioKillThreads(void) {
     int err;
     unsigned long j;
 
-    for (j = 0; j < BIO_WORKER_NUM; j++) {
+    for (j = 0; j < bio_worker_num; j++) {
         if (bio_threads[j] == pthread_self()) continue;
         if (bio_threads[j] && pthread_cancel(bio_threads[j]) == 0) {
             if ((err = pthread_join(bio_threads[j],NULL)) != 0) {
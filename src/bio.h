@@ -32,6 +32,8 @@
 
 typedef void lazy_free_fn(void *args[]);
 
+#define BIO_LAZY_FREE_MAX_THREADS 16
+
 /* Exported API */
 void bioInit(void);
 unsigned long bioPendingJobsOfType(int type);
@@ -41,6 +43,9 @@ void bioCreateCloseJob(int fd, int need_fsync, int need_reclaim_cache);
 void bioCreateCloseAofJob(int fd, long long offset, int need_reclaim_cache);
 void bioCreateFsyncJob(int fd, long long offset, int need_reclaim_cache);
 void bioCreateLazyFreeJob(lazy_free_fn free_fn, int arg_count, ...);
+void bioFlushLazyFreeJobs(void);
+sds bioGenLazyFreeInfoString(sds info);
+void bioResetLazyFreeStats(void);
 
 /* Background job opcodes */
 enum {
@@ -59,6 +59,7 @@ configEnum maxmemory_policy_enum[] = {
     {"allkeys-lfu",MAXMEMORY_ALLKEYS_LFU},
     {"allkeys-random",MAXMEMORY_ALLKEYS_RANDOM},
     {"noeviction",MAXMEMORY_NO_EVICTION},
+    {"allkeys-slru",MAXMEMORY_ALLKEYS_SLRU},
     {NULL, 0}
 };
 
@@ -92,6 +93,12 @@ configEnum supervised_mode_enum[] = {
     {NULL, 0}
 };
 
+configEnum db_hashtable_type_enum[] = {
+    {"chained", DB_HASHTABLE_CHAINED},
+    {"open-addressing", DB_HASHTABLE_OPEN_ADDRESSING},
+    {NULL, 0}
+};
+
 configEnum aof_fsync_enum[] = {
     {"everysec", AOF_FSYNC_EVERYSEC},
     {"always", AOF_FSYNC_ALWAYS},
@@ -115,6 +122,27 @@ configEnum repl_diskless_load_enum[] = {
     {NULL, 0}
 };
 
+configEnum aof_incr_format_enum[] = {
+    {"resp", AOF_FORMAT_RESP},
+    {"binary", AOF_FORMAT_BINARY},
+    {NULL, 0}
+};
+
+configEnum aof_binary_compression_enum[] = {
+    {"no", AOF_COMPRESSION_NO},
+    {"lzf", AOF_COMPRESSION_LZF},
+    {"lz4", AOF_COMPRESSION_LZ4},
+    {"zstd", AOF_COMPRESSION_ZSTD},
+    {NULL, 0}
+};
+
+configEnum rdb_compression_algorithm_enum[] = {
+    {"lzf", RDB_COMPRESSION_LZF},
+    {"lz4", RDB_COMPRESSION_LZ4},
+    {"zstd", RDB_COMPRESSION_ZSTD},
+    {NULL, 0}
+};
+
 configEnum tls_auth_clients_enum[] = {
     {"no", TLS_CLIENT_AUTH_NO},
     {"yes", TLS_CLIENT_AUTH_YES},
@@ -2384,6 +2412,51 @@ static int isValidShutdownOnSigFlags(int val, const char **err) {
     return 1;
 }
 
+static int isValidRdbCompressionAlgorithm(int val, const char **err) {
+    UNUSED(val);
+    UNUSED(err);
+#ifndef HAVE_LZ4
+    if (val == RDB_COMPRESSION_LZ4) {
+        *err = "Sider was built without LZ4 support (USE_LZ4=yes)";
+        return 0;
+    }
+#endif
+#ifndef HAVE_ZSTD
+    if (val == RDB_COMPRESSION_ZSTD) {
+        *err = "Sider was built without ZSTD support (USE_ZSTD=yes)";
+        return 0;
+    }
+#endif
+    return 1;
+}
+
+static int isValidMaxmemoryPolicy(int val, const char **err) {
+    /* The SLRU links are allocated with the keyspace entries. */
+    if (val & MAXMEMORY_FLAG_SLRU && server.db && !server.slru_links) {
+        *err = "allkeys-slru can only be used if it was set when the server started";
+        return 0;
+    }
+    return 1;
+}
+
+static int isValidAofBinaryCompression(int val, const char **err) {
+    UNUSED(val);
+    UNUSED(err);
+#ifndef HAVE_LZ4
+    if (val == AOF_COMPRESSION_LZ4) {
+        *err = "Sider was built without LZ4 support (USE_LZ4=yes)";
+        return 0;
+    }
+#endif
+#ifndef HAVE_ZSTD
+    if (val == AOF_COMPRESSION_ZSTD) {
+        *err = "Sider was built without ZSTD support (USE_ZSTD=yes)";
+        return 0;
+    }
+#endif
+    return 1;
+}
+
 static int isValidAnnouncedNodename(char *val,const char **err) {
     if (!(isValidAuxString(val,sdslen(val)))) {
         *err = "Announced human node name contained invalid character";
@@ -2474,6 +2547,13 @@ static int updateJemallocBgThread(const char **err) {
     return 1;
 }
 
+static int updateActiveExpireIndex(const char **err) {
+    UNUSED(err);
+    for (int j = 0; j < server.dbnum; j++)
+        expireIndexUpdate(server.db+j);
+    return 1;
+}
+
 static int updateReplBacklogSize(const char **err) {
     UNUSED(err);
     resizeReplicationBacklog();
@@ -3052,11 +3132,14 @@ standardConfig static_configs[] = {
     createBoolConfig("rdbchecksum", NULL, IMMUTABLE_CONFIG, server.rdb_checksum, 1, NULL, NULL),
     createBoolConfig("daemonize", NULL, IMMUTABLE_CONFIG, server.daemonize, 0, NULL, NULL),
     createBoolConfig("io-threads-do-reads", NULL, DEBUG_CONFIG | IMMUTABLE_CONFIG, server.io_threads_do_reads, 0,NULL, NULL), /* Read + parse from threads? */
+    createBoolConfig("io-threads-event-loops", NULL, IMMUTABLE_CONFIG, server.io_threads_event_loops, 0,NULL, NULL), /* Serve clients from the threads event loops? */
+    createBoolConfig("io-threads-do-commands", NULL, MODIFIABLE_CONFIG, server.io_threads_do_commands, 0,NULL, NULL), /* Execute read-only commands from threads? */
     createBoolConfig("always-show-logo", NULL, IMMUTABLE_CONFIG, server.always_show_logo, 0, NULL, NULL),
     createBoolConfig("protected-mode", NULL, MODIFIABLE_CONFIG, server.protected_mode, 1, NULL, NULL),
     createBoolConfig("rdbcompression", NULL, MODIFIABLE_CONFIG, server.rdb_compression, 1, NULL, NULL),
     createBoolConfig("rdb-del-sync-files", NULL, MODIFIABLE_CONFIG, server.rdb_del_sync_files, 0, NULL, NULL),
     createBoolConfig("activerehashing", NULL, MODIFIABLE_CONFIG, server.activerehashing, 1, NULL, NULL),
+    createBoolConfig("active-expire-index", NULL, MODIFIABLE_CONFIG, server.active_expire_index, 0, NULL, updateActiveExpireIndex),
     createBoolConfig("stop-writes-on-bgsave-error", NULL, MODIFIABLE_CONFIG, server.stop_writes_on_bgsave_err, 1, NULL, NULL),
     createBoolConfig("set-proc-title", NULL, IMMUTABLE_CONFIG, server.set_proc_title, 1, NULL, NULL), /* Should setproctitle be used? */
     createBoolConfig("dynamic-hz", NULL, MODIFIABLE_CONFIG, server.dynamic_hz, 1, NULL, NULL), /* Adapt hz to # of clients.*/
@@ -3065,14 +3148,19 @@ standardConfig static_configs[] = {
     createBoolConfig("lazyfree-lazy-server-del", NULL, DEBUG_CONFIG | MODIFIABLE_CONFIG, server.lazyfree_lazy_server_del, 0, NULL, NULL),
     createBoolConfig("lazyfree-lazy-user-del", NULL, DEBUG_CONFIG | MODIFIABLE_CONFIG, server.lazyfree_lazy_user_del , 0, NULL, NULL),
     createBoolConfig("lazyfree-lazy-user-flush", NULL, DEBUG_CONFIG | MODIFIABLE_CONFIG, server.lazyfree_lazy_user_flush , 0, NULL, NULL),
+    createBoolConfig("lazyfree-incremental", NULL, MODIFIABLE_CONFIG, server.lazyfree_incremental, 0, NULL, NULL),
     createBoolConfig("repl-disable-tcp-nodelay", NULL, MODIFIABLE_CONFIG, server.repl_disable_tcp_nodelay, 0, NULL, NULL),
     createBoolConfig("repl-diskless-sync", NULL, DEBUG_CONFIG | MODIFIABLE_CONFIG, server.repl_diskless_sync, 1, NULL, NULL),
+    createBoolConfig("dual-channel-replication-enabled", NULL, MODIFIABLE_CONFIG, server.repl_dual_channel, 0, NULL, NULL),
     createBoolConfig("aof-rewrite-incremental-fsync", NULL, MODIFIABLE_CONFIG, server.aof_rewrite_incremental_fsync, 1, NULL, NULL),
     createBoolConfig("no-appendfsync-on-rewrite", NULL, MODIFIABLE_CONFIG, server.aof_no_fsync_on_rewrite, 0, NULL, NULL),
     createBoolConfig("cluster-require-full-coverage", NULL, MODIFIABLE_CONFIG, server.cluster_require_full_coverage, 1, NULL, NULL),
     createBoolConfig("rdb-save-incremental-fsync", NULL, MODIFIABLE_CONFIG, server.rdb_save_incremental_fsync, 1, NULL, NULL),
+    createBoolConfig("rdb-save-forkless", NULL, MODIFIABLE_CONFIG, server.rdb_save_forkless, 0, NULL, NULL),
+    createBoolConfig("rdb-load-on-demand", NULL, MODIFIABLE_CONFIG, server.rdb_load_on_demand, 0, NULL, NULL),
     createBoolConfig("aof-load-truncated", NULL, MODIFIABLE_CONFIG, server.aof_load_truncated, 1, NULL, NULL),
     createBoolConfig("aof-use-rdb-preamble", NULL, MODIFIABLE_CONFIG, server.aof_use_rdb_preamble, 1, NULL, NULL),
+    createBoolConfig("aof-writer-thread", NULL, MODIFIABLE_CONFIG, server.aof_writer_thread, 0, NULL, NULL),
     createBoolConfig("aof-timestamp-enabled", NULL, MODIFIABLE_CONFIG, server.aof_timestamp_enabled, 0, NULL, NULL),
     createBoolConfig("cluster-replica-no-failover", "cluster-slave-no-failover", MODIFIABLE_CONFIG, server.cluster_slave_no_failover, 0, NULL, updateClusterFlags), /* Failover by default. */
     createBoolConfig("replica-lazy-flush", "slave-lazy-flush", MODIFIABLE_CONFIG, server.repl_slave_lazy_flush, 0, NULL, NULL),
@@ -3130,10 +3218,13 @@ standardConfig static_configs[] = {
     /* Enum Configs */
     createEnumConfig("supervised", NULL, IMMUTABLE_CONFIG, supervised_mode_enum, server.supervised_mode, SUPERVISED_NONE, NULL, NULL),
     createEnumConfig("syslog-facility", NULL, IMMUTABLE_CONFIG, syslog_facility_enum, server.syslog_facility, LOG_LOCAL0, NULL, NULL),
+    createEnumConfig("rdbcompression-algorithm", NULL, MODIFIABLE_CONFIG, rdb_compression_algorithm_enum, server.rdb_compression_algorithm, RDB_COMPRESSION_LZF, isValidRdbCompressionAlgorithm, NULL),
     createEnumConfig("repl-diskless-load", NULL, DEBUG_CONFIG | MODIFIABLE_CONFIG | DENY_LOADING_CONFIG, repl_diskless_load_enum, server.repl_diskless_load, REPL_DISKLESS_LOAD_DISABLED, NULL, NULL),
     createEnumConfig("loglevel", NULL, MODIFIABLE_CONFIG, loglevel_enum, server.verbosity, LL_NOTICE, NULL, NULL),
-    createEnumConfig("maxmemory-policy", NULL, MODIFIABLE_CONFIG, maxmemory_policy_enum, server.maxmemory_policy, MAXMEMORY_NO_EVICTION, NULL, NULL),
+    createEnumConfig("maxmemory-policy", NULL, MODIFIABLE_CONFIG, maxmemory_policy_enum, server.maxmemory_policy, MAXMEMORY_NO_EVICTION, isValidMaxmemoryPolicy, NULL),
     createEnumConfig("appendfsync", NULL, MODIFIABLE_CONFIG, aof_fsync_enum, server.aof_fsync, AOF_FSYNC_EVERYSEC, NULL, updateAppendFsync),
+    createEnumConfig("aof-incr-format", NULL, MODIFIABLE_CONFIG, aof_incr_format_enum, server.aof_incr_format, AOF_FORMAT_RESP, NULL, NULL),
+    createEnumConfig("aof-binary-compression", NULL, MODIFIABLE_CONFIG, aof_binary_compression_enum, server.aof_binary_compression, AOF_COMPRESSION_LZF, isValidAofBinaryCompression, NULL),
     createEnumConfig("oom-score-adj", NULL, MODIFIABLE_CONFIG, oom_score_adj_enum, server.oom_score_adj, OOM_SCORE_ADJ_NO, NULL, updateOOMScoreAdj),
     createEnumConfig("acl-pubsub-default", NULL, MODIFIABLE_CONFIG, acl_pubsub_default_enum, server.acl_pubsub_default, 0, NULL, NULL),
     createEnumConfig("sanitize-dump-payload", NULL, DEBUG_CONFIG | MODIFIABLE_CONFIG, sanitize_dump_payload_enum, server.sanitize_dump_payload, SANITIZE_DUMP_NO, NULL, NULL),
@@ -3141,6 +3232,7 @@ standardConfig static_configs[] = {
     createEnumConfig("enable-debug-command", NULL, IMMUTABLE_CONFIG, protected_action_enum, server.enable_debug_cmd, PROTECTED_ACTION_ALLOWED_NO, NULL, NULL),
     createEnumConfig("enable-module-command", NULL, IMMUTABLE_CONFIG, protected_action_enum, server.enable_module_cmd, PROTECTED_ACTION_ALLOWED_NO, NULL, NULL),
     createEnumConfig("cluster-preferred-endpoint-type", NULL, MODIFIABLE_CONFIG, cluster_preferred_endpoint_type_enum, server.cluster_preferred_endpoint_type, CLUSTER_ENDPOINT_TYPE_IP, NULL, NULL),
+    createEnumConfig("db-hashtable-type", NULL, IMMUTABLE_CONFIG, db_hashtable_type_enum, server.db_hashtable_type, DB_HASHTABLE_CHAINED, NULL, NULL),
     createEnumConfig("propagation-error-behavior", NULL, MODIFIABLE_CONFIG, propagation_error_behavior_enum, server.propagation_error_behavior, PROPAGATION_ERR_BEHAVIOR_IGNORE, NULL, NULL),
     createEnumConfig("shutdown-on-sigint", NULL, MODIFIABLE_CONFIG | MULTI_ARG_CONFIG, shutdown_on_sig_enum, server.shutdown_on_sigint, 0, isValidShutdownOnSigFlags, NULL),
     createEnumConfig("shutdown-on-sigterm", NULL, MODIFIABLE_CONFIG | MULTI_ARG_CONFIG, shutdown_on_sig_enum, server.shutdown_on_sigterm, 0, isValidShutdownOnSigFlags, NULL),
@@ -3148,7 +3240,12 @@ standardConfig static_configs[] = {
     /* Integer configs */
     createIntConfig("databases", NULL, IMMUTABLE_CONFIG, 1, INT_MAX, server.dbnum, 16, INTEGER_CONFIG, NULL, NULL),
     createIntConfig("port", NULL, MODIFIABLE_CONFIG, 0, 65535, server.port, 6379, INTEGER_CONFIG, NULL, updatePort), /* TCP port. */
+    createIntConfig("rdb-load-threads", NULL, MODIFIABLE_CONFIG, 0, RDB_LOAD_THREADS_MAX, server.rdb_load_threads, 0, INTEGER_CONFIG, NULL, NULL),
+    createIntConfig("rdbcompression-zstd-level", NULL, MODIFIABLE_CONFIG, 1, 19, server.rdb_compression_zstd_level, 3, INTEGER_CONFIG, NULL, NULL),
+    createIntConfig("rdb-save-parts", NULL, MODIFIABLE_CONFIG, 1, RDB_SAVE_PARTS_MAX, server.rdb_save_parts, 1, INTEGER_CONFIG, NULL, NULL),
     createIntConfig("io-threads", NULL, DEBUG_CONFIG | IMMUTABLE_CONFIG, 1, 128, server.io_threads_num, 1, INTEGER_CONFIG, NULL, NULL), /* Single threaded by default */
+    createIntConfig("io-threads-spin-us", NULL, DEBUG_CONFIG | MODIFIABLE_CONFIG, 0, 1000000, server.io_threads_spin_us, 50, INTEGER_CONFIG, NULL, NULL),
+    createIntConfig("lazyfree-threads", NULL, IMMUTABLE_CONFIG, 1, BIO_LAZY_FREE_MAX_THREADS, server.lazyfree_threads, 1, INTEGER_CONFIG, NULL, NULL),
     createIntConfig("auto-aof-rewrite-percentage", NULL, MODIFIABLE_CONFIG, 0, INT_MAX, server.aof_rewrite_perc, 100, INTEGER_CONFIG, NULL, NULL),
     createIntConfig("cluster-replica-validity-factor", "cluster-slave-validity-factor", MODIFIABLE_CONFIG, 0, INT_MAX, server.cluster_slave_validity_factor, 10, INTEGER_CONFIG, NULL, NULL), /* Slave max data age factor. */
     createIntConfig("list-max-listpack-size", "list-max-ziplist-size", MODIFIABLE_CONFIG, INT_MIN, INT_MAX, server.list_max_listpack_size, -2, INTEGER_CONFIG, NULL, NULL),
@@ -3164,6 +3261,8 @@ standardConfig static_configs[] = {
     createIntConfig("repl-diskless-sync-delay", NULL, MODIFIABLE_CONFIG, 0, INT_MAX, server.repl_diskless_sync_delay, 5, INTEGER_CONFIG, NULL, NULL),
     createIntConfig("maxmemory-samples", NULL, MODIFIABLE_CONFIG, 1, INT_MAX, server.maxmemory_samples, 5, INTEGER_CONFIG, NULL, NULL),
     createIntConfig("maxmemory-eviction-tenacity", NULL, MODIFIABLE_CONFIG, 0, 100, server.maxmemory_eviction_tenacity, 10, INTEGER_CONFIG, NULL, NULL),
+    createIntConfig("maxmemory-eviction-watermark-high", NULL, MODIFIABLE_CONFIG, 0, 100, server.maxmemory_eviction_watermark_high, 0, INTEGER_CONFIG, NULL, NULL),
+    createIntConfig("maxmemory-eviction-watermark-low", NULL, MODIFIABLE_CONFIG, 1, 100, server.maxmemory_eviction_watermark_low, 90, INTEGER_CONFIG, NULL, NULL),
     createIntConfig("timeout", NULL, MODIFIABLE_CONFIG, 0, INT_MAX, server.maxidletime, 0, INTEGER_CONFIG, NULL, NULL), /* Default client timeout: infinite */
     createIntConfig("replica-announce-port", "slave-announce-port", MODIFIABLE_CONFIG, 0, 65535, server.slave_announce_port, 0, INTEGER_CONFIG, NULL, NULL),
     createIntConfig("tcp-backlog", NULL, IMMUTABLE_CONFIG, 0, INT_MAX, server.tcp_backlog, 511, INTEGER_CONFIG, NULL, NULL), /* TCP listen backlog. */
@@ -3206,9 +3305,11 @@ standardConfig static_configs[] = {
     createLongLongConfig("proto-max-bulk-len", NULL, DEBUG_CONFIG | MODIFIABLE_CONFIG, 1024*1024, LONG_MAX, server.proto_max_bulk_len, 512ll*1024*1024, MEMORY_CONFIG, NULL, NULL), /* Bulk request max size */
     createLongLongConfig("stream-node-max-entries", NULL, MODIFIABLE_CONFIG, 0, LLONG_MAX, server.stream_node_max_entries, 100, INTEGER_CONFIG, NULL, NULL),
     createLongLongConfig("repl-backlog-size", NULL, MODIFIABLE_CONFIG, 1, LLONG_MAX, server.repl_backlog_size, 1024*1024, MEMORY_CONFIG, NULL, updateReplBacklogSize), /* Default: 1mb */
+    createLongLongConfig("repl-zerocopy-threshold", NULL, MODIFIABLE_CONFIG, 0, LLONG_MAX, server.repl_zerocopy_threshold, 0, MEMORY_CONFIG, NULL, NULL),
 
     /* Unsigned Long Long configs */
     createULongLongConfig("maxmemory", NULL, MODIFIABLE_CONFIG, 0, ULLONG_MAX, server.maxmemory, 0, MEMORY_CONFIG, NULL, updateMaxmemory),
+    createULongLongConfig("replica-full-sync-buffer-limit", NULL, MODIFIABLE_CONFIG, 0, ULLONG_MAX, server.repl_stream_buf_limit, 0, MEMORY_CONFIG, NULL, NULL),
     createULongLongConfig("cluster-link-sendbuf-limit", NULL, MODIFIABLE_CONFIG, 0, ULLONG_MAX, server.cluster_link_msg_queue_limit_bytes, 0, MEMORY_CONFIG, NULL, NULL),
 
     /* Size_t configs */
@@ -3219,6 +3320,7 @@ standardConfig static_configs[] = {
     createSizeTConfig("zset-max-listpack-entries", "zset-max-ziplist-entries", MODIFIABLE_CONFIG, 0, LONG_MAX, server.zset_max_listpack_entries, 128, INTEGER_CONFIG, NULL, NULL),
     createSizeTConfig("active-defrag-ignore-bytes", NULL, MODIFIABLE_CONFIG, 1, LLONG_MAX, server.active_defrag_ignore_bytes, 100<<20, MEMORY_CONFIG, NULL, NULL), /* Default: don't defrag if frag overhead is below 100mb */
     createSizeTConfig("hash-max-listpack-value", "hash-max-ziplist-value", MODIFIABLE_CONFIG, 0, LONG_MAX, server.hash_max_listpack_value, 64, MEMORY_CONFIG, NULL, NULL),
+    createSizeTConfig("rdbcompression-zstd-dict-size", NULL, MODIFIABLE_CONFIG, 0, 1024*1024, server.rdb_compression_zstd_dict_size, 0, MEMORY_CONFIG, NULL, NULL),
     createSizeTConfig("stream-node-max-bytes", NULL, MODIFIABLE_CONFIG, 0, LONG_MAX, server.stream_node_max_bytes, 4096, MEMORY_CONFIG, NULL, NULL),
     createSizeTConfig("zset-max-listpack-value", "zset-max-ziplist-value", MODIFIABLE_CONFIG, 0, LONG_MAX, server.zset_max_listpack_value, 64, MEMORY_CONFIG, NULL, NULL),
     createSizeTConfig("hll-sparse-max-bytes", NULL, MODIFIABLE_CONFIG, 0, LONG_MAX, server.hll_sparse_max_bytes, 3000, MEMORY_CONFIG, NULL, NULL),
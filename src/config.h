@@ -90,6 +90,14 @@
 #endif
 #endif
 
+/* MSG_ZEROCOPY (Linux 4.14), the kernel support is checked at runtime. */
+#ifdef __linux__
+#include <sys/socket.h>
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#define HAVE_MSG_ZEROCOPY 1
+#endif
+#endif
+
 /* Test for polling API */
 #ifdef __linux__
 #define HAVE_EPOLL 1
@@ -37,6 +37,236 @@
 #include <signal.h>
 #include <ctype.h>
 
+/*-----------------------------------------------------------------------------
+ * Keyspace dicts
+ *
+ * The keys of a DB, and their expire times, are stored in one dict per
+ * cluster slot in cluster mode, and in a single dict otherwise. This keeps
+ * the tables, and their rehashing, small, and lets the cluster count, get
+ * and delete the keys of a slot with no per key overhead.
+ *----------------------------------------------------------------------------*/
+
+/* Returns the slot of the key, that is the index of the dicts storing it. */
+int getKeySlot(sds key) {
+    if (!server.cluster_enabled) return 0;
+    return keyHashSlot(key, (int)sdslen(key));
+}
+
+dict *dbGetDict(siderDb *db, int slot, dbKeyType keyType) {
+    return keyType == DB_MAIN ? db->dict[slot] : db->expires[slot];
+}
+
+dictEntry *dbFind(siderDb *db, void *key) {
+    if (server.loading_on_demand) rdbOnDemandLoadKey(db,key);
+    return dictFind(db->dict[getKeySlot(key)], key);
+}
+
+dictEntry *dbFindExpires(siderDb *db, void *key) {
+    if (server.loading_on_demand) rdbOnDemandLoadKey(db,key);
+    return dictFind(db->expires[getKeySlot(key)], key);
+}
+
+/* Returns the number of keys (or of keys with an expire set) in the DB. */
+unsigned long long dbSize(siderDb *db, dbKeyType keyType) {
+    return db->sub_dict[keyType].key_count;
+}
+
+/* Updates the stats of the keyspace dicts once a key was added to the dict of
+ * 'slot' (delta is 1) or removed from it (delta is -1). */
+static void dbUpdateKeyCount(siderDb *db, int slot, dbKeyType keyType, long delta) {
+    dbDictState *state = &db->sub_dict[keyType];
+    unsigned long size = dictSize(dbGetDict(db, slot, keyType));
+
+    state->key_count += delta;
+    if (delta > 0 && size == 1) state->non_empty_dicts++;
+    if (delta < 0 && size == 0) state->non_empty_dicts--;
+    if (db->dict_count == 1) return;
+
+    /* Update the binary indexed tree, where the slot 's' is stored at the
+     * index s+1. */
+    for (int idx = slot + 1; idx <= CLUSTER_SLOTS; idx += idx & -idx)
+        state->slot_size_index[idx] += delta;
+}
+
+/* Returns the number of keys in the slots 0 to 'slot' included. */
+static unsigned long long dbCumulativeKeyCount(siderDb *db, int slot, dbKeyType keyType) {
+    unsigned long long *tree = db->sub_dict[keyType].slot_size_index;
+    unsigned long long sum = 0;
+
+    for (int idx = slot + 1; idx > 0; idx -= idx & -idx)
+        sum += tree[idx];
+    return sum;
+}
+
+/* Returns the slot holding the target-th key (starting from 1) of the DB,
+ * counting the keys slot by slot. */
+static int dbFindSlotByKeyIndex(siderDb *db, unsigned long long target, dbKeyType keyType) {
+    unsigned long long *tree = db->sub_dict[keyType].slot_size_index;
+    int result = 0;
+
+    serverAssert(target > 0 && target <= dbSize(db, keyType));
+    for (int step = CLUSTER_SLOTS; step != 0; step >>= 1) {
+        int idx = result + step;
+        if (idx <= CLUSTER_SLOTS && target > tree[idx]) {
+            target -= tree[idx];
+            result = idx;
+        }
+    }
+    /* The index 'result' is the last one with fewer keys than the target,
+     * the slot at the next index, that is the slot 'result', holds it. */
+    return result;
+}
+
+/* Returns a random slot of the DB, each slot being picked with a probability
+ * proportional to its number of keys, so that sampling the keys of the
+ * returned slot is fair across the keyspace. */
+int getFairRandomSlot(siderDb *db, dbKeyType keyType) {
+    unsigned long long count = dbSize(db, keyType);
+    if (db->dict_count == 1 || count == 0) return 0;
+    return dbFindSlotByKeyIndex(db, randomULong() % count + 1, keyType);
+}
+
+/* Returns the first slot after 'slot' holding keys, or -1 if none does. */
+int dbGetNextNonEmptySlot(siderDb *db, int slot, dbKeyType keyType) {
+    if (db->dict_count == 1) return -1;
+    unsigned long long next_key = dbCumulativeKeyCount(db, slot, keyType) + 1;
+    if (next_key > dbSize(db, keyType)) return -1;
+    return dbFindSlotByKeyIndex(db, next_key, keyType);
+}
+
+/* Like dictScanDefrag(), for the keyspace dicts of one kind. In cluster mode
+ * the lower CLUSTER_SLOT_MASK_BITS bits of the cursor are the slot being
+ * scanned and the other bits the cursor in its dict: the empty slots are
+ * skipped. */
+unsigned long long dbScanDefrag(siderDb *db, dbKeyType keyType, unsigned long long cursor,
+                                dictScanFunction *scan_cb, dictDefragFunctions *defragfns,
+                                void *privdata)
+{
+    if (db->dict_count == 1)
+        return dictScanDefrag(dbGetDict(db, 0, keyType), cursor, scan_cb, defragfns, privdata);
+
+    int slot = cursor & CLUSTER_SLOT_MASK;
+    cursor >>= CLUSTER_SLOT_MASK_BITS;
+    cursor = dictScanDefrag(dbGetDict(db, slot, keyType), cursor, scan_cb, defragfns, privdata);
+    if (cursor == 0) {
+        slot = dbGetNextNonEmptySlot(db, slot, keyType);
+        if (slot == -1) return 0;
+    }
+    return (cursor << CLUSTER_SLOT_MASK_BITS) | slot;
+}
+
+/* Like dictScan(), for the keyspace dicts of one kind, see dbScanDefrag(). */
+unsigned long long dbScan(siderDb *db, dbKeyType keyType, unsigned long long cursor,
+                          dictScanFunction *scan_cb, void *privdata)
+{
+    return dbScanDefrag(db, keyType, cursor, scan_cb, NULL, privdata);
+}
+
+/* Expands the keyspace dicts of one kind for 'db_size' keys, which is only
+ * possible in a single dict: in cluster mode it's up to the dict of every
+ * slot to grow as keys are added. Returns C_ERR if the allocation of the
+ * table failed (with try_expand) or if the expansion would exceed the
+ * maxmemory limit. */
+int dbExpand(siderDb *db, uint64_t db_size, dbKeyType keyType, int try_expand) {
+    if (db->dict_count > 1) return C_OK;
+    dict *d = dbGetDict(db, 0, keyType);
+    if (try_expand) {
+        if (dictTryExpand(d, db_size) != DICT_OK) return C_ERR;
+    } else {
+        dictExpand(d, db_size);
+    }
+    return C_OK;
+}
+
+/* Creates the keyspace dicts of a DB. */
+void dbInitDicts(siderDb *db) {
+    db->dict_count = server.cluster_enabled ? CLUSTER_SLOTS : 1;
+    db->dict = zmalloc(sizeof(dict*) * db->dict_count);
+    db->expires = zmalloc(sizeof(dict*) * db->dict_count);
+    db->slru = server.slru_links ? zcalloc(sizeof(dbSlru)) : NULL;
+    for (int slot = 0; slot < db->dict_count; slot++) {
+        db->dict[slot] = dictCreate(&dbDictType);
+        db->expires[slot] = dictCreate(&dbExpiresDictType);
+        ((dbDictMetadata *)dictMetadata(db->dict[slot]))->slru = db->slru;
+    }
+    db->expires_index = server.active_expire_index ? raxNew() : NULL;
+    for (dbKeyType keyType = DB_MAIN; keyType <= DB_EXPIRES; keyType++) {
+        dbDictState *state = &db->sub_dict[keyType];
+        memset(state, 0, sizeof(*state));
+        if (db->dict_count > 1)
+            state->slot_size_index = zcalloc(sizeof(unsigned long long) * (CLUSTER_SLOTS + 1));
+    }
+}
+
+/* Releases the keyspace dicts of a DB, and their keys. */
+void dbReleaseDicts(siderDb *db) {
+    for (int slot = 0; slot < db->dict_count; slot++) {
+        dictRelease(db->dict[slot]);
+        dictRelease(db->expires[slot]);
+    }
+    zfree(db->dict);
+    zfree(db->expires);
+    if (db->expires_index) raxFree(db->expires_index);
+    zfree(db->slru);
+    for (dbKeyType keyType = DB_MAIN; keyType <= DB_EXPIRES; keyType++)
+        zfree(db->sub_dict[keyType].slot_size_index);
+    db->dict = db->expires = NULL;
+    db->expires_index = NULL;
+    db->slru = NULL;
+}
+
+/* Resets the stats of the keyspace dicts once they were emptied. */
+void dbResetDictState(siderDb *db) {
+    for (dbKeyType keyType = DB_MAIN; keyType <= DB_EXPIRES; keyType++) {
+        dbDictState *state = &db->sub_dict[keyType];
+        state->key_count = 0;
+        state->non_empty_dicts = 0;
+        if (state->slot_size_index)
+            memset(state->slot_size_index, 0, sizeof(unsigned long long) * (CLUSTER_SLOTS + 1));
+    }
+}
+
+/* Removes the keyspace dicts of a DB from server.rehashing, before they are
+ * released by another thread. */
+void dbUnlinkRehashingDicts(siderDb *db) {
+    if (listLength(server.rehashing) == 0) return;
+    for (int slot = 0; slot < db->dict_count; slot++) {
+        dbDictRehashingCompleted(db->dict[slot]);
+        dbDictRehashingCompleted(db->expires[slot]);
+    }
+}
+
+/* Initializes an iterator over the keys of the dicts of one kind of a DB. It
+ * is a safe iterator (see dictGetSafeIterator()), that must be released with
+ * dbResetIterator(). */
+void dbInitIterator(dbIterator *dbit, siderDb *db, dbKeyType keyType) {
+    dbit->db = db;
+    dbit->keyType = keyType;
+    dbit->slot = 0;
+    dictInitSafeIterator(&dbit->di, dbGetDict(db, 0, keyType));
+}
+
+dictEntry *dbIteratorNext(dbIterator *dbit) {
+    dictEntry *de;
+    while ((de = dictNext(&dbit->di)) == NULL) {
+        int slot = dbGetNextNonEmptySlot(dbit->db, dbit->slot, dbit->keyType);
+        if (slot == -1) return NULL;
+        dictResetIterator(&dbit->di);
+        dbit->slot = slot;
+        dictInitSafeIterator(&dbit->di, dbGetDict(dbit->db, slot, dbit->keyType));
+    }
+    return de;
+}
+
+/* Returns the dict of the last key returned by the iterator. */
+dict *dbIteratorDict(dbIterator *dbit) {
+    return dbit->di.d;
+}
+
+void dbResetIterator(dbIterator *dbit) {
+    dictResetIterator(&dbit->di);
+}
+
 /*-----------------------------------------------------------------------------
  * C-level DB API
  *----------------------------------------------------------------------------*/
@@ -86,7 +316,19 @@ void updateLFU(robj *val) {
  * expired on replicas even if the master is lagging expiring our key via DELs
  * in the replication link. */
 robj *lookupKey(siderDb *db, robj *key, int flags) {
-    dictEntry *de = dictFind(db->dict,key->ptr);
+    /* Commands executed by I/O threads can't modify the global state: they
+     * never find expired keys and the stats are accounted by the caller, see
+     * ioThreadTryExecuteCommand(). */
+    if (io_threads_op != IO_THREADS_OP_IDLE) {
+        flags |= LOOKUP_NONOTIFY | LOOKUP_NOSTATS | LOOKUP_NOEXPIRE;
+    } else if (server.rdb_forkless_tracking) {
+        if (flags & LOOKUP_WRITE)
+            rdbForklessKeyWrite(db,key->ptr);
+        else
+            rdbForklessKeyRead(db,key->ptr);
+    }
+
+    dictEntry *de = dbFind(db,key->ptr);
     robj *val = NULL;
     if (de) {
         val = dictGetVal(de);
@@ -118,10 +360,17 @@ robj *lookupKey(siderDb *db, robj *key, int flags) {
             server.current_client->cmd->proc != touchCommand)
             flags |= LOOKUP_NOTOUCH;
         if (!hasActiveChildProcess() && !(flags & LOOKUP_NOTOUCH)){
-            if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU) {
-                updateLFU(val);
+            if (io_threads_op != IO_THREADS_OP_IDLE) {
+                /* The access time is updated by the main thread, which is
+                 * also the only one updating the SLRU lists. */
+                ioThreadTouchValue(val);
             } else {
-                val->lru = LRU_CLOCK();
+                if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU) {
+                    updateLFU(val);
+                } else {
+                    val->lru = LRU_CLOCK();
+                }
+                if (db->slru) slruTouchEntry(db,de);
             }
         }
 
@@ -192,17 +441,23 @@ robj *lookupKeyWriteOrReply(client *c, robj *key, robj *reply) {
  * if the key already exists, otherwise, it can fall back to dbOverwite. */
 static void dbAddInternal(siderDb *db, robj *key, robj *val, int update_if_existing) {
     dictEntry *existing;
-    dictEntry *de = dictAddRaw(db->dict, key->ptr, &existing);
+    if (server.rdb_forkless_tracking) rdbForklessKeyWrite(db,key->ptr);
+    if (server.loading_on_demand)
+        update_if_existing ? rdbOnDemandLoadKey(db,key->ptr) : rdbOnDemandDiscardKey(db,key->ptr);
+    int slot = getKeySlot(key->ptr);
+    dict *d = db->dict[slot];
+    dictEntry *de = dictAddRaw(d, key->ptr, &existing);
     if (update_if_existing && existing) {
         dbSetValue(db, key, val, 1, existing);
         return;
     }
     serverAssertWithInfo(NULL, key, de != NULL);
-    dictSetKey(db->dict, de, sdsdup(key->ptr));
+    dictSetKey(d, de, sdsdup(key->ptr));
     initObjectLRUOrLFU(val);
-    dictSetVal(db->dict, de, val);
+    dictSetVal(d, de, val);
+    slruAddEntry(db, de);
+    dbUpdateKeyCount(db, slot, DB_MAIN, 1);
     signalKeyAsReady(db, key, val->type);
-    if (server.cluster_enabled) slotToKeyAddEntry(de, db);
     notifyKeyspaceEvent(NOTIFY_NEW,"new",key,db->id);
 }
 
@@ -222,11 +477,14 @@ void dbAdd(siderDb *db, robj *key, robj *val) {
  * ownership of the SDS string, otherwise 0 is returned, and is up to the
  * caller to free the SDS string. */
 int dbAddRDBLoad(siderDb *db, sds key, robj *val) {
-    dictEntry *de = dictAddRaw(db->dict, key, NULL);
+    int slot = getKeySlot(key);
+    dict *d = db->dict[slot];
+    dictEntry *de = dictAddRaw(d, key, NULL);
     if (de == NULL) return 0;
     initObjectLRUOrLFU(val);
-    dictSetVal(db->dict, de, val);
-    if (server.cluster_enabled) slotToKeyAddEntry(de, db);
+    dictSetVal(d, de, val);
+    slruAddEntry(db, de);
+    dbUpdateKeyCount(db, slot, DB_MAIN, 1);
     return 1;
 }
 
@@ -243,13 +501,19 @@ int dbAddRDBLoad(siderDb *db, sds key, robj *val) {
  *
  * The program is aborted if the key was not already present. */
 static void dbSetValue(siderDb *db, robj *key, robj *val, int overwrite, dictEntry *de) {
-    if (!de) de = dictFind(db->dict,key->ptr);
+    if (server.rdb_forkless_tracking) rdbForklessKeyWrite(db,key->ptr);
+    dict *d = db->dict[getKeySlot(key->ptr)];
+    if (!de) de = dictFind(d,key->ptr);
     serverAssertWithInfo(NULL,key,de != NULL);
     robj *old = dictGetVal(de);
 
     val->lru = old->lru;
 
     if (overwrite) {
+        /* The entry must stay where it is while the module callbacks run,
+         * they may access the keyspace: the entries of open addressing
+         * tables move when rehashed. */
+        dictPauseRehashing(d);
         /* RM_StringDMA may call dbUnshareStringValue which may free val, so we
          * need to incr to retain old */
         incrRefCount(old);
@@ -262,14 +526,17 @@ static void dbSetValue(siderDb *db, robj *key, robj *val, int overwrite, dictEnt
         decrRefCount(old);
         /* Because of RM_StringDMA, old may be changed, so we need get old again */
         old = dictGetVal(de);
+        dictResumeRehashing(d);
     }
-    dictSetVal(db->dict, de, val);
+    dictSetVal(d, de, val);
 
     if (server.lazyfree_lazy_server_del) {
         freeObjAsync(key,old,db->id);
+    } else if (server.lazyfree_incremental) {
+        freeObjIncremental(key,old,db->id);
     } else {
         /* This is just decrRefCount(old); */
-        db->dict->type->valDestructor(db->dict, old);
+        d->type->valDestructor(d, old);
     }
 }
 
@@ -321,18 +588,19 @@ void setKey(client *c, siderDb *db, robj *key, robj *val, int flags) {
 robj *dbRandomKey(siderDb *db) {
     dictEntry *de;
     int maxtries = 100;
-    int allvolatile = dictSize(db->dict) == dictSize(db->expires);
+    int allvolatile = dbSize(db, DB_MAIN) == dbSize(db, DB_EXPIRES);
 
     while(1) {
         sds key;
         robj *keyobj;
+        int slot = getFairRandomSlot(db, DB_MAIN);
 
-        de = dictGetFairRandomKey(db->dict);
+        de = dictGetFairRandomKey(db->dict[slot]);
         if (de == NULL) return NULL;
 
         key = dictGetKey(de);
         keyobj = createStringObject(key,sdslen(key));
-        if (dictFind(db->expires,key)) {
+        if (dictFind(db->expires[slot],key)) {
             if (allvolatile && server.masterhost && --maxtries == 0) {
                 /* If the DB is composed only of keys with an expire set,
                  * it could happen that all the keys are already logically
@@ -357,7 +625,11 @@ robj *dbRandomKey(siderDb *db) {
 int dbGenericDelete(siderDb *db, robj *key, int async, int flags) {
     dictEntry **plink;
     int table;
-    dictEntry *de = dictTwoPhaseUnlinkFind(db->dict,key->ptr,&plink,&table);
+    if (server.rdb_forkless_tracking) rdbForklessKeyWrite(db,key->ptr);
+    if (server.loading_on_demand) rdbOnDemandLoadKey(db,key->ptr);
+    int slot = getKeySlot(key->ptr);
+    dict *d = db->dict[slot];
+    dictEntry *de = dictTwoPhaseUnlinkFind(d,key->ptr,&plink,&table);
     if (de) {
         robj *val = dictGetVal(de);
         /* RM_StringDMA may call dbUnshareStringValue which may free val, so we
@@ -373,14 +645,26 @@ int dbGenericDelete(siderDb *db, robj *key, int async, int flags) {
         if (async) {
             /* Because of dbUnshareStringValue, the val in de may change. */
             freeObjAsync(key, dictGetVal(de), db->id);
-            dictSetVal(db->dict, de, NULL);
+            dictSetVal(d, de, NULL);
+        } else if (server.lazyfree_incremental && !(flags & DB_FLAG_KEY_EVICTED)) {
+            /* The evictions need the memory back right away. */
+            freeObjIncremental(key, dictGetVal(de), db->id);
+            dictSetVal(d, de, NULL);
         }
-        if (server.cluster_enabled) slotToKeyDelEntry(de, db);
 
         /* Deleting an entry from the expires dict will not free the sds of
         * the key, because it is shared with the main dictionary. */
-        if (dictSize(db->expires) > 0) dictDelete(db->expires,key->ptr);
-        dictTwoPhaseUnlinkFree(db->dict,de,plink,table);
+        if (dictSize(db->expires[slot]) > 0) {
+            dictEntry *ede;
+            if (db->expires_index &&
+                (ede = dictFind(db->expires[slot],key->ptr)) != NULL)
+                expireIndexRemove(db,key->ptr,dictGetSignedIntegerVal(ede));
+            if (dictDelete(db->expires[slot],key->ptr) == DICT_OK)
+                dbUpdateKeyCount(db, slot, DB_EXPIRES, -1);
+        }
+        slruDelEntry(db,de);
+        dictTwoPhaseUnlinkFree(d,de,plink,table);
+        dbUpdateKeyCount(db, slot, DB_MAIN, -1);
         return 1;
     } else {
         return 0;
@@ -462,12 +746,21 @@ long long emptyDbStructure(siderDb *dbarray, int dbnum, int async,
     }
 
     for (int j = startdb; j <= enddb; j++) {
-        removed += dictSize(dbarray[j].dict);
+        removed += dbSize(&dbarray[j], DB_MAIN);
         if (async) {
             emptyDbAsync(&dbarray[j]);
         } else {
-            dictEmpty(dbarray[j].dict,callback);
-            dictEmpty(dbarray[j].expires,callback);
+            for (int slot = 0; slot < dbarray[j].dict_count; slot++) {
+                dictEmpty(dbarray[j].dict[slot],callback);
+                dictEmpty(dbarray[j].expires[slot],callback);
+            }
+            if (dbarray[j].slru)
+                memset(dbarray[j].slru, 0, sizeof(dbSlru));
+            if (dbarray[j].expires_index) {
+                raxFree(dbarray[j].expires_index);
+                dbarray[j].expires_index = raxNew();
+            }
+            dbResetDictState(&dbarray[j]);
         }
         /* Because all keys of database are removed, reset average ttl. */
         dbarray[j].avg_ttl = 0;
@@ -503,6 +796,9 @@ long long emptyData(int dbnum, int flags, void(callback)(dict*)) {
         return -1;
     }
 
+    /* A fork-less snapshot doesn't see the keys removed by a flush. */
+    if (rdbForklessSaveInProgress()) killRDBChild();
+
     /* Fire the flushdb modules event. */
     moduleFireServerEvent(REDISMODULE_EVENT_FLUSHDB,
                           REDISMODULE_SUBEVENT_FLUSHDB_START,
@@ -513,14 +809,12 @@ long long emptyData(int dbnum, int flags, void(callback)(dict*)) {
      * there. */
     signalFlushedDb(dbnum, async);
 
+    /* The keys not loaded yet are flushed too. */
+    if (server.loading_on_demand) rdbOnDemandDiscard(dbnum);
+
     /* Empty sider database structure. */
     removed = emptyDbStructure(server.db, dbnum, async, callback);
 
-    /* Flush slots to keys map if enable cluster, we can flush entire
-     * slots to keys map whatever dbnum because only support one DB
-     * in cluster mode. */
-    if (server.cluster_enabled) slotToKeyFlush(server.db);
-
     if (dbnum == -1) flushSlaveKeysWithExpireList();
 
     if (with_functions) {
@@ -541,14 +835,7 @@ long long emptyData(int dbnum, int flags, void(callback)(dict*)) {
 siderDb *initTempDb(void) {
     siderDb *tempDb = zcalloc(sizeof(siderDb)*server.dbnum);
     for (int i=0; i<server.dbnum; i++) {
-        tempDb[i].dict = dictCreate(&dbDictType);
-        tempDb[i].expires = dictCreate(&dbExpiresDictType);
-        tempDb[i].slots_to_keys = NULL;
-    }
-
-    if (server.cluster_enabled) {
-        /* Prepare temp slot to key map to be written during async diskless replication. */
-        slotToKeyInit(tempDb);
+        dbInitDicts(&tempDb[i]);
     }
 
     return tempDb;
@@ -561,13 +848,7 @@ void discardTempDb(siderDb *tempDb, void(callback)(dict*)) {
     /* Release temp DBs. */
     emptyDbStructure(tempDb, -1, async, callback);
     for (int i=0; i<server.dbnum; i++) {
-        dictRelease(tempDb[i].dict);
-        dictRelease(tempDb[i].expires);
-    }
-
-    if (server.cluster_enabled) {
-        /* Release temp slot to key map. */
-        slotToKeyDestroy(tempDb);
+        dbReleaseDicts(&tempDb[i]);
     }
 
     zfree(tempDb);
@@ -584,7 +865,7 @@ long long dbTotalServerKeyCount(void) {
     long long total = 0;
     int j;
     for (j = 0; j < server.dbnum; j++) {
-        total += dictSize(server.db[j].dict);
+        total += dbSize(&server.db[j], DB_MAIN);
     }
     return total;
 }
@@ -783,17 +1064,17 @@ void randomkeyCommand(client *c) {
 }
 
 void keysCommand(client *c) {
-    dictIterator *di;
+    dbIterator dbit;
     dictEntry *de;
     sds pattern = c->argv[1]->ptr;
     int plen = sdslen(pattern), allkeys;
     unsigned long numkeys = 0;
     void *replylen = addReplyDeferredLen(c);
 
-    di = dictGetSafeIterator(c->db->dict);
+    dbInitIterator(&dbit, c->db, DB_MAIN);
     allkeys = (pattern[0] == '*' && plen == 1);
     robj keyobj;
-    while((de = dictNext(di)) != NULL) {
+    while((de = dbIteratorNext(&dbit)) != NULL) {
         sds key = dictGetKey(de);
 
         if (allkeys || stringmatchlen(pattern,plen,key,sdslen(key),0)) {
@@ -806,7 +1087,7 @@ void keysCommand(client *c) {
         if (c->flags & CLIENT_CLOSE_ASAP)
             break;
     }
-    dictReleaseIterator(di);
+    dbResetIterator(&dbit);
     setDeferredArrayLen(c,replylen,numkeys);
 }
 
@@ -1022,7 +1303,7 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
     /* Handle the case of a hash table. */
     ht = NULL;
     if (o == NULL) {
-        ht = c->db->dict;
+        /* The keyspace, see dbScan(). */
     } else if (o->type == OBJ_SET && o->encoding == OBJ_ENCODING_HT) {
         ht = o->ptr;
     } else if (o->type == OBJ_HASH && o->encoding == OBJ_ENCODING_HT) {
@@ -1045,7 +1326,7 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
         listSetFreeMethod(keys, (void (*)(void*))sdsfree);
     }
 
-    if (ht) {
+    if (o == NULL || ht) {
         /* We set the max number of iterations to ten times the specified
          * COUNT, so if the hash table is in a pathological state (very
          * sparsely populated) we avoid to block too much time at the cost
@@ -1071,7 +1352,10 @@ void scanGenericCommand(client *c, robj *o, unsigned long cursor) {
             .sampled = 0,
         };
         do {
-            cursor = dictScan(ht, cursor, scanCallback, &data);
+            if (o == NULL)
+                cursor = dbScan(c->db, DB_MAIN, cursor, scanCallback, &data);
+            else
+                cursor = dictScan(ht, cursor, scanCallback, &data);
         } while (cursor && maxiterations-- && data.sampled < count);
     } else if (o->type == OBJ_SET) {
         char *str;
@@ -1166,7 +1450,7 @@ void scanCommand(client *c) {
 }
 
 void dbsizeCommand(client *c) {
-    addReplyLongLong(c,dictSize(c->db->dict));
+    addReplyLongLong(c,dbSize(c->db, DB_MAIN));
 }
 
 void lastsaveCommand(client *c) {
@@ -1463,7 +1747,7 @@ void scanDatabaseForReadyKeys(siderDb *db) {
     dictIterator *di = dictGetSafeIterator(db->blocking_keys);
     while((de = dictNext(di)) != NULL) {
         robj *key = dictGetKey(de);
-        dictEntry *kde = dictFind(db->dict,key->ptr);
+        dictEntry *kde = dbFind(db,key->ptr);
         if (kde) {
             robj *value = dictGetVal(kde);
             signalKeyAsReady(db, key, value->type);
@@ -1483,7 +1767,7 @@ void scanDatabaseForDeletedKeys(siderDb *emptied, siderDb *replaced_with) {
         int existed = 0, exists = 0;
         int original_type = -1, curr_type = -1;
 
-        dictEntry *kde = dictFind(emptied->dict, key->ptr);
+        dictEntry *kde = dbFind(emptied, key->ptr);
         if (kde) {
             robj *value = dictGetVal(kde);
             original_type = value->type;
@@ -1491,7 +1775,7 @@ void scanDatabaseForDeletedKeys(siderDb *emptied, siderDb *replaced_with) {
         }
 
         if (replaced_with) {
-            dictEntry *kde = dictFind(replaced_with->dict, key->ptr);
+            dictEntry *kde = dbFind(replaced_with, key->ptr);
             if (kde) {
                 robj *value = dictGetVal(kde);
                 curr_type = value->type;
@@ -1517,6 +1801,8 @@ int dbSwapDatabases(int id1, int id2) {
     if (id1 < 0 || id1 >= server.dbnum ||
         id2 < 0 || id2 >= server.dbnum) return C_ERR;
     if (id1 == id2) return C_OK;
+    if (rdbForklessSaveInProgress()) killRDBChild();
+    if (server.loading_on_demand) rdbOnDemandLoadAll();
     siderDb aux = server.db[id1];
     siderDb *db1 = &server.db[id1], *db2 = &server.db[id2];
 
@@ -1534,13 +1820,21 @@ int dbSwapDatabases(int id1, int id2) {
      * remain in the same DB they were. */
     db1->dict = db2->dict;
     db1->expires = db2->expires;
+    db1->expires_index = db2->expires_index;
+    db1->slru = db2->slru;
+    db1->dict_count = db2->dict_count;
     db1->avg_ttl = db2->avg_ttl;
     db1->expires_cursor = db2->expires_cursor;
+    memcpy(db1->sub_dict, db2->sub_dict, sizeof(db1->sub_dict));
 
     db2->dict = aux.dict;
     db2->expires = aux.expires;
+    db2->expires_index = aux.expires_index;
+    db2->slru = aux.slru;
+    db2->dict_count = aux.dict_count;
     db2->avg_ttl = aux.avg_ttl;
     db2->expires_cursor = aux.expires_cursor;
+    memcpy(db2->sub_dict, aux.sub_dict, sizeof(db2->sub_dict));
 
     /* Now we need to handle clients blocked on lists: as an effect
      * of swapping the two DBs, a client that was waiting for list
@@ -1560,13 +1854,8 @@ int dbSwapDatabases(int id1, int id2) {
  * database (temp) as the main (active) database, the actual freeing of old database
  * (which will now be placed in the temp one) is done later. */
 void swapMainDbWithTempDb(siderDb *tempDb) {
-    if (server.cluster_enabled) {
-        /* Swap slots_to_keys from tempdb just loaded with main db slots_to_keys. */
-        clusterSlotToKeyMapping *aux = server.db->slots_to_keys;
-        server.db->slots_to_keys = tempDb->slots_to_keys;
-        tempDb->slots_to_keys = aux;
-    }
-
+    if (rdbForklessSaveInProgress()) killRDBChild();
+    if (server.loading_on_demand) rdbOnDemandDiscard(-1);
     for (int i=0; i<server.dbnum; i++) {
         siderDb aux = server.db[i];
         siderDb *activedb = &server.db[i], *newdb = &tempDb[i];
@@ -1583,13 +1872,24 @@ void swapMainDbWithTempDb(siderDb *tempDb) {
          * remain in the same DB they were. */
         activedb->dict = newdb->dict;
         activedb->expires = newdb->expires;
+        activedb->expires_index = newdb->expires_index;
+        activedb->slru = newdb->slru;
+        activedb->dict_count = newdb->dict_count;
         activedb->avg_ttl = newdb->avg_ttl;
         activedb->expires_cursor = newdb->expires_cursor;
+        memcpy(activedb->sub_dict, newdb->sub_dict, sizeof(activedb->sub_dict));
 
         newdb->dict = aux.dict;
         newdb->expires = aux.expires;
+        newdb->expires_index = aux.expires_index;
+        newdb->slru = aux.slru;
+        newdb->dict_count = aux.dict_count;
         newdb->avg_ttl = aux.avg_ttl;
         newdb->expires_cursor = aux.expires_cursor;
+        memcpy(newdb->sub_dict, aux.sub_dict, sizeof(newdb->sub_dict));
+
+        /* The config may have changed while the temp db was loaded. */
+        expireIndexUpdate(activedb);
 
         /* Now we need to handle clients blocked on lists: as an effect
          * of swapping the two DBs, a client that was waiting for list
@@ -1643,7 +1943,16 @@ void swapdbCommand(client *c) {
  *----------------------------------------------------------------------------*/
 
 int removeExpire(siderDb *db, robj *key) {
-    return dictDelete(db->expires,key->ptr) == DICT_OK;
+    if (server.rdb_forkless_tracking) rdbForklessKeyWrite(db,key->ptr);
+    int slot = getKeySlot(key->ptr);
+    if (db->expires_index) {
+        dictEntry *de = dictFind(db->expires[slot],key->ptr);
+        if (!de) return 0;
+        expireIndexRemove(db,key->ptr,dictGetSignedIntegerVal(de));
+    }
+    if (dictDelete(db->expires[slot],key->ptr) != DICT_OK) return 0;
+    dbUpdateKeyCount(db, slot, DB_EXPIRES, -1);
+    return 1;
 }
 
 /* Set an expire to the specified key. If the expire is set in the context
@@ -1651,13 +1960,22 @@ int removeExpire(siderDb *db, robj *key) {
  * to NULL. The 'when' parameter is the absolute unix time in milliseconds
  * after which the key will no longer be considered valid. */
 void setExpire(client *c, siderDb *db, robj *key, long long when) {
-    dictEntry *kde, *de;
+    dictEntry *kde, *de, *existing;
+    if (server.rdb_forkless_tracking) rdbForklessKeyWrite(db,key->ptr);
+    int slot = getKeySlot(key->ptr);
 
     /* Reuse the sds from the main dict in the expire dict */
-    kde = dictFind(db->dict,key->ptr);
+    kde = dictFind(db->dict[slot],key->ptr);
     serverAssertWithInfo(NULL,key,kde != NULL);
-    de = dictAddOrFind(db->expires,dictGetKey(kde));
+    de = dictAddRaw(db->expires[slot],dictGetKey(kde),&existing);
+    if (existing) {
+        de = existing;
+        expireIndexRemove(db,dictGetKey(kde),dictGetSignedIntegerVal(de));
+    } else {
+        dbUpdateKeyCount(db, slot, DB_EXPIRES, 1);
+    }
     dictSetSignedIntegerVal(de,when);
+    expireIndexInsert(db,dictGetKey(kde),when);
 
     int writable_slave = server.masterhost && server.repl_slave_ro == 0;
     if (c && writable_slave && !(c->flags & CLIENT_MASTER))
@@ -1670,8 +1988,8 @@ long long getExpire(siderDb *db, robj *key) {
     dictEntry *de;
 
     /* No expire? return ASAP */
-    if (dictSize(db->expires) == 0 ||
-       (de = dictFind(db->expires,key->ptr)) == NULL) return -1;
+    if (dbSize(db, DB_EXPIRES) == 0 ||
+       (de = dbFindExpires(db,key->ptr)) == NULL) return -1;
 
     return dictGetSignedIntegerVal(de);
 }
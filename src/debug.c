@@ -276,7 +276,7 @@ void xorObjectDigest(siderDb *db, robj *keyobj, unsigned char *digest, robj *o)
  * a different digest. */
 void computeDatasetDigest(unsigned char *final) {
     unsigned char digest[20];
-    dictIterator *di = NULL;
+    dbIterator dbit;
     dictEntry *de;
     int j;
     uint32_t aux;
@@ -286,8 +286,8 @@ void computeDatasetDigest(unsigned char *final) {
     for (j = 0; j < server.dbnum; j++) {
         siderDb *db = server.db+j;
 
-        if (dictSize(db->dict) == 0) continue;
-        di = dictGetSafeIterator(db->dict);
+        if (dbSize(db, DB_MAIN) == 0) continue;
+        dbInitIterator(&dbit, db, DB_MAIN);
 
         /* hash the DB id, so the same dataset moved in a different
          * DB will lead to a different digest */
@@ -295,7 +295,7 @@ void computeDatasetDigest(unsigned char *final) {
         mixDigest(final,&aux,sizeof(aux));
 
         /* Iterate this DB writing every entry */
-        while((de = dictNext(di)) != NULL) {
+        while((de = dbIteratorNext(&dbit)) != NULL) {
             sds key;
             robj *keyobj, *o;
 
@@ -312,10 +312,35 @@ void computeDatasetDigest(unsigned char *final) {
             xorDigest(final,digest,20);
             decrRefCount(keyobj);
         }
-        dictReleaseIterator(di);
+        dbResetIterator(&dbit);
     }
 }
 
+/* Appends the stats of the keyspace dicts of one kind to 'stats', for DEBUG
+ * HTSTATS. In cluster mode the dicts of all the slots are summed up. */
+static sds catDbDictStats(sds stats, siderDb *db, dbKeyType keyType, int full) {
+    if (db->dict_count == 1) {
+        char buf[4096];
+        dictGetStats(buf,sizeof(buf),dbGetDict(db,0,keyType),full);
+        return sdscat(stats,buf);
+    }
+
+    unsigned long buckets = 0, rehashing = 0;
+    for (int slot = 0; slot < db->dict_count; slot++) {
+        dict *d = dbGetDict(db,slot,keyType);
+        buckets += dictBuckets(d);
+        if (dictIsRehashing(d)) rehashing++;
+    }
+    return sdscatprintf(stats,
+        "Slot dicts stats:\n"
+        " dicts with keys: %d\n"
+        " number of elements: %llu\n"
+        " table size: %lu\n"
+        " rehashing dicts: %lu\n",
+        db->sub_dict[keyType].non_empty_dicts, dbSize(db,keyType),
+        buckets, rehashing);
+}
+
 #ifdef USE_JEMALLOC
 void mallctl_int(client *c, robj **argv, int argc) {
     int ret;
@@ -570,7 +595,8 @@ NULL
         if (flush) emptyData(-1,EMPTYDB_NO_FLAGS,NULL);
 
         protectClient(c);
-        int ret = rdbLoad(server.rdb_filename,NULL,flags);
+        int ret = rdbLoadParts(server.rdb_filename,NULL,flags);
+        if (ret == RDB_NOT_EXIST) ret = rdbLoad(server.rdb_filename,NULL,flags);
         unprotectClient(c);
         if (ret != RDB_OK) {
             addReplyError(c,"Error trying to load the RDB dump, check server logs.");
@@ -605,7 +631,7 @@ NULL
         robj *val;
         char *strenc;
 
-        if ((de = dictFind(c->db->dict,c->argv[2]->ptr)) == NULL) {
+        if ((de = dbFind(c->db,c->argv[2]->ptr)) == NULL) {
             addReplyErrorObject(c,shared.nokeyerr);
             return;
         }
@@ -657,7 +683,7 @@ NULL
         robj *val;
         sds key;
 
-        if ((de = dictFind(c->db->dict,c->argv[2]->ptr)) == NULL) {
+        if ((de = dbFind(c->db,c->argv[2]->ptr)) == NULL) {
             addReplyErrorObject(c,shared.nokeyerr);
             return;
         }
@@ -713,7 +739,7 @@ NULL
         if (getPositiveLongFromObjectOrReply(c, c->argv[2], &keys, NULL) != C_OK)
             return;
 
-        if (dictTryExpand(c->db->dict, keys) != DICT_OK) {
+        if (dbExpand(c->db, keys, DB_MAIN, 1) != C_OK) {
             addReplyError(c, "OOM in dictTryExpand");
             return;
         }
@@ -761,7 +787,7 @@ NULL
             /* We don't use lookupKey because a debug command should
              * work on logically expired keys */
             dictEntry *de;
-            robj *o = ((de = dictFind(c->db->dict,c->argv[j]->ptr)) == NULL) ? NULL : dictGetVal(de);
+            robj *o = ((de = dbFind(c->db,c->argv[j]->ptr)) == NULL) ? NULL : dictGetVal(de);
             if (o) xorObjectDigest(c->db,c->argv[j],digest,o);
 
             sds d = sdsempty();
@@ -889,7 +915,6 @@ NULL
     } else if (!strcasecmp(c->argv[1]->ptr,"htstats") && c->argc >= 3) {
         long dbid;
         sds stats = sdsempty();
-        char buf[4096];
         int full = 0;
 
         if (getLongFromObjectOrReply(c, c->argv[2], &dbid, NULL) != C_OK) {
@@ -905,12 +930,10 @@ NULL
             full = 1;
 
         stats = sdscatprintf(stats,"[Dictionary HT]\n");
-        dictGetStats(buf,sizeof(buf),server.db[dbid].dict,full);
-        stats = sdscat(stats,buf);
+        stats = catDbDictStats(stats,server.db+dbid,DB_MAIN,full);
 
         stats = sdscatprintf(stats,"[Expires HT]\n");
-        dictGetStats(buf,sizeof(buf),server.db[dbid].expires,full);
-        stats = sdscat(stats,buf);
+        stats = catDbDictStats(stats,server.db+dbid,DB_EXPIRES,full);
 
         addReplyVerbatim(c,stats,sdslen(stats),"txt");
         sdsfree(stats);
@@ -1936,7 +1959,7 @@ void logCurrentClient(client *cc, const char *title) {
         dictEntry *de;
 
         key = getDecodedObject(cc->argv[1]);
-        de = dictFind(cc->db->dict, key->ptr);
+        de = dbFind(cc->db, key->ptr);
         if (de) {
             val = dictGetVal(de);
             serverLog(LL_WARNING,"key '%s' found in DB containing the following object:", (char*)key->ptr);
@@ -675,25 +675,27 @@ void defragKey(siderDb *db, dictEntry *de) {
     robj *newob, *ob;
     unsigned char *newzl;
     sds newsds;
+    int slot = getKeySlot(keysds);
+    dict *d = db->dict[slot], *expires = db->expires[slot];
 
     /* Try to defrag the key name. */
     newsds = activeDefragSds(keysds);
     if (newsds) {
-        dictSetKey(db->dict, de, newsds);
-        if (dictSize(db->expires)) {
+        dictSetKey(d, de, newsds);
+        if (dictSize(expires)) {
             /* We can't search in db->expires for that key after we've released
              * the pointer it holds, since it won't be able to do the string
              * compare, but we can find the entry using key hash and pointer. */
-            uint64_t hash = dictGetHash(db->dict, newsds);
-            dictEntry *expire_de = dictFindEntryByPtrAndHash(db->expires, keysds, hash);
-            if (expire_de) dictSetKey(db->expires, expire_de, newsds);
+            uint64_t hash = dictGetHash(d, newsds);
+            dictEntry *expire_de = dictFindEntryByPtrAndHash(expires, keysds, hash);
+            if (expire_de) dictSetKey(expires, expire_de, newsds);
         }
     }
 
     /* Try to defrag robj and / or string value. */
     ob = dictGetVal(de);
     if ((newob = activeDefragStringOb(ob))) {
-        dictSetVal(db->dict, de, newob);
+        dictSetVal(d, de, newob);
         ob = newob;
     }
 
@@ -851,7 +853,7 @@ int defragLaterStep(siderDb *db, long long endtime) {
         }
 
         /* each time we enter this function we need to fetch the key from the dict again (if it still exists) */
-        dictEntry *de = dictFind(db->dict, defrag_later_current_key);
+        dictEntry *de = dbFind(db, defrag_later_current_key);
         key_defragged = server.stat_active_defrag_hits;
         do {
             int quit = 0;
@@ -920,8 +922,8 @@ void computeDefragCycles(void) {
  * we do incremental work across calls. */
 void activeDefragCycle(void) {
     static int current_db = -1;
-    static unsigned long cursor = 0;
-    static unsigned long expires_cursor = 0;
+    static unsigned long long cursor = 0;
+    static unsigned long long expires_cursor = 0;
     static siderDb *db = NULL;
     static long long start_scan, start_stat;
     unsigned int iterations = 0;
@@ -1017,14 +1019,14 @@ void activeDefragCycle(void) {
 
             /* Scan the keyspace dict unless we're scanning the expire dict. */
             if (!expires_cursor)
-                cursor = dictScanDefrag(db->dict, cursor, defragScanCallback,
-                                        &defragfns, db);
+                cursor = dbScanDefrag(db, DB_MAIN, cursor, defragScanCallback,
+                                      &defragfns, db);
 
             /* When done scanning the keyspace dict, we scan the expire dict. */
             if (!cursor)
-                expires_cursor = dictScanDefrag(db->expires, expires_cursor,
-                                                scanCallbackCountScanned,
-                                                &defragfns, NULL);
+                expires_cursor = dbScanDefrag(db, DB_EXPIRES, expires_cursor,
+                                              scanCallbackCountScanned,
+                                              &defragfns, NULL);
 
             /* Once in 16 scan iterations, 512 pointer reallocations. or 64 keys
              * (if we have a lot of pointers in one hash bucket or rehashing),
@@ -37,6 +37,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdarg.h>
@@ -87,6 +88,9 @@ static int _dictInit(dict *d, dictType *type);
 static dictEntry *dictGetNext(const dictEntry *de);
 static dictEntry **dictGetNextRef(dictEntry *de);
 static void dictSetNext(dictEntry *de, dictEntry *next);
+static void _dictReset(dict *d, int htidx);
+static int _dictExpandToExp(dict *d, signed char new_ht_size_exp, int *malloc_failed);
+static int dictTypeExpandAllowed(dict *d);
 
 /* -------------------------- hash functions -------------------------------- */
 
@@ -171,6 +175,499 @@ static inline int entryHasValue(const dictEntry *de) {
     return entryIsNormal(de);
 }
 
+/* ----------------------- open addressing tables ---------------------------- */
+
+/* When the dictType 'open_addressing' flag is set, the entries are not
+ * allocated and chained, but stored in the hash table itself. The table is an
+ * array of 64 bytes buckets, each holding up to DICT_BUCKET_SLOTS entries
+ * with the same layout of the first fields of dictEntry: the dictEntry
+ * pointers returned by the API point inside the buckets, so all the entry
+ * accessors work unmodified.
+ *
+ * A key is stored in the first free slot starting from its home bucket
+ * (hash & mask) and probing the following buckets. A bucket that was full at
+ * some point is flagged 'everfull', and lookups only continue to the next
+ * bucket after an 'everfull' one, so a lookup usually touches a single cache
+ * line before comparing the key. Every used slot also stores the top byte of
+ * the hash of its key, to skip most key comparisons, and its distance from
+ * the home bucket, so that dictScan() can report the keys by home bucket and
+ * keep the guarantees of the reverse binary cursor.
+ *
+ * Deleted keys leave their bucket 'everfull': when too many buckets are
+ * flagged, the keys are rehashed into a clean table, incrementally like for
+ * any other resize. */
+
+#define DICT_OA_FILL_MAX 85     /* Grow the table past this fill percentage. */
+#define DICT_OA_FILL_FORCE 95   /* ... even if resizing should be avoided. */
+#define DICT_OA_EVERFULL_MAX 90 /* Clean up past this 'everfull' percentage. */
+#define DICT_OA_DISPL_MAX 255   /* Max distance of a key from its home bucket. */
+#define DICT_OA_FULL ((1<<DICT_BUCKET_SLOTS)-1)
+
+typedef struct {
+    void *key;
+    union {
+        void *val;
+        uint64_t u64;
+        int64_t s64;
+        double d;
+    } v;
+} dictSlot;
+
+typedef struct {
+    uint8_t presence;                 /* Bitmap of the used slots. */
+    uint8_t everfull;                 /* All the slots were used at some point. */
+    uint8_t tag[DICT_BUCKET_SLOTS];   /* Top byte of the hash of the keys. */
+    uint8_t displ[DICT_BUCKET_SLOTS]; /* Distance of the keys from their home. */
+    dictSlot slot[DICT_BUCKET_SLOTS];
+    /* Only used in the first bucket of the table: the number of buckets of
+     * the table flagged 'everfull'. */
+    unsigned long everfull_buckets;
+} dictBucket;
+
+_Static_assert(sizeof(dictBucket) == 64, "dictBucket should fill a cache line");
+_Static_assert(offsetof(dictSlot, key) == offsetof(struct dictEntry, key) &&
+               offsetof(dictSlot, v) == offsetof(struct dictEntry, v),
+               "dictSlot should be accessible as a dictEntry");
+
+#define dictIsOpenAddressing(d) ((d)->type->open_addressing)
+#define oaTable(d, table) ((dictBucket *)(d)->ht_table[table])
+#define oaCapacity(exp) (DICTHT_SIZE(exp)*DICT_BUCKET_SLOTS)
+
+static inline uint8_t oaTag(uint64_t hash) {
+    return hash >> 56;
+}
+
+/* Return the exponent of the smallest table holding 'size' keys without
+ * exceeding the max fill. */
+static signed char oaNextExp(unsigned long size) {
+    unsigned long buckets = size / DICT_BUCKET_SLOTS;
+    if (buckets < ULONG_MAX / 100) buckets = buckets * 100 / DICT_OA_FILL_MAX;
+    return _dictNextExp(buckets < LONG_MAX ? buckets + 1 : buckets);
+}
+
+/* Search the key in the specified table. Returns the bucket holding it, and
+ * its slot in '*slotidx', or NULL if not found. */
+static dictBucket *oaLookup(dict *d, int table, const void *key, uint64_t hash, int *slotidx) {
+    unsigned long mask = DICTHT_SIZE_MASK(d->ht_size_exp[table]);
+    dictBucket *t = oaTable(d, table);
+    uint8_t tag = oaTag(hash);
+
+    for (unsigned long displ = 0; displ <= mask && displ <= DICT_OA_DISPL_MAX; displ++) {
+        dictBucket *b = &t[(hash + displ) & mask];
+        for (int j = 0; j < DICT_BUCKET_SLOTS; j++) {
+            if (!(b->presence & (1 << j)) || b->tag[j] != tag || b->displ[j] != displ)
+                continue;
+            void *he_key = b->slot[j].key;
+            if (key == he_key || dictCompareKeys(d, key, he_key)) {
+                *slotidx = j;
+                return b;
+            }
+        }
+        if (!b->everfull) break;
+    }
+    return NULL;
+}
+
+/* Search the key in both the tables, setting '*table_index' if found. */
+static dictEntry *oaFind(dict *d, const void *key, uint64_t hash, int *table_index) {
+    for (int table = 0; table <= 1; table++) {
+        int j;
+        dictBucket *b = d->ht_used[table] ? oaLookup(d, table, key, hash, &j) : NULL;
+        if (b) {
+            if (table_index) *table_index = table;
+            return (dictEntry *)&b->slot[j];
+        }
+        if (!dictIsRehashing(d)) break;
+    }
+    return NULL;
+}
+
+/* Return the first free slot of the table for a key with the specified hash,
+ * or NULL if there is none close enough to its home bucket. */
+static dictSlot *oaFreeSlot(dict *d, int table, uint64_t hash) {
+    unsigned long mask = DICTHT_SIZE_MASK(d->ht_size_exp[table]);
+    dictBucket *t = oaTable(d, table);
+
+    for (unsigned long displ = 0; displ <= mask && displ <= DICT_OA_DISPL_MAX; displ++) {
+        dictBucket *b = &t[(hash + displ) & mask];
+        if (b->presence != DICT_OA_FULL)
+            return &b->slot[__builtin_ctz(~b->presence)];
+    }
+    return NULL;
+}
+
+/* Return the bucket of the table containing the specified slot. */
+static inline dictBucket *oaSlotBucket(dict *d, int table, dictSlot *slot) {
+    dictBucket *t = oaTable(d, table);
+    return &t[((char *)slot - (char *)t) / sizeof(dictBucket)];
+}
+
+/* Store the key in a free slot returned by oaFreeSlot(). */
+static dictEntry *oaFillSlot(dict *d, int table, dictSlot *slot, void *key, uint64_t hash) {
+    dictBucket *t = oaTable(d, table);
+    dictBucket *b = oaSlotBucket(d, table, slot);
+    int j = slot - b->slot;
+
+    b->presence |= 1 << j;
+    b->tag[j] = oaTag(hash);
+    b->displ[j] = ((unsigned long)(b - t) - hash) & DICTHT_SIZE_MASK(d->ht_size_exp[table]);
+    slot->key = key;
+    slot->v.u64 = 0;
+    if (b->presence == DICT_OA_FULL && !b->everfull) {
+        b->everfull = 1;
+        t[0].everfull_buckets++;
+    }
+    d->ht_used[table]++;
+    return (dictEntry *)slot;
+}
+
+/* Remove the key of the slot from the table, without releasing it. */
+static inline void oaClearSlot(dict *d, int table, dictBucket *b, int j) {
+    b->presence &= ~(1 << j);
+    d->ht_used[table]--;
+}
+
+/* Move the keys of N buckets from the old to the new table. See dictRehash(),
+ * that also applies the resize policy before calling this function. */
+static int oaRehash(dict *d, int n) {
+    int empty_visits = n*10; /* Max number of empty buckets to visit. */
+    dictBucket *t0 = oaTable(d, 0);
+
+    while (n-- && d->ht_used[0] != 0) {
+        assert(DICTHT_SIZE(d->ht_size_exp[0]) > (unsigned long)d->rehashidx);
+        while (t0[d->rehashidx].presence == 0) {
+            d->rehashidx++;
+            if (--empty_visits == 0) return 1;
+        }
+        /* Note that the bucket keeps its 'everfull' flag: lookups of the keys
+         * of the previous buckets that were stored past it still need to
+         * probe the following buckets of the old table. */
+        dictBucket *b = &t0[d->rehashidx];
+        while (b->presence) {
+            int j = __builtin_ctz(b->presence);
+            dictSlot *src = &b->slot[j];
+            uint64_t h = dictHashKey(d, src->key);
+            dictSlot *dst = oaFreeSlot(d, 1, h);
+            assert(dst != NULL);
+            oaFillSlot(d, 1, dst, src->key, h);
+            dst->v = src->v;
+            oaClearSlot(d, 0, b, j);
+        }
+        d->rehashidx++;
+    }
+
+    /* Check if we already rehashed the whole table... */
+    if (d->ht_used[0] == 0) {
+        zfree(d->ht_table[0]);
+        d->ht_table[0] = d->ht_table[1];
+        d->ht_used[0] = d->ht_used[1];
+        d->ht_size_exp[0] = d->ht_size_exp[1];
+        _dictReset(d, 1);
+        d->rehashidx = -1;
+        if (d->type->rehashingCompleted) d->type->rehashingCompleted(d);
+        return 0;
+    }
+    return 1;
+}
+
+/* Complete a rehashing in progress regardless of the resize policy. Used when
+ * the keys of both tables are about to exceed the capacity of the new table,
+ * which is possible while resizing is avoided because of a child process, or
+ * when keys are added while shrinking the table. */
+static int oaCompleteRehash(dict *d) {
+    if (d->pauserehash > 0) return DICT_ERR;
+    while (oaRehash(d, 1000));
+    return DICT_OK;
+}
+
+/* Grow the table, or clean it up, if needed. See _dictExpandIfNeeded().
+ * Failing to grow the table is not an error: the keys are inserted in the
+ * current table until oaGrow() is called because it is full. */
+static void oaExpandIfNeeded(dict *d) {
+    /* The new table must have room for the keys of both tables. */
+    if (dictIsRehashing(d)) {
+        if (dictSize(d)*100 < oaCapacity(d->ht_size_exp[1])*DICT_OA_FILL_FORCE ||
+            oaCompleteRehash(d) == DICT_ERR)
+        {
+            return;
+        }
+    }
+
+    /* If the hash table is empty expand it to the initial size. */
+    if (DICTHT_SIZE(d->ht_size_exp[0]) == 0) {
+        dictExpand(d, DICT_HT_INITIAL_SIZE);
+        return;
+    }
+
+    /* Unlike a chained table, an open addressing table can't hold more keys
+     * than its slots: past DICT_OA_FILL_FORCE it grows regardless of the
+     * resize policy and of the dictType expandAllowed callback. */
+    unsigned long used = d->ht_used[0], capacity = oaCapacity(d->ht_size_exp[0]);
+    if (used*100 >= capacity*DICT_OA_FILL_FORCE) {
+        dictExpand(d, capacity + 1);
+        return;
+    }
+    if (dict_can_resize != DICT_RESIZE_ENABLE) return;
+    if (used*100 >= capacity*DICT_OA_FILL_MAX) {
+        if (dictTypeExpandAllowed(d)) dictExpand(d, capacity + 1);
+        return;
+    }
+
+    /* Too many buckets flagged 'everfull' by keys that were deleted since
+     * then make the probing longer: move the keys to a clean table. */
+    unsigned long buckets = DICTHT_SIZE(d->ht_size_exp[0]);
+    if (buckets > DICT_HT_INITIAL_SIZE &&
+        oaTable(d, 0)[0].everfull_buckets*100 > buckets*DICT_OA_EVERFULL_MAX)
+    {
+        _dictExpandToExp(d, oaNextExp(used), NULL);
+    }
+}
+
+/* Make room for one more key when there is no free slot close enough to its
+ * home bucket, which is only possible with a table almost full. */
+static void oaGrow(dict *d) {
+    if (dictIsRehashing(d) && oaCompleteRehash(d) == DICT_ERR)
+        assert(0 && "No free slot in a paused open addressing table");
+    int retval = _dictExpandToExp(d, d->ht_size_exp[0] + 1, NULL);
+    assert(retval == DICT_OK);
+}
+
+/* Return a random used slot of the bucket. */
+static dictEntry *oaRandomSlot(dictBucket *b) {
+    int count = __builtin_popcount(b->presence);
+    int skip = random() % count;
+    unsigned int presence = b->presence;
+    while (skip--) presence &= presence - 1;
+    return (dictEntry *)&b->slot[__builtin_ctz(presence)];
+}
+
+/* Call the scan function for all the keys of the specified home bucket. */
+static void oaScanHome(dict *d, int table, unsigned long idx, dictScanFunction *fn,
+                       dictDefragFunctions *defragfns, void *privdata)
+{
+    unsigned long mask = DICTHT_SIZE_MASK(d->ht_size_exp[table]);
+    dictBucket *t = oaTable(d, table);
+
+    for (unsigned long displ = 0; displ <= mask && displ <= DICT_OA_DISPL_MAX; displ++) {
+        dictBucket *b = &t[(idx + displ) & mask];
+        for (int j = 0; j < DICT_BUCKET_SLOTS; j++) {
+            if (!(b->presence & (1 << j)) || b->displ[j] != displ) continue;
+            dictSlot *slot = &b->slot[j];
+            if (defragfns) {
+                void *newkey = defragfns->defragKey ? defragfns->defragKey(slot->key) : NULL;
+                void *newval = defragfns->defragVal ? defragfns->defragVal(slot->v.val) : NULL;
+                if (newkey) slot->key = newkey;
+                if (newval) slot->v.val = newval;
+            }
+            fn(privdata, (dictEntry *)slot);
+        }
+        if (!b->everfull) break;
+    }
+}
+
+/* Search and remove the key, see dictGenericDelete(). The slot may be reused
+ * as soon as it's cleared, so unlinked entries are returned as a copy that
+ * dictFreeUnlinkedEntry() releases like a chained entry. */
+static dictEntry *oaDelete(dict *d, const void *key, uint64_t hash, int nofree) {
+    for (int table = 0; table <= 1; table++) {
+        int j;
+        dictBucket *b = d->ht_used[table] ? oaLookup(d, table, key, hash, &j) : NULL;
+        if (b) {
+            dictEntry *he = (dictEntry *)&b->slot[j];
+            if (nofree) {
+                dictEntry *copy = zmalloc(sizeof(*copy));
+                copy->key = he->key;
+                copy->v = he->v;
+                copy->next = NULL;
+                he = copy;
+            } else {
+                dictFreeKey(d, he);
+                dictFreeVal(d, he);
+            }
+            oaClearSlot(d, table, b, j);
+            return he;
+        }
+        if (!dictIsRehashing(d)) break;
+    }
+    return NULL;
+}
+
+/* Release all the keys of the bucket, see _dictClear(). */
+static void oaClearBucket(dict *d, int table, dictBucket *b) {
+    while (b->presence) {
+        int j = __builtin_ctz(b->presence);
+        dictFreeKey(d, (dictEntry *)&b->slot[j]);
+        dictFreeVal(d, (dictEntry *)&b->slot[j]);
+        oaClearSlot(d, table, b, j);
+    }
+}
+
+/* Iterator implementation, see dictNext(). The iterator position is the slot
+ * of the entry returned last, that the user may delete. */
+static dictEntry *oaNext(dictIterator *iter) {
+    dict *d = iter->d;
+
+    while (1) {
+        unsigned int pending = DICT_OA_FULL; /* Slots of the bucket to visit. */
+        if (iter->entry == NULL) {
+            iter->index++;
+            if (iter->index >= (long) DICTHT_SIZE(d->ht_size_exp[iter->table])) {
+                if (dictIsRehashing(d) && iter->table == 0) {
+                    iter->table++;
+                    iter->index = 0;
+                } else {
+                    break;
+                }
+            }
+        } else {
+            int j = (dictSlot *)iter->entry - oaTable(d, iter->table)[iter->index].slot;
+            pending &= ~((2u << j) - 1);
+        }
+        dictBucket *b = &oaTable(d, iter->table)[iter->index];
+        unsigned int presence = b->presence & pending;
+        if (presence) {
+            iter->entry = (dictEntry *)&b->slot[__builtin_ctz(presence)];
+            return iter->entry;
+        }
+        iter->entry = NULL;
+    }
+    return NULL;
+}
+
+/* Return a random entry, see dictGetRandomKey(). */
+static dictEntry *oaRandomKey(dict *d) {
+    dictBucket *b;
+    unsigned long h;
+
+    if (dictIsRehashing(d)) {
+        unsigned long s0 = DICTHT_SIZE(d->ht_size_exp[0]);
+        do {
+            /* We are sure there are no elements in indexes from 0
+             * to rehashidx-1 */
+            h = d->rehashidx + (randomULong() % (dictBuckets(d) - d->rehashidx));
+            b = (h >= s0) ? &oaTable(d, 1)[h - s0] : &oaTable(d, 0)[h];
+        } while (b->presence == 0);
+    } else {
+        unsigned long m = DICTHT_SIZE_MASK(d->ht_size_exp[0]);
+        do {
+            h = randomULong() & m;
+            b = &oaTable(d, 0)[h];
+        } while (b->presence == 0);
+    }
+    return oaRandomSlot(b);
+}
+
+/* Sample the keys of continuous buckets, see dictGetSomeKeys(). Since the
+ * buckets hold a bounded number of keys, the sampling is a simple walk. */
+static unsigned int oaGetSomeKeys(dict *d, dictEntry **des, unsigned int count) {
+    unsigned long tables = dictIsRehashing(d) ? 2 : 1;
+    unsigned long stored = 0, maxsteps = count*10, emptylen = 0;
+    unsigned long maxsizemask = DICTHT_SIZE_MASK(d->ht_size_exp[0]);
+    if (tables > 1 && maxsizemask < DICTHT_SIZE_MASK(d->ht_size_exp[1]))
+        maxsizemask = DICTHT_SIZE_MASK(d->ht_size_exp[1]);
+
+    unsigned long i = randomULong() & maxsizemask;
+    while (stored < count && maxsteps--) {
+        for (unsigned long j = 0; j < tables; j++) {
+            /* See dictGetSomeKeys() about skipping the rehashed part. */
+            if (tables == 2 && j == 0 && i < (unsigned long) d->rehashidx) {
+                if (i >= DICTHT_SIZE(d->ht_size_exp[1]))
+                    i = d->rehashidx;
+                else
+                    continue;
+            }
+            if (i >= DICTHT_SIZE(d->ht_size_exp[j])) continue;
+            unsigned int presence = oaTable(d, j)[i].presence;
+            if (presence == 0) {
+                emptylen++;
+                if (emptylen >= 5 && emptylen > count) {
+                    i = randomULong() & maxsizemask;
+                    emptylen = 0;
+                }
+                continue;
+            }
+            emptylen = 0;
+            while (presence && stored < count) {
+                des[stored++] = (dictEntry *)&oaTable(d, j)[i].slot[__builtin_ctz(presence)];
+                presence &= presence - 1;
+            }
+            if (stored >= count) return stored;
+        }
+        i = (i+1) & maxsizemask;
+    }
+    return stored;
+}
+
+/* Find the slot of the key with the specified pointer and hash, without
+ * comparing the keys, see dictFindEntryByPtrAndHash(). */
+static dictEntry *oaFindByPtr(dict *d, const void *oldptr, uint64_t hash) {
+    for (int table = 0; table <= 1; table++) {
+        unsigned long mask = DICTHT_SIZE_MASK(d->ht_size_exp[table]);
+        dictBucket *t = oaTable(d, table);
+        for (unsigned long displ = 0; d->ht_used[table] && displ <= mask &&
+                                      displ <= DICT_OA_DISPL_MAX; displ++)
+        {
+            dictBucket *b = &t[(hash + displ) & mask];
+            for (int j = 0; j < DICT_BUCKET_SLOTS; j++) {
+                if ((b->presence & (1 << j)) && b->slot[j].key == oldptr)
+                    return (dictEntry *)&b->slot[j];
+            }
+            if (!b->everfull) break;
+        }
+        if (!dictIsRehashing(d)) break;
+    }
+    return NULL;
+}
+
+/* Debugging stats of an open addressing table, see _dictGetStatsHt(). */
+static size_t oaGetStatsHt(char *buf, size_t bufsize, dict *d, int htidx) {
+    unsigned long buckets = DICTHT_SIZE(d->ht_size_exp[htidx]);
+    unsigned long dvector[DICT_BUCKET_SLOTS+2] = {0}, maxdispl = 0;
+    unsigned long long totdispl = 0;
+    dictBucket *t = oaTable(d, htidx);
+    size_t l = 0;
+
+    for (unsigned long i = 0; i < buckets; i++) {
+        for (int j = 0; j < DICT_BUCKET_SLOTS; j++) {
+            if (!(t[i].presence & (1 << j))) continue;
+            unsigned long displ = t[i].displ[j];
+            dvector[displ <= DICT_BUCKET_SLOTS ? displ : DICT_BUCKET_SLOTS+1]++;
+            if (displ > maxdispl) maxdispl = displ;
+            totdispl += displ;
+        }
+    }
+
+    l += snprintf(buf+l,bufsize-l,
+        "Hash table %d stats (%s):\n"
+        " table size: %lu\n"
+        " number of elements: %lu\n"
+        " slots: %lu (%d per bucket)\n"
+        " fill factor: %.02f%%\n"
+        " everfull buckets: %lu\n"
+        " max probe distance: %lu\n"
+        " avg probe distance: %.02f\n"
+        " Probe distance distribution:\n",
+        htidx, (htidx == 0) ? "main hash table" : "rehashing target",
+        buckets, d->ht_used[htidx], buckets*DICT_BUCKET_SLOTS, DICT_BUCKET_SLOTS,
+        (float)d->ht_used[htidx]*100/(buckets*DICT_BUCKET_SLOTS),
+        t[0].everfull_buckets, maxdispl,
+        (float)totdispl/d->ht_used[htidx]);
+
+    for (int i = 0; i < DICT_BUCKET_SLOTS+2; i++) {
+        if (dvector[i] == 0) continue;
+        if (l >= bufsize) break;
+        l += snprintf(buf+l,bufsize-l,
+            "   %s%d: %ld (%.02f%%)\n",
+            i > DICT_BUCKET_SLOTS ? ">" : "", i > DICT_BUCKET_SLOTS ? DICT_BUCKET_SLOTS : i,
+            dvector[i], ((float)dvector[i]/d->ht_used[htidx])*100);
+    }
+
+    /* Make sure there is a NULL term at the end. */
+    buf[bufsize-1] = '\0';
+    /* Unlike snprintf(), return the number of characters actually written. */
+    return strlen(buf);
+}
+
 /* ----------------------------- API implementation ------------------------- */
 
 /* Reset hash table parameters already initialized with _dictInit()*/
@@ -191,6 +688,10 @@ dict *dictCreate(dictType *type)
     }
 
     _dictInit(d,type);
+    /* Open addressing tables store the entries in place: no room for the
+     * entry metadata, and no need for the no_value optimization. */
+    if (type->open_addressing)
+        assert(!type->no_value && !dictEntryMetadataSize(d));
     return d;
 }
 
@@ -231,26 +732,37 @@ int _dictExpand(dict *d, unsigned long size, int* malloc_failed)
         return DICT_ERR;
 
     /* the new hash table */
-    dictEntry **new_ht_table;
-    unsigned long new_ht_used;
-    signed char new_ht_size_exp = _dictNextExp(size);
+    signed char new_ht_size_exp = dictIsOpenAddressing(d) ? oaNextExp(size) : _dictNextExp(size);
 
     /* Detect overflows */
     size_t newsize = 1ul<<new_ht_size_exp;
-    if (newsize < size || newsize * sizeof(dictEntry*) < newsize)
+    size_t capacity = dictIsOpenAddressing(d) ? oaCapacity(new_ht_size_exp) : newsize;
+    size_t bucketsize = dictIsOpenAddressing(d) ? sizeof(dictBucket) : sizeof(dictEntry*);
+    if (capacity < size || newsize * bucketsize < newsize)
         return DICT_ERR;
 
     /* Rehashing to the same table size is not useful. */
     if (new_ht_size_exp == d->ht_size_exp[0]) return DICT_ERR;
 
-    /* Allocate the new hash table and initialize all pointers to NULL */
+    return _dictExpandToExp(d, new_ht_size_exp, malloc_failed);
+}
+
+/* Allocate a new hash table of 2^new_ht_size_exp buckets, either the first
+ * one or the target of a rehashing, see _dictExpand(). */
+static int _dictExpandToExp(dict *d, signed char new_ht_size_exp, int *malloc_failed) {
+    void *new_ht_table;
+    unsigned long new_ht_used;
+    size_t newsize = DICTHT_SIZE(new_ht_size_exp);
+    size_t bucketsize = dictIsOpenAddressing(d) ? sizeof(dictBucket) : sizeof(dictEntry*);
+
+    /* Allocate the new hash table and initialize all the buckets */
     if (malloc_failed) {
-        new_ht_table = ztrycalloc(newsize*sizeof(dictEntry*));
+        new_ht_table = ztrycalloc(newsize*bucketsize);
         *malloc_failed = new_ht_table == NULL;
         if (*malloc_failed)
             return DICT_ERR;
     } else
-        new_ht_table = zcalloc(newsize*sizeof(dictEntry*));
+        new_ht_table = zcalloc(newsize*bucketsize);
 
     new_ht_used = 0;
 
@@ -268,6 +780,7 @@ int _dictExpand(dict *d, unsigned long size, int* malloc_failed)
     d->ht_used[1] = new_ht_used;
     d->ht_table[1] = new_ht_table;
     d->rehashidx = 0;
+    if (d->type->rehashingStarted) d->type->rehashingStarted(d);
     return DICT_OK;
 }
 
@@ -303,6 +816,7 @@ int dictRehash(dict *d, int n) {
     {
         return 0;
     }
+    if (dictIsOpenAddressing(d)) return oaRehash(d, n);
 
     while(n-- && d->ht_used[0] != 0) {
         dictEntry *de, *nextde;
@@ -373,6 +887,7 @@ int dictRehash(dict *d, int n) {
         d->ht_size_exp[0] = d->ht_size_exp[1];
         _dictReset(d, 1);
         d->rehashidx = -1;
+        if (d->type->rehashingCompleted) d->type->rehashingCompleted(d);
         return 0;
     }
 
@@ -470,6 +985,14 @@ dictEntry *dictInsertAtPosition(dict *d, void *key, void *position) {
     /* If rehashing is ongoing, we insert in table 1, otherwise in table 0.
      * Assert that the provided bucket is the right table. */
     int htidx = dictIsRehashing(d) ? 1 : 0;
+    if (dictIsOpenAddressing(d)) {
+        /* It's a free slot, with the hash of the key stashed as value. */
+        dictSlot *slot = position;
+        dictBucket *t = oaTable(d, htidx);
+        assert((void *)slot > (void *)t &&
+               (void *)slot < (void *)&t[DICTHT_SIZE(d->ht_size_exp[htidx])]);
+        return oaFillSlot(d, htidx, slot, key, slot->v.u64);
+    }
     assert(bucket >= &d->ht_table[htidx][0] &&
            bucket <= &d->ht_table[htidx][DICTHT_SIZE_MASK(d->ht_size_exp[htidx])]);
     size_t metasize = dictEntryMetadataSize(d);
@@ -563,6 +1086,7 @@ static dictEntry *dictGenericDelete(dict *d, const void *key, int nofree) {
 
     if (dictIsRehashing(d)) _dictRehashStep(d);
     h = dictHashKey(d, key);
+    if (dictIsOpenAddressing(d)) return oaDelete(d, key, h, nofree);
 
     for (table = 0; table <= 1; table++) {
         idx = h & DICTHT_SIZE_MASK(d->ht_size_exp[table]);
@@ -630,36 +1154,115 @@ void dictFreeUnlinkedEntry(dict *d, dictEntry *he) {
     if (!entryIsKey(he)) zfree(decodeMaskedPtr(he));
 }
 
+/* Free all the elements of the bucket 'i' of the table 'htidx'. */
+static void _dictClearBucket(dict *d, int htidx, unsigned long i) {
+    dictEntry *he, *nextHe;
+
+    if (dictIsOpenAddressing(d)) {
+        oaClearBucket(d, htidx, &oaTable(d, htidx)[i]);
+        return;
+    }
+    he = d->ht_table[htidx][i];
+    while(he) {
+        nextHe = dictGetNext(he);
+        dictFreeKey(d, he);
+        dictFreeVal(d, he);
+        if (!entryIsKey(he)) zfree(decodeMaskedPtr(he));
+        d->ht_used[htidx]--;
+        he = nextHe;
+    }
+    d->ht_table[htidx][i] = NULL;
+}
+
 /* Destroy an entire dictionary */
 int _dictClear(dict *d, int htidx, void(callback)(dict*)) {
     unsigned long i;
 
     /* Free all the elements */
     for (i = 0; i < DICTHT_SIZE(d->ht_size_exp[htidx]) && d->ht_used[htidx] > 0; i++) {
-        dictEntry *he, *nextHe;
-
         if (callback && (i & 65535) == 0) callback(d);
+        _dictClearBucket(d, htidx, i);
+    }
+    /* Free the table and the allocated cache structure */
+    zfree(d->ht_table[htidx]);
+    /* Re-initialize the table */
+    _dictReset(d, htidx);
+    return DICT_OK; /* never fails */
+}
 
-        if ((he = d->ht_table[htidx][i]) == NULL) continue;
-        while(he) {
+/* Release a dictionary in steps, freeing the elements of up to 'buckets'
+ * buckets per call, starting from the bucket '*cursor' that is updated (it
+ * must be 0 on the first call). Returns 1 when the dictionary was released,
+ * 0 if more calls are needed. Nothing else can access the dictionary until
+ * it is released. */
+int dictReleaseStep(dict *d, unsigned long *cursor, unsigned long buckets) {
+    if (dictIsRehashing(d)) {
+        if (d->type->rehashingCompleted) d->type->rehashingCompleted(d);
+        /* Both tables are released anyway, the rehashing is over. */
+        d->rehashidx = -1;
+    }
+
+    for (int htidx = 0; htidx <= 1; htidx++) {
+        if (d->ht_table[htidx] == NULL) continue;
+        while (d->ht_used[htidx] > 0 && buckets--) {
+            _dictClearBucket(d, htidx, *cursor);
+            (*cursor)++;
+        }
+        if (d->ht_used[htidx] > 0) return 0;
+        zfree(d->ht_table[htidx]);
+        _dictReset(d, htidx);
+        *cursor = 0;
+    }
+    zfree(d);
+    return 1;
+}
+
+/* Free the elements of the buckets [from, to) of the table 'htidx', returning
+ * how many they were. Nothing else of the dictionary is updated, not even
+ * the number of elements, so that different ranges of buckets of the same
+ * dictionary can be freed by different threads at the same time. Once all
+ * the buckets were freed, dictMarkEmpty() must be called before releasing
+ * the dictionary. */
+unsigned long dictFreeBuckets(dict *d, int htidx, unsigned long from, unsigned long to) {
+    unsigned long freed = 0;
+
+    for (unsigned long i = from; i < to; i++) {
+        if (dictIsOpenAddressing(d)) {
+            dictBucket *b = &oaTable(d, htidx)[i];
+            while (b->presence) {
+                int j = __builtin_ctz(b->presence);
+                dictFreeKey(d, (dictEntry *)&b->slot[j]);
+                dictFreeVal(d, (dictEntry *)&b->slot[j]);
+                b->presence &= ~(1 << j);
+                freed++;
+            }
+            continue;
+        }
+        dictEntry *he = d->ht_table[htidx][i], *nextHe;
+        while (he) {
             nextHe = dictGetNext(he);
             dictFreeKey(d, he);
             dictFreeVal(d, he);
             if (!entryIsKey(he)) zfree(decodeMaskedPtr(he));
-            d->ht_used[htidx]--;
+            freed++;
             he = nextHe;
         }
+        d->ht_table[htidx][i] = NULL;
     }
-    /* Free the table and the allocated cache structure */
-    zfree(d->ht_table[htidx]);
-    /* Re-initialize the table */
-    _dictReset(d, htidx);
-    return DICT_OK; /* never fails */
+    return freed;
+}
+
+/* Forget the elements of a dictionary, that were all freed with
+ * dictFreeBuckets(): dictRelease() then just releases the tables. */
+void dictMarkEmpty(dict *d) {
+    d->ht_used[0] = d->ht_used[1] = 0;
 }
 
 /* Clear & Release the hash table */
 void dictRelease(dict *d)
 {
+    if (dictIsRehashing(d) && d->type->rehashingCompleted)
+        d->type->rehashingCompleted(d);
     _dictClear(d,0,NULL);
     _dictClear(d,1,NULL);
     zfree(d);
@@ -673,6 +1276,7 @@ dictEntry *dictFind(dict *d, const void *key)
     if (dictSize(d) == 0) return NULL; /* dict is empty */
     if (dictIsRehashing(d)) _dictRehashStep(d);
     h = dictHashKey(d, key);
+    if (dictIsOpenAddressing(d)) return oaFind(d, key, h, NULL);
     for (table = 0; table <= 1; table++) {
         idx = h & DICTHT_SIZE_MASK(d->ht_size_exp[table]);
         he = d->ht_table[table][idx];
@@ -717,6 +1321,18 @@ dictEntry *dictTwoPhaseUnlinkFind(dict *d, const void *key, dictEntry ***plink,
     if (dictIsRehashing(d)) _dictRehashStep(d);
     h = dictHashKey(d, key);
 
+    if (dictIsOpenAddressing(d)) {
+        /* The entry is the slot itself, that is also used as 'plink'. */
+        int table_found;
+        dictEntry *he = oaFind(d, key, h, &table_found);
+        if (he) {
+            *table_index = table_found;
+            *plink = (dictEntry **)he;
+            dictPauseRehashing(d);
+        }
+        return he;
+    }
+
     for (table = 0; table <= 1; table++) {
         idx = h & DICTHT_SIZE_MASK(d->ht_size_exp[table]);
         dictEntry **ref = &d->ht_table[table][idx];
@@ -737,6 +1353,14 @@ dictEntry *dictTwoPhaseUnlinkFind(dict *d, const void *key, dictEntry ***plink,
 
 void dictTwoPhaseUnlinkFree(dict *d, dictEntry *he, dictEntry **plink, int table_index) {
     if (he == NULL) return;
+    if (dictIsOpenAddressing(d)) {
+        dictBucket *b = oaSlotBucket(d, table_index, (dictSlot *)plink);
+        dictFreeKey(d, he);
+        dictFreeVal(d, he);
+        oaClearSlot(d, table_index, b, (dictSlot *)plink - b->slot);
+        dictResumeRehashing(d);
+        return;
+    }
     d->ht_used[table_index]--;
     *plink = dictGetNext(he);
     dictFreeKey(d, he);
@@ -855,6 +1479,7 @@ static void dictSetNext(dictEntry *de, dictEntry *next) {
 /* Returns the memory usage in bytes of the dict, excluding the size of the keys
  * and values. */
 size_t dictMemUsage(const dict *d) {
+    if (dictIsOpenAddressing(d)) return dictBuckets(d) * sizeof(dictBucket);
     return dictSize(d) * sizeof(dictEntry) +
         dictSlots(d) * sizeof(dictEntry*);
 }
@@ -951,6 +1576,7 @@ dictEntry *dictNext(dictIterator *iter)
                 else
                     iter->fingerprint = dictFingerprint(iter->d);
             }
+            if (dictIsOpenAddressing(iter->d)) return oaNext(iter);
             iter->index++;
             if (iter->index >= (long) DICTHT_SIZE(iter->d->ht_size_exp[iter->table])) {
                 if (dictIsRehashing(iter->d) && iter->table == 0) {
@@ -962,6 +1588,7 @@ dictEntry *dictNext(dictIterator *iter)
             }
             iter->entry = iter->d->ht_table[iter->table][iter->index];
         } else {
+            if (dictIsOpenAddressing(iter->d)) return oaNext(iter);
             iter->entry = iter->nextEntry;
         }
         if (iter->entry) {
@@ -990,12 +1617,13 @@ dictEntry *dictGetRandomKey(dict *d)
 
     if (dictSize(d) == 0) return NULL;
     if (dictIsRehashing(d)) _dictRehashStep(d);
+    if (dictIsOpenAddressing(d)) return oaRandomKey(d);
     if (dictIsRehashing(d)) {
         unsigned long s0 = DICTHT_SIZE(d->ht_size_exp[0]);
         do {
             /* We are sure there are no elements in indexes from 0
              * to rehashidx-1 */
-            h = d->rehashidx + (randomULong() % (dictSlots(d) - d->rehashidx));
+            h = d->rehashidx + (randomULong() % (dictBuckets(d) - d->rehashidx));
             he = (h >= s0) ? d->ht_table[1][h - s0] : d->ht_table[0][h];
         } while(he == NULL);
     } else {
@@ -1061,6 +1689,8 @@ unsigned int dictGetSomeKeys(dict *d, dictEntry **des, unsigned int count) {
             break;
     }
 
+    if (dictIsOpenAddressing(d)) return oaGetSomeKeys(d, des, count);
+
     tables = dictIsRehashing(d) ? 2 : 1;
     maxsizemask = DICTHT_SIZE_MASK(d->ht_size_exp[0]);
     if (tables > 1 && maxsizemask < DICTHT_SIZE_MASK(d->ht_size_exp[1]))
@@ -1161,6 +1791,29 @@ static void dictDefragBucket(dict *d, dictEntry **bucketref, dictDefragFunctions
     }
 }
 
+/* Call the scan function for all the entries of a bucket, defragging them
+ * first if 'defragfns' is not NULL. For open addressing tables, the bucket is
+ * the home bucket of the keys, see oaScanHome(). */
+static void dictScanBucket(dict *d, int htidx, unsigned long idx, dictScanFunction *fn,
+                           dictDefragFunctions *defragfns, void *privdata)
+{
+    const dictEntry *de, *next;
+
+    if (dictIsOpenAddressing(d)) {
+        oaScanHome(d, htidx, idx, fn, defragfns, privdata);
+        return;
+    }
+    if (defragfns) {
+        dictDefragBucket(d, &d->ht_table[htidx][idx], defragfns);
+    }
+    de = d->ht_table[htidx][idx];
+    while (de) {
+        next = dictGetNext(de);
+        fn(privdata, de);
+        de = next;
+    }
+}
+
 /* This is like dictGetRandomKey() from the POV of the API, but will do more
  * work to ensure a better distribution of the returned element.
  *
@@ -1304,7 +1957,6 @@ unsigned long dictScanDefrag(dict *d,
                              void *privdata)
 {
     int htidx0, htidx1;
-    const dictEntry *de, *next;
     unsigned long m0, m1;
 
     if (dictSize(d) == 0) return 0;
@@ -1317,15 +1969,7 @@ unsigned long dictScanDefrag(dict *d,
         m0 = DICTHT_SIZE_MASK(d->ht_size_exp[htidx0]);
 
         /* Emit entries at cursor */
-        if (defragfns) {
-            dictDefragBucket(d, &d->ht_table[htidx0][v & m0], defragfns);
-        }
-        de = d->ht_table[htidx0][v & m0];
-        while (de) {
-            next = dictGetNext(de);
-            fn(privdata, de);
-            de = next;
-        }
+        dictScanBucket(d, htidx0, v & m0, fn, defragfns, privdata);
 
         /* Set unmasked bits so incrementing the reversed cursor
          * operates on the masked bits */
@@ -1350,29 +1994,13 @@ unsigned long dictScanDefrag(dict *d,
         m1 = DICTHT_SIZE_MASK(d->ht_size_exp[htidx1]);
 
         /* Emit entries at cursor */
-        if (defragfns) {
-            dictDefragBucket(d, &d->ht_table[htidx0][v & m0], defragfns);
-        }
-        de = d->ht_table[htidx0][v & m0];
-        while (de) {
-            next = dictGetNext(de);
-            fn(privdata, de);
-            de = next;
-        }
+        dictScanBucket(d, htidx0, v & m0, fn, defragfns, privdata);
 
         /* Iterate over indices in larger table that are the expansion
          * of the index pointed to by the cursor in the smaller table */
         do {
             /* Emit entries at cursor */
-            if (defragfns) {
-                dictDefragBucket(d, &d->ht_table[htidx1][v & m1], defragfns);
-            }
-            de = d->ht_table[htidx1][v & m1];
-            while (de) {
-                next = dictGetNext(de);
-                fn(privdata, de);
-                de = next;
-            }
+            dictScanBucket(d, htidx1, v & m1, fn, defragfns, privdata);
 
             /* Increment the reverse cursor not covered by the smaller mask.*/
             v |= ~m1;
@@ -1389,6 +2017,67 @@ unsigned long dictScanDefrag(dict *d,
     return v;
 }
 
+/* Call 'fn' for all the entries of the part 'part' of the dict, when the
+ * buckets of each table are split in 'parts' ranges of the same size. As
+ * long as the dict is not modified, the parts are disjoint and together
+ * cover all the entries, so that a dict can be visited by 'parts' threads at
+ * the same time: unlike dictScan() this function doesn't write to the dict,
+ * not even to pause the rehashing. */
+void dictScanPart(dict *d, unsigned long part, unsigned long parts,
+                  dictScanFunction *fn, void *privdata)
+{
+    if (dictSize(d) == 0) return;
+    for (int htidx = 0; htidx <= 1; htidx++) {
+        unsigned long size = d->ht_table[htidx] ? DICTHT_SIZE(d->ht_size_exp[htidx]) : 0;
+        unsigned long step = size / parts, extra = size % parts;
+        unsigned long start = part*step + (part < extra ? part : extra);
+        unsigned long end = start + step + (part < extra);
+
+        for (unsigned long idx = start; idx < end; idx++)
+            dictScanBucket(d, htidx, idx, fn, NULL, privdata);
+        if (!dictIsRehashing(d)) break;
+    }
+}
+
+typedef struct {
+    dict *d;
+    unsigned long class, mask;
+    dictScanFunction *fn;
+    void *privdata;
+} dictHashClassFilter;
+
+static void dictHashClassFilterEntry(void *privdata, const dictEntry *de) {
+    dictHashClassFilter *f = privdata;
+    if ((dictHashKey(f->d, dictGetKey(de)) & f->mask) == f->class)
+        f->fn(f->privdata, de);
+}
+
+/* Call 'fn' for all the entries whose hash has the 'bits' lower bits equal to
+ * 'class'. Unlike the buckets, the classes don't depend on the size of the
+ * tables, so a dict that is resized between the calls is still visited
+ * exactly once by calling the function for all the classes in order: an
+ * entry is in a class before the current one if and only if it was already
+ * visited. When a table is smaller than the classes, the entries of the home
+ * bucket are filtered by hash. Like dictScanPart(), this function doesn't
+ * write to the dict. */
+void dictScanHashClass(dict *d, unsigned long class, int bits,
+                       dictScanFunction *fn, void *privdata)
+{
+    if (dictSize(d) == 0) return;
+    for (int htidx = 0; htidx <= 1; htidx++) {
+        int exp = d->ht_size_exp[htidx];
+
+        if (exp >= bits) {
+            for (unsigned long idx = class; idx < DICTHT_SIZE(exp); idx += 1UL << bits)
+                dictScanBucket(d, htidx, idx, fn, NULL, privdata);
+        } else if (exp >= 0) {
+            dictHashClassFilter f = {d, class, (1UL << bits) - 1, fn, privdata};
+            dictScanBucket(d, htidx, class & DICTHT_SIZE_MASK(exp), dictHashClassFilterEntry, NULL, &f);
+        }
+        if (!dictIsRehashing(d)) break;
+    }
+}
+
 /* ------------------------- private functions ------------------------------ */
 
 /* Because we may need to allocate huge memory chunk at once when dict
@@ -1396,6 +2085,11 @@ unsigned long dictScanDefrag(dict *d,
  * type has expandAllowed member function. */
 static int dictTypeExpandAllowed(dict *d) {
     if (d->type->expandAllowed == NULL) return 1;
+    if (dictIsOpenAddressing(d)) {
+        return d->type->expandAllowed(
+                    DICTHT_SIZE(d->ht_size_exp[0] + 1) * sizeof(dictBucket),
+                    (double)d->ht_used[0] / oaCapacity(d->ht_size_exp[0]));
+    }
     return d->type->expandAllowed(
                     DICTHT_SIZE(_dictNextExp(d->ht_used[0] + 1)) * sizeof(dictEntry*),
                     (double)d->ht_used[0] / DICTHT_SIZE(d->ht_size_exp[0]));
@@ -1404,6 +2098,11 @@ static int dictTypeExpandAllowed(dict *d) {
 /* Expand the hash table if needed */
 static int _dictExpandIfNeeded(dict *d)
 {
+    if (dictIsOpenAddressing(d)) {
+        oaExpandIfNeeded(d);
+        return DICT_OK;
+    }
+
     /* Incremental rehashing already in progress. Return. */
     if (dictIsRehashing(d)) return DICT_OK;
 
@@ -1449,6 +2148,21 @@ void *dictFindPositionForInsert(dict *d, const void *key, dictEntry **existing)
     /* Expand the hash table if needed */
     if (_dictExpandIfNeeded(d) == DICT_ERR)
         return NULL;
+    if (dictIsOpenAddressing(d)) {
+        if ((he = oaFind(d, key, hash, NULL)) != NULL) {
+            if (existing) *existing = he;
+            return NULL;
+        }
+        /* The position is the free slot, in the new table when rehashing. */
+        dictSlot *slot = oaFreeSlot(d, dictIsRehashing(d) ? 1 : 0, hash);
+        if (slot == NULL) {
+            oaGrow(d);
+            slot = oaFreeSlot(d, dictIsRehashing(d) ? 1 : 0, hash);
+            assert(slot != NULL);
+        }
+        slot->v.u64 = hash; /* Used by dictInsertAtPosition(). */
+        return slot;
+    }
     for (table = 0; table <= 1; table++) {
         idx = hash & DICTHT_SIZE_MASK(d->ht_size_exp[table]);
         /* Search if this slot does not already contain the given key */
@@ -1471,6 +2185,8 @@ void *dictFindPositionForInsert(dict *d, const void *key, dictEntry **existing)
 }
 
 void dictEmpty(dict *d, void(callback)(dict*)) {
+    if (dictIsRehashing(d) && d->type->rehashingCompleted)
+        d->type->rehashingCompleted(d);
     _dictClear(d,0,callback);
     _dictClear(d,1,callback);
     d->rehashidx = -1;
@@ -1495,6 +2211,7 @@ dictEntry *dictFindEntryByPtrAndHash(dict *d, const void *oldptr, uint64_t hash)
     unsigned long idx, table;
 
     if (dictSize(d) == 0) return NULL; /* dict is empty */
+    if (dictIsOpenAddressing(d)) return oaFindByPtr(d, oldptr, hash);
     for (table = 0; table <= 1; table++) {
         idx = hash & DICTHT_SIZE_MASK(d->ht_size_exp[table]);
         he = d->ht_table[table][idx];
@@ -1538,6 +2255,8 @@ size_t _dictGetStatsHt(char *buf, size_t bufsize, dict *d, int htidx, int full)
         return strlen(buf);
     }
 
+    if (dictIsOpenAddressing(d)) return oaGetStatsHt(buf, bufsize, d, htidx);
+
     /* Compute stats. */
     for (i = 0; i < DICT_STATS_VECTLEN; i++) clvector[i] = 0;
     for (i = 0; i < DICTHT_SIZE(d->ht_size_exp[htidx]); i++) {
@@ -1652,37 +2371,38 @@ dictType BenchmarkDictType = {
     NULL
 };
 
+dictType BenchmarkOpenAddressingDictType = {
+    .hashFunction = hashCallback,
+    .keyCompare = compareCallback,
+    .keyDestructor = freeCallback,
+    .open_addressing = 1
+};
+
 #define start_benchmark() start = timeInMilliseconds()
 #define end_benchmark(msg) do { \
     elapsed = timeInMilliseconds()-start; \
     printf(msg ": %ld items in %lld ms\n", count, elapsed); \
 } while(0)
 
-/* ./sider-server test dict [<count> | --accurate] */
-int dictTest(int argc, char **argv, int flags) {
+static void dictBenchmark(dictType *type, long count) {
     long j;
     long long start, elapsed;
-    dict *dict = dictCreate(&BenchmarkDictType);
-    long count = 0;
-    int accurate = (flags & REDIS_TEST_ACCURATE);
-
-    if (argc == 4) {
-        if (accurate) {
-            count = 5000000;
-        } else {
-            count = strtol(argv[3],NULL,10);
-        }
-    } else {
-        count = 5000;
-    }
+    dict *dict = dictCreate(type);
+    size_t used = zmalloc_used_memory(), keys = 0;
 
+    printf("--- %s hash table ---\n",
+        type->open_addressing ? "Open addressing" : "Chained");
     start_benchmark();
     for (j = 0; j < count; j++) {
-        int retval = dictAdd(dict,stringFromLongLong(j),(void*)j);
+        char *key = stringFromLongLong(j);
+        keys += zmalloc_size(key);
+        int retval = dictAdd(dict,key,(void*)j);
         assert(retval == DICT_OK);
     }
     end_benchmark("Inserting");
     assert((long)dictSize(dict) == count);
+    printf("Memory: %.2f bytes per item, keys excluded\n",
+        (double)(zmalloc_used_memory()-used-keys)/count);
 
     /* Wait for rehashing. */
     while (dictIsRehashing(dict)) {
@@ -1744,6 +2464,25 @@ int dictTest(int argc, char **argv, int flags) {
     }
     end_benchmark("Removing and adding");
     dictRelease(dict);
+}
+
+/* ./sider-server test dict [<count> | --accurate] */
+int dictTest(int argc, char **argv, int flags) {
+    long count = 0;
+    int accurate = (flags & REDIS_TEST_ACCURATE);
+
+    if (argc == 4) {
+        if (accurate) {
+            count = 5000000;
+        } else {
+            count = strtol(argv[3],NULL,10);
+        }
+    } else {
+        count = 5000;
+    }
+
+    dictBenchmark(&BenchmarkDictType, count);
+    dictBenchmark(&BenchmarkOpenAddressingDictType, count);
     return 0;
 }
 #endif
@@ -68,6 +68,13 @@ typedef struct dictType {
     unsigned int keys_are_odd:1;
     /* TODO: Add a 'keys_are_even' flag and use a similar optimization if that
      * flag is set. */
+    /* The 'open_addressing' flag, if set, stores the entries inside the hash
+     * table, in buckets of DICT_BUCKET_SLOTS entries filling a cache line,
+     * instead of allocating and chaining every entry. The dictEntry pointers
+     * returned by the API are then only valid until the next operation that
+     * may rehash the table. Not compatible with 'no_value' or entry
+     * metadata. */
+    unsigned int open_addressing:1;
 
     /* Allow each dict and dictEntry to carry extra caller-defined metadata. The
      * extra memory is initialized to 0 when allocated. */
@@ -76,11 +83,19 @@ typedef struct dictType {
     /* Optional callback called after an entry has been reallocated (due to
      * active defrag). Only called if the entry has metadata. */
     void (*afterReplaceEntry)(dict *d, dictEntry *entry);
+    /* Optional callbacks called when a rehashing of the dict starts, and
+     * when it completes, including when the dict is emptied or released while
+     * rehashing. */
+    void (*rehashingStarted)(dict *d);
+    void (*rehashingCompleted)(dict *d);
 } dictType;
 
 #define DICTHT_SIZE(exp) ((exp) == -1 ? 0 : (unsigned long)1<<(exp))
 #define DICTHT_SIZE_MASK(exp) ((exp) == -1 ? 0 : (DICTHT_SIZE(exp))-1)
 
+/* Number of entries in a bucket of an open addressing table. */
+#define DICT_BUCKET_SLOTS 3
+
 struct dict {
     dictType *type;
 
@@ -144,7 +159,8 @@ typedef struct {
                              ? (d)->type->dictMetadataBytes() : 0)
 
 #define dictHashKey(d, key) ((d)->type->hashFunction(key))
-#define dictSlots(d) (DICTHT_SIZE((d)->ht_size_exp[0])+DICTHT_SIZE((d)->ht_size_exp[1]))
+#define dictBuckets(d) (DICTHT_SIZE((d)->ht_size_exp[0])+DICTHT_SIZE((d)->ht_size_exp[1]))
+#define dictSlots(d) (dictBuckets(d)*((d)->type->open_addressing ? DICT_BUCKET_SLOTS : 1))
 #define dictSize(d) ((d)->ht_used[0]+(d)->ht_used[1])
 #define dictIsRehashing(d) ((d)->rehashidx != -1)
 #define dictPauseRehashing(d) ((d)->pauserehash++)
@@ -180,6 +196,9 @@ void dictFreeUnlinkedEntry(dict *d, dictEntry *he);
 dictEntry *dictTwoPhaseUnlinkFind(dict *d, const void *key, dictEntry ***plink, int *table_index);
 void dictTwoPhaseUnlinkFree(dict *d, dictEntry *he, dictEntry **plink, int table_index);
 void dictRelease(dict *d);
+int dictReleaseStep(dict *d, unsigned long *cursor, unsigned long buckets);
+unsigned long dictFreeBuckets(dict *d, int htidx, unsigned long from, unsigned long to);
+void dictMarkEmpty(dict *d);
 dictEntry * dictFind(dict *d, const void *key);
 void *dictFetchValue(dict *d, const void *key);
 int dictResize(dict *d);
@@ -221,6 +240,8 @@ void dictSetHashFunctionSeed(uint8_t *seed);
 uint8_t *dictGetHashFunctionSeed(void);
 unsigned long dictScan(dict *d, unsigned long v, dictScanFunction *fn, void *privdata);
 unsigned long dictScanDefrag(dict *d, unsigned long v, dictScanFunction *fn, dictDefragFunctions *defragfns, void *privdata);
+void dictScanPart(dict *d, unsigned long part, unsigned long parts, dictScanFunction *fn, void *privdata);
+void dictScanHashClass(dict *d, unsigned long class, int bits, dictScanFunction *fn, void *privdata);
 uint64_t dictGetHash(dict *d, const void *key);
 dictEntry *dictFindEntryByPtrAndHash(dict *d, const void *oldptr, uint64_t hash);
 
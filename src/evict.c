@@ -58,6 +58,7 @@ struct evictionPoolEntry {
     sds key;                    /* Key name. */
     sds cached;                 /* Cached SDS object for key name. */
     int dbid;                   /* Key DB number. */
+    int slot;                   /* Slot of the key, that is its dict. */
 };
 
 static struct evictionPoolEntry *EvictionPoolLRU;
@@ -130,6 +131,7 @@ void evictionPoolAlloc(void) {
         ep[j].key = NULL;
         ep[j].cached = sdsnewlen(NULL,EVPOOL_CACHED_SDS_SIZE);
         ep[j].dbid = 0;
+        ep[j].slot = 0;
     }
     EvictionPoolLRU = ep;
 }
@@ -141,9 +143,10 @@ void evictionPoolAlloc(void) {
  *
  * We insert keys on place in ascending order, so keys with the smaller
  * idle time are on the left, and keys with the higher idle time on the
- * right. */
+ * right. The keys are sampled from 'sampledict', the dict of the given slot.
+ * Returns the number of sampled keys. */
 
-void evictionPoolPopulate(int dbid, dict *sampledict, dict *keydict, struct evictionPoolEntry *pool) {
+unsigned int evictionPoolPopulate(int dbid, int slot, dict *sampledict, dict *keydict, struct evictionPoolEntry *pool) {
     int j, k, count;
     dictEntry *samples[server.maxmemory_samples];
 
@@ -237,7 +240,10 @@ void evictionPoolPopulate(int dbid, dict *sampledict, dict *keydict, struct evic
         }
         pool[k].idle = idle;
         pool[k].dbid = dbid;
+        pool[k].slot = slot;
     }
+
+    return count;
 }
 
 /* ----------------------------------------------------------------------------
@@ -325,6 +331,159 @@ unsigned long LFUDecrAndReturn(robj *o) {
     return counter;
 }
 
+/* ----------------------------------------------------------------------------
+ * Segmented LRU implementation.
+ *
+ * The allkeys-slru policy evicts from exact LRU lists instead of sampling.
+ * The keys of every DB are linked in two lists through the metadata of their
+ * dict entry: new keys enter the "probation" segment, and keys accessed again
+ * are moved to the "protected" segment, that can hold up to
+ * SLRU_PROTECTED_PERC percent of the keys of the DB: beyond that its least
+ * recently used keys are moved back to the head of the probation segment.
+ * The keys are evicted from the tail of the probation segment first, so that
+ * keys that are only accessed once, such as the ones read by a scan, don't
+ * evict the keys accessed more often.
+ *
+ * Every operation on the lists is O(1). The links cost two pointers per key,
+ * so they are only allocated if the policy is allkeys-slru when the server
+ * starts, and require the chained keyspace hash table. The segment of an
+ * entry is stored in the lowest bit of its 'prev' link.
+ * --------------------------------------------------------------------------*/
+
+#define SLRU_PROTECTED_PERC 80
+
+typedef struct slruLinks {
+    uintptr_t prev;     /* Previous entry, or'ed with the segment. */
+    dictEntry *next;    /* Next entry. */
+} slruLinks;
+
+static inline slruLinks *slruGetLinks(dictEntry *de) {
+    return dictEntryMetadata(de);
+}
+
+static inline int slruGetSegment(dictEntry *de) {
+    return slruGetLinks(de)->prev & 1;
+}
+
+static inline dictEntry *slruGetPrev(dictEntry *de) {
+    return (dictEntry *)(slruGetLinks(de)->prev & ~(uintptr_t)1);
+}
+
+static inline void slruSetPrev(dictEntry *de, dictEntry *prev) {
+    slruLinks *links = slruGetLinks(de);
+    links->prev = (uintptr_t)prev | (links->prev & 1);
+}
+
+/* Links 'de' at the head of the 'segment' list. */
+static void slruPushHead(dbSlru *slru, dictEntry *de, int segment) {
+    slruLinks *links = slruGetLinks(de);
+    links->prev = segment;
+    links->next = slru->head[segment];
+    if (links->next)
+        slruSetPrev(links->next, de);
+    else
+        slru->tail[segment] = de;
+    slru->head[segment] = de;
+    slru->len[segment]++;
+}
+
+/* Unlinks 'de' from the list of its segment. */
+static void slruUnlink(dbSlru *slru, dictEntry *de) {
+    int segment = slruGetSegment(de);
+    dictEntry *prev = slruGetPrev(de), *next = slruGetLinks(de)->next;
+    if (prev)
+        slruGetLinks(prev)->next = next;
+    else
+        slru->head[segment] = next;
+    if (next)
+        slruSetPrev(next, prev);
+    else
+        slru->tail[segment] = prev;
+    slru->len[segment]--;
+}
+
+/* Returns the size of the metadata of the keyspace entries when they are
+ * linked in SLRU lists. */
+size_t slruEntryMetadataSize(dict *d) {
+    UNUSED(d);
+    return sizeof(slruLinks);
+}
+
+/* Called when the entry 'de' of the keyspace dict 'd' was reallocated by
+ * the active defrag: its neighbors must point to the new entry. */
+void slruReplaceEntry(dict *d, dictEntry *de) {
+    dbDictMetadata *meta = dictMetadata(d);
+    dbSlru *slru = meta->slru;
+    int segment = slruGetSegment(de);
+    dictEntry *prev = slruGetPrev(de), *next = slruGetLinks(de)->next;
+    if (prev)
+        slruGetLinks(prev)->next = de;
+    else
+        slru->head[segment] = de;
+    if (next)
+        slruSetPrev(next, de);
+    else
+        slru->tail[segment] = de;
+}
+
+/* Links the entry of a key just added to 'db' in the probation segment. */
+void slruAddEntry(siderDb *db, dictEntry *de) {
+    if (db->slru) slruPushHead(db->slru, de, SLRU_PROBATION);
+}
+
+/* Unlinks the entry of a key about to be deleted from 'db'. */
+void slruDelEntry(siderDb *db, dictEntry *de) {
+    if (db->slru) slruUnlink(db->slru, de);
+}
+
+/* Moves the entry of a key of 'db' that was accessed at the head of the
+ * protected segment, demoting the least recently used protected key to
+ * the probation segment if the protected segment is full. */
+void slruTouchEntry(siderDb *db, dictEntry *de) {
+    dbSlru *slru = db->slru;
+    if (!slru) return;
+
+    slruUnlink(slru, de);
+    slruPushHead(slru, de, SLRU_PROTECTED);
+    if (slru->len[SLRU_PROTECTED] > 1 &&
+        slru->len[SLRU_PROTECTED] > dbSize(db, DB_MAIN)*SLRU_PROTECTED_PERC/100)
+    {
+        dictEntry *demoted = slru->tail[SLRU_PROTECTED];
+        slruUnlink(slru, demoted);
+        slruPushHead(slru, demoted, SLRU_PROBATION);
+    }
+}
+
+/* Returns the key to evict according to the allkeys-slru policy, storing
+ * its DB in '*dbid', or NULL if there are no keys. The candidates are the
+ * tails of the lists of every DB, the probation segment first, and the one
+ * idle for the longest time is picked. */
+static sds slruGetKeyToEvict(int *dbid) {
+    dictEntry *best = NULL;
+    int best_segment = 0;
+    unsigned long long best_idle = 0;
+
+    for (int j = 0; j < server.dbnum; j++) {
+        dbSlru *slru = server.db[j].slru;
+        if (!slru) continue;
+
+        int segment = slru->tail[SLRU_PROBATION] ? SLRU_PROBATION : SLRU_PROTECTED;
+        dictEntry *de = slru->tail[segment];
+        if (!de) continue;
+
+        unsigned long long idle = estimateObjectIdleTime(dictGetVal(de));
+        if (!best || segment < best_segment ||
+            (segment == best_segment && idle > best_idle))
+        {
+            best = de;
+            best_segment = segment;
+            best_idle = idle;
+            *dbid = j;
+        }
+    }
+    return best ? dictGetKey(best) : NULL;
+}
+
 /* We don't want to count AOF buffers and slaves output buffers as
  * used memory: the eviction should use mostly data size, because
  * it can cause feedback-loop when we push DELs into them, putting
@@ -332,7 +491,8 @@ unsigned long LFUDecrAndReturn(robj *o) {
  * need to evict more keys, and then generate more DELs, maybe cause
  * massive eviction loop, even all keys are evicted.
  *
- * This function returns the sum of AOF and replication buffer. */
+ * This function returns the sum of AOF and replication buffer, and of the
+ * keys buffered by a fork-less snapshot. */
 size_t freeMemoryGetNotCountedMemory(void) {
     size_t overhead = 0;
 
@@ -366,7 +526,11 @@ size_t freeMemoryGetNotCountedMemory(void) {
 
     if (server.aof_state != AOF_OFF) {
         overhead += sdsAllocSize(server.aof_buf);
+        overhead += sdsAllocSize(server.aof_block);
     }
+
+    /* The keys saved by a fork-less snapshot before they were written. */
+    overhead += rdbForklessSaveMemory();
     return overhead;
 }
 
@@ -511,6 +675,258 @@ static unsigned long evictionTimeLimitUs(void) {
     return ULONG_MAX;   /* No limit to eviction time */
 }
 
+/* Pick the best key to evict according to the maxmemory policy, storing the
+ * ID of its DB in *dbid. The returned key is owned by the keyspace. Returns
+ * NULL when there are no keys that can be evicted. */
+static sds evictionGetBestKey(int *dbid) {
+    int j, k, i;
+    static unsigned int next_db = 0;
+    sds bestkey = NULL;
+    int bestdbid = -1;
+    siderDb *db;
+    dict *dict;
+    dbKeyType keyType;
+    dictEntry *de;
+
+    if (server.maxmemory_policy & (MAXMEMORY_FLAG_LRU|MAXMEMORY_FLAG_LFU) ||
+        server.maxmemory_policy == MAXMEMORY_VOLATILE_TTL)
+    {
+        struct evictionPoolEntry *pool = EvictionPoolLRU;
+
+        while (bestkey == NULL) {
+            unsigned long total_keys = 0, keys;
+
+            /* We don't want to make local-db choices when expiring keys,
+             * so to start populate the eviction pool sampling keys from
+             * every DB. */
+            for (i = 0; i < server.dbnum; i++) {
+                db = server.db+i;
+                keyType = (server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) ?
+                          DB_MAIN : DB_EXPIRES;
+                if ((keys = dbSize(db, keyType)) == 0) continue;
+                total_keys += keys;
+
+                /* In cluster mode the keys are sampled from the dict of
+                 * a slot picked at random, weighted by its number of keys.
+                 * Sample more slots until we got enough keys, unless the
+                 * DB has few keys: the dicts are then sparsely populated. */
+                unsigned long sampled_keys = 0;
+                int l = db->sub_dict[keyType].non_empty_dicts;
+                while (l--) {
+                    int slot = getFairRandomSlot(db, keyType);
+                    sampled_keys += evictionPoolPopulate(i, slot,
+                        dbGetDict(db, slot, keyType), db->dict[slot], pool);
+                    if (sampled_keys >= (unsigned long)server.maxmemory_samples ||
+                        keys < (unsigned long)server.maxmemory_samples*10)
+                    {
+                        break;
+                    }
+                }
+            }
+            if (!total_keys) break; /* No keys to evict. */
+
+            /* Go backward from best to worst element to evict. */
+            for (k = EVPOOL_SIZE-1; k >= 0; k--) {
+                if (pool[k].key == NULL) continue;
+                bestdbid = pool[k].dbid;
+
+                keyType = (server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) ?
+                          DB_MAIN : DB_EXPIRES;
+                de = dictFind(dbGetDict(server.db+bestdbid, pool[k].slot, keyType),
+                              pool[k].key);
+
+                /* Remove the entry from the pool. */
+                if (pool[k].key != pool[k].cached)
+                    sdsfree(pool[k].key);
+                pool[k].key = NULL;
+                pool[k].idle = 0;
+
+                /* If the key exists, is our pick. Otherwise it is
+                 * a ghost and we need to try the next element. */
+                if (de) {
+                    bestkey = dictGetKey(de);
+                    break;
+                } else {
+                    /* Ghost... Iterate again. */
+                }
+            }
+        }
+    }
+
+    /* allkeys-slru policy */
+    else if (server.maxmemory_policy & MAXMEMORY_FLAG_SLRU) {
+        bestkey = slruGetKeyToEvict(&bestdbid);
+    }
+
+    /* volatile-random and allkeys-random policy */
+    else if (server.maxmemory_policy == MAXMEMORY_ALLKEYS_RANDOM ||
+             server.maxmemory_policy == MAXMEMORY_VOLATILE_RANDOM)
+    {
+        /* When evicting a random key, we try to evict a key for
+         * each DB, so we use the static 'next_db' variable to
+         * incrementally visit all DBs. */
+        for (i = 0; i < server.dbnum; i++) {
+            j = (++next_db) % server.dbnum;
+            db = server.db+j;
+            keyType = (server.maxmemory_policy == MAXMEMORY_ALLKEYS_RANDOM) ?
+                      DB_MAIN : DB_EXPIRES;
+            if (dbSize(db, keyType) != 0) {
+                dict = dbGetDict(db, getFairRandomSlot(db, keyType), keyType);
+                de = dictGetRandomKey(dict);
+                bestkey = dictGetKey(de);
+                bestdbid = j;
+                break;
+            }
+        }
+    }
+
+    *dbid = bestdbid;
+    return bestkey;
+}
+
+/* Evict the given key, deleting it in the lazyfree thread when 'lazy' is set,
+ * and return the amount of memory freed by the deletion itself. */
+static long long evictKey(siderDb *db, sds key, int lazy) {
+    mstime_t eviction_latency;
+    long long delta;
+    robj *keyobj = createStringObject(key,sdslen(key));
+
+    /* We compute the amount of memory freed by db*Delete() alone.
+     * It is possible that actually the memory needed to propagate
+     * the DEL in AOF and replication link is greater than the one
+     * we are freeing removing the key, but we can't account for
+     * that otherwise we would never exit the loop.
+     *
+     * Same for CSC invalidation messages generated by signalModifiedKey.
+     *
+     * AOF and Output buffer memory will be freed eventually so
+     * we only care about memory used by the key space. */
+    enterExecutionUnit(1, 0);
+    delta = (long long) zmalloc_used_memory();
+    latencyStartMonitor(eviction_latency);
+    dbGenericDelete(db,keyobj,lazy,DB_FLAG_KEY_EVICTED);
+    latencyEndMonitor(eviction_latency);
+    latencyAddSampleIfNeeded("eviction-del",eviction_latency);
+    delta -= (long long) zmalloc_used_memory();
+    server.stat_evictedkeys++;
+    signalModifiedKey(NULL,db,keyobj);
+    notifyKeyspaceEvent(NOTIFY_EVICTED, "evicted",
+        keyobj, db->id);
+    propagateDeletion(db,keyobj,lazy);
+    exitExecutionUnit();
+    postExecutionUnitOperations();
+    decrRefCount(keyobj);
+    return delta;
+}
+
+/* ----------------------------------------------------------------------------
+ * Background eviction
+ *
+ * When "maxmemory-eviction-watermark-high" is set, keys are evicted ahead of
+ * the maxmemory limit: once the used memory crosses the high watermark, a
+ * timer evicts keys in short slices of time until the used memory is back
+ * below the low watermark. The evicted values are released by the lazyfree
+ * thread, so that the clients writing near the limit pay neither for the
+ * evictions nor for the frees in the latency of their commands, as long as
+ * the timer keeps up with the write rate.
+ * --------------------------------------------------------------------------*/
+
+#define EVICTION_BG_SLICE_US 500    /* Max eviction time of every timer call. */
+#define EVICTION_BG_PERIOD_MS 1     /* Delay between two timer calls. */
+
+static int isBackgroundEvictionRunning = 0;
+
+/* Return the limit in bytes of a watermark, a percentage of maxmemory. */
+static size_t evictionWatermarkLimit(int perc) {
+    return (size_t)((double)server.maxmemory * perc / 100);
+}
+
+/* Return how much memory must be freed to get below 'limit', not counting
+ * the replicas output buffers and the AOF buffer like getMaxmemoryState(). */
+static size_t evictionMemAboveLimit(size_t limit) {
+    size_t mem_used = zmalloc_used_memory();
+    if (mem_used <= limit) return 0;
+
+    size_t overhead = freeMemoryGetNotCountedMemory();
+    mem_used = (mem_used > overhead) ? mem_used-overhead : 0;
+    return (mem_used > limit) ? mem_used-limit : 0;
+}
+
+static int backgroundEvictionTimeProc(
+        struct aeEventLoop *eventLoop, long long id, void *clientData) {
+    UNUSED(eventLoop);
+    UNUSED(id);
+    UNUSED(clientData);
+
+    int high = server.maxmemory_eviction_watermark_high;
+    int low = min(server.maxmemory_eviction_watermark_low, high);
+    if (!server.maxmemory || !high ||
+        server.maxmemory_policy == MAXMEMORY_NO_EVICTION ||
+        !isSafeToPerformEvictions()) goto stop;
+
+    size_t mem_tofree = evictionMemAboveLimit(evictionWatermarkLimit(low));
+    if (mem_tofree == 0) goto stop;
+
+    /* The values evicted so far are still being released: wait for the
+     * lazyfree thread to catch up, otherwise the memory it is going to free
+     * would be freed a second time by evicting more keys. */
+    if (bioPendingJobsOfType(BIO_LAZY_FREE)) return EVICTION_BG_PERIOD_MS;
+
+    int keys_freed = 0;
+    long long mem_freed = 0;
+    int slaves = listLength(server.slaves);
+    monotime evictionTimer;
+    elapsedStart(&evictionTimer);
+
+    /* Try to smoke-out bugs (server.also_propagate should be empty here) */
+    serverAssert(server.also_propagate.numops == 0);
+
+    while (mem_freed < (long long)mem_tofree) {
+        int bestdbid;
+        sds bestkey = evictionGetBestKey(&bestdbid);
+        if (!bestkey) goto stop; /* Nothing left to evict. */
+
+        /* The memory released by the lazyfree thread is not accounted by
+         * evictKey(), use an estimate of the size of the value instead. */
+        siderDb *db = server.db+bestdbid;
+        robj *val = dictGetVal(dbFind(db,bestkey));
+        robj keyobj;
+        initStaticStringObject(keyobj,bestkey);
+        if (lazyfreeWouldFreeAsync(&keyobj,val,bestdbid)) {
+            mem_freed += objectComputeSize(&keyobj,val,
+                OBJ_COMPUTE_SIZE_DEF_SAMPLES,bestdbid);
+        }
+
+        mem_freed += evictKey(db,bestkey,1);
+        server.stat_evictedkeys_background++;
+        keys_freed++;
+
+        if (keys_freed % 16 == 0) {
+            if (slaves) flushSlavesOutputBuffers();
+            if (elapsedUs(evictionTimer) > EVICTION_BG_SLICE_US) break;
+        }
+    }
+    return EVICTION_BG_PERIOD_MS;
+
+stop:
+    isBackgroundEvictionRunning = 0;
+    return AE_NOMORE;
+}
+
+/* Start the background eviction if the used memory crossed the high
+ * watermark. 'mem_reported' is the memory used as reported by zmalloc. */
+static void startBackgroundEvictionIfNeeded(size_t mem_reported) {
+    if (isBackgroundEvictionRunning || !server.maxmemory ||
+        !server.maxmemory_eviction_watermark_high ||
+        server.maxmemory_policy == MAXMEMORY_NO_EVICTION) return;
+
+    size_t limit = evictionWatermarkLimit(server.maxmemory_eviction_watermark_high);
+    if (mem_reported <= limit || evictionMemAboveLimit(limit) == 0) return;
+
+    isBackgroundEvictionRunning = 1;
+    aeCreateTimeEvent(server.el, 0, backgroundEvictionTimeProc, NULL, NULL);
+}
+
 /* Check that memory usage is within the current "maxmemory" limit.  If over
  * "maxmemory", attempt to free memory by evicting data (if it's safe to do so).
  *
@@ -524,7 +940,8 @@ static unsigned long evictionTimeLimitUs(void) {
  * immediately resolve it.  In the case that some items have been evicted but
  * the "maxmemory" limit has not been achieved, an aeTimeProc will be started
  * which will continue to evict items until memory limits are achieved or
- * nothing more is evictable.
+ * nothing more is evictable. When the memory is below the limit, but above the
+ * high watermark, the background eviction is started instead.
  *
  * This should be called before execution of commands.  If EVICT_FAIL is
  * returned, commands which will result in increased memory usage should be
@@ -543,12 +960,21 @@ int performEvictions(void) {
     int keys_freed = 0;
     size_t mem_reported, mem_tofree;
     long long mem_freed; /* May be negative */
-    mstime_t latency, eviction_latency;
-    long long delta;
+    mstime_t latency;
     int slaves = listLength(server.slaves);
     int result = EVICT_FAIL;
 
     if (getMaxmemoryState(&mem_reported,NULL,&mem_tofree,NULL) == C_OK) {
+        startBackgroundEvictionIfNeeded(mem_reported);
+        result = EVICT_OK;
+        goto update_metrics;
+    }
+
+    /* The buffers idle in the reply pools are the cheapest memory to give
+     * back before evicting keys. */
+    if (emptyReplyPools() &&
+        getMaxmemoryState(&mem_reported,NULL,&mem_tofree,NULL) == C_OK)
+    {
         result = EVICT_OK;
         goto update_metrics;
     }
@@ -571,118 +997,13 @@ int performEvictions(void) {
     serverAssert(server.also_propagate.numops == 0);
 
     while (mem_freed < (long long)mem_tofree) {
-        int j, k, i;
-        static unsigned int next_db = 0;
-        sds bestkey = NULL;
         int bestdbid;
-        siderDb *db;
-        dict *dict;
-        dictEntry *de;
-
-        if (server.maxmemory_policy & (MAXMEMORY_FLAG_LRU|MAXMEMORY_FLAG_LFU) ||
-            server.maxmemory_policy == MAXMEMORY_VOLATILE_TTL)
-        {
-            struct evictionPoolEntry *pool = EvictionPoolLRU;
-
-            while (bestkey == NULL) {
-                unsigned long total_keys = 0, keys;
-
-                /* We don't want to make local-db choices when expiring keys,
-                 * so to start populate the eviction pool sampling keys from
-                 * every DB. */
-                for (i = 0; i < server.dbnum; i++) {
-                    db = server.db+i;
-                    dict = (server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) ?
-                            db->dict : db->expires;
-                    if ((keys = dictSize(dict)) != 0) {
-                        evictionPoolPopulate(i, dict, db->dict, pool);
-                        total_keys += keys;
-                    }
-                }
-                if (!total_keys) break; /* No keys to evict. */
-
-                /* Go backward from best to worst element to evict. */
-                for (k = EVPOOL_SIZE-1; k >= 0; k--) {
-                    if (pool[k].key == NULL) continue;
-                    bestdbid = pool[k].dbid;
-
-                    if (server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) {
-                        de = dictFind(server.db[bestdbid].dict,
-                            pool[k].key);
-                    } else {
-                        de = dictFind(server.db[bestdbid].expires,
-                            pool[k].key);
-                    }
-
-                    /* Remove the entry from the pool. */
-                    if (pool[k].key != pool[k].cached)
-                        sdsfree(pool[k].key);
-                    pool[k].key = NULL;
-                    pool[k].idle = 0;
-
-                    /* If the key exists, is our pick. Otherwise it is
-                     * a ghost and we need to try the next element. */
-                    if (de) {
-                        bestkey = dictGetKey(de);
-                        break;
-                    } else {
-                        /* Ghost... Iterate again. */
-                    }
-                }
-            }
-        }
-
-        /* volatile-random and allkeys-random policy */
-        else if (server.maxmemory_policy == MAXMEMORY_ALLKEYS_RANDOM ||
-                 server.maxmemory_policy == MAXMEMORY_VOLATILE_RANDOM)
-        {
-            /* When evicting a random key, we try to evict a key for
-             * each DB, so we use the static 'next_db' variable to
-             * incrementally visit all DBs. */
-            for (i = 0; i < server.dbnum; i++) {
-                j = (++next_db) % server.dbnum;
-                db = server.db+j;
-                dict = (server.maxmemory_policy == MAXMEMORY_ALLKEYS_RANDOM) ?
-                        db->dict : db->expires;
-                if (dictSize(dict) != 0) {
-                    de = dictGetRandomKey(dict);
-                    bestkey = dictGetKey(de);
-                    bestdbid = j;
-                    break;
-                }
-            }
-        }
+        sds bestkey = evictionGetBestKey(&bestdbid);
 
         /* Finally remove the selected key. */
         if (bestkey) {
-            db = server.db+bestdbid;
-            robj *keyobj = createStringObject(bestkey,sdslen(bestkey));
-            /* We compute the amount of memory freed by db*Delete() alone.
-             * It is possible that actually the memory needed to propagate
-             * the DEL in AOF and replication link is greater than the one
-             * we are freeing removing the key, but we can't account for
-             * that otherwise we would never exit the loop.
-             *
-             * Same for CSC invalidation messages generated by signalModifiedKey.
-             *
-             * AOF and Output buffer memory will be freed eventually so
-             * we only care about memory used by the key space. */
-            enterExecutionUnit(1, 0);
-            delta = (long long) zmalloc_used_memory();
-            latencyStartMonitor(eviction_latency);
-            dbGenericDelete(db,keyobj,server.lazyfree_lazy_eviction,DB_FLAG_KEY_EVICTED);
-            latencyEndMonitor(eviction_latency);
-            latencyAddSampleIfNeeded("eviction-del",eviction_latency);
-            delta -= (long long) zmalloc_used_memory();
-            mem_freed += delta;
-            server.stat_evictedkeys++;
-            signalModifiedKey(NULL,db,keyobj);
-            notifyKeyspaceEvent(NOTIFY_EVICTED, "evicted",
-                keyobj, db->id);
-            propagateDeletion(db,keyobj,server.lazyfree_lazy_eviction);
-            exitExecutionUnit();
-            postExecutionUnitOperations();
-            decrRefCount(keyobj);
+            mem_freed += evictKey(server.db+bestdbid,bestkey,
+                                  server.lazyfree_lazy_eviction);
             keys_freed++;
 
             if (keys_freed % 16 == 0) {
@@ -728,6 +1049,7 @@ cant_free:
          * short wait here if such jobs exist, but don't wait long.  */
         mstime_t lazyfree_latency;
         latencyStartMonitor(lazyfree_latency);
+        bioFlushLazyFreeJobs();
         while (bioPendingJobsOfType(BIO_LAZY_FREE) &&
               elapsedUs(evictionTimer) < eviction_time_limit_us) {
             if (getMaxmemoryState(NULL,NULL,NULL,NULL) == C_OK) {
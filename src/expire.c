@@ -66,6 +66,170 @@ int activeExpireCycleTryExpire(siderDb *db, dictEntry *de, long long now) {
     }
 }
 
+/*-----------------------------------------------------------------------------
+ * Expire index
+ *
+ * When active-expire-index is enabled every DB keeps its volatile keys in a
+ * radix tree ordered by expire time, so that the active expire cycle can
+ * reclaim exactly the keys that are due, in order, instead of sampling the
+ * expires dicts. The work of a cycle is then proportional to the number of
+ * expired keys, and keys don't linger in memory long after they expired.
+ *
+ * The elements of the tree are the 8 bytes big endian expire time, with the
+ * sign bit flipped so that the byte order is the numeric order, followed by
+ * the key name. The tree has no values. It is maintained by setExpire(),
+ * removeExpire() and dbGenericDelete(), and replaced together with the
+ * keyspace dicts of the DB.
+ *----------------------------------------------------------------------------*/
+
+#define EXPIRE_INDEX_TIME_LEN 8
+#define EXPIRE_INDEX_STATIC_KEY_LEN 128
+
+/* Encodes the index element of 'key' in 'buf' if it fits in 'buflen' bytes,
+ * otherwise in a new allocation. Returns the element, its length is stored
+ * in '*len'. */
+static unsigned char *expireIndexEncode(unsigned char *buf, size_t buflen,
+                                        sds key, long long when, size_t *len)
+{
+    uint64_t t = (uint64_t)when ^ (1ULL<<63);
+    *len = EXPIRE_INDEX_TIME_LEN+sdslen(key);
+    if (*len > buflen) buf = zmalloc(*len);
+    for (int j = 0; j < EXPIRE_INDEX_TIME_LEN; j++)
+        buf[j] = t >> (56-j*8);
+    memcpy(buf+EXPIRE_INDEX_TIME_LEN,key,sdslen(key));
+    return buf;
+}
+
+/* Returns the expire time of the index element 'ele'. */
+static long long expireIndexDecodeTime(unsigned char *ele) {
+    uint64_t t = 0;
+    for (int j = 0; j < EXPIRE_INDEX_TIME_LEN; j++)
+        t = (t<<8) | ele[j];
+    return (long long)(t ^ (1ULL<<63));
+}
+
+/* Adds 'key', expiring at 'when', to the expire index of 'db', if any. */
+void expireIndexInsert(siderDb *db, sds key, long long when) {
+    unsigned char buf[EXPIRE_INDEX_STATIC_KEY_LEN], *ele;
+    size_t len;
+
+    if (!db->expires_index) return;
+    ele = expireIndexEncode(buf,sizeof(buf),key,when,&len);
+    raxTryInsert(db->expires_index,ele,len,NULL,NULL);
+    if (ele != buf) zfree(ele);
+}
+
+/* Removes 'key', expiring at 'when', from the expire index of 'db', if any. */
+void expireIndexRemove(siderDb *db, sds key, long long when) {
+    unsigned char buf[EXPIRE_INDEX_STATIC_KEY_LEN], *ele;
+    size_t len;
+
+    if (!db->expires_index) return;
+    ele = expireIndexEncode(buf,sizeof(buf),key,when,&len);
+    raxRemove(db->expires_index,ele,len,NULL);
+    if (ele != buf) zfree(ele);
+}
+
+/* Creates or releases the expire index of 'db' according to the
+ * active-expire-index config. A new index is filled with the volatile
+ * keys of the DB. */
+void expireIndexUpdate(siderDb *db) {
+    if (server.active_expire_index && !db->expires_index) {
+        dbIterator dbit;
+        dictEntry *de;
+
+        db->expires_index = raxNew();
+        dbInitIterator(&dbit, db, DB_EXPIRES);
+        while ((de = dbIteratorNext(&dbit)) != NULL)
+            expireIndexInsert(db,dictGetKey(de),dictGetSignedIntegerVal(de));
+        dbResetIterator(&dbit);
+    } else if (!server.active_expire_index && db->expires_index) {
+        raxFree(db->expires_index);
+        db->expires_index = NULL;
+    }
+}
+
+/* Returns the number of keys in the expire indexes of all the DBs. */
+unsigned long long expireIndexSize(void) {
+    unsigned long long size = 0;
+    for (int j = 0; j < server.dbnum; j++) {
+        if (server.db[j].expires_index)
+            size += raxSize(server.db[j].expires_index);
+    }
+    return size;
+}
+
+/* Returns how many milliseconds ago the oldest key of the expire indexes,
+ * that was not reclaimed yet, expired. Zero if no key is past its expire
+ * time. */
+long long expireIndexLag(void) {
+    long long now = mstime(), lag = 0;
+
+    for (int j = 0; j < server.dbnum; j++) {
+        rax *idx = server.db[j].expires_index;
+        raxIterator ri;
+
+        if (!idx || raxSize(idx) == 0) continue;
+        raxStart(&ri,idx);
+        raxSeek(&ri,"^",NULL,0);
+        if (raxNext(&ri)) {
+            long long when = expireIndexDecodeTime(ri.key);
+            if (now - when > lag) lag = now - when;
+        }
+        raxStop(&ri);
+    }
+    return lag;
+}
+
+/* Expires the keys of the expire indexes that are past their expire time,
+ * oldest first, until there are none or the 'timelimit' microseconds since
+ * 'start' are elapsed. Returns 1 if the time limit was reached. */
+static int expireIndexCycle(long long start, long long timelimit) {
+    long long now = mstime();
+    unsigned long expired = 0;
+
+    for (int j = 0; j < server.dbnum; j++) {
+        siderDb *db = server.db+j;
+        raxIterator ri;
+
+        if (!db->expires_index) continue;
+        raxStart(&ri,db->expires_index);
+        while (1) {
+            /* The tree is modified by the deletion of the key, so seek the
+             * first element again every time. */
+            raxSeek(&ri,"^",NULL,0);
+            if (!raxNext(&ri)) break;
+            long long when = expireIndexDecodeTime(ri.key);
+            if (when >= now) break;
+
+            robj *keyobj = createStringObject((char*)ri.key+EXPIRE_INDEX_TIME_LEN,
+                                              ri.key_len-EXPIRE_INDEX_TIME_LEN);
+            dictEntry *de = dbFindExpires(db,keyobj->ptr);
+            if (de && dictGetSignedIntegerVal(de) == when) {
+                enterExecutionUnit(1, 0);
+                deleteExpiredKeyAndPropagate(db,keyobj);
+                exitExecutionUnit();
+                /* Propagate the DEL command */
+                postExecutionUnitOperations();
+                if (now - when > server.stat_expire_index_lag_max)
+                    server.stat_expire_index_lag_max = now - when;
+            } else {
+                /* Never expected, but don't loop on a stale element. */
+                raxRemove(db->expires_index,ri.key,ri.key_len,NULL);
+            }
+            decrRefCount(keyobj);
+
+            if ((++expired & 0xf) == 0 && ustime()-start > timelimit) {
+                raxStop(&ri);
+                server.stat_expired_time_cap_reached_count++;
+                return 1;
+            }
+        }
+        raxStop(&ri);
+    }
+    return 0;
+}
+
 /* Try to expire a few timed out keys. The algorithm used is adaptive and
  * will use few CPU cycles if there are few expiring keys, otherwise
  * it will get more aggressive to avoid that too much memory is used by
@@ -172,10 +336,12 @@ void activeExpireCycle(int type) {
     if (type == ACTIVE_EXPIRE_CYCLE_FAST) {
         /* Don't start a fast cycle if the previous cycle did not exit
          * for time limit, unless the percentage of estimated stale keys is
-         * too high. Also never repeat a fast cycle for the same period
-         * as the fast cycle total duration itself. */
+         * too high, or with the expire index, some key is already expired.
+         * Also never repeat a fast cycle for the same period as the fast
+         * cycle total duration itself. */
         if (!timelimit_exit &&
-            server.stat_expired_stale_perc < config_cycle_acceptable_stale)
+            (server.active_expire_index ? expireIndexLag() == 0 :
+             server.stat_expired_stale_perc < config_cycle_acceptable_stale))
             return;
 
         if (start < last_fast_cycle + (long long)config_cycle_fast_duration*2)
@@ -214,6 +380,13 @@ void activeExpireCycle(int type) {
     /* Try to smoke-out bugs (server.also_propagate should be empty here) */
     serverAssert(server.also_propagate.numops == 0);
 
+    /* With the expire index the due keys are known, there is nothing to
+     * sample. */
+    if (server.active_expire_index) {
+        timelimit_exit = expireIndexCycle(start,timelimit);
+        dbs_per_call = 0;
+    }
+
     for (j = 0; j < dbs_per_call && timelimit_exit == 0; j++) {
         /* Scan callback data including expired and checked count per iteration. */
         expireScanData data;
@@ -231,22 +404,26 @@ void activeExpireCycle(int type) {
          * we scanned. The percentage, stored in config_cycle_acceptable_stale
          * is not fixed, but depends on the Sider configured "expire effort". */
         do {
-            unsigned long num, slots;
+            unsigned long num;
             iteration++;
 
             /* If there is nothing to expire try next DB ASAP. */
-            if ((num = dictSize(db->expires)) == 0) {
+            if ((num = dbSize(db, DB_EXPIRES)) == 0) {
                 db->avg_ttl = 0;
                 break;
             }
-            slots = dictSlots(db->expires);
             data.now = mstime();
 
             /* When there are less than 1% filled slots, sampling the key
              * space is expensive, so stop here waiting for better times...
-             * The dictionary will be resized asap. */
-            if (slots > DICT_HT_INITIAL_SIZE &&
-                (num*100/slots < 1)) break;
+             * The dictionary will be resized asap. In cluster mode every
+             * slot has its own dict, resized on its own, and the scan skips
+             * the empty ones. */
+            if (db->dict_count == 1) {
+                unsigned long slots = dictSlots(db->expires[0]);
+                if (slots > DICT_HT_INITIAL_SIZE &&
+                    (num*100/slots < 1)) break;
+            }
 
             /* The main collection cycle. Scan through keys among keys
              * with an expire set, checking for expired ones. */
@@ -272,8 +449,8 @@ void activeExpireCycle(int type) {
             long checked_buckets = 0;
 
             while (data.sampled < num && checked_buckets < max_buckets) {
-                db->expires_cursor = dictScan(db->expires, db->expires_cursor,
-                                              expireScanCallback, &data);
+                db->expires_cursor = dbScan(db, DB_EXPIRES, db->expires_cursor,
+                                            expireScanCallback, &data);
                 checked_buckets++;
             }
             total_expired += data.expired;
@@ -380,7 +557,7 @@ void expireSlaveKeys(void) {
         while(dbids && dbid < server.dbnum) {
             if ((dbids & 1) != 0) {
                 siderDb *db = server.db+dbid;
-                dictEntry *expire = dictFind(db->expires,keyname);
+                dictEntry *expire = dbFindExpires(db,keyname);
                 int expired = 0;
 
                 if (expire &&
@@ -5,6 +5,7 @@
 
 static siderAtomic size_t lazyfree_objects = 0;
 static siderAtomic size_t lazyfreed_objects = 0;
+static size_t incrementally_freed_objects = 0; /* See freeObjIncremental(). */
 
 /* Release objects from the lazyfree thread. It's just decrRefCount()
  * updating the count of objects to release. */
@@ -15,18 +16,59 @@ void lazyfreeFreeObject(void *args[]) {
     atomicIncr(lazyfreed_objects,1);
 }
 
-/* Release a database from the lazyfree thread. The 'db' pointer is the
- * database which was substituted with a fresh one in the main thread
- * when the database was logically deleted. */
+/* A database which was substituted with a fresh one in the main thread when
+ * it was logically deleted. The buckets of all its keyspace dicts are split
+ * in 'parts' ranges, released by different lazyfree jobs, so that a big
+ * database is released by all the lazyfree threads. */
+typedef struct lazyfreeDb {
+    siderDb db;
+    unsigned long long buckets; /* Buckets of all the keyspace dicts. */
+    unsigned long parts;
+    unsigned long parts_left;   /* Parts not released yet, under 'lock'. */
+    pthread_mutex_t lock;
+} lazyfreeDb;
+
+/* Release a range of the buckets of a database from a lazyfree thread. The
+ * job releasing the last range also releases the dicts and the database. */
 void lazyfreeFreeDatabase(void *args[]) {
-    dict *ht1 = (dict *) args[0];
-    dict *ht2 = (dict *) args[1];
+    lazyfreeDb *lfdb = args[0];
+    unsigned long part = (unsigned long) args[1];
+    siderDb *olddb = &lfdb->db;
+    unsigned long long from = lfdb->buckets * part / lfdb->parts;
+    unsigned long long to = lfdb->buckets * (part + 1) / lfdb->parts;
+    unsigned long long pos = 0;
+    size_t numkeys = 0;
 
-    size_t numkeys = dictSize(ht1);
-    dictRelease(ht1);
-    dictRelease(ht2);
+    for (dbKeyType keyType = DB_MAIN; keyType <= DB_EXPIRES && pos < to; keyType++) {
+        for (int slot = 0; slot < olddb->dict_count && pos < to; slot++) {
+            dict *d = dbGetDict(olddb, slot, keyType);
+            for (int htidx = 0; htidx <= 1; htidx++) {
+                unsigned long long size = DICTHT_SIZE(d->ht_size_exp[htidx]);
+                if (pos + size > from && pos < to) {
+                    unsigned long start = from > pos ? from - pos : 0;
+                    unsigned long end = to < pos + size ? to - pos : size;
+                    unsigned long freed = dictFreeBuckets(d, htidx, start, end);
+                    if (keyType == DB_MAIN) numkeys += freed;
+                }
+                pos += size;
+            }
+        }
+    }
     atomicDecr(lazyfree_objects,numkeys);
     atomicIncr(lazyfreed_objects,numkeys);
+
+    pthread_mutex_lock(&lfdb->lock);
+    unsigned long left = --lfdb->parts_left;
+    pthread_mutex_unlock(&lfdb->lock);
+    if (left) return;
+
+    for (dbKeyType keyType = DB_MAIN; keyType <= DB_EXPIRES; keyType++) {
+        for (int slot = 0; slot < olddb->dict_count; slot++)
+            dictMarkEmpty(dbGetDict(olddb, slot, keyType));
+    }
+    dbReleaseDicts(olddb);
+    pthread_mutex_destroy(&lfdb->lock);
+    zfree(lfdb);
 }
 
 /* Release the key tracking table. */
@@ -84,6 +126,7 @@ size_t lazyfreeGetFreedObjectsCount(void) {
 
 void lazyfreeResetStats(void) {
     atomicSet(lazyfreed_objects,0);
+    incrementally_freed_objects = 0;
 }
 
 /* Return the amount of work needed in order to free an object.
@@ -155,14 +198,20 @@ size_t lazyfreeGetFreeEffort(robj *key, robj *obj, int dbid) {
  * slower... So under a certain limit we just free the object synchronously. */
 #define LAZYFREE_THRESHOLD 64
 
-/* Free an object, if the object is huge enough, free it in async way. */
-void freeObjAsync(robj *key, robj *obj, int dbid) {
+/* Return 1 if freeObjAsync() would release the object in the lazyfree
+ * thread, 0 if it would release it synchronously. */
+int lazyfreeWouldFreeAsync(robj *key, robj *obj, int dbid) {
     size_t free_effort = lazyfreeGetFreeEffort(key,obj,dbid);
     /* Note that if the object is shared, to reclaim it now it is not
      * possible. This rarely happens, however sometimes the implementation
      * of parts of the Sider core may call incrRefCount() to protect
      * objects, and then call dbDelete(). */
-    if (free_effort > LAZYFREE_THRESHOLD && obj->refcount == 1) {
+    return free_effort > LAZYFREE_THRESHOLD && obj->refcount == 1;
+}
+
+/* Free an object, if the object is huge enough, free it in async way. */
+void freeObjAsync(robj *key, robj *obj, int dbid) {
+    if (lazyfreeWouldFreeAsync(key,obj,dbid)) {
         atomicIncr(lazyfree_objects,1);
         bioCreateLazyFreeJob(lazyfreeFreeObject,1,obj);
     } else {
@@ -170,15 +219,41 @@ void freeObjAsync(robj *key, robj *obj, int dbid) {
     }
 }
 
+/* Minimum number of keys released by every lazyfree job of emptyDbAsync(). */
+#define LAZYFREE_DB_PART_KEYS 1024
+
 /* Empty a Sider DB asynchronously. What the function does actually is to
  * create a new empty set of hash tables and scheduling the old ones for
- * lazy freeing. */
+ * lazy freeing, split in a few jobs per lazyfree thread. */
 void emptyDbAsync(siderDb *db) {
-    dict *oldht1 = db->dict, *oldht2 = db->expires;
-    db->dict = dictCreate(&dbDictType);
-    db->expires = dictCreate(&dbExpiresDictType);
-    atomicIncr(lazyfree_objects,dictSize(oldht1));
-    bioCreateLazyFreeJob(lazyfreeFreeDatabase,2,oldht1,oldht2);
+    /* Only the keyspace dicts, and their stats, are handed over. */
+    lazyfreeDb *lfdb = zcalloc(sizeof(*lfdb));
+    siderDb *olddb = &lfdb->db;
+    olddb->dict = db->dict;
+    olddb->expires = db->expires;
+    olddb->expires_index = db->expires_index;
+    olddb->slru = db->slru;
+    olddb->dict_count = db->dict_count;
+    memcpy(olddb->sub_dict, db->sub_dict, sizeof(olddb->sub_dict));
+    /* The rehashing list is only accessed by the main thread. */
+    dbUnlinkRehashingDicts(olddb);
+    /* The values may still be referenced by the clients output buffers. */
+    unshareClientsReplyObjects();
+    dbInitDicts(db);
+
+    size_t numkeys = dbSize(olddb, DB_MAIN);
+    for (dbKeyType keyType = DB_MAIN; keyType <= DB_EXPIRES; keyType++) {
+        for (int slot = 0; slot < olddb->dict_count; slot++)
+            lfdb->buckets += dictBuckets(dbGetDict(olddb, slot, keyType));
+    }
+    lfdb->parts = 1 + numkeys / LAZYFREE_DB_PART_KEYS;
+    if (lfdb->parts > (unsigned long) server.lazyfree_threads * 4)
+        lfdb->parts = server.lazyfree_threads * 4;
+    lfdb->parts_left = lfdb->parts;
+    pthread_mutex_init(&lfdb->lock, NULL);
+    atomicIncr(lazyfree_objects,numkeys);
+    for (unsigned long part = 0; part < lfdb->parts; part++)
+        bioCreateLazyFreeJob(lazyfreeFreeDatabase,2,lfdb,(void *) part);
 }
 
 /* Free the key tracking table.
@@ -225,3 +300,91 @@ void freeReplicationBacklogRefMemAsync(list *blocks, rax *index) {
         raxFree(index);
     }
 }
+
+/* With "lazyfree-incremental", the values that freeObjAsync() would release
+ * in the lazyfree thread are released by the main thread instead when the
+ * deletion is not lazy: the value is unlinked from the keyspace right away,
+ * and dismantled a few buckets or nodes at a time before sleeping, so that
+ * the time spent releasing it is bounded in every event loop iteration. */
+#define INCREMENTAL_FREE_CYCLE_US 1000 /* Time of an incrementalFreeCycle(). */
+#define INCREMENTAL_FREE_STEP 64       /* Buckets or nodes freed by a step. */
+
+static list *incremental_free_queue = NULL;
+static unsigned long incremental_free_cursor = 0; /* Of the first object. */
+
+/* Return 1 if the encoding of the object can be released in steps. */
+static int canFreeObjIncremental(robj *obj) {
+    return (obj->type == OBJ_LIST && obj->encoding == OBJ_ENCODING_QUICKLIST) ||
+           (obj->type == OBJ_SET && obj->encoding == OBJ_ENCODING_HT) ||
+           (obj->type == OBJ_HASH && obj->encoding == OBJ_ENCODING_HT) ||
+           (obj->type == OBJ_ZSET && obj->encoding == OBJ_ENCODING_SKIPLIST);
+}
+
+/* Free an object, if the object is huge enough, free it in steps. The other
+ * objects, including the big streams and module values, are freed
+ * synchronously. */
+void freeObjIncremental(robj *key, robj *obj, int dbid) {
+    if (canFreeObjIncremental(obj) && lazyfreeWouldFreeAsync(key,obj,dbid)) {
+        if (!incremental_free_queue) incremental_free_queue = listCreate();
+        listAddNodeTail(incremental_free_queue,obj);
+    } else {
+        decrRefCount(obj);
+    }
+}
+
+/* Free a step of the object. Returns 1 when the object was released. */
+static int freeObjStep(robj *obj, unsigned long *cursor) {
+    if (obj->type == OBJ_LIST) {
+        quicklist *ql = obj->ptr;
+        for (int j = 0; j < INCREMENTAL_FREE_STEP && ql->len; j++)
+            quicklistDelRange(ql,0,ql->head->count);
+        if (ql->len) return 0;
+        quicklistRelease(ql);
+    } else if (obj->type == OBJ_SET || obj->type == OBJ_HASH) {
+        if (!dictReleaseStep(obj->ptr,cursor,INCREMENTAL_FREE_STEP)) return 0;
+    } else if (obj->type == OBJ_ZSET) {
+        /* The elements are shared by the dict and the skiplist, and are freed
+         * with the skiplist nodes. */
+        zset *zs = obj->ptr;
+        if (zs->dict) {
+            if (!dictReleaseStep(zs->dict,cursor,INCREMENTAL_FREE_STEP)) return 0;
+            zs->dict = NULL;
+        }
+        if (!zslReleaseStep(zs->zsl,INCREMENTAL_FREE_STEP)) return 0;
+        zfree(zs);
+    } else {
+        serverPanic("Unknown object type in freeObjStep()");
+    }
+    zfree(obj);
+    return 1;
+}
+
+/* Free the queued objects for up to INCREMENTAL_FREE_CYCLE_US. This is called
+ * before sleeping, and returns the number of objects still to free. */
+size_t incrementalFreeCycle(void) {
+    if (!incremental_free_queue || !listLength(incremental_free_queue)) return 0;
+
+    monotime timer;
+    elapsedStart(&timer);
+    while (listLength(incremental_free_queue) &&
+           elapsedUs(timer) < INCREMENTAL_FREE_CYCLE_US)
+    {
+        listNode *ln = listFirst(incremental_free_queue);
+        if (freeObjStep(listNodeValue(ln),&incremental_free_cursor)) {
+            listDelNode(incremental_free_queue,ln);
+            incremental_free_cursor = 0;
+            incrementally_freed_objects++;
+        }
+    }
+    return listLength(incremental_free_queue);
+}
+
+/* Return the number of objects to free in steps. */
+size_t incrementalFreeGetPendingObjectsCount(void) {
+    return incremental_free_queue ? listLength(incremental_free_queue) : 0;
+}
+
+/* Return the number of objects that have been freed in steps. */
+size_t incrementalFreeGetFreedObjectsCount(void) {
+    return incrementally_freed_objects;
+}
@@ -31,17 +31,37 @@
 #include "atomicvar.h"
 #include "cluster.h"
 #include "script.h"
+#include "slowlog.h"
 #include "fpconv_dtoa.h"
+#include "respscan.h"
 #include <sys/socket.h>
 #include <sys/uio.h>
+#include <netinet/tcp.h>
 #include <math.h>
 #include <ctype.h>
 
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
 static void setProtocolError(const char *errstr, client *c);
 static void pauseClientsByClient(mstime_t end, int isPauseClientAll);
 int postponeClientRead(client *c);
+static int ioThreadTryExecuteCommand(client *c);
+static void processQueryBufferData(client *c, size_t nread);
+static void ioThreadAttachClient(client *c);
+static void ioThreadResumeClient(client *c);
+static void ioThreadDetachClient(client *c);
+static void initIOThreadsEventLoops(void);
+static void ioThreadRunEventLoop(void);
 char *getClientSockname(client *c);
 int ProcessingEventsWhileBlocked = 0; /* See processEventsWhileBlocked(). */
+static __thread int io_thread_id = 0; /* Set by IOThreadMain(), 0 for the main thread. */
+static __thread sds thread_shared_qb = NULL; /* See takeReusableQueryBuf(). */
+static void releaseReplyObject(robj *o);
+static void releaseReplyBlock(clientReplyBlock *o);
+static void resetReusableQueryBuf(client *c);
 
 /* Return the size consumed from the allocator, for the specified SDS string,
  * including internal fragmentation. This function is used in order to compute
@@ -76,13 +96,135 @@ size_t getStringObjectLen(robj *o) {
 /* Client.reply list dup and free methods. */
 void *dupClientReplyValue(void *o) {
     clientReplyBlock *old = o;
+    if (old->obj) {
+        clientReplyBlock *buf = zmalloc(sizeof(clientReplyBlock));
+        memcpy(buf, o, sizeof(clientReplyBlock));
+        incrRefCount(buf->obj);
+        return buf;
+    }
     clientReplyBlock *buf = zmalloc(sizeof(clientReplyBlock) + old->size);
     memcpy(buf, o, sizeof(clientReplyBlock) + old->size);
     return buf;
 }
 
 void freeClientReplyValue(void *o) {
-    zfree(o);
+    clientReplyBlock *block = o;
+    if (!block) return;
+    if (block->obj) {
+        releaseReplyObject(block->obj);
+        zfree(block);
+    } else {
+        releaseReplyBlock(block);
+    }
+}
+
+/* -----------------------------------------------------------------------------
+ * Reply buffers pool
+ * -------------------------------------------------------------------------- */
+
+/* Every client allocates a static reply buffer when created, and standard
+ * sized reply blocks while its output does not fit there: with many short
+ * lived connections, or many clients receiving mid sized replies, most of
+ * the allocator traffic is for buffers of the very same size. Such buffers
+ * are recycled through a free list per size class instead.
+ *
+ * The pools are only accessed by the main thread: IO threads allocate from
+ * the allocator, and hand back the blocks they release, see
+ * releaseReplyBlock(). The other threads, like the module threads creating
+ * and freeing thread safe contexts without the GIL, bypass the pools. Buffers
+ * idle in the pools are given back to the allocator by replyPoolsCron(), or
+ * when maxmemory is reached. */
+void initReplyPools(void) {
+    static const size_t sizes[REPLY_POOL_CLASSES] = {
+        PROTO_REPLY_CHUNK_BYTES,
+        PROTO_REPLY_CHUNK_BYTES + sizeof(clientReplyBlock)
+    };
+
+    for (int j = 0; j < REPLY_POOL_CLASSES; j++) {
+        replyBufferPool *pool = &server.reply_pool[j];
+        /* Learn the usable size of the class from a first allocation. */
+        void *buf = zmalloc_usable(sizes[j], &pool->usable);
+        pool->free = NULL;
+        pool->len = pool->min_len = 0;
+        replyPoolRelease(j, buf, pool->usable);
+    }
+}
+
+/* Return a buffer of the specified pool class, storing its usable size in
+ * '*usable'. The buffer should be released with replyPoolRelease(). */
+void *replyPoolAlloc(int class, size_t *usable) {
+    replyBufferPool *pool = &server.reply_pool[class];
+
+    if (pthread_equal(pthread_self(),server.main_thread_id)) {
+        if (pool->len) {
+            void *buf = pool->free;
+            pool->free = *(void **)buf;
+            if (--pool->len < pool->min_len) pool->min_len = pool->len;
+            server.stat_reply_pool_hits++;
+            *usable = pool->usable;
+            return buf;
+        }
+        server.stat_reply_pool_misses++;
+    }
+    return zmalloc_usable(pool->usable, usable);
+}
+
+/* Give back a reply buffer. Buffers not matching the size of the class, like
+ * the ones resized by clientsCronResizeOutputBuffer(), are just freed. */
+void replyPoolRelease(int class, void *buf, size_t usable) {
+    replyBufferPool *pool = &server.reply_pool[class];
+
+    if (usable != pool->usable || pool->len >= REPLY_POOL_MAX_LEN ||
+        !pthread_equal(pthread_self(),server.main_thread_id))
+    {
+        zfree(buf);
+        return;
+    }
+    *(void **)buf = pool->free;
+    pool->free = buf;
+    pool->len++;
+}
+
+/* Free up to 'count' buffers of the pool. */
+static size_t replyPoolTrim(replyBufferPool *pool, int count) {
+    size_t freed = 0;
+
+    while (count-- && pool->len) {
+        void *buf = pool->free;
+        pool->free = *(void **)buf;
+        pool->len--;
+        freed += pool->usable;
+        zfree(buf);
+    }
+    if (pool->min_len > pool->len) pool->min_len = pool->len;
+    return freed;
+}
+
+/* Return the memory held by the free buffers of the pools. */
+size_t replyPoolsMemory(void) {
+    size_t mem = 0;
+    for (int j = 0; j < REPLY_POOL_CLASSES; j++)
+        mem += server.reply_pool[j].usable * server.reply_pool[j].len;
+    return mem;
+}
+
+/* Free all the buffers of the pools, returning the amount of memory freed. */
+size_t emptyReplyPools(void) {
+    size_t freed = 0;
+    for (int j = 0; j < REPLY_POOL_CLASSES; j++)
+        freed += replyPoolTrim(&server.reply_pool[j], INT_MAX);
+    return freed;
+}
+
+/* Called every second: the buffers that stayed in a pool for the whole
+ * period were not needed, so half of them are freed, to shrink the pools
+ * progressively after a burst of clients. */
+void replyPoolsCron(void) {
+    for (int j = 0; j < REPLY_POOL_CLASSES; j++) {
+        replyBufferPool *pool = &server.reply_pool[j];
+        replyPoolTrim(pool, (pool->min_len+1)/2);
+        pool->min_len = pool->len;
+    }
 }
 
 /* This function links the client to the global linked list of clients.
@@ -130,7 +272,7 @@ client *createClient(connection *conn) {
         connSetReadHandler(conn, readQueryFromClient);
         connSetPrivateData(conn, c);
     }
-    c->buf = zmalloc_usable(PROTO_REPLY_CHUNK_BYTES, &c->buf_usable_size);
+    c->buf = replyPoolAlloc(REPLY_POOL_BUF, &c->buf_usable_size);
     selectDb(c,0);
     uint64_t client_id;
     atomicGetIncr(server.next_client_id, client_id, 1);
@@ -150,14 +292,18 @@ client *createClient(connection *conn) {
     c->buf_peak_last_reset_time = server.unixtime;
     c->ref_repl_buf_node = NULL;
     c->ref_block_pos = 0;
+    c->repl_zerocopy = 0;
+    c->repl_zerocopy_id = 0;
+    c->repl_zerocopy_blocks = NULL;
     c->qb_pos = 0;
-    c->querybuf = sdsempty();
+    c->querybuf = NULL;
     c->querybuf_peak = 0;
     c->reqtype = 0;
     c->argc = 0;
     c->argv = NULL;
     c->argv_len = 0;
     c->argv_len_sum = 0;
+    c->argv_pool_len = 0;
     c->original_argc = 0;
     c->original_argv = NULL;
     c->cmd = c->lastcmd = c->realcmd = NULL;
@@ -183,6 +329,7 @@ client *createClient(connection *conn) {
     c->slave_addr = NULL;
     c->slave_capa = SLAVE_CAPA_NONE;
     c->slave_req = SLAVE_REQ_NONE;
+    c->rdb_client_id = 0;
     c->reply = listCreate();
     c->deferred_reply_errors = NULL;
     c->reply_bytes = 0;
@@ -191,6 +338,7 @@ client *createClient(connection *conn) {
     listSetDupMethod(c->reply,dupClientReplyValue);
     initClientBlockingState(c);
     c->woff = 0;
+    c->aof_woff = 0;
     c->watched_keys = listCreate();
     c->pubsub_channels = dictCreate(&objectKeyPointerValueDictType);
     c->pubsub_patterns = dictCreate(&objectKeyPointerValueDictType);
@@ -200,6 +348,8 @@ client *createClient(connection *conn) {
     c->client_list_node = NULL;
     c->postponed_list_node = NULL;
     c->pending_read_list_node = NULL;
+    c->io_thread = 0;
+    c->io_thread_pending = NULL;
     c->client_tracking_redirection = 0;
     c->client_tracking_prefixes = NULL;
     c->last_memory_usage = 0;
@@ -368,11 +518,14 @@ void _addReplyProtoToList(client *c, list *reply_list, const char *s, size_t len
         /* Create a new node, make sure it is allocated to at
          * least PROTO_REPLY_CHUNK_BYTES */
         size_t usable_size;
-        size_t size = len < PROTO_REPLY_CHUNK_BYTES? PROTO_REPLY_CHUNK_BYTES: len;
-        tail = zmalloc_usable(size + sizeof(clientReplyBlock), &usable_size);
+        if (len < PROTO_REPLY_CHUNK_BYTES)
+            tail = replyPoolAlloc(REPLY_POOL_BLOCK, &usable_size);
+        else
+            tail = zmalloc_usable(len + sizeof(clientReplyBlock), &usable_size);
         /* take over the allocation's internal fragmentation */
         tail->size = usable_size - sizeof(clientReplyBlock);
         tail->used = len;
+        tail->obj = NULL;
         memcpy(tail->buf, s, len);
         listAddNodeTail(reply_list, tail);
         c->reply_bytes += tail->size;
@@ -806,6 +959,7 @@ void setDeferredReply(client *c, void *node, const char *s, size_t length) {
         /* Take over the allocation's internal fragmentation */
         buf->size = usable_size - sizeof(clientReplyBlock);
         buf->used = length;
+        buf->obj = NULL;
         memcpy(buf->buf, s, length);
         listNodeValue(ln) = buf;
         c->reply_bytes += buf->size;
@@ -1040,10 +1194,77 @@ void addReplyBulkLen(client *c, robj *obj) {
     addReplyLongLongWithPrefix(c,len,'$');
 }
 
+/* Append to the reply list a block referencing the large string object
+ * 'obj' instead of copying it: the value is written to the socket directly
+ * from the object, so serving a big value to many clients costs neither a
+ * copy nor extra memory per client. Returns 0 if the value must be copied
+ * instead. */
+static int _addReplyObjectRef(client *c, robj *obj) {
+    if (obj->encoding != OBJ_ENCODING_RAW ||
+        sdslen(obj->ptr) < PROTO_REPLY_REF_MIN_BYTES ||
+        obj->refcount == OBJ_STATIC_REFCOUNT) return 0;
+
+    /* Only the main thread can change the refcount of an object. */
+    if (io_thread_id != 0) return 0;
+
+    /* Fake clients have their reply inspected as a plain buffer, and a
+     * module may want to modify a string it replied with. */
+    if (c->conn == NULL || (c->cmd && c->cmd->flags & CMD_MODULE)) return 0;
+
+    /* Leave to _addReplyToBufferOrList() the replicas, and the push messages
+     * that it may postpone. */
+    if (getClientType(c) == CLIENT_TYPE_SLAVE || c->flags & CLIENT_PUSHING)
+        return 0;
+
+    if (prepareClientToWrite(c) != C_OK) return 1;
+    if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return 1;
+    reqresSaveClientReplyOffset(c);
+
+    clientReplyBlock *block = zmalloc(sizeof(clientReplyBlock));
+    block->size = block->used = sdslen(obj->ptr);
+    block->obj = obj;
+    incrRefCount(obj);
+    listAddNodeTail(c->reply, block);
+    c->reply_bytes += block->size;
+
+    closeClientOnOutputBufferLimitReached(c, 1);
+    return 1;
+}
+
+/* Turn the reply blocks referencing string objects into plain copies. This
+ * is called before the values of a database are released by a background
+ * thread, that would otherwise race with the main thread on the refcount of
+ * the objects. */
+void unshareClientsReplyObjects(void) {
+    listIter li, ri;
+    listNode *ln, *rn;
+
+    listRewind(server.clients,&li);
+    while ((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+
+        listRewind(c->reply,&ri);
+        while ((rn = listNext(&ri))) {
+            clientReplyBlock *o = listNodeValue(rn);
+            if (!o || !o->obj) continue;
+
+            size_t usable_size;
+            clientReplyBlock *copy = zmalloc_usable(o->used + sizeof(clientReplyBlock), &usable_size);
+            copy->size = usable_size - sizeof(clientReplyBlock);
+            copy->used = o->used;
+            copy->obj = NULL;
+            memcpy(copy->buf, o->obj->ptr, o->used);
+            c->reply_bytes = c->reply_bytes + copy->size - o->size;
+            listNodeValue(rn) = copy;
+            freeClientReplyValue(o);
+        }
+    }
+}
+
 /* Add a Sider Object as a bulk reply */
 void addReplyBulk(client *c, robj *obj) {
     addReplyBulkLen(c,obj);
-    addReply(c,obj);
+    if (!_addReplyObjectRef(c,obj)) addReply(c,obj);
     addReplyProto(c,"\r\n",2);
 }
 
@@ -1294,6 +1515,9 @@ void clientAcceptHandler(connection *conn) {
     moduleFireServerEvent(REDISMODULE_EVENT_CLIENT_CHANGE,
                           REDISMODULE_SUBEVENT_CLIENT_CHANGE_CONNECTED,
                           c);
+
+    /* Let the event loop of an I/O thread read from the client if needed. */
+    ioThreadAttachClient(c);
 }
 
 void acceptCommonHandler(connection *conn, int flags, char *ip) {
@@ -1395,6 +1619,87 @@ void freeClientArgv(client *c) {
     c->argv = NULL;
 }
 
+/* Most of the arguments of a command are released as soon as the command
+ * returns: only the commands retaining an argument (for instance SET storing
+ * the value, or WATCH the key) take a reference to it. So instead of freeing
+ * the argument objects nobody else references, resetClient() keeps a few of
+ * them, together with the argv array, and the parser copies the arguments of
+ * the next command into them, saving the allocation and the release of the
+ * robj and of its sds for every argument.
+ *
+ * This is only done for real connections: fake clients get their argv from
+ * other sources and would just hold the objects. */
+static void releaseClientArgvObject(client *c, robj *o) {
+    if (c->argv_pool_len < CLIENT_ARGV_POOL_SIZE &&
+        o->refcount == 1 &&
+        o->type == OBJ_STRING &&
+        (o->encoding == OBJ_ENCODING_EMBSTR ||
+         (o->encoding == OBJ_ENCODING_RAW &&
+          sdsalloc(o->ptr) <= CLIENT_ARGV_POOL_MAX_LEN)))
+    {
+        c->argv_pool[c->argv_pool_len++] = o;
+    } else {
+        decrRefCount(o);
+    }
+}
+
+/* Create the string object of an argument of length 'len', reusing the
+ * last released argument object when it is large enough and has the same
+ * encoding createStringObject() would use. The pool is a stack, filled in
+ * reverse by resetClientArgv(), so commands with the same shape reuse the
+ * object of the same argument. */
+static robj *createClientArgvObject(client *c, const char *ptr, size_t len) {
+    if (c->argv_pool_len == 0) return createStringObject(ptr,len);
+
+    robj *o = c->argv_pool[--c->argv_pool_len];
+    size_t alloc = sdsalloc(o->ptr);
+    int embstr = len <= OBJ_ENCODING_EMBSTR_SIZE_LIMIT;
+    /* Don't reuse RAW strings much larger than needed, since commands may
+     * retain the object as it is. */
+    if (len > alloc ||
+        embstr != (o->encoding == OBJ_ENCODING_EMBSTR) ||
+        (!embstr && alloc/2 > len))
+    {
+        decrRefCount(o);
+        return createStringObject(ptr,len);
+    }
+    memcpy(o->ptr,ptr,len);
+    ((char*)o->ptr)[len] = '\0';
+    sdssetlen(o->ptr,len);
+    o->lru = 0;
+    return o;
+}
+
+/* Free the argument objects kept for reuse. Called when the client is freed
+ * or when it is idle. */
+void freeClientArgvPool(client *c) {
+    while (c->argv_pool_len)
+        decrRefCount(c->argv_pool[--c->argv_pool_len]);
+}
+
+/* Like freeClientArgv() but called between the commands of the client, see
+ * releaseClientArgvObject(). */
+static void resetClientArgv(client *c) {
+    if (!c->conn || c->argv_len > CLIENT_ARGV_KEEP_LEN) {
+        freeClientArgv(c);
+        return;
+    }
+    for (int j = c->argc-1; j >= 0; j--)
+        releaseClientArgvObject(c,c->argv[j]);
+    c->argc = 0;
+    c->cmd = NULL;
+    c->argv_len_sum = 0;
+}
+
+/* Make sure the argv array of the client can hold 'len' arguments, reusing
+ * the array of the previous command if possible. */
+static void prepareClientArgv(client *c, int len) {
+    if (c->argv && c->argv_len >= len) return;
+    zfree(c->argv);
+    c->argv_len = len;
+    c->argv = zmalloc(sizeof(robj*)*c->argv_len);
+}
+
 /* Close all the slaves connections. This is useful in chained replication
  * when we resync with our own master and want to force all our slaves to
  * resync with us as well. */
@@ -1462,6 +1767,12 @@ void unlinkClient(client *c) {
                 }
             }
         }
+        /* Make sure the event loop of the I/O thread no longer reads from
+         * the connection before closing it. */
+        if (c->io_thread) ioThreadDetachClient(c);
+
+        if (c->flags & CLIENT_SLAVE) replicaReleaseZerocopy(c);
+
         /* Only use shutdown when the fork is active and we are the parent. */
         if (server.child_type) connShutdown(c->conn);
         connClose(c->conn);
@@ -1597,7 +1908,9 @@ void freeClient(client *c) {
     }
 
     /* Free the query buffer */
+    if (c->flags & CLIENT_REUSABLE_QUERYBUFFER) resetReusableQueryBuf(c);
     sdsfree(c->querybuf);
+    sdsfree(c->io_thread_pending);
     c->querybuf = NULL;
 
     /* Deallocate structures used to block on blocking ops. */
@@ -1620,9 +1933,10 @@ void freeClient(client *c) {
 
     /* Free data structures. */
     listRelease(c->reply);
-    zfree(c->buf);
+    replyPoolRelease(REPLY_POOL_BUF, c->buf, c->buf_usable_size);
     freeReplicaReferencedReplBuffer(c);
     freeClientArgv(c);
+    freeClientArgvPool(c);
     freeClientOriginalArgv(c);
     if (c->deferred_reply_errors)
         listRelease(c->deferred_reply_errors);
@@ -1830,7 +2144,7 @@ static int _writevToClient(client *c, ssize_t *nwritten) {
             continue;
         }
 
-        iov[iovcnt].iov_base = o->buf + offset;
+        iov[iovcnt].iov_base = replyBlockData(o) + offset;
         iov[iovcnt].iov_len = o->used - offset;
         iov_bytes_len += iov[iovcnt++].iov_len;
         offset = 0;
@@ -1870,6 +2184,305 @@ static int _writevToClient(client *c, ssize_t *nwritten) {
     return C_OK;
 }
 
+/* -----------------------------------------------------------------------------
+ * Writes to the replicas
+ *
+ * The replicas share the blocks of the replication buffer, and every replica
+ * references the block it's sending and the position in it. All the blocks a
+ * replica didn't receive yet are sent with a single writev(), so that when
+ * many replicas are fed in the same pass of handleClientsWithPendingWrites()
+ * every replica costs one system call, whatever the number of blocks.
+ *
+ * When repl-zerocopy-threshold is set, on Linux the blocks with at least that
+ * many bytes to send are written with MSG_ZEROCOPY instead, saving the copy
+ * to the kernel. The kernel keeps reading the block after send() returned, so
+ * the replica holds a reference to it until the kernel notifies that it's
+ * done with it on the error queue of the socket: the block may not be trimmed
+ * from the backlog meanwhile. The bytes of a block are never modified once
+ * written, only new bytes are appended.
+ *
+ * When a replica is freed before the kernel completed its sends, a duplicate
+ * of its socket is kept open to read the completions, and the blocks stay
+ * referenced until then, see replicaReleaseZerocopy().
+ * -------------------------------------------------------------------------- */
+
+/* The MSG_ZEROCOPY sends of a freed replica the kernel is not done with. */
+typedef struct replZerocopyOrphan {
+    int fd;             /* Duplicate of the socket of the replica. */
+    uint32_t id;        /* Id of the next send, like repl_zerocopy_id. */
+    list *blocks;       /* Blocks of the sends not completed, in order of id. */
+    int detached;       /* Set when the replication buffer was freed: the
+                         * blocks are then freed with their last reference. */
+} replZerocopyOrphan;
+
+#ifdef HAVE_MSG_ZEROCOPY
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+
+/* Returns 1 if the 'len' bytes to send to the replica 'c' from a block should
+ * be sent with MSG_ZEROCOPY, enabling it on the connection the first time. */
+static int replicaUseZerocopy(client *c, size_t len) {
+    if (server.repl_zerocopy_threshold == 0 ||
+        len < (size_t)server.repl_zerocopy_threshold ||
+        c->repl_zerocopy == -1) return 0;
+    if (c->repl_zerocopy == 0) {
+        int one = 1;
+        if (c->conn->type != connectionTypeTcp() ||
+            setsockopt(c->conn->fd,SOL_SOCKET,SO_ZEROCOPY,&one,sizeof(one)) == -1)
+        {
+            c->repl_zerocopy = -1;
+            return 0;
+        }
+        c->repl_zerocopy = 1;
+        c->repl_zerocopy_blocks = listCreate();
+    }
+    return 1;
+}
+
+/* Send the block 'o' from 'pos' to the replica 'c' with MSG_ZEROCOPY. */
+static ssize_t replicaWriteZerocopy(client *c, replBufBlock *o, size_t pos) {
+    ssize_t nwritten = send(c->conn->fd,o->buf+pos,o->used-pos,MSG_ZEROCOPY);
+    if (nwritten == -1) {
+        if (errno == EAGAIN) return -1;
+        /* ENOBUFS when the pages can't be pinned: just copy them. Other
+         * errors are handled by the connection layer as usual. */
+        return connWrite(c->conn,o->buf+pos,o->used-pos);
+    }
+    o->refcount++;
+    listAddNodeTail(c->repl_zerocopy_blocks,o);
+    c->repl_zerocopy_id++;
+    server.stat_repl_zerocopy_sends++;
+    server.stat_repl_zerocopy_bytes += nwritten;
+    return nwritten;
+}
+
+/* Release the blocks of the MSG_ZEROCOPY sends completed by the kernel on the
+ * socket 'fd', 'id' being the id of the next send. When 'detached' is set the
+ * blocks are freed once no longer referenced. Returns the number of sends
+ * completed. */
+static int zerocopyReap(int fd, uint32_t id, list *blocks, int detached) {
+    char control[128];
+    int released = 0;
+
+    while (listLength(blocks)) {
+        struct msghdr msg = {0};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(fd,&msg,MSG_ERRQUEUE) == -1) break;
+
+        struct cmsghdr *cm;
+        for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg,cm)) {
+            if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+                !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) continue;
+            struct sock_extended_err *ee = (struct sock_extended_err*)CMSG_DATA(cm);
+            if (ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+
+            /* The sends from ee_info to ee_data are completed: since they
+             * complete in order, so are all the sends up to ee_data. */
+            if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                server.stat_repl_zerocopy_copied += ee->ee_data - ee->ee_info + 1;
+            uint32_t first = id - listLength(blocks);
+            while (listLength(blocks) && (int32_t)(ee->ee_data - first) >= 0) {
+                listNode *ln = listFirst(blocks);
+                replBufBlock *o = listNodeValue(ln);
+                if (--o->refcount == 0 && detached) zfree(o);
+                listDelNode(blocks,ln);
+                released++;
+                first++;
+            }
+        }
+    }
+    if (released && server.repl_backlog)
+        incrementalTrimReplicationBacklog(REPL_BACKLOG_TRIM_BLOCKS_PER_CALL);
+    return released;
+}
+
+static void replicaReapZerocopy(client *c) {
+    zerocopyReap(c->conn->fd,c->repl_zerocopy_id,c->repl_zerocopy_blocks,0);
+}
+
+/* Keep the MSG_ZEROCOPY sends of the replica 'c', whose connection is about
+ * to be closed, until the kernel completes them. The socket is shut down, and
+ * it is aborted by the kernel if the replica doesn't acknowledge the data in
+ * time. Returns 0 if the socket can't be duplicated. */
+static int replicaOrphanZerocopy(client *c) {
+    int fd = dup(c->conn->fd);
+    if (fd == -1) return 0;
+    anetCloexec(fd);
+    unsigned int timeout = server.repl_timeout*1000;
+    setsockopt(fd,IPPROTO_TCP,TCP_USER_TIMEOUT,&timeout,sizeof(timeout));
+    shutdown(fd,SHUT_RDWR);
+
+    replZerocopyOrphan *orphan = zmalloc(sizeof(*orphan));
+    orphan->fd = fd;
+    orphan->id = c->repl_zerocopy_id;
+    orphan->blocks = c->repl_zerocopy_blocks;
+    orphan->detached = 0;
+    listAddNodeTail(server.repl_zerocopy_orphans,orphan);
+    c->repl_zerocopy_blocks = NULL;
+    return 1;
+}
+
+/* Called periodically to release the blocks of the sends of the freed
+ * replicas the kernel completed. */
+void replicaReapZerocopyOrphans(void) {
+    listIter li;
+    listNode *ln;
+
+    listRewind(server.repl_zerocopy_orphans,&li);
+    while ((ln = listNext(&li))) {
+        replZerocopyOrphan *orphan = listNodeValue(ln);
+        zerocopyReap(orphan->fd,orphan->id,orphan->blocks,orphan->detached);
+        if (listLength(orphan->blocks)) continue;
+        close(orphan->fd);
+        listRelease(orphan->blocks);
+        zfree(orphan);
+        listDelNode(server.repl_zerocopy_orphans,ln);
+    }
+}
+
+/* Called when the replication buffer is freed: the blocks the kernel may
+ * still be reading are unlinked from it, and freed by the orphans. */
+void replicaDetachZerocopyOrphans(void) {
+    listIter li;
+    listNode *ln;
+
+    if (listLength(server.repl_zerocopy_orphans) == 0) return;
+    listRewind(server.repl_buffer_blocks,&li);
+    while ((ln = listNext(&li))) {
+        replBufBlock *o = listNodeValue(ln);
+        if (o->refcount == 0) continue;
+        listUnlinkNode(server.repl_buffer_blocks,ln);
+        zfree(ln);
+    }
+
+    listRewind(server.repl_zerocopy_orphans,&li);
+    while ((ln = listNext(&li))) {
+        replZerocopyOrphan *orphan = listNodeValue(ln);
+        orphan->detached = 1;
+    }
+}
+
+/* Return the number of sends of the freed replicas not completed yet. */
+unsigned long replicaZerocopyOrphanedSends(void) {
+    unsigned long sends = 0;
+    listIter li;
+    listNode *ln;
+
+    listRewind(server.repl_zerocopy_orphans,&li);
+    while ((ln = listNext(&li))) {
+        replZerocopyOrphan *orphan = listNodeValue(ln);
+        sends += listLength(orphan->blocks);
+    }
+    return sends;
+}
+#else
+static int replicaUseZerocopy(client *c, size_t len) {
+    UNUSED(c);
+    UNUSED(len);
+    return 0;
+}
+
+static ssize_t replicaWriteZerocopy(client *c, replBufBlock *o, size_t pos) {
+    return connWrite(c->conn,o->buf+pos,o->used-pos);
+}
+
+static void replicaReapZerocopy(client *c) {
+    UNUSED(c);
+}
+
+static int replicaOrphanZerocopy(client *c) {
+    UNUSED(c);
+    return 0;
+}
+
+void replicaReapZerocopyOrphans(void) {}
+
+void replicaDetachZerocopyOrphans(void) {}
+
+unsigned long replicaZerocopyOrphanedSends(void) {
+    return 0;
+}
+#endif
+
+/* Called before the connection of the replica 'c' is closed: the blocks of
+ * the MSG_ZEROCOPY sends not completed yet stay referenced until the kernel
+ * is done with them. */
+void replicaReleaseZerocopy(client *c) {
+    if (c->repl_zerocopy_blocks == NULL) return;
+    if (listLength(c->repl_zerocopy_blocks)) {
+        replicaReapZerocopy(c);
+        if (listLength(c->repl_zerocopy_blocks) && replicaOrphanZerocopy(c)) {
+            c->repl_zerocopy = 0;
+            return;
+        }
+    }
+    /* All the sends completed, or the socket can't be duplicated, in which
+     * case there is nothing better than dropping the references. */
+    while (listLength(c->repl_zerocopy_blocks)) {
+        listNode *ln = listFirst(c->repl_zerocopy_blocks);
+        ((replBufBlock *)listNodeValue(ln))->refcount--;
+        listDelNode(c->repl_zerocopy_blocks,ln);
+    }
+    listRelease(c->repl_zerocopy_blocks);
+    c->repl_zerocopy_blocks = NULL;
+    c->repl_zerocopy = 0;
+}
+
+/* Send to the replica 'c' the blocks of the replication buffer from the one it
+ * references, see the top comment. 'nwritten' is set like in _writeToClient(). */
+static int _writevToReplica(client *c, ssize_t *nwritten) {
+    int iovmax = min(IOV_MAX, c->conn->iovcnt);
+    struct iovec iov[iovmax];
+    int iovcnt = 0;
+
+    if (c->repl_zerocopy_blocks && listLength(c->repl_zerocopy_blocks))
+        replicaReapZerocopy(c);
+
+    replBufBlock *o = listNodeValue(c->ref_repl_buf_node);
+    serverAssert(o->used >= c->ref_block_pos);
+    if (replicaUseZerocopy(c,o->used-c->ref_block_pos)) {
+        *nwritten = replicaWriteZerocopy(c,o,c->ref_block_pos);
+    } else {
+        /* Gather the blocks up to the next one to send with MSG_ZEROCOPY. */
+        listNode *ln = c->ref_repl_buf_node;
+        size_t pos = c->ref_block_pos;
+        while (ln && iovcnt < iovmax) {
+            replBufBlock *b = listNodeValue(ln);
+            if (b->used > pos) {
+                if (iovcnt && replicaUseZerocopy(c,b->used-pos)) break;
+                iov[iovcnt].iov_base = b->buf+pos;
+                iov[iovcnt].iov_len = b->used-pos;
+                iovcnt++;
+            }
+            pos = 0;
+            ln = listNextNode(ln);
+        }
+        *nwritten = iovcnt ? connWritev(c->conn,iov,iovcnt) : 0;
+    }
+    if (*nwritten < 0 || (*nwritten == 0 && iovcnt)) return C_ERR;
+
+    /* Move to the block with bytes left to send, or to the last one. */
+    size_t remaining = *nwritten;
+    int moved = 0;
+    while (1) {
+        o = listNodeValue(c->ref_repl_buf_node);
+        size_t len = min(remaining, o->used-c->ref_block_pos);
+        c->ref_block_pos += len;
+        remaining -= len;
+
+        listNode *next = listNextNode(c->ref_repl_buf_node);
+        if (!next || c->ref_block_pos != o->used) break;
+        o->refcount--;
+        ((replBufBlock *)(listNodeValue(next)))->refcount++;
+        c->ref_repl_buf_node = next;
+        c->ref_block_pos = 0;
+        moved++;
+    }
+    if (moved) incrementalTrimReplicationBacklog(REPL_BACKLOG_TRIM_BLOCKS_PER_CALL*moved);
+    return C_OK;
+}
+
 /* This function does actual writing output buffers to different types of
  * clients, it is called by writeToClient.
  * If we write successfully, it returns C_OK, otherwise, C_ERR is returned,
@@ -1879,27 +2492,7 @@ int _writeToClient(client *c, ssize_t *nwritten) {
     *nwritten = 0;
     if (getClientType(c) == CLIENT_TYPE_SLAVE) {
         serverAssert(c->bufpos == 0 && listLength(c->reply) == 0);
-
-        replBufBlock *o = listNodeValue(c->ref_repl_buf_node);
-        serverAssert(o->used >= c->ref_block_pos);
-        /* Send current block if it is not fully sent. */
-        if (o->used > c->ref_block_pos) {
-            *nwritten = connWrite(c->conn, o->buf+c->ref_block_pos,
-                                  o->used-c->ref_block_pos);
-            if (*nwritten <= 0) return C_ERR;
-            c->ref_block_pos += *nwritten;
-        }
-
-        /* If we fully sent the object on head, go to the next one. */
-        listNode *next = listNextNode(c->ref_repl_buf_node);
-        if (next && c->ref_block_pos == o->used) {
-            o->refcount--;
-            ((replBufBlock *)(listNodeValue(next)))->refcount++;
-            c->ref_repl_buf_node = next;
-            c->ref_block_pos = 0;
-            incrementalTrimReplicationBacklog(REPL_BACKLOG_TRIM_BLOCKS_PER_CALL);
-        }
-        return C_OK;
+        return _writevToReplica(c, nwritten);
     }
 
     /* When the reply list is not empty, it's better to use writev to save us some
@@ -2013,6 +2606,14 @@ int writeToClient(client *c, int handler_installed) {
 /* Write event handler. Just send data to the client. */
 void sendReplyToClient(connection *conn) {
     client *c = connGetPrivateData(conn);
+
+    /* The reply may depend on commands the AOF writer thread didn't fsync
+     * yet: wait in the pending writes list, which is served once it did. */
+    if (aofClientWaitsFsync(c)) {
+        connSetWriteHandler(c->conn, NULL);
+        putClientInPendingWriteQueue(c);
+        return;
+    }
     writeToClient(c,1);
 }
 
@@ -2028,6 +2629,10 @@ int handleClientsWithPendingWrites(void) {
     listRewind(server.clients_pending_write,&li);
     while((ln = listNext(&li))) {
         client *c = listNodeValue(ln);
+
+        /* Replies waiting for the AOF to be fsynced stay in the list. */
+        if (aofClientWaitsFsync(c)) continue;
+
         c->flags &= ~CLIENT_PENDING_WRITE;
         listUnlinkNode(server.clients_pending_write,ln);
 
@@ -2054,7 +2659,7 @@ int handleClientsWithPendingWrites(void) {
 void resetClient(client *c) {
     siderCommandProc *prevcmd = c->cmd ? c->cmd->proc : NULL;
 
-    freeClientArgv(c);
+    resetClientArgv(c);
     c->cur_script = NULL;
     c->reqtype = 0;
     c->multibulklen = 0;
@@ -2118,7 +2723,22 @@ void protectClient(client *c) {
 void unprotectClient(client *c) {
     if (c->flags & CLIENT_PROTECTED) {
         c->flags &= ~CLIENT_PROTECTED;
-        if (c->conn) {
+        if (c->io_thread) {
+            /* The I/O thread paused reading from the client: consume what
+             * it read meanwhile (the command that protected the client will
+             * process it once done) and let it read again. */
+            if (c->io_thread_pending) {
+                if (c->querybuf) {
+                    c->querybuf = sdscatsds(c->querybuf,c->io_thread_pending);
+                    sdsfree(c->io_thread_pending);
+                } else {
+                    c->querybuf = c->io_thread_pending;
+                }
+                c->io_thread_pending = NULL;
+                ioThreadResumeClient(c);
+            }
+            if (clientHasPendingReplies(c)) putClientInPendingWriteQueue(c);
+        } else if (c->conn) {
             connSetReadHandler(c->conn,readQueryFromClient);
             if (clientHasPendingReplies(c)) putClientInPendingWriteQueue(c);
         }
@@ -2190,9 +2810,7 @@ int processInlineBuffer(client *c) {
 
     /* Setup argv array on client structure */
     if (argc) {
-        if (c->argv) zfree(c->argv);
-        c->argv_len = argc;
-        c->argv = zmalloc(sizeof(robj*)*c->argv_len);
+        prepareClientArgv(c,argc);
         c->argv_len_sum = 0;
     }
 
@@ -2254,13 +2872,19 @@ int processMultibulkBuffer(client *c) {
     char *newline = NULL;
     int ok;
     long long ll;
+    respScanner scanner;
+
+    /* The headers are located with a scanner that resolves all the ones in
+     * the same block of the query buffer from a single vectorized scan. */
+    respScannerReset(&scanner);
 
     if (c->multibulklen == 0) {
         /* The client should have been reset */
         serverAssertWithInfo(c,NULL,c->argc == 0);
 
         /* Multi bulk length cannot be read without a \r\n */
-        newline = strchr(c->querybuf+c->qb_pos,'\r');
+        newline = (char*)respScanFindCR(&scanner,c->querybuf+c->qb_pos,
+                                        c->querybuf+sdslen(c->querybuf));
         if (newline == NULL) {
             if (sdslen(c->querybuf)-c->qb_pos > PROTO_INLINE_MAX_SIZE) {
                 addReplyError(c,"Protocol error: too big mbulk count string");
@@ -2276,7 +2900,7 @@ int processMultibulkBuffer(client *c) {
         /* We know for sure there is a whole line since newline != NULL,
          * so go ahead and find out the multi bulk length. */
         serverAssertWithInfo(c,NULL,c->querybuf[c->qb_pos] == '*');
-        ok = string2ll(c->querybuf+1+c->qb_pos,newline-(c->querybuf+1+c->qb_pos),&ll);
+        ok = respParseLength(c->querybuf+1+c->qb_pos,newline-(c->querybuf+1+c->qb_pos),&ll);
         if (!ok || ll > INT_MAX) {
             addReplyError(c,"Protocol error: invalid multibulk length");
             setProtocolError("invalid mbulk count",c);
@@ -2294,9 +2918,7 @@ int processMultibulkBuffer(client *c) {
         c->multibulklen = ll;
 
         /* Setup argv array on client structure */
-        if (c->argv) zfree(c->argv);
-        c->argv_len = min(c->multibulklen, 1024);
-        c->argv = zmalloc(sizeof(robj*)*c->argv_len);
+        prepareClientArgv(c,min(c->multibulklen, 1024));
         c->argv_len_sum = 0;
     }
 
@@ -2304,7 +2926,8 @@ int processMultibulkBuffer(client *c) {
     while(c->multibulklen) {
         /* Read bulk length if unknown */
         if (c->bulklen == -1) {
-            newline = strchr(c->querybuf+c->qb_pos,'\r');
+            newline = (char*)respScanFindCR(&scanner,c->querybuf+c->qb_pos,
+                                            c->querybuf+sdslen(c->querybuf));
             if (newline == NULL) {
                 if (sdslen(c->querybuf)-c->qb_pos > PROTO_INLINE_MAX_SIZE) {
                     addReplyError(c,
@@ -2327,7 +2950,7 @@ int processMultibulkBuffer(client *c) {
                 return C_ERR;
             }
 
-            ok = string2ll(c->querybuf+c->qb_pos+1,newline-(c->querybuf+c->qb_pos+1),&ll);
+            ok = respParseLength(c->querybuf+c->qb_pos+1,newline-(c->querybuf+c->qb_pos+1),&ll);
             if (!ok || ll < 0 ||
                 (!(c->flags & CLIENT_MASTER) && ll > server.proto_max_bulk_len)) {
                 addReplyError(c,"Protocol error: invalid bulk length");
@@ -2357,6 +2980,7 @@ int processMultibulkBuffer(client *c) {
                 if (sdslen(c->querybuf)-c->qb_pos <= (size_t)ll+2) {
                     sdsrange(c->querybuf,c->qb_pos,-1);
                     c->qb_pos = 0;
+                    respScannerReset(&scanner);
                     /* Hint the sds library about the amount of bytes this string is
                      * going to contain. */
                     c->querybuf = sdsMakeRoomForNonGreedy(c->querybuf,ll+2-sdslen(c->querybuf));
@@ -2394,9 +3018,10 @@ int processMultibulkBuffer(client *c) {
                  * likely... */
                 c->querybuf = sdsnewlen(SDS_NOINIT,c->bulklen+2);
                 sdsclear(c->querybuf);
+                respScannerReset(&scanner);
             } else {
                 c->argv[c->argc++] =
-                    createStringObject(c->querybuf+c->qb_pos,c->bulklen);
+                    createClientArgvObject(c,c->querybuf+c->qb_pos,c->bulklen);
                 c->argv_len_sum += c->bulklen;
                 c->qb_pos += c->bulklen+2;
             }
@@ -2562,10 +3187,12 @@ int processInputBuffer(client *c) {
             resetClient(c);
         } else {
             /* If we are in the context of an I/O thread, we can't really
-             * execute the command here. All we can do is to flag the client
-             * as one that needs to process the command. */
+             * execute the command here, with the exception of a few read-only
+             * commands (see ioThreadTryExecuteCommand()). All we can do is to
+             * flag the client as one that needs to process the command. */
             if (io_threads_op != IO_THREADS_OP_IDLE) {
                 serverAssert(io_threads_op == IO_THREADS_OP_READ);
+                if (ioThreadTryExecuteCommand(c)) continue;
                 c->flags |= CLIENT_PENDING_COMMAND;
                 break;
             }
@@ -2613,6 +3240,52 @@ int processInputBuffer(client *c) {
     return C_OK;
 }
 
+/* Most clients send complete commands and read their replies before sending
+ * more, so once a read is processed their query buffer is empty. Instead of
+ * having every client own a query buffer, which for many idle connections
+ * sums up to a lot of memory, clients with no pending input borrow the query
+ * buffer of the thread serving them for the duration of a read, and keep a
+ * private buffer only if something is left after processing the input, that
+ * is, a partial command or commands not executed yet.
+ *
+ * The buffer is removed from the thread while borrowed, so a client reading
+ * while another one is executing a command (see processEventsWhileBlocked())
+ * just gets a new buffer. */
+static void takeReusableQueryBuf(client *c) {
+    if (thread_shared_qb) {
+        c->querybuf = thread_shared_qb;
+        thread_shared_qb = NULL;
+    } else {
+        c->querybuf = sdsnewlen(NULL,PROTO_IOBUF_LEN);
+        sdsclear(c->querybuf);
+    }
+    c->flags |= CLIENT_REUSABLE_QUERYBUFFER;
+}
+
+/* Called once the input read into a borrowed query buffer was processed:
+ * give the buffer back to the thread if it is empty, otherwise the client
+ * takes the ownership of it. The buffer may have been reallocated meanwhile,
+ * or moved to an argument (see processMultibulkBuffer()).
+ *
+ * Large buffers are also left to the client, since they are likely sized
+ * for the big arguments it is sending: clientsCron() reclaims them once the
+ * client is idle. */
+static void resetReusableQueryBuf(client *c) {
+    serverAssert(c->flags & CLIENT_REUSABLE_QUERYBUFFER);
+    c->flags &= ~CLIENT_REUSABLE_QUERYBUFFER;
+    if (sdslen(c->querybuf) > c->qb_pos ||
+        sdsalloc(c->querybuf) > PROTO_RESIZE_THRESHOLD) return;
+
+    if (thread_shared_qb == NULL) {
+        sdsclear(c->querybuf);
+        thread_shared_qb = c->querybuf;
+    } else {
+        sdsfree(c->querybuf);
+    }
+    c->querybuf = NULL;
+    c->qb_pos = 0;
+}
+
 void readQueryFromClient(connection *conn) {
     client *c = connGetPrivateData(conn);
     int nread, big_arg = 0;
@@ -2625,6 +3298,20 @@ void readQueryFromClient(connection *conn) {
     /* Update total number of reads on server */
     atomicIncr(server.stat_total_reads_processed, 1);
 
+    /* The completions of the MSG_ZEROCOPY sends wake up the replica socket
+     * like an error, until they are read. */
+    if (c->repl_zerocopy_blocks && listLength(c->repl_zerocopy_blocks))
+        replicaReapZerocopy(c);
+
+    if (!c->querybuf) {
+        /* The master client buffer is also the replication stream proxied
+         * to our replicas, see processInputBuffer(). */
+        if (c->flags & CLIENT_MASTER)
+            c->querybuf = sdsempty();
+        else
+            takeReusableQueryBuf(c);
+    }
+
     readlen = PROTO_IOBUF_LEN;
     /* If this is a multi bulk request, and we are processing a bulk reply
      * that is large enough, try to maximize the probability that the query
@@ -2669,6 +3356,7 @@ void readQueryFromClient(connection *conn) {
     nread = connRead(c->conn, c->querybuf+qblen, readlen);
     if (nread == -1) {
         if (connGetState(conn) == CONN_STATE_CONNECTED) {
+            if (c->flags & CLIENT_REUSABLE_QUERYBUFFER) resetReusableQueryBuf(c);
             return;
         } else {
             serverLog(LL_VERBOSE, "Reading from client: %s",connGetLastError(c->conn));
@@ -2686,7 +3374,20 @@ void readQueryFromClient(connection *conn) {
     }
 
     sdsIncrLen(c->querybuf,nread);
-    qblen = sdslen(c->querybuf);
+    processQueryBufferData(c,nread);
+    return;
+
+done:
+    if (c->flags & CLIENT_REUSABLE_QUERYBUFFER) resetReusableQueryBuf(c);
+    beforeNextClient(c);
+}
+
+/* Called after 'nread' bytes were appended to the query buffer of the client,
+ * either by readQueryFromClient() or, when the client is served by the event
+ * loop of an I/O thread, by the main thread receiving the data read by the
+ * thread. Performs the accounting and processes the new input. */
+static void processQueryBufferData(client *c, size_t nread) {
+    size_t qblen = sdslen(c->querybuf);
     if (c->querybuf_peak < qblen) c->querybuf_peak = qblen;
 
     c->lastinteraction = server.unixtime;
@@ -2705,7 +3406,9 @@ void readQueryFromClient(connection *conn) {
         sdsfree(ci);
         sdsfree(bytes);
         freeClientAsync(c);
-        goto done;
+        if (c->flags & CLIENT_REUSABLE_QUERYBUFFER) resetReusableQueryBuf(c);
+        beforeNextClient(c);
+        return;
     }
 
     /* There is more data in the client input buffer, continue parsing it
@@ -2713,10 +3416,26 @@ void readQueryFromClient(connection *conn) {
     if (processInputBuffer(c) == C_ERR)
          c = NULL;
 
-done:
+    if (c && c->flags & CLIENT_REUSABLE_QUERYBUFFER) resetReusableQueryBuf(c);
     beforeNextClient(c);
 }
 
+/* Process 'data' as if it was just read from the connection of the client,
+ * taking the ownership of it. Used by a replica to apply the replication
+ * stream it buffered during a dual channel sync. */
+void feedClientQueryBuffer(client *c, sds data) {
+    size_t nread = sdslen(data);
+
+    if (c->querybuf == NULL || sdslen(c->querybuf) == 0) {
+        sdsfree(c->querybuf);
+        c->querybuf = data;
+    } else {
+        c->querybuf = sdscatsds(c->querybuf,data);
+        sdsfree(data);
+    }
+    processQueryBufferData(c,nread);
+}
+
 /* A Sider "Address String" is a colon separated ip:port pair.
  * For IPv4 it's in the form x.y.z.k:port, example: "127.0.0.1:1234".
  * For IPv6 addresses we use [] around the IP part, like in "[::1]:1234".
@@ -2799,7 +3518,8 @@ sds catClientInfoString(sds s, client *client) {
 
     p = events;
     if (client->conn) {
-        if (connHasReadHandler(client->conn)) *p++ = 'r';
+        /* Clients served by an I/O thread event loop are always read. */
+        if (connHasReadHandler(client->conn) || client->io_thread) *p++ = 'r';
         if (connHasWriteHandler(client->conn)) *p++ = 'w';
     }
     *p = '\0';
@@ -2829,8 +3549,8 @@ sds catClientInfoString(sds s, client *client) {
         (int) dictSize(client->pubsub_patterns),
         (int) dictSize(client->pubsubshard_channels),
         (client->flags & CLIENT_MULTI) ? client->mstate.count : -1,
-        (unsigned long long) sdslen(client->querybuf),
-        (unsigned long long) sdsavail(client->querybuf),
+        client->querybuf ? (unsigned long long) sdslen(client->querybuf) : 0,
+        client->querybuf ? (unsigned long long) sdsavail(client->querybuf) : 0,
         (unsigned long long) client->argv_len_sum,
         (unsigned long long) client->mstate.argv_len_sums,
         (unsigned long long) client->buf_usable_size,
@@ -3784,7 +4504,9 @@ size_t getClientMemoryUsage(client *c, size_t *output_buffer_mem_usage) {
     size_t mem = getClientOutputBufferMemoryUsage(c);
     if (output_buffer_mem_usage != NULL)
         *output_buffer_mem_usage = mem;
-    mem += sdsZmallocSize(c->querybuf);
+    /* The shared query buffer is not accounted to the client using it. */
+    if (c->querybuf && !(c->flags & CLIENT_REUSABLE_QUERYBUFFER))
+        mem += sdsZmallocSize(c->querybuf);
     mem += zmalloc_size(c);
     mem += c->buf_usable_size;
     /* For efficiency (less work keeping track of the argv memory), it doesn't include the used memory
@@ -4146,28 +4868,470 @@ void processEventsWhileBlocked(void) {
 #endif
 #endif
 
+/* An idle thread spins for io-threads-spin-us microseconds waiting for new
+ * jobs before going to sleep, the spinning loop checks the clock every
+ * IO_THREADS_SPIN_CHECK iterations. */
+#define IO_THREADS_SPIN_CHECK 128
+
 typedef struct __attribute__((aligned(CACHE_LINE_SIZE))) threads_pending {
-    siderAtomic unsigned long value;
+    siderAtomic unsigned int value; /* Also the word the thread sleeps on. */
+    siderAtomic int sleeping;       /* Is the thread sleeping waiting for jobs? */
 } threads_pending;
 
 pthread_t io_threads[IO_THREADS_MAX_NUM];
-pthread_mutex_t io_threads_mutex[IO_THREADS_MAX_NUM];
 threads_pending io_threads_pending[IO_THREADS_MAX_NUM];
 int io_threads_op;      /* IO_THREADS_OP_IDLE, IO_THREADS_OP_READ or IO_THREADS_OP_WRITE. */ // TODO: should access to this be atomic??!
 
+/* Incremented by every I/O thread completing its jobs: this is the word the
+ * main thread sleeps on while waiting for the I/O threads to end their work. */
+static siderAtomic unsigned int io_threads_done = 0;
+static siderAtomic int io_threads_main_sleeping = 0;
+
 /* This is the list of clients each thread will serve when threaded I/O is
  * used. We spawn io_threads_num-1 threads, since one is the main thread
- * itself. */
-list *io_threads_list[IO_THREADS_MAX_NUM];
+ * itself. The main thread fills the list of a thread only while the thread
+ * is idle, and hands it over setting the pending count of the thread, so
+ * no locking is needed. */
+typedef struct ioThreadClients {
+    client **clients;
+    int count;
+    int size;
+} ioThreadClients;
+
+static ioThreadClients io_threads_list[IO_THREADS_MAX_NUM];
+
+/* Objects referenced by reply blocks that the I/O threads released while
+ * writing: only the main thread can touch the refcount of an object, so it
+ * decrements them after the write phase. */
+static list *io_threads_released_objs[IO_THREADS_MAX_NUM];
+/* Standard sized reply blocks released by the IO threads, linked through
+ * their first word, that the main thread gives back to the reply pool. */
+static void *io_threads_released_blocks[IO_THREADS_MAX_NUM];
+
+static void releaseReplyObject(robj *o) {
+    if (io_thread_id == 0)
+        decrRefCount(o);
+    else
+        listAddNodeTail(io_threads_released_objs[io_thread_id],o);
+}
+
+static void releaseReplyBlock(clientReplyBlock *o) {
+    size_t usable = o->size + sizeof(clientReplyBlock);
+
+    if (io_thread_id == 0) {
+        replyPoolRelease(REPLY_POOL_BLOCK, o, usable);
+    } else if (usable == server.reply_pool[REPLY_POOL_BLOCK].usable) {
+        *(void **)o = io_threads_released_blocks[io_thread_id];
+        io_threads_released_blocks[io_thread_id] = o;
+    } else {
+        zfree(o);
+    }
+}
 
 static inline unsigned long getIOPendingCount(int i) {
-    unsigned long count = 0;
+    unsigned int count = 0;
     atomicGetWithSync(io_threads_pending[i].value, count);
     return count;
 }
 
 static inline void setIOPendingCount(int i, unsigned long count) {
-    atomicSetWithSync(io_threads_pending[i].value, count);
+    atomicSetWithSync(io_threads_pending[i].value, (unsigned int)count);
+}
+
+static void ioThreadAddClient(int i, client *c) {
+    ioThreadClients *l = &io_threads_list[i];
+    if (l->count == l->size) {
+        l->size = l->size ? l->size*2 : 16;
+        l->clients = zrealloc(l->clients,sizeof(client*)*l->size);
+    }
+    l->clients[l->count++] = c;
+}
+
+/* Sleep as long as the value at 'addr' is 'val', until ioThreadsWake() is
+ * called for the same address. Spurious wakeups are possible, so the caller
+ * must check its condition again. On Linux this is just a futex, elsewhere
+ * we fall back to a condition variable. */
+#ifdef __linux__
+static void ioThreadsSleep(siderAtomic unsigned int *addr, unsigned int val) {
+    syscall(SYS_futex,addr,FUTEX_WAIT_PRIVATE,val,NULL,NULL,0);
+}
+
+static void ioThreadsWake(siderAtomic unsigned int *addr) {
+    syscall(SYS_futex,addr,FUTEX_WAKE_PRIVATE,1,NULL,NULL,0);
+}
+#else
+static pthread_mutex_t io_threads_sleep_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t io_threads_sleep_cond = PTHREAD_COND_INITIALIZER;
+
+static void ioThreadsSleep(siderAtomic unsigned int *addr, unsigned int val) {
+    unsigned int cur;
+    pthread_mutex_lock(&io_threads_sleep_mutex);
+    atomicGetWithSync(*addr,cur);
+    if (cur == val) pthread_cond_wait(&io_threads_sleep_cond,&io_threads_sleep_mutex);
+    pthread_mutex_unlock(&io_threads_sleep_mutex);
+}
+
+static void ioThreadsWake(siderAtomic unsigned int *addr) {
+    UNUSED(addr);
+    pthread_mutex_lock(&io_threads_sleep_mutex);
+    pthread_cond_broadcast(&io_threads_sleep_cond);
+    pthread_mutex_unlock(&io_threads_sleep_mutex);
+}
+#endif
+
+/* Called by the I/O thread 'id' to wait for the main thread to hand over
+ * some clients: we spin for a short time, so that back to back phases don't
+ * pay any wakeup latency, then go to sleep until ioThreadsHandOff() wakes
+ * us up. The sleeping flag and the pending count are written and read in
+ * opposite order by the two sides, so a wakeup can't be lost. */
+static void ioThreadWaitForJobs(long id) {
+    threads_pending *p = &io_threads_pending[id];
+    monotime start = getMonotonicUs();
+    unsigned long j = 0;
+
+    while (getIOPendingCount(id) == 0) {
+        if (++j % IO_THREADS_SPIN_CHECK ||
+            getMonotonicUs()-start < (monotime)server.io_threads_spin_us) continue;
+
+        atomicIncr(server.stat_io_threads_spin_usec, getMonotonicUs()-start);
+        atomicSetWithSync(p->sleeping, 1);
+        while (getIOPendingCount(id) == 0)
+            ioThreadsSleep(&p->value, 0);
+        atomicSetWithSync(p->sleeping, 0);
+        atomicIncr(server.stat_io_threads_wakeups, 1);
+        return;
+    }
+    atomicIncr(server.stat_io_threads_spin_usec, getMonotonicUs()-start);
+}
+
+/* Called by the I/O thread 'id' once it served all its clients. The pending
+ * count is cleared before io_threads_done is incremented: the main thread
+ * reads them in opposite order in ioThreadsWaitForCompletion(), so it can't
+ * go to sleep on the new value of io_threads_done while it still sees the
+ * jobs of this thread as pending. */
+static void ioThreadJobsDone(long id) {
+    int main_sleeping;
+
+    setIOPendingCount(id, 0);
+    atomicIncr(io_threads_done, 1);
+    atomicGetWithSync(io_threads_main_sleeping, main_sleeping);
+    if (main_sleeping) ioThreadsWake(&io_threads_done);
+}
+
+/* Hand over the clients in io_threads_list[id] to the I/O thread 'id',
+ * waking it up if it is sleeping. */
+static void ioThreadsHandOff(int id) {
+    int sleeping;
+
+    if (io_threads_list[id].count == 0) return;
+    setIOPendingCount(id, io_threads_list[id].count);
+    atomicGetWithSync(io_threads_pending[id].sleeping, sleeping);
+    if (sleeping) ioThreadsWake(&io_threads_pending[id].value);
+}
+
+static unsigned long ioThreadsPendingCount(void) {
+    unsigned long pending = 0;
+    for (int j = 1; j < server.io_threads_num; j++)
+        pending += getIOPendingCount(j);
+    return pending;
+}
+
+/* Wait for all the I/O threads to end their work, spinning for a short time
+ * before going to sleep until the last I/O thread is done. */
+static void ioThreadsWaitForCompletion(void) {
+    monotime start = getMonotonicUs();
+    unsigned long j = 0;
+
+    while (ioThreadsPendingCount() != 0) {
+        if (++j % IO_THREADS_SPIN_CHECK ||
+            getMonotonicUs()-start < (monotime)server.io_threads_spin_us) continue;
+
+        unsigned int done;
+        atomicSetWithSync(io_threads_main_sleeping, 1);
+        atomicGetWithSync(io_threads_done, done);
+        if (ioThreadsPendingCount() != 0) {
+            ioThreadsSleep(&io_threads_done, done);
+            server.stat_io_threads_main_wakeups++;
+        }
+        atomicSetWithSync(io_threads_main_sleeping, 0);
+    }
+    server.stat_io_threads_main_wait_usec += getMonotonicUs()-start;
+}
+
+/* ==========================================================================
+ * Read-only command execution from I/O threads
+ *
+ * When io-threads-do-commands is enabled, the I/O threads don't just parse
+ * the commands during the read phase, but also execute the commands listed
+ * in ioThreadCommandTable. This is possible because during the read phase the
+ * main thread does not touch the keyspace: all the threads only perform
+ * lookups, so it is enough to pause the incremental rehashing of the dicts
+ * involved for the duration of the phase. Anything that could require a write
+ * to shared state (expired keys, type errors, keyspace events, ...) is left
+ * to the main thread, and the stats call() would update are accumulated per
+ * thread and merged by the main thread once the phase is over.
+ * ========================================================================== */
+
+/* The commands I/O threads may execute. The implementation of each command
+ * must only look up its keys, read the values and emit non-error replies
+ * assuming the keys have the expected type. */
+typedef struct ioThreadCommand {
+    siderCommandProc *proc;
+    int firstkey;   /* Index of the first key argument. */
+    int lastkey;    /* Index of the last key argument, negative counts from argc. */
+    int type;       /* The type existing keys must have, or -1 for any type. */
+} ioThreadCommand;
+
+static ioThreadCommand ioThreadCommandTable[] = {
+    {getCommand,1,1,OBJ_STRING},
+    {mgetCommand,1,-1,-1},
+    {strlenCommand,1,1,OBJ_STRING},
+    {existsCommand,1,-1,-1},
+    {hgetCommand,1,1,OBJ_HASH},
+    {hmgetCommand,1,1,OBJ_HASH},
+    {hexistsCommand,1,1,OBJ_HASH},
+    {hstrlenCommand,1,1,OBJ_HASH},
+    {sismemberCommand,1,1,OBJ_SET},
+    {smismemberCommand,1,1,OBJ_SET},
+    {zscoreCommand,1,1,OBJ_ZSET},
+    {zmscoreCommand,1,1,OBJ_ZSET},
+    {NULL,0,0,0}
+};
+
+/* Per command stats collected by an I/O thread, see ioThreadsMergeCommandStats(). */
+typedef struct ioThreadCommandSample {
+    struct siderCommand *cmd;
+    ustime_t duration;
+    client *c;          /* The fields below are only set when the command */
+    robj **argv;        /* has to be logged in the slowlog. */
+    int argc;
+} ioThreadCommandSample;
+
+typedef struct __attribute__((aligned(CACHE_LINE_SIZE))) ioThreadCommandStats {
+    ioThreadCommandSample *samples;
+    size_t count;
+    size_t size;
+    long long keyspace_hits;
+    long long keyspace_misses;
+    robj **touched;     /* Values whose access time must be updated. */
+    size_t touched_count;
+    size_t touched_size;
+} ioThreadCommandStats;
+
+#define IO_THREAD_SAMPLES_MIN_SIZE 16
+#define IO_THREAD_SAMPLES_MAX_IDLE_SIZE 1024
+
+static ioThreadCommandStats io_threads_cmd_stats[IO_THREADS_MAX_NUM];
+static int io_threads_do_commands = 0; /* Set by the main thread for the current read phase. */
+
+/* Return 1 if the I/O threads can execute commands during the next read phase.
+ * These are the global conditions processCommand() or call() would act upon
+ * even for a read-only command, in any of them we leave the execution to the
+ * main thread. */
+static int ioThreadsCanExecuteCommands(void) {
+    if (!server.io_threads_do_commands) return 0;
+    if (ProcessingEventsWhileBlocked || isInsideYieldingLongCommand()) return 0;
+    if (server.busy_module_yield_flags != BUSY_MODULE_YIELD_NONE) return 0;
+    /* Keys loaded on demand are added to the keyspace by the lookups. */
+    if (server.loading || server.loading_on_demand || server.cluster_enabled) return 0;
+    /* Command filters, keyspace notifications and MONITOR. */
+    if (moduleCount() || listLength(server.monitors)) return 0;
+#ifdef LOG_REQ_RES
+    if (server.req_res_logfile) return 0;
+#endif
+    if (server.notify_keyspace_events & NOTIFY_KEY_MISS) return 0;
+    if (isPausedActions(PAUSE_ACTION_CLIENT_ALL)) return 0;
+    if (server.masterhost && server.repl_state != REPL_STATE_CONNECTED &&
+        server.repl_serve_stale_data == 0) return 0;
+    /* processCommand() evicts keys before executing any command. */
+    if (server.maxmemory && getMaxmemoryState(NULL,NULL,NULL,NULL) != C_OK) return 0;
+    return 1;
+}
+
+/* The lookups performed by the commands would do a rehashing step on
+ * rehashing dicts, so we pause the rehashing for the whole read phase. Not
+ * being in cluster mode, every DB has a single keyspace dict. */
+static void ioThreadsPauseRehashing(void) {
+    for (int j = 0; j < server.dbnum; j++) {
+        dictPauseRehashing(server.db[j].dict[0]);
+        dictPauseRehashing(server.db[j].expires[0]);
+    }
+    dictPauseRehashing(server.commands);
+}
+
+static void ioThreadsResumeRehashing(void) {
+    for (int j = 0; j < server.dbnum; j++) {
+        dictResumeRehashing(server.db[j].dict[0]);
+        dictResumeRehashing(server.db[j].expires[0]);
+    }
+    dictResumeRehashing(server.commands);
+}
+
+/* Values encoded as hash tables are accessed with dictFind(), which is only
+ * read-only as long as the dict is not rehashing. */
+static int ioThreadValueIsRehashing(robj *o) {
+    if (o->encoding == OBJ_ENCODING_HT) return dictIsRehashing((dict*)o->ptr);
+    if (o->encoding == OBJ_ENCODING_SKIPLIST) return dictIsRehashing(((zset*)o->ptr)->dict);
+    return 0;
+}
+
+/* Try to execute the command the client just parsed from the context of an
+ * I/O thread. Returns 1 if the command was executed and the client was reset,
+ * otherwise 0 is returned and the command is left to the main thread. */
+static int ioThreadTryExecuteCommand(client *c) {
+    if (!io_threads_do_commands) return 0;
+    if (c->flags & (CLIENT_MULTI|CLIENT_TRACKING|CLIENT_PUBSUB|CLIENT_NO_TOUCH|
+                    CLIENT_MASTER|CLIENT_SLAVE|CLIENT_MONITOR|CLIENT_BLOCKED))
+        return 0;
+
+    struct siderCommand *cmd = dictFetchValue(server.commands, c->argv[0]->ptr);
+    if (!cmd || cmd->subcommands_dict) return 0;
+    ioThreadCommand *tc = ioThreadCommandTable;
+    while (tc->proc && tc->proc != cmd->proc) tc++;
+    if (!tc->proc) return 0;
+
+    /* Arity, authentication and ACL errors are handled by processCommand(). */
+    if ((cmd->arity > 0 && cmd->arity != c->argc) || c->argc < -cmd->arity) return 0;
+    if (authRequired(c)) return 0;
+    int acl_errpos;
+    if (ACLCheckAllUserCommandPerm(c->user,cmd,c->argv,c->argc,&acl_errpos) != ACL_OK)
+        return 0;
+
+    /* Make sure no key needs to be expired and that the command can't
+     * reply with a type error. */
+    long long hits = 0, misses = 0;
+    int lastkey = tc->lastkey < 0 ? c->argc + tc->lastkey : tc->lastkey;
+    for (int j = tc->firstkey; j <= lastkey; j++) {
+        dictEntry *de = dbFind(c->db,c->argv[j]->ptr);
+        if (!de) {
+            misses++;
+            continue;
+        }
+        robj *val = dictGetVal(de);
+        if (tc->type != -1 && val->type != tc->type) return 0;
+        if (ioThreadValueIsRehashing(val)) return 0;
+        if (keyIsExpired(c->db,c->argv[j])) return 0;
+        hits++;
+    }
+
+    c->cmd = c->lastcmd = c->realcmd = cmd;
+    /* Like call() does, the reply may depend on writes the AOF writer
+     * thread didn't fsync yet. The main thread is waiting for us during
+     * the read phase so the offset can't change under our feet. */
+    c->aof_woff = server.aof_fed_offset;
+    monotime monotonic_start = 0;
+    ustime_t call_timer = 0;
+    if (monotonicGetType() == MONOTONIC_CLOCK_HW)
+        monotonic_start = getMonotonicUs();
+    else
+        call_timer = ustime();
+
+    cmd->proc(c);
+
+    ustime_t duration;
+    if (monotonicGetType() == MONOTONIC_CLOCK_HW)
+        duration = getMonotonicUs() - monotonic_start;
+    else
+        duration = ustime() - call_timer;
+
+    ioThreadCommandStats *st = &io_threads_cmd_stats[io_thread_id];
+    if (st->count == st->size) {
+        st->size = st->size ? st->size*2 : IO_THREAD_SAMPLES_MIN_SIZE;
+        st->samples = zrealloc(st->samples,sizeof(ioThreadCommandSample)*st->size);
+    }
+    ioThreadCommandSample *sample = &st->samples[st->count++];
+    sample->cmd = cmd;
+    sample->duration = duration;
+    sample->c = NULL;
+    sample->argv = NULL;
+    sample->argc = 0;
+    if (server.slowlog_log_slower_than >= 0 &&
+        duration >= server.slowlog_log_slower_than &&
+        !(cmd->flags & CMD_SKIP_SLOWLOG))
+    {
+        sample->c = c;
+        sample->argc = c->argc;
+        sample->argv = zmalloc(sizeof(robj*)*c->argc);
+        for (int j = 0; j < c->argc; j++)
+            sample->argv[j] = dupStringObject(c->argv[j]);
+    }
+    st->keyspace_hits += hits;
+    st->keyspace_misses += misses;
+
+    resetClient(c);
+    return 1;
+}
+
+/* Called by lookupKey() in an I/O thread. The same value may be accessed by
+ * other I/O threads at the same time, so its LRU/LFU access time is updated
+ * by the main thread after the read phase, see ioThreadsMergeCommandStats(). */
+void ioThreadTouchValue(robj *val) {
+    ioThreadCommandStats *st = &io_threads_cmd_stats[io_thread_id];
+    if (st->touched_count == st->touched_size) {
+        st->touched_size = st->touched_size ? st->touched_size*2 : IO_THREAD_SAMPLES_MIN_SIZE;
+        st->touched = zrealloc(st->touched,sizeof(robj*)*st->touched_size);
+    }
+    st->touched[st->touched_count++] = val;
+}
+
+/* Account the commands executed by the I/O threads during the last read
+ * phase, like call() does for the commands executed by the main thread. */
+static void ioThreadsMergeCommandStats(void) {
+    for (int i = 0; i < server.io_threads_num; i++) {
+        ioThreadCommandStats *st = &io_threads_cmd_stats[i];
+
+        /* The values are still in the keyspace: only read only commands
+         * were executed since they were looked up. */
+        for (size_t j = 0; j < st->touched_count; j++) {
+            robj *val = st->touched[j];
+            if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU)
+                updateLFU(val);
+            else
+                val->lru = LRU_CLOCK();
+        }
+        st->touched_count = 0;
+        if (st->touched_size > IO_THREAD_SAMPLES_MAX_IDLE_SIZE) {
+            zfree(st->touched);
+            st->touched = NULL;
+            st->touched_size = 0;
+        }
+
+        for (size_t j = 0; j < st->count; j++) {
+            ioThreadCommandSample *sample = &st->samples[j];
+            struct siderCommand *cmd = sample->cmd;
+
+            char *latency_event = (cmd->flags & CMD_FAST) ?
+                                   "fast-command" : "command";
+            latencyAddSampleIfNeeded(latency_event,sample->duration/1000);
+            durationAddSample(EL_DURATION_TYPE_CMD,sample->duration);
+            if (sample->argv) {
+                slowlogPushEntryIfNeeded(sample->c,sample->argv,sample->argc,
+                                         sample->duration);
+                for (int k = 0; k < sample->argc; k++)
+                    decrRefCount(sample->argv[k]);
+                zfree(sample->argv);
+            }
+            cmd->calls++;
+            cmd->microseconds += sample->duration;
+            if (server.latency_tracking_enabled)
+                updateCommandLatencyHistogram(&(cmd->latency_histogram),
+                                              sample->duration*1000);
+        }
+        server.stat_numcommands += st->count;
+        server.stat_io_commands_processed += st->count;
+        server.stat_keyspace_hits += st->keyspace_hits;
+        server.stat_keyspace_misses += st->keyspace_misses;
+
+        st->count = 0;
+        st->keyspace_hits = 0;
+        st->keyspace_misses = 0;
+        /* Don't hold memory after a burst of pipelined commands. */
+        if (st->size > IO_THREAD_SAMPLES_MAX_IDLE_SIZE) {
+            zfree(st->samples);
+            st->samples = NULL;
+            st->size = 0;
+        }
+    }
 }
 
 void *IOThreadMain(void *myid) {
@@ -4176,33 +5340,29 @@ void *IOThreadMain(void *myid) {
     long id = (unsigned long)myid;
     char thdname[16];
 
+    io_thread_id = id;
     snprintf(thdname, sizeof(thdname), "io_thd_%ld", id);
     sider_set_thread_title(thdname);
     siderSetCpuAffinity(server.server_cpulist);
     makeThreadKillable();
 
+    /* Serve the clients assigned to our own event loop if enabled, in that
+     * case the main thread will never fan out jobs to this thread. */
+    if (server.io_threads_event_loops) {
+        ioThreadRunEventLoop();
+        return NULL;
+    }
+
     while(1) {
         /* Wait for start */
-        for (int j = 0; j < 1000000; j++) {
-            if (getIOPendingCount(id) != 0) break;
-        }
-
-        /* Give the main thread a chance to stop this thread. */
-        if (getIOPendingCount(id) == 0) {
-            pthread_mutex_lock(&io_threads_mutex[id]);
-            pthread_mutex_unlock(&io_threads_mutex[id]);
-            continue;
-        }
-
+        ioThreadWaitForJobs(id);
         serverAssert(getIOPendingCount(id) != 0);
 
         /* Process: note that the main thread will never touch our list
          * before we drop the pending count to 0. */
-        listIter li;
-        listNode *ln;
-        listRewind(io_threads_list[id],&li);
-        while((ln = listNext(&li))) {
-            client *c = listNodeValue(ln);
+        ioThreadClients *l = &io_threads_list[id];
+        for (int j = 0; j < l->count; j++) {
+            client *c = l->clients[j];
             if (io_threads_op == IO_THREADS_OP_WRITE) {
                 writeToClient(c,0);
             } else if (io_threads_op == IO_THREADS_OP_READ) {
@@ -4211,8 +5371,8 @@ void *IOThreadMain(void *myid) {
                 serverPanic("io_threads_op value is unknown");
             }
         }
-        listEmpty(io_threads_list[id]);
-        setIOPendingCount(id, 0);
+        l->count = 0;
+        ioThreadJobsDone(id);
     }
 }
 
@@ -4233,17 +5393,16 @@ void initThreadedIO(void) {
         exit(1);
     }
 
-    /* Spawn and initialize the I/O threads. */
-    for (int i = 0; i < server.io_threads_num; i++) {
-        /* Things we do for all the threads including the main thread. */
-        io_threads_list[i] = listCreate();
-        if (i == 0) continue; /* Thread 0 is the main thread. */
+    if (server.io_threads_event_loops) initIOThreadsEventLoops();
 
-        /* Things we do only for the additional threads. */
+    /* Spawn and initialize the I/O threads. */
+    for (int i = 1; i < server.io_threads_num; i++) {
+        /* Thread 0 is the main thread, the additional threads start idle
+         * and go to sleep until they get some clients to serve. */
         pthread_t tid;
-        pthread_mutex_init(&io_threads_mutex[i],NULL);
         setIOPendingCount(i, 0);
-        pthread_mutex_lock(&io_threads_mutex[i]); /* Thread will be stopped. */
+        io_threads_released_objs[i] = listCreate();
+        listSetFreeMethod(io_threads_released_objs[i],decrRefCountVoid);
         if (pthread_create(&tid,NULL,IOThreadMain,(void*)(long)i) != 0) {
             serverLog(LL_WARNING,"Fatal: Can't initialize IO thread.");
             exit(1);
@@ -4269,10 +5428,10 @@ void killIOThreads(void) {
     }
 }
 
+/* Threads not used for a while just sleep waiting for jobs, so starting and
+ * stopping the threaded I/O only changes how the clients are served. */
 void startThreadedIO(void) {
     serverAssert(server.io_threads_active == 0);
-    for (int j = 1; j < server.io_threads_num; j++)
-        pthread_mutex_unlock(&io_threads_mutex[j]);
     server.io_threads_active = 1;
 }
 
@@ -4281,8 +5440,6 @@ void stopThreadedIO(void) {
      * is called: handle them before stopping the threads. */
     handleClientsWithPendingReadsUsingThreads();
     serverAssert(server.io_threads_active == 1);
-    for (int j = 1; j < server.io_threads_num; j++)
-        pthread_mutex_lock(&io_threads_mutex[j]);
     server.io_threads_active = 0;
 }
 
@@ -4298,8 +5455,9 @@ void stopThreadedIO(void) {
 int stopThreadedIOIfNeeded(void) {
     int pending = listLength(server.clients_pending_write);
 
-    /* Return ASAP if IO threads are disabled (single threaded mode). */
-    if (server.io_threads_num == 1) return 1;
+    /* Return ASAP if IO threads are disabled (single threaded mode), or
+     * they are busy with their own event loops. */
+    if (server.io_threads_num == 1 || server.io_threads_event_loops) return 1;
 
     if (pending < (server.io_threads_num*2)) {
         if (server.io_threads_active) stopThreadedIO();
@@ -4335,6 +5493,10 @@ int handleClientsWithPendingWritesUsingThreads(void) {
     int item_id = 0;
     while((ln = listNext(&li))) {
         client *c = listNodeValue(ln);
+
+        /* Replies waiting for the AOF to be fsynced stay in the list. */
+        if (aofClientWaitsFsync(c)) continue;
+
         c->flags &= ~CLIENT_PENDING_WRITE;
 
         /* Remove clients from the list of pending writes since
@@ -4349,47 +5511,52 @@ int handleClientsWithPendingWritesUsingThreads(void) {
          * replicas client into io_threads_list[0] i.e. main thread handles
          * sending the output buffer of all replicas. */
         if (getClientType(c) == CLIENT_TYPE_SLAVE) {
-            listAddNodeTail(io_threads_list[0],c);
+            ioThreadAddClient(0,c);
             continue;
         }
 
         int target_id = item_id % server.io_threads_num;
-        listAddNodeTail(io_threads_list[target_id],c);
+        ioThreadAddClient(target_id,c);
         item_id++;
     }
 
     /* Give the start condition to the waiting threads, by setting the
      * start condition atomic var. */
     io_threads_op = IO_THREADS_OP_WRITE;
-    for (int j = 1; j < server.io_threads_num; j++) {
-        int count = listLength(io_threads_list[j]);
-        setIOPendingCount(j, count);
-    }
+    for (int j = 1; j < server.io_threads_num; j++)
+        ioThreadsHandOff(j);
 
     /* Also use the main thread to process a slice of clients. */
-    listRewind(io_threads_list[0],&li);
-    while((ln = listNext(&li))) {
-        client *c = listNodeValue(ln);
-        writeToClient(c,0);
-    }
-    listEmpty(io_threads_list[0]);
+    for (int j = 0; j < io_threads_list[0].count; j++)
+        writeToClient(io_threads_list[0].clients[j],0);
+    io_threads_list[0].count = 0;
 
     /* Wait for all the other threads to end their work. */
-    while(1) {
-        unsigned long pending = 0;
-        for (int j = 1; j < server.io_threads_num; j++)
-            pending += getIOPendingCount(j);
-        if (pending == 0) break;
-    }
+    ioThreadsWaitForCompletion();
 
     io_threads_op = IO_THREADS_OP_IDLE;
 
+    /* Release the objects of the reply blocks sent by the threads, and
+     * return their standard sized blocks to the pool. */
+    for (int j = 1; j < server.io_threads_num; j++) {
+        listEmpty(io_threads_released_objs[j]);
+        while (io_threads_released_blocks[j]) {
+            void *block = io_threads_released_blocks[j];
+            io_threads_released_blocks[j] = *(void **)block;
+            replyPoolRelease(REPLY_POOL_BLOCK, block,
+                             server.reply_pool[REPLY_POOL_BLOCK].usable);
+        }
+    }
+
     /* Run the list of clients again to install the write handler where
      * needed. */
     listRewind(server.clients_pending_write,&li);
     while((ln = listNext(&li))) {
         client *c = listNodeValue(ln);
 
+        if (aofClientWaitsFsync(c)) continue;
+        listUnlinkNode(server.clients_pending_write, ln);
+
         /* Update the client in the mem usage after we're done processing it in the io-threads */
         updateClientMemUsageAndBucket(c);
 
@@ -4399,9 +5566,6 @@ int handleClientsWithPendingWritesUsingThreads(void) {
             installClientWriteHandler(c);
         }
     }
-    while(listLength(server.clients_pending_write) > 0) {
-        listUnlinkNode(server.clients_pending_write, server.clients_pending_write->head);
-    }
 
     /* Update processed count on server */
     server.stat_io_writes_processed += processed;
@@ -4453,36 +5617,37 @@ int handleClientsWithPendingReadsUsingThreads(void) {
     while((ln = listNext(&li))) {
         client *c = listNodeValue(ln);
         int target_id = item_id % server.io_threads_num;
-        listAddNodeTail(io_threads_list[target_id],c);
+        ioThreadAddClient(target_id,c);
         item_id++;
     }
 
+    /* Check if during this read phase the threads can also execute
+     * commands, see ioThreadTryExecuteCommand(). */
+    io_threads_do_commands = ioThreadsCanExecuteCommands();
+    if (io_threads_do_commands) ioThreadsPauseRehashing();
+
     /* Give the start condition to the waiting threads, by setting the
      * start condition atomic var. */
     io_threads_op = IO_THREADS_OP_READ;
-    for (int j = 1; j < server.io_threads_num; j++) {
-        int count = listLength(io_threads_list[j]);
-        setIOPendingCount(j, count);
-    }
+    for (int j = 1; j < server.io_threads_num; j++)
+        ioThreadsHandOff(j);
 
     /* Also use the main thread to process a slice of clients. */
-    listRewind(io_threads_list[0],&li);
-    while((ln = listNext(&li))) {
-        client *c = listNodeValue(ln);
-        readQueryFromClient(c->conn);
-    }
-    listEmpty(io_threads_list[0]);
+    for (int j = 0; j < io_threads_list[0].count; j++)
+        readQueryFromClient(io_threads_list[0].clients[j]->conn);
+    io_threads_list[0].count = 0;
 
     /* Wait for all the other threads to end their work. */
-    while(1) {
-        unsigned long pending = 0;
-        for (int j = 1; j < server.io_threads_num; j++)
-            pending += getIOPendingCount(j);
-        if (pending == 0) break;
-    }
+    ioThreadsWaitForCompletion();
 
     io_threads_op = IO_THREADS_OP_IDLE;
 
+    if (io_threads_do_commands) {
+        io_threads_do_commands = 0;
+        ioThreadsResumeRehashing();
+        ioThreadsMergeCommandStats();
+    }
+
     /* Run the list of clients again to process the new buffers. */
     while(listLength(server.clients_pending_read)) {
         ln = listFirst(server.clients_pending_read);
@@ -4522,6 +5687,333 @@ int handleClientsWithPendingReadsUsingThreads(void) {
     return processed;
 }
 
+/* ==========================================================================
+ * I/O threads event loops
+ * ========================================================================== */
+
+/* When io-threads-event-loops is enabled the I/O threads don't wait for the
+ * fan-out jobs of the main thread, but every thread runs its own event loop.
+ * Accepted connections are assigned round robin to the threads, and from then
+ * on the thread is the only one waiting for the socket to become readable and
+ * reading from it, so the main thread no longer pays for polling and reading
+ * from all the connections.
+ *
+ * The thread never touches the client structure, that the main thread may
+ * modify at any time: it just reads into a new buffer and passes it to the
+ * main thread, which appends it to the query buffer of the client and goes
+ * on exactly like readQueryFromClient() would do. Replies are still written
+ * by the main thread.
+ *
+ * The main thread and every I/O thread talk using two lock-free single
+ * producer / single consumer queues of messages, and the consumer of a queue
+ * is woken up using a pipe registered in its event loop. After passing some
+ * data to the main thread, the I/O thread stops reading from the client
+ * until the main thread sends a RESUME message, so for every client there is
+ * at most a buffer in flight.
+ *
+ * The only time the main thread touches the event loop of a thread is when
+ * a client is released, see ioThreadDetachClient(): to do so synchronously
+ * the thread holds a mutex while processing the fired events, and releases
+ * it only while waiting for new events. */
+
+#define IO_THREAD_MSG_NONE 0        /* Dropped message. */
+#define IO_THREAD_MSG_ATTACH 1      /* Main -> thread: read from the client. */
+#define IO_THREAD_MSG_RESUME 2      /* Main -> thread: read again. */
+#define IO_THREAD_MSG_READ 3        /* Thread -> main: some data was read. */
+#define IO_THREAD_MSG_CLOSED 4      /* Thread -> main: EOF or read error. */
+
+typedef struct ioThreadMsg {
+    int type;
+    int fd;
+    int err;        /* errno of the failed read(2) for CLOSED messages. */
+    client *c;      /* Never dereferenced by the I/O thread. */
+    sds data;       /* Data read for READ messages. */
+    struct ioThreadMsg * siderAtomic next;
+} ioThreadMsg;
+
+/* The queue always contains a stub message, the last one consumed, so that
+ * the producer and the consumer never touch the same message but for the
+ * 'next' pointer. */
+typedef struct ioThreadQueue {
+    ioThreadMsg *head;          /* Last consumed message: consumer only. */
+    ioThreadMsg *tail __attribute__((aligned(CACHE_LINE_SIZE)));
+                                /* Last produced message: producer only. */
+    siderAtomic int notified;   /* Did the producer write to the pipe since
+                                   the consumer last emptied the queue? */
+    int pipe[2];                /* The consumer waits on pipe[0]. */
+} ioThreadQueue;
+
+static aeEventLoop *io_threads_el[IO_THREADS_MAX_NUM];
+static pthread_mutex_t io_threads_el_mutex[IO_THREADS_MAX_NUM];
+static ioThreadQueue io_threads_inbox[IO_THREADS_MAX_NUM];  /* Main -> thread. */
+static ioThreadQueue io_threads_outbox[IO_THREADS_MAX_NUM]; /* Thread -> main. */
+
+static void ioThreadQueueInit(ioThreadQueue *q) {
+    q->head = q->tail = zcalloc(sizeof(ioThreadMsg));
+    atomicSet(q->notified, 0);
+    if (anetPipe(q->pipe, O_CLOEXEC|O_NONBLOCK, O_CLOEXEC|O_NONBLOCK) == -1) {
+        serverLog(LL_WARNING,
+            "Fatal: can't create the pipe for the IO threads: %s", strerror(errno));
+        exit(1);
+    }
+}
+
+/* Append a message to the queue, waking up the consumer if this is the first
+ * message since it last emptied the queue. Only called by the producer. */
+static void ioThreadQueuePush(ioThreadQueue *q, int type, client *c, int fd, sds data, int err) {
+    ioThreadMsg *msg = zmalloc(sizeof(*msg));
+    int notified;
+
+    msg->type = type;
+    msg->fd = fd;
+    msg->err = err;
+    msg->c = c;
+    msg->data = data;
+    atomicSet(msg->next, NULL);
+    atomicSetWithSync(q->tail->next, msg);
+    q->tail = msg;
+
+    atomicGetWithSync(q->notified, notified);
+    if (!notified) {
+        atomicSetWithSync(q->notified, 1);
+        if (write(q->pipe[1],"A",1) != 1) {
+            /* Ignore the error, the pipe is never full since we write to it
+             * at most once every time the consumer empties the queue. */
+        }
+    }
+}
+
+/* Called by the consumer when woken up, before emptying the queue with
+ * ioThreadQueuePop(): the producer writes to the pipe again on the next
+ * push after this call, so no message can be left behind. */
+static void ioThreadQueueWakeupDone(ioThreadQueue *q) {
+    char buf[64];
+    while (read(q->pipe[0],buf,sizeof(buf)) > 0);
+    atomicSetWithSync(q->notified, 0);
+}
+
+/* Return the next message of the queue or NULL if the queue is empty. The
+ * message is valid until the next call. Only called by the consumer. */
+static ioThreadMsg *ioThreadQueuePop(ioThreadQueue *q) {
+    ioThreadMsg *next;
+
+    atomicGetWithSync(q->head->next, next);
+    if (next == NULL) return NULL;
+    zfree(q->head);
+    q->head = next;
+    return next;
+}
+
+/* Drop the messages about the client 'c' not yet consumed. Must be called
+ * holding the mutex of the I/O thread, so that neither side of the queue
+ * is in use by the thread. */
+static void ioThreadQueueForgetClient(ioThreadQueue *q, client *c) {
+    ioThreadMsg *msg;
+
+    atomicGetWithSync(q->head->next, msg);
+    while (msg) {
+        if (msg->c == c) {
+            msg->type = IO_THREAD_MSG_NONE;
+            sdsfree(msg->data);
+            msg->data = NULL;
+        }
+        atomicGetWithSync(msg->next, msg);
+    }
+}
+
+/* Readable event handler of the clients in the event loop of an I/O thread. */
+static void ioThreadReadHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
+    char buf[PROTO_IOBUF_LEN];
+    UNUSED(mask);
+
+    ssize_t nread = read(fd,buf,sizeof(buf));
+    if (nread == -1 && (errno == EAGAIN || errno == EINTR)) return;
+    int err = nread == -1 ? errno : 0;
+
+    /* Stop reading until the main thread consumed what we read. */
+    aeDeleteFileEvent(el,fd,AE_READABLE);
+    atomicIncr(server.stat_total_reads_processed, 1);
+    if (nread > 0) {
+        ioThreadQueuePush(&io_threads_outbox[io_thread_id],IO_THREAD_MSG_READ,
+                          privdata,fd,sdsnewlen(buf,nread),0);
+    } else {
+        ioThreadQueuePush(&io_threads_outbox[io_thread_id],IO_THREAD_MSG_CLOSED,
+                          privdata,fd,NULL,err);
+    }
+}
+
+/* Handle the messages sent by the main thread to the I/O thread. */
+static void ioThreadHandleMessages(aeEventLoop *el, int fd, void *privdata, int mask) {
+    ioThreadQueue *q = &io_threads_inbox[io_thread_id];
+    ioThreadMsg *msg;
+    UNUSED(fd);
+    UNUSED(privdata);
+    UNUSED(mask);
+
+    ioThreadQueueWakeupDone(q);
+    while ((msg = ioThreadQueuePop(q)) != NULL) {
+        if (msg->type == IO_THREAD_MSG_NONE) continue;
+        serverAssert(msg->type == IO_THREAD_MSG_ATTACH ||
+                     msg->type == IO_THREAD_MSG_RESUME);
+
+        /* The main thread may have raised maxclients after we created
+         * our event loop. */
+        if (msg->fd >= aeGetSetSize(el))
+            aeResizeSetSize(el,msg->fd+CONFIG_FDSET_INCR);
+        if (aeCreateFileEvent(el,msg->fd,AE_READABLE,
+                              ioThreadReadHandler,msg->c) == AE_ERR)
+        {
+            ioThreadQueuePush(&io_threads_outbox[io_thread_id],
+                IO_THREAD_MSG_CLOSED,msg->c,msg->fd,NULL,errno);
+        }
+    }
+}
+
+/* The I/O thread holds its mutex all the time but while waiting for events. */
+static void ioThreadBeforeSleep(aeEventLoop *el) {
+    UNUSED(el);
+    pthread_mutex_unlock(&io_threads_el_mutex[io_thread_id]);
+}
+
+static void ioThreadAfterSleep(aeEventLoop *el) {
+    UNUSED(el);
+    pthread_mutex_lock(&io_threads_el_mutex[io_thread_id]);
+}
+
+static void ioThreadRunEventLoop(void) {
+    pthread_mutex_lock(&io_threads_el_mutex[io_thread_id]);
+    aeMain(io_threads_el[io_thread_id]);
+}
+
+/* Assign a just accepted client to the event loop of an I/O thread, if
+ * enabled. TLS connections are always served by the main thread. */
+static void ioThreadAttachClient(client *c) {
+    static int next_thread = 0;
+
+    if (!server.io_threads_event_loops || server.io_threads_num == 1) return;
+    if (connIsTLS(c->conn) || c->flags & CLIENT_CLOSE_ASAP) return;
+
+    /* Stop reading from the main thread and let the I/O thread do it. */
+    connSetReadHandler(c->conn,NULL);
+    c->io_thread = 1 + next_thread++ % (server.io_threads_num-1);
+    ioThreadQueuePush(&io_threads_inbox[c->io_thread],IO_THREAD_MSG_ATTACH,
+                      c,c->conn->fd,NULL,0);
+}
+
+/* Let the I/O thread of the client read again after the main thread
+ * consumed the last data it sent. */
+static void ioThreadResumeClient(client *c) {
+    ioThreadQueuePush(&io_threads_inbox[c->io_thread],IO_THREAD_MSG_RESUME,
+                      c,c->conn->fd,NULL,0);
+}
+
+/* Called before closing the connection of a client served by an I/O thread:
+ * make sure the thread stops reading from it, and that no message about the
+ * client is left in the queues. */
+static void ioThreadDetachClient(client *c) {
+    int id = c->io_thread;
+
+    pthread_mutex_lock(&io_threads_el_mutex[id]);
+    aeDeleteFileEvent(io_threads_el[id],c->conn->fd,AE_READABLE);
+    ioThreadQueueForgetClient(&io_threads_inbox[id],c);
+    ioThreadQueueForgetClient(&io_threads_outbox[id],c);
+    pthread_mutex_unlock(&io_threads_el_mutex[id]);
+    c->io_thread = 0;
+}
+
+/* Append the data read by the I/O thread to the query buffer of the client
+ * and process it. */
+static void ioThreadClientRead(client *c, sds data) {
+    size_t nread = sdslen(data);
+
+    server.stat_io_reads_processed++;
+    if (c->flags & CLIENT_CLOSE_ASAP) {
+        sdsfree(data);
+        return;
+    }
+
+    /* A protected client is in the middle of executing a command: keep the
+     * data aside until unprotectClient(), and don't let the thread read
+     * more meanwhile, like protectClient() does removing the read handler. */
+    if (c->flags & CLIENT_PROTECTED) {
+        serverAssert(c->io_thread_pending == NULL);
+        atomicIncr(server.stat_net_input_bytes, nread);
+        c->io_thread_pending = data;
+        return;
+    }
+
+    if (c->querybuf == NULL || sdslen(c->querybuf) == 0) {
+        sdsfree(c->querybuf);
+        c->querybuf = data;
+    } else {
+        c->querybuf = sdscatsds(c->querybuf,data);
+        sdsfree(data);
+    }
+
+    /* The thread can read the next chunk while we process this one. */
+    ioThreadResumeClient(c);
+    processQueryBufferData(c,nread);
+}
+
+/* Handle the messages sent by the I/O thread 'privdata' to the main thread. */
+static void handleIOThreadMessages(aeEventLoop *el, int fd, void *privdata, int mask) {
+    ioThreadQueue *q = privdata;
+    ioThreadMsg *msg;
+    UNUSED(el);
+    UNUSED(fd);
+    UNUSED(mask);
+
+    ioThreadQueueWakeupDone(q);
+    while ((msg = ioThreadQueuePop(q)) != NULL) {
+        client *c = msg->c;
+
+        if (msg->type == IO_THREAD_MSG_READ) {
+            ioThreadClientRead(c,msg->data);
+        } else if (msg->type == IO_THREAD_MSG_CLOSED) {
+            /* The thread already stopped reading from the client. */
+            c->io_thread = 0;
+            if (msg->err == 0) {
+                if (server.verbosity <= LL_VERBOSE) {
+                    sds info = catClientInfoString(sdsempty(), c);
+                    serverLog(LL_VERBOSE, "Client closed connection %s", info);
+                    sdsfree(info);
+                }
+            } else {
+                serverLog(LL_VERBOSE, "Reading from client: %s", strerror(msg->err));
+            }
+            freeClientAsync(c);
+        }
+    }
+}
+
+/* Create the event loops of the I/O threads, and the queues used to talk
+ * with the main thread. */
+static void initIOThreadsEventLoops(void) {
+    for (int i = 1; i < server.io_threads_num; i++) {
+        io_threads_el[i] = aeCreateEventLoop(server.maxclients+CONFIG_FDSET_INCR);
+        if (io_threads_el[i] == NULL) {
+            serverLog(LL_WARNING,
+                "Fatal: can't create the event loop of the IO threads: %s",
+                strerror(errno));
+            exit(1);
+        }
+        aeSetBeforeSleepProc(io_threads_el[i],ioThreadBeforeSleep);
+        aeSetAfterSleepProc(io_threads_el[i],ioThreadAfterSleep);
+        pthread_mutex_init(&io_threads_el_mutex[i],NULL);
+        ioThreadQueueInit(&io_threads_inbox[i]);
+        ioThreadQueueInit(&io_threads_outbox[i]);
+        if (aeCreateFileEvent(io_threads_el[i],io_threads_inbox[i].pipe[0],
+                AE_READABLE,ioThreadHandleMessages,NULL) == AE_ERR ||
+            aeCreateFileEvent(server.el,io_threads_outbox[i].pipe[0],
+                AE_READABLE,handleIOThreadMessages,&io_threads_outbox[i]) == AE_ERR)
+        {
+            serverLog(LL_WARNING,
+                "Fatal: can't register the pipes of the IO threads in the event loops.");
+            exit(1);
+        }
+    }
+}
+
 /* Returns the actual client eviction limit based on current configuration or
  * 0 if no limit. */
 size_t getClientEvictionLimit(void) {
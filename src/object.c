@@ -119,7 +119,6 @@ robj *createEmbeddedStringObject(const char *ptr, size_t len) {
  *
  * The current limit of 44 is chosen so that the biggest string object
  * we allocate as EMBSTR will still fit into the 64 byte arena of jemalloc. */
-#define OBJ_ENCODING_EMBSTR_SIZE_LIMIT 44
 robj *createStringObject(const char *ptr, size_t len) {
     if (len <= OBJ_ENCODING_EMBSTR_SIZE_LIMIT)
         return createEmbeddedStringObject(ptr,len);
@@ -998,7 +997,6 @@ size_t streamRadixTreeMemoryUsage(rax *rax) {
  * Note that the returned value is just an approximation, especially in the
  * case of aggregated data types where only "sample_size" elements
  * are checked and averaged to estimate the total size. */
-#define OBJ_COMPUTE_SIZE_DEF_SAMPLES 5 /* Default sample size. */
 size_t objectComputeSize(robj *key, robj *o, size_t sample_size, int dbid) {
     sds ele, ele2;
     dict *d;
@@ -1234,10 +1232,14 @@ struct siderMemOverhead *getMemoryOverheadData(void) {
     mem = 0;
     if (server.aof_state != AOF_OFF) {
         mem += sdsZmallocSize(server.aof_buf);
+        mem += sdsZmallocSize(server.aof_block);
     }
     mh->aof_buffer = mem;
     mem_total+=mem;
 
+    mh->reply_pools = replyPoolsMemory();
+    mem_total += mh->reply_pools;
+
     mem = evalScriptsMemory();
     mh->lua_caches = mem;
     mem_total+=mem;
@@ -1246,27 +1248,24 @@ struct siderMemOverhead *getMemoryOverheadData(void) {
 
     for (j = 0; j < server.dbnum; j++) {
         siderDb *db = server.db+j;
-        long long keyscount = dictSize(db->dict);
+        long long keyscount = dbSize(db, DB_MAIN);
         if (keyscount==0) continue;
 
         mh->total_keys += keyscount;
         mh->db = zrealloc(mh->db,sizeof(mh->db[0])*(mh->num_dbs+1));
         mh->db[mh->num_dbs].dbid = j;
 
-        mem = dictMemUsage(db->dict) +
-              dictSize(db->dict) * sizeof(robj);
-        mh->db[mh->num_dbs].overhead_ht_main = mem;
-        mem_total+=mem;
-
-        mem = dictMemUsage(db->expires);
-        mh->db[mh->num_dbs].overhead_ht_expires = mem;
-        mem_total+=mem;
+        /* In cluster mode this includes the dict of every slot. */
+        size_t main_mem = keyscount * sizeof(robj), expires_mem = 0;
+        for (int slot = 0; slot < db->dict_count; slot++) {
+            main_mem += dictMemUsage(db->dict[slot]);
+            expires_mem += dictMemUsage(db->expires[slot]);
+        }
+        mh->db[mh->num_dbs].overhead_ht_main = main_mem;
+        mem_total+=main_mem;
 
-        /* Account for the slot to keys map in cluster mode */
-        mem = dictSize(db->dict) * dictEntryMetadataSize(db->dict) +
-              dictMetadataSize(db->dict);
-        mh->db[mh->num_dbs].overhead_ht_slot_to_keys = mem;
-        mem_total+=mem;
+        mh->db[mh->num_dbs].overhead_ht_expires = expires_mem;
+        mem_total+=expires_mem;
 
         mh->num_dbs++;
     }
@@ -1551,14 +1550,13 @@ NULL
                 return;
             }
         }
-        if ((de = dictFind(c->db->dict,c->argv[2]->ptr)) == NULL) {
+        if ((de = dbFind(c->db,c->argv[2]->ptr)) == NULL) {
             addReplyNull(c);
             return;
         }
         size_t usage = objectComputeSize(c->argv[2],dictGetVal(de),samples,c->db->id);
         usage += sdsZmallocSize(dictGetKey(de));
         usage += dictEntryMemUsage();
-        usage += dictMetadataSize(c->db->dict);
         addReplyLongLong(c,usage);
     } else if (!strcasecmp(c->argv[1]->ptr,"stats") && c->argc == 2) {
         struct siderMemOverhead *mh = getMemoryOverheadData();
@@ -1599,16 +1597,13 @@ NULL
             char dbname[32];
             snprintf(dbname,sizeof(dbname),"db.%zd",mh->db[j].dbid);
             addReplyBulkCString(c,dbname);
-            addReplyMapLen(c,3);
+            addReplyMapLen(c,2);
 
             addReplyBulkCString(c,"overhead.hashtable.main");
             addReplyLongLong(c,mh->db[j].overhead_ht_main);
 
             addReplyBulkCString(c,"overhead.hashtable.expires");
             addReplyLongLong(c,mh->db[j].overhead_ht_expires);
-
-            addReplyBulkCString(c,"overhead.hashtable.slot-to-keys");
-            addReplyLongLong(c,mh->db[j].overhead_ht_slot_to_keys);
         }
 
 
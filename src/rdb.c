@@ -37,6 +37,14 @@
 #include "intset.h"  /* Compact integer set structure */
 #include "bio.h"
 
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+
 #include <math.h>
 #include <fcntl.h>
 #include <sys/types.h>
@@ -45,6 +53,7 @@
 #include <sys/wait.h>
 #include <arpa/inet.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <sys/param.h>
 
 /* This macro is called when the internal RDB structure is corrupt */
@@ -342,13 +351,158 @@ int rdbTryIntegerEncoding(char *s, size_t len, unsigned char *enc) {
     }
 }
 
-ssize_t rdbSaveLzfBlob(rio *rdb, void *data, size_t compress_len,
-                       size_t original_len) {
+/* ---------------------------------------------------------------------------
+ * Compression of the string values
+ *
+ * Strings are compressed with LZF, or with LZ4 and ZSTD when Sider is built
+ * with them (USE_LZ4=yes / USE_ZSTD=yes), according to the
+ * rdbcompression-algorithm option. All the algorithms share the same format:
+ * the RDB_ENC_* byte, the compressed and the original lengths, and the
+ * compressed bytes.
+ *
+ * When the values are compressed with ZSTD, the snapshots can also start with
+ * a ZSTD dictionary trained from a sample of the values, that greatly improves
+ * the compression of many small and similar values. The dictionary is saved
+ * with the RDB_OPCODE_ZSTD_DICT opcode before the keys, and the ZSTD frames
+ * compressed with it refer to it by its ID.
+ * ------------------------------------------------------------------------- */
+
+#ifdef HAVE_ZSTD
+/* Contexts of the calling thread, created on first use. */
+static __thread ZSTD_CCtx *rdb_zstd_cctx = NULL;
+static __thread ZSTD_DCtx *rdb_zstd_dctx = NULL;
+
+/* Dictionary used by the calling thread to compress the values of the
+ * snapshot being saved, if any. */
+static __thread ZSTD_CDict *rdb_zstd_cdict = NULL;
+
+/* The dictionaries loaded so far. They are added by any loading thread and
+ * looked up without locking, since an entry is never modified once counted,
+ * and are released when the loading ends. */
+static struct {
+    unsigned int id;
+    ZSTD_DDict *ddict;
+} rdb_zstd_ddicts[RDB_ZSTD_DICTS_MAX];
+static siderAtomic int rdb_zstd_ddicts_count = 0;
+static pthread_mutex_t rdb_zstd_ddicts_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static ZSTD_DDict *rdbLookupZstdDict(unsigned int id) {
+    int count;
+
+    atomicGetWithSync(rdb_zstd_ddicts_count,count);
+    for (int j = 0; j < count; j++) {
+        if (rdb_zstd_ddicts[j].id == id) return rdb_zstd_ddicts[j].ddict;
+    }
+    return NULL;
+}
+
+static size_t rdbZstdCompress(const void *s, size_t len, void *out, size_t outlen) {
+    size_t comprlen;
+
+    if (rdb_zstd_cctx == NULL) {
+        rdb_zstd_cctx = ZSTD_createCCtx();
+        if (rdb_zstd_cctx == NULL) return 0;
+        /* The original length is already saved before the frame. */
+        ZSTD_CCtx_setParameter(rdb_zstd_cctx,ZSTD_c_contentSizeFlag,0);
+    }
+    ZSTD_CCtx_setParameter(rdb_zstd_cctx,ZSTD_c_compressionLevel,
+                           server.rdb_compression_zstd_level);
+    ZSTD_CCtx_refCDict(rdb_zstd_cctx,rdb_zstd_cdict);
+    comprlen = ZSTD_compress2(rdb_zstd_cctx,out,outlen,s,len);
+    return ZSTD_isError(comprlen) ? 0 : comprlen;
+}
+
+static int rdbZstdDecompress(const void *c, size_t clen, void *val, size_t len) {
+    unsigned int id = ZSTD_getDictID_fromFrame(c,clen);
+    ZSTD_DDict *ddict = NULL;
+    size_t retval;
+
+    if (id && (ddict = rdbLookupZstdDict(id)) == NULL) {
+        rdbReportCorruptRDB("Unknown ZSTD dictionary %u", id);
+        return -1;
+    }
+    if (rdb_zstd_dctx == NULL && (rdb_zstd_dctx = ZSTD_createDCtx()) == NULL)
+        return -1;
+    if (ddict)
+        retval = ZSTD_decompress_usingDDict(rdb_zstd_dctx,val,len,c,clen,ddict);
+    else
+        retval = ZSTD_decompressDCtx(rdb_zstd_dctx,val,len,c,clen);
+    return (!ZSTD_isError(retval) && retval == len) ? 0 : -1;
+}
+#endif
+
+/* Release the compression contexts of the calling thread. Called by the
+ * threads saving and loading snapshots before they exit. */
+static void rdbReleaseThreadCompression(void) {
+#ifdef HAVE_ZSTD
+    ZSTD_freeCCtx(rdb_zstd_cctx);
+    ZSTD_freeDCtx(rdb_zstd_dctx);
+    rdb_zstd_cctx = NULL;
+    rdb_zstd_dctx = NULL;
+#endif
+}
+
+/* Compress 's' with the algorithm of 'enctype' in 'out', returning the
+ * compressed length, or 0 if it does not fit in 'outlen' bytes. */
+static size_t rdbCompress(int enctype, const unsigned char *s, size_t len,
+                          void *out, size_t outlen)
+{
+    switch(enctype) {
+    case RDB_ENC_LZF:
+        return lzf_compress(s,len,out,outlen);
+#ifdef HAVE_LZ4
+    case RDB_ENC_LZ4:
+        if (len > LZ4_MAX_INPUT_SIZE) return 0;
+        return LZ4_compress_default((const char*)s,out,len,outlen);
+#endif
+#ifdef HAVE_ZSTD
+    case RDB_ENC_ZSTD:
+        return rdbZstdCompress(s,len,out,outlen);
+#endif
+    default:
+        return 0;
+    }
+}
+
+/* Decompress the 'clen' bytes of 'c', compressed with the algorithm of
+ * 'enctype', to the 'len' bytes of 'val'. Returns 0 on success, -1 if the
+ * compressed string is invalid, or if this build can't decompress it. */
+static int rdbDecompress(int enctype, const void *c, size_t clen, void *val, size_t len) {
+    switch(enctype) {
+    case RDB_ENC_LZF:
+        if (lzf_decompress(c,clen,val,len) != len) break;
+        return 0;
+    case RDB_ENC_LZ4:
+#ifdef HAVE_LZ4
+        if (clen > INT_MAX || len > INT_MAX ||
+            LZ4_decompress_safe(c,val,clen,len) != (int)len) break;
+        return 0;
+#else
+        rdbReportCorruptRDB("String compressed with LZ4, but Sider was built without LZ4 support");
+        return -1;
+#endif
+    case RDB_ENC_ZSTD:
+#ifdef HAVE_ZSTD
+        if (rdbZstdDecompress(c,clen,val,len) == -1) break;
+        return 0;
+#else
+        rdbReportCorruptRDB("String compressed with ZSTD, but Sider was built without ZSTD support");
+        return -1;
+#endif
+    }
+    rdbReportCorruptRDB("Invalid %s compressed string",
+        enctype == RDB_ENC_LZF ? "LZF" : (enctype == RDB_ENC_LZ4 ? "LZ4" : "ZSTD"));
+    return -1;
+}
+
+static ssize_t rdbSaveCompressedBlob(rio *rdb, int enctype, void *data,
+                                     size_t compress_len, size_t original_len)
+{
     unsigned char byte;
     ssize_t n, nwritten = 0;
 
     /* Data compressed! Let's save it on disk */
-    byte = (RDB_ENCVAL<<6)|RDB_ENC_LZF;
+    byte = (RDB_ENCVAL<<6)|enctype;
     if ((n = rdbWriteRaw(rdb,&byte,1)) == -1) goto writeerr;
     nwritten += n;
 
@@ -367,28 +521,42 @@ writeerr:
     return -1;
 }
 
-ssize_t rdbSaveLzfStringObject(rio *rdb, unsigned char *s, size_t len) {
+ssize_t rdbSaveLzfBlob(rio *rdb, void *data, size_t compress_len,
+                       size_t original_len) {
+    return rdbSaveCompressedBlob(rdb,RDB_ENC_LZF,data,compress_len,original_len);
+}
+
+/* Save 's' compressed with the algorithm set by rdbcompression-algorithm.
+ * Returns 0 if the string can't be compressed. */
+ssize_t rdbSaveCompressedStringObject(rio *rdb, unsigned char *s, size_t len) {
     size_t comprlen, outlen;
+    int enctype;
     void *out;
 
+    switch(server.rdb_compression_algorithm) {
+    case RDB_COMPRESSION_LZ4: enctype = RDB_ENC_LZ4; break;
+    case RDB_COMPRESSION_ZSTD: enctype = RDB_ENC_ZSTD; break;
+    default: enctype = RDB_ENC_LZF; break;
+    }
+
     /* We require at least four bytes compression for this to be worth it */
     if (len <= 4) return 0;
     outlen = len-4;
     if ((out = zmalloc(outlen+1)) == NULL) return 0;
-    comprlen = lzf_compress(s, len, out, outlen);
+    comprlen = rdbCompress(enctype,s,len,out,outlen);
     if (comprlen == 0) {
         zfree(out);
         return 0;
     }
-    ssize_t nwritten = rdbSaveLzfBlob(rdb, out, comprlen, len);
+    ssize_t nwritten = rdbSaveCompressedBlob(rdb,enctype,out,comprlen,len);
     zfree(out);
     return nwritten;
 }
 
-/* Load an LZF compressed string in RDB format. The returned value
- * changes according to 'flags'. For more info check the
+/* Load a compressed string in RDB format, of the RDB_ENC_* type 'enctype'.
+ * The returned value changes according to 'flags'. For more info check the
  * rdbGenericLoadStringObject() function. */
-void *rdbLoadLzfStringObject(rio *rdb, int flags, size_t *lenptr) {
+void *rdbLoadCompressedStringObject(rio *rdb, int enctype, int flags, size_t *lenptr) {
     int plain = flags & RDB_LOAD_PLAIN;
     int sds = flags & RDB_LOAD_SDS;
     uint64_t len, clen;
@@ -398,7 +566,7 @@ void *rdbLoadLzfStringObject(rio *rdb, int flags, size_t *lenptr) {
     if ((clen = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;
     if ((len = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;
     if ((c = ztrymalloc(clen)) == NULL) {
-        serverLog(isRestoreContext()? LL_VERBOSE: LL_WARNING, "rdbLoadLzfStringObject failed allocating %llu bytes", (unsigned long long)clen);
+        serverLog(isRestoreContext()? LL_VERBOSE: LL_WARNING, "rdbLoadCompressedStringObject failed allocating %llu bytes", (unsigned long long)clen);
         goto err;
     }
 
@@ -409,7 +577,7 @@ void *rdbLoadLzfStringObject(rio *rdb, int flags, size_t *lenptr) {
         val = sdstrynewlen(SDS_NOINIT,len);
     }
     if (!val) {
-        serverLog(isRestoreContext()? LL_VERBOSE: LL_WARNING, "rdbLoadLzfStringObject failed allocating %llu bytes", (unsigned long long)len);
+        serverLog(isRestoreContext()? LL_VERBOSE: LL_WARNING, "rdbLoadCompressedStringObject failed allocating %llu bytes", (unsigned long long)len);
         goto err;
     }
 
@@ -417,10 +585,7 @@ void *rdbLoadLzfStringObject(rio *rdb, int flags, size_t *lenptr) {
 
     /* Load the compressed representation and uncompress it to target. */
     if (rioRead(rdb,c,clen) == 0) goto err;
-    if (lzf_decompress(c,clen,val,len) != len) {
-        rdbReportCorruptRDB("Invalid LZF compressed string");
-        goto err;
-    }
+    if (rdbDecompress(enctype,c,clen,val,len) == -1) goto err;
     zfree(c);
 
     if (plain || sds) {
@@ -437,6 +602,176 @@ err:
     return NULL;
 }
 
+/* The ZSTD dictionary of a snapshot being saved. */
+typedef struct rdbZstdDict {
+    sds data;               /* Serialized dictionary, NULL if none. */
+    void *cdict;            /* The ZSTD_CDict of 'data'. */
+} rdbZstdDict;
+
+#ifdef HAVE_ZSTD
+/* Return in 'p' and 'len' the string saved for the value 'o', if it is saved
+ * as a single string, so that it can be used to train the dictionary. */
+static int rdbGetZstdDictSample(robj *o, unsigned char **p, size_t *len) {
+    if (o->type == OBJ_STRING && sdsEncodedObject(o)) {
+        *p = o->ptr;
+        *len = sdslen(o->ptr);
+    } else if (o->encoding == OBJ_ENCODING_LISTPACK && o->type != OBJ_LIST) {
+        *p = o->ptr;
+        *len = lpBytes(o->ptr);
+    } else {
+        return 0;
+    }
+    return *len > 20 && *len <= RDB_ZSTD_DICT_SAMPLE_MAX;
+}
+#endif
+
+/* Train the dictionary of the snapshot about to be saved from a sample of
+ * the values, if they are compressed with ZSTD and the
+ * rdbcompression-zstd-dict-size option is set. Otherwise, or if the training
+ * fails, 'zd' is set to no dictionary. */
+static void rdbTrainZstdDict(rdbZstdDict *zd) {
+    zd->data = NULL;
+    zd->cdict = NULL;
+    if (!server.rdb_compression ||
+        server.rdb_compression_algorithm != RDB_COMPRESSION_ZSTD ||
+        server.rdb_compression_zstd_dict_size == 0) return;
+
+#ifdef HAVE_ZSTD
+    size_t dict_size = server.rdb_compression_zstd_dict_size;
+    /* ZSTD suggests about 100 times the size of the dictionary of samples. */
+    size_t budget = dict_size*100;
+    sds samples = sdsempty();
+    size_t *sizes = NULL, count = 0, alloc = 0;
+
+    for (int j = 0; j < server.dbnum && sdslen(samples) < budget; j++) {
+        dbIterator dbit;
+        dictEntry *de;
+
+        if (dbSize(server.db+j,DB_MAIN) == 0) continue;
+        dbInitIterator(&dbit,server.db+j,DB_MAIN);
+        while (sdslen(samples) < budget && (de = dbIteratorNext(&dbit)) != NULL) {
+            unsigned char *p;
+            size_t len;
+
+            if (!rdbGetZstdDictSample(dictGetVal(de),&p,&len)) continue;
+            samples = sdscatlen(samples,p,len);
+            if (count == alloc) {
+                alloc = alloc ? alloc*2 : 1024;
+                sizes = zrealloc(sizes,sizeof(size_t)*alloc);
+            }
+            sizes[count++] = len;
+        }
+        dbResetIterator(&dbit);
+    }
+
+    sds dict = sdsnewlen(SDS_NOINIT,dict_size);
+    size_t len = ZDICT_trainFromBuffer(dict,dict_size,samples,sizes,count);
+    if (ZDICT_isError(len)) {
+        serverLog(LL_NOTICE,"Unable to train a ZSTD dictionary from %zu values: %s",
+            count, ZDICT_getErrorName(len));
+        sdsfree(dict);
+    } else {
+        sdssetlen(dict,len);
+        zd->cdict = ZSTD_createCDict(dict,len,server.rdb_compression_zstd_level);
+        if (zd->cdict) {
+            zd->data = dict;
+            serverLog(LL_NOTICE,"Trained a ZSTD dictionary of %zu bytes from %zu values",
+                len, count);
+        } else {
+            sdsfree(dict);
+        }
+    }
+    sdsfree(samples);
+    zfree(sizes);
+#endif
+}
+
+/* Save the dictionary 'zd', if any, before the values compressed with it. */
+static int rdbSaveZstdDict(rio *rdb, rdbZstdDict *zd) {
+    if (zd->data == NULL) return 0;
+    if (rdbSaveType(rdb,RDB_OPCODE_ZSTD_DICT) == -1) return -1;
+    if (rdbSaveRawString(rdb,(unsigned char*)zd->data,sdslen(zd->data)) == -1) return -1;
+    return 1;
+}
+
+/* Compress the values saved by the calling thread with the dictionary 'zd',
+ * or without a dictionary if 'zd' is NULL. */
+static void rdbUseZstdDict(rdbZstdDict *zd) {
+#ifdef HAVE_ZSTD
+    rdb_zstd_cdict = zd ? zd->cdict : NULL;
+#else
+    UNUSED(zd);
+#endif
+}
+
+static void rdbReleaseZstdDict(rdbZstdDict *zd) {
+#ifdef HAVE_ZSTD
+    ZSTD_freeCDict(zd->cdict);
+#endif
+    sdsfree(zd->data);
+    zd->cdict = NULL;
+    zd->data = NULL;
+}
+
+/* Load a dictionary saved by rdbSaveZstdDict(), so that the values
+ * compressed with it can be decompressed. The length of the dictionary is
+ * returned in 'lenptr' if not NULL. Returns -1 on error. */
+int rdbLoadZstdDict(rio *rdb, size_t *lenptr) {
+    size_t len;
+    sds dict;
+
+    if ((dict = rdbGenericLoadStringObject(rdb,RDB_LOAD_SDS,&len)) == NULL) return -1;
+    if (lenptr) *lenptr = len;
+#ifdef HAVE_ZSTD
+    unsigned int id = ZSTD_getDictID_fromDict(dict,len);
+    int retval = 0;
+
+    if (id == 0) {
+        rdbReportCorruptRDB("Invalid ZSTD dictionary");
+        sdsfree(dict);
+        return -1;
+    }
+
+    /* The parts of a multi-part snapshot all have the same dictionary. */
+    pthread_mutex_lock(&rdb_zstd_ddicts_lock);
+    if (rdbLookupZstdDict(id) == NULL) {
+        int count;
+        ZSTD_DDict *ddict;
+
+        atomicGet(rdb_zstd_ddicts_count,count);
+        if (count == RDB_ZSTD_DICTS_MAX) {
+            rdbReportCorruptRDB("Too many ZSTD dictionaries");
+            retval = -1;
+        } else if ((ddict = ZSTD_createDDict(dict,len)) == NULL) {
+            rdbReportCorruptRDB("Invalid ZSTD dictionary %u", id);
+            retval = -1;
+        } else {
+            rdb_zstd_ddicts[count].id = id;
+            rdb_zstd_ddicts[count].ddict = ddict;
+            atomicSetWithSync(rdb_zstd_ddicts_count,count+1);
+        }
+    }
+    pthread_mutex_unlock(&rdb_zstd_ddicts_lock);
+    sdsfree(dict);
+    return retval;
+#else
+    sdsfree(dict);
+    rdbReportCorruptRDB("ZSTD dictionary found, but Sider was built without ZSTD support");
+    return -1;
+#endif
+}
+
+/* Release the dictionaries loaded, once the loading ended. */
+static void rdbReleaseZstdDicts(void) {
+#ifdef HAVE_ZSTD
+    int count;
+
+    atomicGet(rdb_zstd_ddicts_count,count);
+    for (int j = 0; j < count; j++) ZSTD_freeDDict(rdb_zstd_ddicts[j].ddict);
+    atomicSetWithSync(rdb_zstd_ddicts_count,0);
+#endif
+}
+
 /* Save a string object as [len][data] on disk. If the object is a string
  * representation of an integer value we try to save it in a special form */
 ssize_t rdbSaveRawString(rio *rdb, unsigned char *s, size_t len) {
@@ -452,10 +787,10 @@ ssize_t rdbSaveRawString(rio *rdb, unsigned char *s, size_t len) {
         }
     }
 
-    /* Try LZF compression - under 20 bytes it's unable to compress even
+    /* Try compression - under 20 bytes LZF is unable to compress even
      * aaaaaaaaaaaaaaaaaa so skip it */
     if (server.rdb_compression && len > 20) {
-        n = rdbSaveLzfStringObject(rdb,s,len);
+        n = rdbSaveCompressedStringObject(rdb,s,len);
         if (n == -1) return -1;
         if (n > 0) return n;
         /* Return value of 0 means data can't be compressed, save the old way */
@@ -531,7 +866,9 @@ void *rdbGenericLoadStringObject(rio *rdb, int flags, size_t *lenptr) {
         case RDB_ENC_INT32:
             return rdbLoadIntegerObject(rdb,len,flags,lenptr);
         case RDB_ENC_LZF:
-            return rdbLoadLzfStringObject(rdb,flags,lenptr);
+        case RDB_ENC_LZ4:
+        case RDB_ENC_ZSTD:
+            return rdbLoadCompressedStringObject(rdb,len,flags,lenptr);
         default:
             rdbReportCorruptRDB("Unknown RDB string encoding type %llu",len);
             return NULL;
@@ -1297,8 +1634,16 @@ werr:
     return -1;
 }
 
+/* Index of the keys of the RDB, see the on-demand loading section. */
+static void rdbIndexCreate(void);
+static void rdbIndexRelease(void);
+static void rdbIndexSave(const char *filename);
+static int rdbIndexStart(rio *rdb);
+static void rdbIndexAddKey(rio *rdb, int dbid, sds key, size_t offset, size_t len);
+static void rdbIndexInvalidate(rio *rdb);
+
 ssize_t rdbSaveDb(rio *rdb, int dbid, int rdbflags, long *key_counter) {
-    dictIterator *di;
+    dbIterator dbit;
     dictEntry *de;
     ssize_t written = 0;
     ssize_t res;
@@ -1306,9 +1651,8 @@ ssize_t rdbSaveDb(rio *rdb, int dbid, int rdbflags, long *key_counter) {
     char *pname = (rdbflags & RDBFLAGS_AOF_PREAMBLE) ? "AOF rewrite" :  "RDB";
 
     siderDb *db = server.db + dbid;
-    dict *d = db->dict;
-    if (dictSize(d) == 0) return 0;
-    di = dictGetSafeIterator(d);
+    if (dbSize(db, DB_MAIN) == 0) return 0;
+    dbInitIterator(&dbit, db, DB_MAIN);
 
     /* Write the SELECT DB opcode */
     if ((res = rdbSaveType(rdb,RDB_OPCODE_SELECTDB)) < 0) goto werr;
@@ -1318,8 +1662,8 @@ ssize_t rdbSaveDb(rio *rdb, int dbid, int rdbflags, long *key_counter) {
 
     /* Write the RESIZE DB opcode. */
     uint64_t db_size, expires_size;
-    db_size = dictSize(db->dict);
-    expires_size = dictSize(db->expires);
+    db_size = dbSize(db, DB_MAIN);
+    expires_size = dbSize(db, DB_EXPIRES);
     if ((res = rdbSaveType(rdb,RDB_OPCODE_RESIZEDB)) < 0) goto werr;
     written += res;
     if ((res = rdbSaveLen(rdb,db_size)) < 0) goto werr;
@@ -1328,7 +1672,7 @@ ssize_t rdbSaveDb(rio *rdb, int dbid, int rdbflags, long *key_counter) {
     written += res;
 
     /* Iterate this DB writing every entry */
-    while((de = dictNext(di)) != NULL) {
+    while((de = dbIteratorNext(&dbit)) != NULL) {
         sds keystr = dictGetKey(de);
         robj key, *o = dictGetVal(de);
         long long expire;
@@ -1338,6 +1682,8 @@ ssize_t rdbSaveDb(rio *rdb, int dbid, int rdbflags, long *key_counter) {
         expire = getExpire(db,&key);
         if ((res = rdbSaveKeyValuePair(rdb, &key, o, expire, dbid)) < 0) goto werr;
         written += res;
+        rdbIndexAddKey(rdb,dbid,keystr,rdb_bytes_before_key,
+                       rdb->processed_bytes - rdb_bytes_before_key);
 
         /* In fork child process, we can try to release memory back to the
          * OS and possibly avoid or decrease COW. We give the dismiss
@@ -1357,11 +1703,11 @@ ssize_t rdbSaveDb(rio *rdb, int dbid, int rdbflags, long *key_counter) {
         }
     }
 
-    dictReleaseIterator(di);
+    dbResetIterator(&dbit);
     return written;
 
 werr:
-    dictReleaseIterator(di);
+    dbResetIterator(&dbit);
     return -1;
 }
 
@@ -1377,13 +1723,21 @@ int rdbSaveRio(int req, rio *rdb, int *error, int rdbflags, rdbSaveInfo *rsi) {
     char magic[10];
     uint64_t cksum;
     long key_counter = 0;
+    rdbZstdDict zd;
     int j;
 
+    if (req & SLAVE_REQ_RDB_EXCLUDE_DATA)
+        zd.data = zd.cdict = NULL;
+    else
+        rdbTrainZstdDict(&zd);
     if (server.rdb_checksum)
         rdb->update_cksum = rioGenericUpdateChecksum;
     snprintf(magic,sizeof(magic),"REDIS%04d",RDB_VERSION);
     if (rdbWriteRaw(rdb,magic,9) == -1) goto werr;
     if (rdbSaveInfoAuxFields(rdb,rdbflags,rsi) == -1) goto werr;
+    if (!(req & SLAVE_REQ_RDB_EXCLUDE_DATA) && rdbIndexStart(rdb) == -1) goto werr;
+    if (rdbSaveZstdDict(rdb,&zd) == -1) goto werr;
+    rdbUseZstdDict(&zd);
     if (!(req & SLAVE_REQ_RDB_EXCLUDE_DATA) && rdbSaveModulesAux(rdb, REDISMODULE_AUX_BEFORE_RDB) == -1) goto werr;
 
     /* save functions */
@@ -1396,7 +1750,12 @@ int rdbSaveRio(int req, rio *rdb, int *error, int rdbflags, rdbSaveInfo *rsi) {
         }
     }
 
-    if (!(req & SLAVE_REQ_RDB_EXCLUDE_DATA) && rdbSaveModulesAux(rdb, REDISMODULE_AUX_AFTER_RDB) == -1) goto werr;
+    if (!(req & SLAVE_REQ_RDB_EXCLUDE_DATA)) {
+        ssize_t ret = rdbSaveModulesAux(rdb, REDISMODULE_AUX_AFTER_RDB);
+        if (ret == -1) goto werr;
+        /* The keys loaded on demand would miss the data of the modules. */
+        if (ret > 0) rdbIndexInvalidate(rdb);
+    }
 
     /* EOF opcode */
     if (rdbSaveType(rdb,RDB_OPCODE_EOF) == -1) goto werr;
@@ -1406,10 +1765,14 @@ int rdbSaveRio(int req, rio *rdb, int *error, int rdbflags, rdbSaveInfo *rsi) {
     cksum = rdb->cksum;
     memrev64ifbe(&cksum);
     if (rioWrite(rdb,&cksum,8) == 0) goto werr;
+    rdbUseZstdDict(NULL);
+    rdbReleaseZstdDict(&zd);
     return C_OK;
 
 werr:
     if (error) *error = errno;
+    rdbUseZstdDict(NULL);
+    rdbReleaseZstdDict(&zd);
     return C_ERR;
 }
 
@@ -1512,15 +1875,553 @@ int rdbSaveToFile(const char *filename) {
     return C_OK;
 }
 
+/* -----------------------------------------------------------------------------
+ * Multi-part snapshots
+ *
+ * When rdb-save-parts is greater than 1, the snapshots saved on disk are
+ * written as that number of RDB files, serialized at the same time by as
+ * many threads, plus a manifest listing them. The names are derived from
+ * dbfilename:
+ *
+ *   dump.rdb.manifest
+ *   dump.rdb.3.part0
+ *   dump.rdb.3.part1
+ *   ...
+ *
+ * With the following manifest content:
+ *
+ *   file dump.rdb.3.part0 seq 3 part 0
+ *   file dump.rdb.3.part1 seq 3 part 1
+ *
+ * Every part is a complete RDB file holding a disjoint subset of the keys: in
+ * cluster mode the dicts of the slots are assigned to the parts round robin,
+ * otherwise every part saves a range of the buckets of the dict of each DB,
+ * see dictScanPart(). The first part also holds all the data that is not a
+ * key (AUX fields, functions and module AUX data) and the keys of module
+ * types, that are saved by the main thread once the other threads are done,
+ * since modules don't expect their rdb_save callback to be called from
+ * other threads.
+ *
+ * The sequence number in the names changes at every save, and the manifest
+ * is replaced atomically once all the parts are on disk, so the previous
+ * snapshot is valid until then. When a manifest exists it is loaded in place
+ * of dbfilename, see rdbLoadParts(), while saving a single file removes the
+ * manifest and its parts.
+ * -------------------------------------------------------------------------- */
+
+#define RDB_MANIFEST_SUFFIX ".manifest"
+#define RDB_MANIFEST_MAX_LINE 1024
+
+/* Manifest keys. */
+#define RDB_MANIFEST_KEY_FILE_NAME "file"
+#define RDB_MANIFEST_KEY_FILE_SEQ  "seq"
+#define RDB_MANIFEST_KEY_FILE_PART "part"
+
+static sds rdbGetManifestName(const char *filename) {
+    return sdscatfmt(sdsempty(),"%s%s",filename,RDB_MANIFEST_SUFFIX);
+}
+
+static sds rdbGetPartName(const char *filename, long long seq, int part) {
+    return sdscatfmt(sdsempty(),"%s.%I.part%i",filename,seq,part);
+}
+
+/* Read the manifest of the multi-part snapshot of 'filename'. Returns the
+ * names of the parts, in order, and sets '*seq' to their sequence number.
+ * On error NULL is returned and '*err' is set, while '*err' is left NULL
+ * if there is no manifest. */
+static list *rdbLoadManifest(const char *filename, long long *seq, const char **err) {
+    char buf[RDB_MANIFEST_MAX_LINE+1];
+    sds *argv;
+    int argc;
+
+    *seq = 0;
+    *err = NULL;
+    sds am_name = rdbGetManifestName(filename);
+    FILE *fp = fopen(am_name,"r");
+    sdsfree(am_name);
+    if (fp == NULL) {
+        if (errno != ENOENT) *err = strerror(errno);
+        return NULL;
+    }
+
+    list *parts = listCreate();
+    listSetFreeMethod(parts,(void (*)(void*))sdsfree);
+    while (fgets(buf,sizeof(buf),fp) != NULL) {
+        /* Skip comments lines */
+        if (buf[0] == '#') continue;
+
+        if (strchr(buf,'\n') == NULL) {
+            *err = "The manifest contains too long line";
+            break;
+        }
+        argv = sdssplitargs(buf,&argc);
+        if (argv == NULL || argc < 6 || (argc % 2)) {
+            if (argv) sdsfreesplitres(argv,argc);
+            *err = "Invalid manifest format";
+            break;
+        }
+
+        char *name = NULL;
+        long long file_seq = 0, part = -1;
+        for (int j = 0; j < argc; j += 2) {
+            if (!strcasecmp(argv[j],RDB_MANIFEST_KEY_FILE_NAME))
+                name = argv[j+1];
+            else if (!strcasecmp(argv[j],RDB_MANIFEST_KEY_FILE_SEQ))
+                file_seq = atoll(argv[j+1]);
+            else if (!strcasecmp(argv[j],RDB_MANIFEST_KEY_FILE_PART))
+                part = atoll(argv[j+1]);
+        }
+        if (name == NULL || !pathIsBaseName(name) || file_seq <= 0 ||
+            (*seq && file_seq != *seq) || part != (long long)listLength(parts))
+        {
+            sdsfreesplitres(argv,argc);
+            *err = "Invalid manifest format";
+            break;
+        }
+        *seq = file_seq;
+        listAddNodeTail(parts,sdsnew(name));
+        sdsfreesplitres(argv,argc);
+    }
+    if (*err == NULL && ferror(fp)) *err = "Read manifest failed";
+    if (*err == NULL && listLength(parts) == 0) *err = "Found an empty manifest";
+    fclose(fp);
+
+    if (*err) {
+        listRelease(parts);
+        return NULL;
+    }
+    return parts;
+}
+
+/* Replace the manifest of the multi-part snapshot of 'filename' with 'buf'. */
+static int rdbWriteManifest(const char *filename, sds buf) {
+    int ret = C_ERR;
+    ssize_t nwritten;
+    size_t len = sdslen(buf);
+    char *p = buf;
+
+    sds am_name = rdbGetManifestName(filename);
+    sds tmp_am_name = sdscatfmt(sdsempty(),"temp-%s",am_name);
+    int fd = open(tmp_am_name,O_WRONLY|O_TRUNC|O_CREAT,0644);
+    if (fd == -1) {
+        serverLog(LL_WARNING,"Can't open the RDB manifest file %s: %s",
+            tmp_am_name, strerror(errno));
+        goto cleanup;
+    }
+    while (len) {
+        nwritten = write(fd,p,len);
+        if (nwritten < 0) {
+            if (errno == EINTR) continue;
+            serverLog(LL_WARNING,"Error trying to write the temporary RDB manifest file %s: %s",
+                tmp_am_name, strerror(errno));
+            goto cleanup;
+        }
+        len -= nwritten;
+        p += nwritten;
+    }
+    if (sider_fsync(fd) == -1) {
+        serverLog(LL_WARNING,"Fail to fsync the temp RDB manifest file %s: %s.",
+            tmp_am_name, strerror(errno));
+        goto cleanup;
+    }
+    if (rename(tmp_am_name,am_name) != 0) {
+        serverLog(LL_WARNING,"Error trying to rename the temporary RDB manifest file %s into %s: %s",
+            tmp_am_name, am_name, strerror(errno));
+        goto cleanup;
+    }
+    if (fsyncFileDir(am_name) == -1) {
+        serverLog(LL_WARNING,"Failed to fsync directory while saving DB: %s",
+            strerror(errno));
+        goto cleanup;
+    }
+    ret = C_OK;
+
+cleanup:
+    if (fd != -1) close(fd);
+    if (ret == C_ERR) unlink(tmp_am_name);
+    sdsfree(am_name);
+    sdsfree(tmp_am_name);
+    return ret;
+}
+
+/* Remove a file of a snapshot, closing it in a background thread unless we
+ * are the saving child, that has no background threads. */
+static void rdbUnlinkFile(const char *name) {
+    if (server.in_fork_child)
+        unlink(name);
+    else
+        bg_unlink(name);
+}
+
+/* Remove the multi-part snapshot of 'filename', if any, starting from its
+ * manifest so that it's never loaded partially removed. Called once a newer
+ * snapshot is stored in 'filename' as a single file. */
+void rdbRemoveParts(const char *filename) {
+    long long seq;
+    const char *err;
+    listIter li;
+    listNode *ln;
+
+    list *parts = rdbLoadManifest(filename,&seq,&err);
+    if (parts == NULL && err == NULL) return;
+
+    sds am_name = rdbGetManifestName(filename);
+    rdbUnlinkFile(am_name);
+    serverLog(LL_NOTICE,"Removed the multi-part snapshot %s", am_name);
+    sdsfree(am_name);
+    if (parts == NULL) return;
+    listRewind(parts,&li);
+    while ((ln = listNext(&li)) != NULL)
+        rdbUnlinkFile(listNodeValue(ln));
+    listRelease(parts);
+}
+
+/* A key of a module type found by a saving thread. */
+typedef struct rdbModuleKey {
+    int dbid;
+    const dictEntry *de;
+} rdbModuleKey;
+
+typedef struct rdbSavePart {
+    int index;
+    int dbid;               /* DB being saved. */
+    FILE *fp;
+    rio rdb;
+    int failed;
+    int error;              /* errno of the first error. */
+    list *module_keys;      /* Keys left to the main thread. */
+    int thread_started;
+    pthread_t thread;
+    struct rdbPartsSave *s;
+} rdbSavePart;
+
+typedef struct rdbPartsSave {
+    int parts;
+    int rdbflags;
+    rdbZstdDict zd;             /* Dictionary shared by all the parts. */
+    siderAtomic long long keys; /* Keys saved, for the progress reports. */
+    siderAtomic int running;    /* Threads still saving keys. */
+    rdbSavePart part[RDB_SAVE_PARTS_MAX];
+} rdbPartsSave;
+
+static void rdbSavePartEntry(void *privdata, const dictEntry *de) {
+    rdbSavePart *p = privdata;
+    robj key, *o = dictGetVal(de);
+
+    if (p->failed) return;
+    if (o->type == OBJ_MODULE) {
+        rdbModuleKey *mk = zmalloc(sizeof(*mk));
+        mk->dbid = p->dbid;
+        mk->de = de;
+        listAddNodeTail(p->module_keys,mk);
+        return;
+    }
+
+    size_t rdb_bytes_before_key = p->rdb.processed_bytes;
+    initStaticStringObject(key,dictGetKey(de));
+    if (rdbSaveKeyValuePair(&p->rdb,&key,o,getExpire(server.db+p->dbid,&key),p->dbid) == -1) {
+        p->failed = 1;
+        p->error = errno;
+        return;
+    }
+    if (server.in_fork_child) dismissObject(o,p->rdb.processed_bytes-rdb_bytes_before_key);
+    atomicIncr(p->s->keys,1);
+}
+
+/* Save the keys of every DB that belong to the part 'p'. */
+static int rdbSavePartKeys(rdbSavePart *p) {
+    for (int j = 0; j < server.dbnum; j++) {
+        siderDb *db = server.db+j;
+
+        if (dbSize(db,DB_MAIN) == 0) continue;
+        if (rdbSaveType(&p->rdb,RDB_OPCODE_SELECTDB) == -1) return C_ERR;
+        if (rdbSaveLen(&p->rdb,j) == -1) return C_ERR;
+        /* The first part is the first one loaded, so it holds the size of
+         * the whole DB, in order to avoid useless rehashing. */
+        if (p->index == 0) {
+            if (rdbSaveType(&p->rdb,RDB_OPCODE_RESIZEDB) == -1) return C_ERR;
+            if (rdbSaveLen(&p->rdb,dbSize(db,DB_MAIN)) == -1) return C_ERR;
+            if (rdbSaveLen(&p->rdb,dbSize(db,DB_EXPIRES)) == -1) return C_ERR;
+        }
+
+        p->dbid = j;
+        if (db->dict_count == 1) {
+            dictScanPart(db->dict[0],p->index,p->s->parts,rdbSavePartEntry,p);
+        } else {
+            /* The slots served by a node are usually a few ranges, so they
+             * are assigned round robin to get parts of a similar size. */
+            for (int slot = p->index; slot < db->dict_count; slot += p->s->parts)
+                dictScanPart(db->dict[slot],0,1,rdbSavePartEntry,p);
+        }
+        if (p->failed) return C_ERR;
+    }
+    return C_OK;
+}
+
+/* Terminate the RDB file written by 'rdb' with the EOF opcode and the
+ * checksum, and flush it to the disk. The file is closed and '*fpp' set to
+ * NULL on success. */
+static int rdbSaveFinishFile(rio *rdb, FILE **fpp, int rdbflags) {
+    uint64_t cksum;
+
+    if (rdbSaveType(rdb,RDB_OPCODE_EOF) == -1) return C_ERR;
+    cksum = rdb->cksum;
+    memrev64ifbe(&cksum);
+    if (rioWrite(rdb,&cksum,8) == 0) return C_ERR;
+    if (fflush(*fpp) || fsync(fileno(*fpp))) return C_ERR;
+    if (!(rdbflags & RDBFLAGS_KEEP_CACHE) && reclaimFilePageCache(fileno(*fpp),0,0) == -1) {
+        serverLog(LL_NOTICE,"Unable to reclaim cache after saving RDB: %s", strerror(errno));
+    }
+    int retval = fclose(*fpp);
+    *fpp = NULL;
+    return retval ? C_ERR : C_OK;
+}
+
+static void *rdbSavePartThreadMain(void *arg) {
+    rdbSavePart *p = arg;
+
+    sider_set_thread_title("rdb_save");
+    rdbUseZstdDict(&p->s->zd);
+    if (rdbSavePartKeys(p) == C_ERR ||
+        (p->index != 0 && rdbSaveFinishFile(&p->rdb,&p->fp,p->s->rdbflags) == C_ERR))
+    {
+        if (!p->failed) p->error = errno;
+        p->failed = 1;
+    }
+    rdbReleaseThreadCompression();
+    atomicDecr(p->s->running,1);
+    return NULL;
+}
+
+/* Pause (or resume) the rehashing of the dicts of the expires: the saving
+ * threads look them up, and lookups rehash. */
+static void rdbPauseExpiresRehashing(int pause) {
+    for (int j = 0; j < server.dbnum; j++) {
+        siderDb *db = server.db+j;
+        for (int slot = 0; slot < db->dict_count; slot++) {
+            if (!dictIsRehashing(db->expires[slot])) continue;
+            if (pause)
+                dictPauseRehashing(db->expires[slot]);
+            else
+                dictResumeRehashing(db->expires[slot]);
+        }
+    }
+}
+
+/* Save the parts of the snapshot to the files 'names'. */
+static int rdbSavePartsToFiles(rdbPartsSave *s, sds *names, rdbSaveInfo *rsi) {
+    rdbSavePart *first = s->part;
+    long long info_updated_time = 0;
+    char magic[10];
+    char *err_op = NULL;
+    int j, retval = C_ERR, error = 0;
+    listIter li;
+    listNode *ln;
+
+    rdbTrainZstdDict(&s->zd);
+    snprintf(magic,sizeof(magic),"REDIS%04d",RDB_VERSION);
+    for (j = 0; j < s->parts; j++) {
+        rdbSavePart *p = s->part+j;
+        p->index = j;
+        p->s = s;
+        p->module_keys = listCreate();
+        listSetFreeMethod(p->module_keys,zfree);
+        if ((p->fp = fopen(names[j],"w")) == NULL) {
+            error = errno;
+            serverLog(LL_WARNING,"Failed opening the temp RDB file %s for saving: %s",
+                names[j], strerror(errno));
+            goto cleanup;
+        }
+        rioInitWithFile(&p->rdb,p->fp);
+        if (server.rdb_save_incremental_fsync) {
+            rioSetAutoSync(&p->rdb,REDIS_AUTOSYNC_BYTES);
+            if (!(s->rdbflags & RDBFLAGS_KEEP_CACHE)) rioSetReclaimCache(&p->rdb,1);
+        }
+        if (server.rdb_checksum)
+            p->rdb.update_cksum = rioGenericUpdateChecksum;
+        if (rdbWriteRaw(&p->rdb,magic,9) == -1 ||
+            rdbSaveInfoAuxFields(&p->rdb,s->rdbflags,j == 0 ? rsi : NULL) == -1 ||
+            rdbSaveZstdDict(&p->rdb,&s->zd) == -1)
+        {
+            err_op = "header";
+            goto werr;
+        }
+    }
+    rdbUseZstdDict(&s->zd);
+    if (rdbSaveModulesAux(&first->rdb,REDISMODULE_AUX_BEFORE_RDB) == -1 ||
+        rdbSaveFunctions(&first->rdb) == -1)
+    {
+        err_op = "header";
+        goto werr;
+    }
+
+    rdbPauseExpiresRehashing(1);
+    atomicSet(s->running,s->parts);
+    for (j = 0; j < s->parts; j++) {
+        rdbSavePart *p = s->part+j;
+        if (pthread_create(&p->thread,NULL,rdbSavePartThreadMain,p) == 0) {
+            p->thread_started = 1;
+        } else {
+            /* Not a reason to fail: this part is saved by this thread. */
+            rdbSavePartThreadMain(p);
+        }
+    }
+
+    /* Report the progress every second (approximately) while waiting. */
+    int running;
+    atomicGet(s->running,running);
+    while (running) {
+        long long now = mstime(), keys;
+        if (now - info_updated_time >= 1000) {
+            atomicGet(s->keys,keys);
+            sendChildInfo(CHILD_INFO_TYPE_CURRENT_INFO,keys,"RDB");
+            info_updated_time = now;
+        }
+        usleep(1000);
+        atomicGet(s->running,running);
+    }
+    for (j = 0; j < s->parts; j++) {
+        if (s->part[j].thread_started) pthread_join(s->part[j].thread,NULL);
+    }
+    rdbPauseExpiresRehashing(0);
+    for (j = 0; j < s->parts; j++) {
+        if (s->part[j].failed) {
+            errno = s->part[j].error;
+            err_op = "rdbSavePartKeys";
+            goto werr;
+        }
+    }
+
+    /* Add the keys of module types to the first part. */
+    int dbid = -1;
+    for (j = 0; j < s->parts; j++) {
+        listRewind(s->part[j].module_keys,&li);
+        while ((ln = listNext(&li)) != NULL) {
+            rdbModuleKey *mk = listNodeValue(ln);
+            robj key, *o = dictGetVal(mk->de);
+
+            if (mk->dbid != dbid) {
+                dbid = mk->dbid;
+                if (rdbSaveType(&first->rdb,RDB_OPCODE_SELECTDB) == -1 ||
+                    rdbSaveLen(&first->rdb,dbid) == -1) goto werr_keys;
+            }
+            initStaticStringObject(key,dictGetKey(mk->de));
+            if (rdbSaveKeyValuePair(&first->rdb,&key,o,getExpire(server.db+dbid,&key),dbid) == -1)
+                goto werr_keys;
+        }
+    }
+    if (rdbSaveModulesAux(&first->rdb,REDISMODULE_AUX_AFTER_RDB) == -1) goto werr_keys;
+    if (rdbSaveFinishFile(&first->rdb,&first->fp,s->rdbflags) == C_ERR) {
+        err_op = "rdbSaveFinishFile";
+        goto werr;
+    }
+    retval = C_OK;
+    goto cleanup;
+
+werr_keys:
+    err_op = "rdbSaveKeyValuePair";
+werr:
+    error = errno;
+    serverLog(LL_WARNING,"Write error while saving DB to the disk(%s): %s", err_op, strerror(errno));
+cleanup:
+    rdbUseZstdDict(NULL);
+    rdbReleaseZstdDict(&s->zd);
+    for (j = 0; j < s->parts; j++) {
+        rdbSavePart *p = s->part+j;
+        if (p->fp) fclose(p->fp);
+        if (p->module_keys) listRelease(p->module_keys);
+        if (retval == C_ERR) unlink(names[j]);
+    }
+    errno = error;
+    return retval;
+}
+
+/* Like rdbSave(), but saving a multi-part snapshot of rdb-save-parts files
+ * named after 'filename'. */
+static int rdbSaveParts(char *filename, rdbSaveInfo *rsi, int rdbflags) {
+    rdbPartsSave *s = zcalloc(sizeof(*s));
+    sds tmpnames[RDB_SAVE_PARTS_MAX], names[RDB_SAVE_PARTS_MAX];
+    sds manifest = sdsempty();
+    long long seq;
+    const char *err;
+    listIter li;
+    listNode *ln;
+    int j, retval = C_ERR;
+
+    /* A manifest we can't read is just replaced. */
+    list *old_parts = rdbLoadManifest(filename,&seq,&err);
+    seq++;
+
+    startSaving(RDBFLAGS_NONE);
+    s->parts = server.rdb_save_parts;
+    s->rdbflags = rdbflags;
+    for (j = 0; j < s->parts; j++) {
+        tmpnames[j] = sdscatprintf(sdsempty(),"temp-%d.part%d.rdb",(int)getpid(),j);
+        names[j] = rdbGetPartName(filename,seq,j);
+    }
+    if (rdbSavePartsToFiles(s,tmpnames,rsi) == C_ERR) goto cleanup;
+
+    /* Use RENAME so that the parts are never seen incomplete, even if they
+     * are only referenced once the manifest is replaced. */
+    for (j = 0; j < s->parts; j++) {
+        if (rename(tmpnames[j],names[j]) == -1) {
+            serverLog(LL_WARNING,"Error moving temp DB file %s on the final destination %s: %s",
+                tmpnames[j], names[j], strerror(errno));
+            for (int k = 0; k < s->parts; k++) unlink(k < j ? names[k] : tmpnames[k]);
+            goto cleanup;
+        }
+        manifest = sdscatfmt(manifest,"%s %s %s %I %s %i\n",
+            RDB_MANIFEST_KEY_FILE_NAME, names[j],
+            RDB_MANIFEST_KEY_FILE_SEQ, seq,
+            RDB_MANIFEST_KEY_FILE_PART, j);
+    }
+    if (rdbWriteManifest(filename,manifest) == C_ERR) {
+        for (j = 0; j < s->parts; j++) unlink(names[j]);
+        goto cleanup;
+    }
+
+    /* The previous snapshot is not referenced anymore. */
+    if (old_parts) {
+        listRewind(old_parts,&li);
+        while ((ln = listNext(&li)) != NULL)
+            rdbUnlinkFile(listNodeValue(ln));
+    }
+
+    serverLog(LL_NOTICE,"DB saved on disk (%d parts)", s->parts);
+    server.dirty = 0;
+    server.lastsave = time(NULL);
+    server.lastbgsave_status = C_OK;
+    retval = C_OK;
+
+cleanup:
+    stopSaving(retval == C_OK);
+    for (j = 0; j < s->parts; j++) {
+        sdsfree(tmpnames[j]);
+        sdsfree(names[j]);
+    }
+    if (old_parts) listRelease(old_parts);
+    sdsfree(manifest);
+    zfree(s);
+    return retval;
+}
+
 /* Save the DB on disk. Return C_ERR on error, C_OK on success. */
 int rdbSave(int req, char *filename, rdbSaveInfo *rsi, int rdbflags) {
     char tmpfile[256];
     char cwd[MAXPATHLEN]; /* Current working dir path for error messages. */
 
+    /* The keys not loaded yet are only in the file we may overwrite. */
+    if (server.loading_on_demand) rdbOnDemandLoadAll();
+
+    if (server.rdb_save_parts > 1 && req == SLAVE_REQ_NONE && !(rdbflags & RDBFLAGS_SINGLE_FILE))
+        return rdbSaveParts(filename,rsi,rdbflags);
+
     startSaving(RDBFLAGS_NONE);
     snprintf(tmpfile,256,"temp-%d.rdb", (int) getpid());
+    if (server.rdb_load_on_demand && req == SLAVE_REQ_NONE) rdbIndexCreate();
 
     if (rdbSaveInternal(req,tmpfile,rsi,rdbflags) != C_OK) {
+        rdbIndexRelease();
         stopSaving(0);
         return C_ERR;
     }
@@ -1538,15 +2439,20 @@ int rdbSave(int req, char *filename, rdbSaveInfo *rsi, int rdbflags) {
             cwdp ? cwdp : "unknown",
             str_err);
         unlink(tmpfile);
+        rdbIndexRelease();
         stopSaving(0);
         return C_ERR;
     }
     if (fsyncFileDir(filename) != 0) {
         serverLog(LL_WARNING,
             "Failed to fsync directory while saving DB: %s", strerror(errno));
+        rdbIndexRelease();
         stopSaving(0);
         return C_ERR;
     }
+    /* A multi-part snapshot would be loaded in place of this file. */
+    rdbRemoveParts(filename);
+    rdbIndexSave(filename);
 
     serverLog(LL_NOTICE,"DB saved on disk");
     server.dirty = 0;
@@ -1556,15 +2462,675 @@ int rdbSave(int req, char *filename, rdbSaveInfo *rsi, int rdbflags) {
     return C_OK;
 }
 
-int rdbSaveBackground(int req, char *filename, rdbSaveInfo *rsi, int rdbflags) {
-    pid_t childpid;
+/* -----------------------------------------------------------------------------
+ * Fork-less snapshots
+ *
+ * When rdb-save-forkless is enabled, BGSAVE doesn't fork a child: the snapshot
+ * is written by a thread of this process while the main thread keeps serving
+ * the clients, and it still holds the dataset as it was when BGSAVE started.
+ *
+ * The main thread walks the keyspace a few keys at a time, handing batches of
+ * keys to the thread, that serializes the values and writes them to the file.
+ * The dicts are walked by hash class, see dictScanHashClass(), so that the
+ * position of the walk tells if a key was already handed to the thread even
+ * if its dict is resized meanwhile: this position acts as the snapshot epoch
+ * of every key, without storing anything in the keys. Before a key the walk
+ * didn't reach yet is created, modified or deleted, the main thread saves its
+ * current value in a batch of its own (or nothing if the key doesn't exist)
+ * and adds the key to the 'touched' set, so that the walk skips it. The
+ * memory used by the snapshot is then bounded by the keys written while it
+ * is in progress, not by the size of the dataset.
+ *
+ * The keys of the batches not processed yet by the thread are in flight.
+ * Before one of them is accessed, the main thread either serializes it in
+ * place of the thread, if the thread didn't start it yet, or waits for the
+ * thread to finish it. This is also needed for the reads, that may change
+ * the internal representation of a value, for instance rehashing its dict.
+ *
+ * For the rest of the server the snapshot is an RDB child with the pid of
+ * this process: it excludes the other children, it's killed with
+ * killRDBChild() and reported as terminated by checkChildrenDone(). Since no
+ * write is seen when a DB is flushed or swapped, this aborts the snapshot.
+ * -------------------------------------------------------------------------- */
+
+#define RDB_FORKLESS_BATCH_KEYS 1024 /* Keys walked by every batch. */
+#define RDB_FORKLESS_INFLIGHT 4      /* Batches of the walk in flight. */
+
+/* States of the keys in flight. */
+#define RDB_FORKLESS_PENDING 0  /* To be saved by the thread. */
+#define RDB_FORKLESS_SAVING 1   /* Being saved by the thread. */
+#define RDB_FORKLESS_SAVED 2    /* Saved by the thread. */
+#define RDB_FORKLESS_STOLEN 3   /* Being serialized by the main thread. */
+#define RDB_FORKLESS_READY 4    /* Serialized by the main thread. */
+
+typedef struct rdbForklessEntry {
+    sds key;                /* Copy of the key name. */
+    robj *val;              /* Value in the keyspace. */
+    long long expire;
+    sds payload;            /* Serialized key if READY. */
+    int state;              /* RDB_FORKLESS_*, protected by the lock. */
+} rdbForklessEntry;
+
+typedef struct rdbForklessBatch {
+    int dbid;               /* DB of the keys, -1 for none. */
+    sds payload;            /* Written as it is, before the entries. */
+    long keys;              /* Keys serialized in the payload. */
+    rdbForklessEntry *entries;
+    int count, size;
+    int last;               /* Terminates the file. */
+    int done;               /* Processed by the thread, protected by the lock. */
+} rdbForklessBatch;
+
+typedef struct rdbForklessSave {
+    char tmpfile[256];
+    sds filename;
+    int rdbflags;
+    FILE *fp;
+    rio rdb;                /* Only used by the thread once started. */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    list *queue;            /* Batches for the thread, protected by the lock. */
+    int stop;               /* Asks the thread to exit, protected by the lock. */
+    int failed;             /* The thread got an error, protected by the lock. */
+    int error;              /* errno of the error, protected by the lock. */
+    int waiting;            /* The main thread waits for a key, protected by the lock. */
+    int pipe[2];            /* Written by the thread after every batch. */
+    int thread_dbid;        /* DB selected in the file by the thread. */
+    char *resized;          /* DBs with a RESIZEDB opcode, used by the thread. */
+    uint64_t *db_size;      /* Sizes of the DBs when the snapshot started. */
+    uint64_t *expires_size;
+    /* The fields below are only used by the main thread. */
+    list *inflight;         /* Batches handed to the thread, in order. */
+    int dbid, slot, bits;   /* Position of the walk. */
+    unsigned long class;
+    int walked;             /* All the keys were walked. */
+    int finished;           /* The last batch was handed to the thread. */
+    int completed;          /* The thread exited and the result is known. */
+    int exitcode, bysignal; /* Result, like the one of a child. */
+    dict **touched;         /* Per DB, the keys the walk must skip. */
+    dict **index;           /* Per DB, the keys in flight and their entries. */
+    rdbForklessBatch *batch;     /* Batch filled by the walk. */
+    rdbForklessBatch *preserved; /* Keys saved before a write. */
+    size_t buffered;        /* Memory of the serialized keys. */
+    long long keys;         /* Keys saved. */
+} rdbForklessSave;
+
+static rdbForklessSave *rdb_forkless = NULL;
+
+static rdbForklessBatch *rdbForklessCreateBatch(int dbid) {
+    rdbForklessBatch *b = zcalloc(sizeof(*b));
+    b->dbid = dbid;
+    return b;
+}
 
-    if (hasActiveChildProcess()) return C_ERR;
-    server.stat_rdb_saves++;
+static void rdbForklessReleaseBatch(rdbForklessSave *s, rdbForklessBatch *b) {
+    if (b->payload) {
+        s->buffered -= sdsZmallocSize(b->payload);
+        sdsfree(b->payload);
+    }
+    for (int j = 0; j < b->count; j++) {
+        rdbForklessEntry *e = b->entries+j;
+        if (dictFetchValue(s->index[b->dbid],e->key) == e)
+            dictDelete(s->index[b->dbid],e->key);
+        if (e->payload) {
+            s->buffered -= sdsZmallocSize(e->payload);
+            sdsfree(e->payload);
+        }
+        sdsfree(e->key);
+    }
+    zfree(b->entries);
+    zfree(b);
+}
+
+/* Serialize the key with the RDB format, appending it to 'buf'. */
+static sds rdbForklessSerialize(sds buf, int dbid, sds keystr, robj *o, long long expire) {
+    rio rdb;
+    robj key;
+
+    rioInitWithBuffer(&rdb,buf);
+    initStaticStringObject(key,keystr);
+    rdbSaveKeyValuePair(&rdb,&key,o,expire,dbid);
+    return rdb.io.buffer.ptr;
+}
+
+/* Write a batch to the file, called by the thread. */
+static int rdbForklessWriteBatch(rdbForklessSave *s, rdbForklessBatch *b) {
+    int retval = C_OK;
+
+    if (b->dbid != -1 && b->dbid != s->thread_dbid) {
+        if (rdbSaveType(&s->rdb,RDB_OPCODE_SELECTDB) == -1 ||
+            rdbSaveLen(&s->rdb,b->dbid) == -1) return C_ERR;
+        if (!s->resized[b->dbid]) {
+            if (rdbSaveType(&s->rdb,RDB_OPCODE_RESIZEDB) == -1 ||
+                rdbSaveLen(&s->rdb,s->db_size[b->dbid]) == -1 ||
+                rdbSaveLen(&s->rdb,s->expires_size[b->dbid]) == -1) return C_ERR;
+            s->resized[b->dbid] = 1;
+        }
+        s->thread_dbid = b->dbid;
+    }
+    if (b->payload && rdbWriteRaw(&s->rdb,b->payload,sdslen(b->payload)) == -1)
+        return C_ERR;
+
+    for (int j = 0; j < b->count && retval == C_OK; j++) {
+        rdbForklessEntry *e = b->entries+j;
+        int state, stop;
+
+        pthread_mutex_lock(&s->lock);
+        while (e->state == RDB_FORKLESS_STOLEN) pthread_cond_wait(&s->cond,&s->lock);
+        if (e->state == RDB_FORKLESS_PENDING) e->state = RDB_FORKLESS_SAVING;
+        state = e->state;
+        stop = s->stop;
+        pthread_mutex_unlock(&s->lock);
+
+        if (state == RDB_FORKLESS_READY) {
+            if (rdbWriteRaw(&s->rdb,e->payload,sdslen(e->payload)) == -1) retval = C_ERR;
+            continue;
+        }
+
+        robj key;
+        initStaticStringObject(key,e->key);
+        if (stop || rdbSaveKeyValuePair(&s->rdb,&key,e->val,e->expire,b->dbid) == -1)
+            retval = C_ERR;
+        pthread_mutex_lock(&s->lock);
+        e->state = RDB_FORKLESS_SAVED;
+        if (s->waiting) pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->lock);
+    }
+    return retval;
+}
+
+static void *rdbForklessThreadMain(void *arg) {
+    rdbForklessSave *s = arg;
+    int failed = 0, last = 0;
+
+    sider_set_thread_title("rdb_save");
+    while (!last) {
+        rdbForklessBatch *b;
+
+        pthread_mutex_lock(&s->lock);
+        while (listLength(s->queue) == 0 && !s->stop)
+            pthread_cond_wait(&s->cond,&s->lock);
+        if (s->stop) {
+            pthread_mutex_unlock(&s->lock);
+            break;
+        }
+        b = listNodeValue(listFirst(s->queue));
+        listDelNode(s->queue,listFirst(s->queue));
+        pthread_mutex_unlock(&s->lock);
+
+        /* After an error the batches are just marked as done, until the
+         * main thread stops us. */
+        int error = 0;
+        if (!failed && (rdbForklessWriteBatch(s,b) == C_ERR ||
+                        (b->last && rdbSaveFinishFile(&s->rdb,&s->fp,s->rdbflags) == C_ERR)))
+        {
+            failed = 1;
+            error = errno;
+        }
+        last = b->last && !failed;
+
+        pthread_mutex_lock(&s->lock);
+        b->done = 1;
+        if (error) {
+            s->failed = 1;
+            s->error = error;
+        }
+        pthread_mutex_unlock(&s->lock);
+        if (write(s->pipe[1],"x",1) == -1) {
+            /* The pipe is full: the main thread will wake up anyway. */
+        }
+    }
+    rdbReleaseThreadCompression();
+    return NULL;
+}
+
+static void rdbForklessSubmit(rdbForklessSave *s, rdbForklessBatch *b) {
+    listAddNodeTail(s->inflight,b);
+    pthread_mutex_lock(&s->lock);
+    listAddNodeTail(s->queue,b);
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+}
+
+/* Start the walk of the dict at the current position: the number of bits
+ * of the hash classes is fixed by its size at this time. */
+static void rdbForklessEnterDict(rdbForklessSave *s) {
+    dict *d = server.db[s->dbid].dict[s->slot];
+    int exp = d->ht_size_exp[0] > d->ht_size_exp[1] ? d->ht_size_exp[0] : d->ht_size_exp[1];
+
+    s->bits = exp > 0 ? exp : 0;
+    s->class = 0;
+}
+
+static void rdbForklessNextDict(rdbForklessSave *s) {
+    if (++s->slot == server.db[s->dbid].dict_count) {
+        s->slot = 0;
+        if (++s->dbid == server.dbnum) {
+            s->walked = 1;
+            return;
+        }
+    }
+    rdbForklessEnterDict(s);
+}
+
+/* Return true if the walk already reached the key, that is if the key was
+ * handed to the thread or skipped because it was written before. */
+static int rdbForklessWalked(rdbForklessSave *s, int dbid, sds key) {
+    if (s->walked) return 1;
+    if (dbid != s->dbid) return dbid < s->dbid;
+    int slot = getKeySlot(key);
+    if (slot != s->slot) return slot < s->slot;
+    dict *d = server.db[dbid].dict[slot];
+    return (dictGetHash(d,key) & ((1UL << s->bits) - 1)) < s->class;
+}
+
+static void rdbForklessCollect(void *privdata, const dictEntry *de) {
+    rdbForklessSave *s = privdata;
+    rdbForklessBatch *b = s->batch;
+    sds keystr = dictGetKey(de);
+    robj key, *o = dictGetVal(de);
+
+    if (dictSize(s->touched[b->dbid]) && dictFind(s->touched[b->dbid],keystr)) return;
+    if (b->count == b->size) {
+        b->size = b->size ? b->size*2 : RDB_FORKLESS_BATCH_KEYS;
+        b->entries = zrealloc(b->entries,sizeof(rdbForklessEntry)*b->size);
+    }
+    rdbForklessEntry *e = b->entries+b->count++;
+    initStaticStringObject(key,keystr);
+    e->key = sdsdup(keystr);
+    e->val = o;
+    e->expire = getExpire(server.db+b->dbid,&key);
+    e->payload = NULL;
+    e->state = RDB_FORKLESS_PENDING;
+    /* Modules don't expect their rdb_save callback to be called from other
+     * threads. */
+    if (o->type == OBJ_MODULE) {
+        e->payload = rdbForklessSerialize(sdsempty(),b->dbid,e->key,o,e->expire);
+        s->buffered += sdsZmallocSize(e->payload);
+        e->state = RDB_FORKLESS_READY;
+    }
+}
+
+/* Walk the next hash classes of the keyspace, until a batch of keys of the
+ * same DB is filled. Returns NULL if the walk is over without finding keys. */
+static rdbForklessBatch *rdbForklessWalk(rdbForklessSave *s) {
+    rdbForklessBatch *b = NULL;
+
+    while (!s->walked) {
+        dict *d = server.db[s->dbid].dict[s->slot];
+
+        if (dictSize(d) == 0 || s->class > (1UL << s->bits) - 1) {
+            rdbForklessNextDict(s);
+            continue;
+        }
+        if (b == NULL) {
+            b = rdbForklessCreateBatch(s->dbid);
+        } else if (b->dbid != s->dbid) {
+            break;
+        }
+        s->batch = b;
+        dictScanHashClass(d,s->class,s->bits,rdbForklessCollect,s);
+        s->class++;
+        if (b->count >= RDB_FORKLESS_BATCH_KEYS) break;
+    }
+    s->batch = NULL;
+    if (b == NULL) return NULL;
+
+    /* The entries don't move anymore, they can be indexed. */
+    for (int j = 0; j < b->count; j++) {
+        rdbForklessEntry *e = b->entries+j;
+        if (e->state == RDB_FORKLESS_PENDING) dictAdd(s->index[b->dbid],e->key,e);
+    }
+    return b;
+}
+
+/* Stop the thread, and set the result of the snapshot. */
+static void rdbForklessComplete(rdbForklessSave *s, int exitcode, int bysignal) {
+    pthread_mutex_lock(&s->lock);
+    s->stop = 1;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->thread,NULL);
+    if (s->fp) {
+        fclose(s->fp);
+        s->fp = NULL;
+    }
+
+    if (!bysignal && exitcode == 0) {
+        /* Use RENAME to make sure the DB file is changed atomically only
+         * if the generate DB file is ok. */
+        if (rename(s->tmpfile,s->filename) == -1) {
+            serverLog(LL_WARNING,"Error moving temp DB file %s on the final destination %s: %s",
+                s->tmpfile, s->filename, strerror(errno));
+            exitcode = 1;
+        } else if (fsyncFileDir(s->filename) != 0) {
+            serverLog(LL_WARNING,"Failed to fsync directory while saving DB: %s", strerror(errno));
+            exitcode = 1;
+        } else {
+            /* A multi-part snapshot would be loaded in place of this file. */
+            rdbRemoveParts(s->filename);
+            rdbIndexSave(s->filename);
+            serverLog(LL_NOTICE,"DB saved on disk");
+        }
+    }
+    /* When killed, the temp file is removed by the caller like for a child. */
+    if (!bysignal && exitcode != 0) unlink(s->tmpfile);
+
+    s->completed = 1;
+    s->exitcode = exitcode;
+    s->bysignal = bysignal;
+    server.rdb_forkless_tracking = 0;
+}
+
+/* Release the batches processed by the thread, and hand it new ones. */
+static void rdbForklessStep(rdbForklessSave *s) {
+    int failed, error;
+
+    if (s->completed) return;
+    while (listLength(s->inflight)) {
+        rdbForklessBatch *b = listNodeValue(listFirst(s->inflight));
+        int done, last = b->last;
+
+        pthread_mutex_lock(&s->lock);
+        done = b->done;
+        pthread_mutex_unlock(&s->lock);
+        if (!done) break;
+        s->keys += b->count + b->keys;
+        listDelNode(s->inflight,listFirst(s->inflight));
+        rdbForklessReleaseBatch(s,b);
+        if (last) {
+            rdbForklessComplete(s,0,0);
+            return;
+        }
+    }
+    server.stat_current_save_keys_processed = s->keys;
+
+    pthread_mutex_lock(&s->lock);
+    failed = s->failed;
+    error = s->error;
+    pthread_mutex_unlock(&s->lock);
+    if (failed) {
+        serverLog(LL_WARNING,"Write error while saving DB to the disk: %s", strerror(error));
+        rdbForklessComplete(s,1,0);
+        return;
+    }
+
+    if (s->preserved) {
+        rdbForklessSubmit(s,s->preserved);
+        s->preserved = NULL;
+    }
+    while (!s->walked && listLength(s->inflight) < RDB_FORKLESS_INFLIGHT) {
+        rdbForklessBatch *b = rdbForklessWalk(s);
+        if (b) rdbForklessSubmit(s,b);
+    }
+    if (s->walked && !s->finished) {
+        rio rdb;
+        rdbForklessBatch *b = rdbForklessCreateBatch(-1);
+
+        rioInitWithBuffer(&rdb,sdsempty());
+        rdbSaveModulesAux(&rdb,REDISMODULE_AUX_AFTER_RDB);
+        b->payload = rdb.io.buffer.ptr;
+        s->buffered += sdsZmallocSize(b->payload);
+        b->last = 1;
+        rdbForklessSubmit(s,b);
+        s->finished = 1;
+    }
+}
+
+static void rdbForklessPipeHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
+    char buf[64];
+    UNUSED(el);
+    UNUSED(privdata);
+    UNUSED(mask);
+
+    while (read(fd,buf,sizeof(buf)) > 0);
+    if (rdb_forkless) rdbForklessStep(rdb_forkless);
+}
+
+static void rdbForklessRelease(rdbForklessSave *s) {
+    listIter li;
+    listNode *ln;
+
+    listRewind(s->inflight,&li);
+    while ((ln = listNext(&li)) != NULL) rdbForklessReleaseBatch(s,listNodeValue(ln));
+    if (s->preserved) rdbForklessReleaseBatch(s,s->preserved);
+    listRelease(s->inflight);
+    listRelease(s->queue);
+    for (int j = 0; j < server.dbnum; j++) {
+        dictRelease(s->touched[j]);
+        dictRelease(s->index[j]);
+    }
+    zfree(s->touched);
+    zfree(s->index);
+    zfree(s->resized);
+    zfree(s->db_size);
+    zfree(s->expires_size);
+    if (s->pipe[0] != -1) {
+        aeDeleteFileEvent(server.el,s->pipe[0],AE_READABLE);
+        close(s->pipe[0]);
+        close(s->pipe[1]);
+    }
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->cond);
+    if (s->fp) fclose(s->fp);
+    sdsfree(s->filename);
+    zfree(s);
+}
+
+/* Like rdbSaveBackground(), but saving the snapshot from a thread. */
+static int rdbSaveBackgroundForkless(char *filename, rdbSaveInfo *rsi, int rdbflags) {
+    rdbForklessSave *s = zcalloc(sizeof(*s));
+    char magic[10];
+
+    s->filename = sdsnew(filename);
+    s->rdbflags = rdbflags;
+    s->pipe[0] = s->pipe[1] = -1;
+    snprintf(s->tmpfile,sizeof(s->tmpfile),"temp-%d.rdb",(int)getpid());
+    if ((s->fp = fopen(s->tmpfile,"w")) == NULL) {
+        serverLog(LL_WARNING,"Failed opening the temp RDB file %s for saving: %s",
+            s->tmpfile, strerror(errno));
+        sdsfree(s->filename);
+        zfree(s);
+        goto err;
+    }
+    rioInitWithFile(&s->rdb,s->fp);
+    if (server.rdb_save_incremental_fsync) {
+        rioSetAutoSync(&s->rdb,REDIS_AUTOSYNC_BYTES);
+        if (!(rdbflags & RDBFLAGS_KEEP_CACHE)) rioSetReclaimCache(&s->rdb,1);
+    }
+    if (server.rdb_checksum)
+        s->rdb.update_cksum = rioGenericUpdateChecksum;
+
+    pthread_mutex_init(&s->lock,NULL);
+    pthread_cond_init(&s->cond,NULL);
+    s->queue = listCreate();
+    s->inflight = listCreate();
+    s->thread_dbid = -1;
+    s->touched = zmalloc(sizeof(dict*)*server.dbnum);
+    s->index = zmalloc(sizeof(dict*)*server.dbnum);
+    s->resized = zcalloc(server.dbnum);
+    s->db_size = zmalloc(sizeof(uint64_t)*server.dbnum);
+    s->expires_size = zmalloc(sizeof(uint64_t)*server.dbnum);
+    for (int j = 0; j < server.dbnum; j++) {
+        s->touched[j] = dictCreate(&setDictType);
+        s->index[j] = dictCreate(&sdsReplyDictType);
+        s->db_size[j] = dbSize(server.db+j,DB_MAIN);
+        s->expires_size[j] = dbSize(server.db+j,DB_EXPIRES);
+    }
+
+    /* The data that is not a key is saved right away. */
+    snprintf(magic,sizeof(magic),"REDIS%04d",RDB_VERSION);
+    if (rdbWriteRaw(&s->rdb,magic,9) == -1 ||
+        rdbSaveInfoAuxFields(&s->rdb,rdbflags,rsi) == -1 ||
+        rdbSaveModulesAux(&s->rdb,REDISMODULE_AUX_BEFORE_RDB) == -1 ||
+        rdbSaveFunctions(&s->rdb) == -1)
+    {
+        serverLog(LL_WARNING,"Write error while saving DB to the disk: %s", strerror(errno));
+        goto cleanup;
+    }
+
+    if (anetPipe(s->pipe,O_CLOEXEC|O_NONBLOCK,O_CLOEXEC|O_NONBLOCK) == -1 ||
+        aeCreateFileEvent(server.el,s->pipe[0],AE_READABLE,rdbForklessPipeHandler,NULL) == AE_ERR)
+    {
+        serverLog(LL_WARNING,"Can't create the pipe of the fork-less snapshot: %s", strerror(errno));
+        goto cleanup;
+    }
+    if (pthread_create(&s->thread,NULL,rdbForklessThreadMain,s) != 0) {
+        serverLog(LL_WARNING,"Can't create the thread of the fork-less snapshot");
+        goto cleanup;
+    }
+
+    rdb_forkless = s;
+    server.rdb_forkless_tracking = 1;
+    server.stat_rdb_forkless_preserved_keys = 0;
+    server.child_type = CHILD_TYPE_RDB;
+    server.child_pid = server.pid;
+    server.stat_current_save_keys_processed = 0;
+    server.stat_current_save_keys_total = dbTotalServerKeyCount();
+    updateDictResizePolicy();
+    server.rdb_save_time_start = time(NULL);
+    server.rdb_child_type = RDB_CHILD_TYPE_DISK;
+    serverLog(LL_NOTICE,"Background saving started without fork");
+
+    rdbForklessEnterDict(s);
+    rdbForklessStep(s);
+    return C_OK;
+
+cleanup:
+    unlink(s->tmpfile);
+    rdbForklessRelease(s);
+err:
+    server.lastbgsave_status = C_ERR;
+    return C_ERR;
+}
+
+/* Return true if a fork-less snapshot is in progress (or terminated but not
+ * yet reported by rdbForklessSaveDone()). */
+int rdbForklessSaveInProgress(void) {
+    return rdb_forkless != NULL;
+}
+
+/* If the fork-less snapshot in progress is over, set its result like the
+ * one of a child, release it and return 1, otherwise return 0. */
+int rdbForklessSaveDone(int *exitcode, int *bysignal) {
+    rdbForklessSave *s = rdb_forkless;
+
+    if (!s) return 0;
+    rdbForklessStep(s);
+    if (!s->completed) return 0;
+    *exitcode = s->exitcode;
+    *bysignal = s->bysignal;
+    rdb_forkless = NULL;
+    rdbForklessRelease(s);
+    return 1;
+}
+
+/* Abort the fork-less snapshot in progress, like a child killed with
+ * SIGUSR1. */
+void rdbForklessSaveAbort(void) {
+    rdbForklessSave *s = rdb_forkless;
+    if (s && !s->completed) rdbForklessComplete(s,1,SIGUSR1);
+}
+
+/* Memory used by the fork-less snapshot in progress for the keys serialized
+ * by the main thread, and not counted for maxmemory, like the copy on write
+ * of a child. */
+size_t rdbForklessSaveMemory(void) {
+    return rdb_forkless ? rdb_forkless->buffered : 0;
+}
+
+/* Called before the key 'key' of the DB 'db' is created, modified, deleted,
+ * or its TTL changed, while server.rdb_forkless_tracking is set. If the walk
+ * didn't reach the key yet, its current value is saved right now, otherwise
+ * if the key is in flight, it's settled, see rdbForklessKeyRead(). */
+void rdbForklessKeyWrite(siderDb *db, sds key) {
+    rdbForklessSave *s = rdb_forkless;
+
+    if (s->completed || db != server.db+db->id) return;
+    if (rdbForklessWalked(s,db->id,key)) {
+        rdbForklessKeyRead(db,key);
+        return;
+    }
+    if (dictFind(s->touched[db->id],key)) return;
+    dictAddRaw(s->touched[db->id],sdsdup(key),NULL);
+
+    dictEntry *de = dbFind(db,key);
+    if (de == NULL) return;
+    if (s->preserved && s->preserved->dbid != db->id) {
+        rdbForklessSubmit(s,s->preserved);
+        s->preserved = NULL;
+    }
+    if (s->preserved == NULL) {
+        s->preserved = rdbForklessCreateBatch(db->id);
+        s->preserved->payload = sdsempty();
+    } else {
+        s->buffered -= sdsZmallocSize(s->preserved->payload);
+    }
+    robj keyobj;
+    initStaticStringObject(keyobj,key);
+    s->preserved->payload = rdbForklessSerialize(s->preserved->payload,db->id,key,
+        dictGetVal(de),getExpire(db,&keyobj));
+    s->buffered += sdsZmallocSize(s->preserved->payload);
+    s->preserved->keys++;
+    server.stat_rdb_forkless_preserved_keys++;
+}
+
+/* Called before the value of the key 'key' of the DB 'db' is accessed, while
+ * server.rdb_forkless_tracking is set. If the key is in flight, either it's
+ * serialized right now if the thread didn't start it yet, or we wait for the
+ * thread to finish it, so that the value can be changed. */
+void rdbForklessKeyRead(siderDb *db, sds key) {
+    rdbForklessSave *s = rdb_forkless;
+
+    if (s->completed || db != server.db+db->id || dictSize(s->index[db->id]) == 0) return;
+    rdbForklessEntry *e = dictFetchValue(s->index[db->id],key);
+    if (e == NULL) return;
+    dictDelete(s->index[db->id],key);
+
+    pthread_mutex_lock(&s->lock);
+    if (e->state == RDB_FORKLESS_PENDING) {
+        e->state = RDB_FORKLESS_STOLEN;
+        pthread_mutex_unlock(&s->lock);
+        e->payload = rdbForklessSerialize(sdsempty(),db->id,e->key,e->val,e->expire);
+        s->buffered += sdsZmallocSize(e->payload);
+        pthread_mutex_lock(&s->lock);
+        e->state = RDB_FORKLESS_READY;
+        pthread_cond_broadcast(&s->cond);
+    } else {
+        s->waiting = 1;
+        while (e->state == RDB_FORKLESS_SAVING) pthread_cond_wait(&s->cond,&s->lock);
+        s->waiting = 0;
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+/* Called before a write command is executed while server.rdb_forkless_tracking
+ * is set: some commands modify keys they looked up for reading. */
+void rdbForklessCommandKeys(client *c) {
+    getKeysResult result = GETKEYS_RESULT_INIT;
+    int numkeys = getKeysFromCommandWithSpecs(c->cmd,c->argv,c->argc,GET_KEYSPEC_DEFAULT,&result);
+
+    for (int j = 0; j < numkeys; j++) {
+        if (result.keys[j].flags & CMD_KEY_RO) continue;
+        rdbForklessKeyWrite(c->db,c->argv[result.keys[j].pos]->ptr);
+    }
+    getKeysFreeResult(&result);
+}
+
+int rdbSaveBackground(int req, char *filename, rdbSaveInfo *rsi, int rdbflags) {
+    pid_t childpid;
+
+    if (hasActiveChildProcess()) return C_ERR;
+    if (server.loading_on_demand) rdbOnDemandLoadAll();
+    server.stat_rdb_saves++;
 
     server.dirty_before_bgsave = server.dirty;
     server.lastbgsave_try = time(NULL);
 
+    if (server.rdb_save_forkless && req == SLAVE_REQ_NONE && server.rdb_save_parts == 1)
+        return rdbSaveBackgroundForkless(filename,rsi,rdbflags);
+
     if ((childpid = siderFork(CHILD_TYPE_RDB)) == 0) {
         int retval;
 
@@ -1615,6 +3181,24 @@ void rdbRemoveTempFile(pid_t childpid, int from_signal) {
     } else {
         bg_unlink(tmpfile);
     }
+
+    /* The index of the keys, written after the RDB. */
+    sider_strlcpy(tmpfile, "temp-", sizeof(tmpfile));
+    sider_strlcat(tmpfile, pid, sizeof(tmpfile));
+    sider_strlcat(tmpfile, RDB_INDEX_SUFFIX, sizeof(tmpfile));
+    unlink(tmpfile);
+
+    /* The temp files of a multi-part snapshot, created in order. */
+    for (int j = 0; j < RDB_SAVE_PARTS_MAX; j++) {
+        char part[32];
+        ll2string(part, sizeof(part), j);
+        sider_strlcpy(tmpfile, "temp-", sizeof(tmpfile));
+        sider_strlcat(tmpfile, pid, sizeof(tmpfile));
+        sider_strlcat(tmpfile, ".part", sizeof(tmpfile));
+        sider_strlcat(tmpfile, part, sizeof(tmpfile));
+        sider_strlcat(tmpfile, ".rdb", sizeof(tmpfile));
+        if ((from_signal ? unlink(tmpfile) : bg_unlink(tmpfile)) == -1) break;
+    }
 }
 
 /* This function is called by rdbLoadObject() when the code is in RDB-check
@@ -2198,7 +3782,7 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, sds key, int dbid, int *error) {
 
             if (rdbtype == RDB_TYPE_LIST_QUICKLIST_2) {
                 lp = data;
-                if (deep_integrity_validation) server.stat_dump_payload_sanitizations++;
+                if (deep_integrity_validation) atomicIncr(server.stat_dump_payload_sanitizations, 1);
                 if (!lpValidateIntegrity(lp, encoded_len, deep_integrity_validation, NULL, NULL)) {
                     rdbReportCorruptRDB("Listpack integrity check failed.");
                     decrRefCount(o);
@@ -2343,7 +3927,7 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, sds key, int dbid, int *error) {
                     break;
                 }
             case RDB_TYPE_SET_INTSET:
-                if (deep_integrity_validation) server.stat_dump_payload_sanitizations++;
+                if (deep_integrity_validation) atomicIncr(server.stat_dump_payload_sanitizations, 1);
                 if (!intsetValidateIntegrity(encoded, encoded_len, deep_integrity_validation)) {
                     rdbReportCorruptRDB("Intset integrity check failed.");
                     zfree(encoded);
@@ -2357,7 +3941,7 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, sds key, int dbid, int *error) {
                     setTypeConvert(o,OBJ_ENCODING_HT);
                 break;
             case RDB_TYPE_SET_LISTPACK:
-                if (deep_integrity_validation) server.stat_dump_payload_sanitizations++;
+                if (deep_integrity_validation) atomicIncr(server.stat_dump_payload_sanitizations, 1);
                 if (!lpValidateIntegrityAndDups(encoded, encoded_len, deep_integrity_validation, 0)) {
                     rdbReportCorruptRDB("Set listpack integrity check failed.");
                     zfree(encoded);
@@ -2405,7 +3989,7 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, sds key, int dbid, int *error) {
                     break;
                 }
             case RDB_TYPE_ZSET_LISTPACK:
-                if (deep_integrity_validation) server.stat_dump_payload_sanitizations++;
+                if (deep_integrity_validation) atomicIncr(server.stat_dump_payload_sanitizations, 1);
                 if (!lpValidateIntegrityAndDups(encoded, encoded_len, deep_integrity_validation, 1)) {
                     rdbReportCorruptRDB("Zset listpack integrity check failed.");
                     zfree(encoded);
@@ -2451,7 +4035,7 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, sds key, int dbid, int *error) {
                     break;
                 }
             case RDB_TYPE_HASH_LISTPACK:
-                if (deep_integrity_validation) server.stat_dump_payload_sanitizations++;
+                if (deep_integrity_validation) atomicIncr(server.stat_dump_payload_sanitizations, 1);
                 if (!lpValidateIntegrityAndDups(encoded, encoded_len, deep_integrity_validation, 1)) {
                     rdbReportCorruptRDB("Hash listpack integrity check failed.");
                     zfree(encoded);
@@ -2515,7 +4099,7 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, sds key, int dbid, int *error) {
                 decrRefCount(o);
                 return NULL;
             }
-            if (deep_integrity_validation) server.stat_dump_payload_sanitizations++;
+            if (deep_integrity_validation) atomicIncr(server.stat_dump_payload_sanitizations, 1);
             if (!streamValidateListpackIntegrity(lp, lp_size, deep_integrity_validation)) {
                 rdbReportCorruptRDB("Stream listpack integrity check failed.");
                 sdsfree(nodekey);
@@ -2907,6 +4491,8 @@ void updateLoadingFileName(char* filename) {
 
 /* Loading finished */
 void stopLoading(int success) {
+    /* The keys loaded on demand may need the dictionaries. */
+    if (!server.loading_on_demand) rdbReleaseZstdDicts();
     server.loading = 0;
     server.async_loading = 0;
     blockingOperationEnds();
@@ -3005,85 +4591,630 @@ done:
     return res;
 }
 
-/* Load an RDB file from the rio stream 'rdb'. On success C_OK is returned,
- * otherwise C_ERR is returned and 'errno' is set accordingly. */
-int rdbLoadRio(rio *rdb, int rdbflags, rdbSaveInfo *rsi) {
-    functionsLibCtx* functions_lib_ctx = functionsLibCtxGetCurrent();
-    rdbLoadingCtx loading_ctx = { .dbarray = server.db, .functions_lib_ctx = functions_lib_ctx };
-    int retval = rdbLoadRioWithLoadingCtx(rdb,rdbflags,rsi,&loading_ctx);
-    return retval;
+/* State of an RDB load that is needed in order to add the loaded keys to
+ * the keyspace, either as they are read or once a loading thread decoded
+ * them. */
+typedef struct rdbLoadState {
+    int rdbflags;
+    long long now;
+    long long lru_clock;
+    long long empty_keys_skipped;
+} rdbLoadState;
+
+/* Add a key that was just loaded to 'db', handling the keys that already
+ * expired and the duplicated keys. 'val' is NULL when rdbLoadObject() failed
+ * with 'error'. The ownership of 'key' and 'val' is taken by this function.
+ * Returns C_ERR if the RDB can't be loaded any further. */
+static int rdbLoadAddKey(rdbLoadState *ls, siderDb *db, sds key, robj *val, int error,
+                         long long expiretime, long long lfu_freq, long long lru_idle)
+{
+    /* Check if the key already expired. This function is used when loading
+     * an RDB file from disk, either at startup, or when an RDB was
+     * received from the master. In the latter case, the master is
+     * responsible for key expiry. If we would expire keys here, the
+     * snapshot taken by the master may not be reflected on the slave.
+     * Similarly, if the base AOF is RDB format, we want to load all 
+     * the keys they are, since the log of operations in the incr AOF 
+     * is assumed to work in the exact keyspace state. */
+    if (val == NULL) {
+        /* Since we used to have bug that could lead to empty keys
+         * (See #8453), we rather not fail when empty key is encountered
+         * in an RDB file, instead we will silently discard it and
+         * continue loading. */
+        if (error == RDB_LOAD_ERR_EMPTY_KEY) {
+            if(ls->empty_keys_skipped++ < 10)
+                serverLog(LL_NOTICE, "rdbLoadObject skipping empty key: %s", key);
+            sdsfree(key);
+        } else {
+            sdsfree(key);
+            return C_ERR;
+        }
+    } else if (iAmMaster() &&
+        !(ls->rdbflags&RDBFLAGS_AOF_PREAMBLE) &&
+        expiretime != -1 && expiretime < ls->now)
+    {
+        if (ls->rdbflags & RDBFLAGS_FEED_REPL) {
+            /* Caller should have created replication backlog,
+             * and now this path only works when rebooting,
+             * so we don't have replicas yet. */
+            serverAssert(server.repl_backlog != NULL && listLength(server.slaves) == 0);
+            robj keyobj;
+            initStaticStringObject(keyobj,key);
+            robj *argv[2];
+            argv[0] = server.lazyfree_lazy_expire ? shared.unlink : shared.del;
+            argv[1] = &keyobj;
+            replicationFeedSlaves(server.slaves,db->id,argv,2);
+        }
+        sdsfree(key);
+        decrRefCount(val);
+        server.rdb_last_load_keys_expired++;
+    } else {
+        robj keyobj;
+        initStaticStringObject(keyobj,key);
+
+        /* Add the new object in the hash table */
+        int added = dbAddRDBLoad(db,key,val);
+        server.rdb_last_load_keys_loaded++;
+        if (!added) {
+            if (ls->rdbflags & RDBFLAGS_ALLOW_DUP) {
+                /* This flag is useful for DEBUG RELOAD special modes.
+                 * When it's set we allow new keys to replace the current
+                 * keys with the same name. */
+                dbSyncDelete(db,&keyobj);
+                dbAddRDBLoad(db,key,val);
+            } else {
+                serverLog(LL_WARNING,
+                    "RDB has duplicated key '%s' in DB %d",key,db->id);
+                serverPanic("Duplicated key found in RDB file");
+            }
+        }
+
+        /* Set the expire time if needed */
+        if (expiretime != -1) {
+            setExpire(NULL,db,&keyobj,expiretime);
+        }
+
+        /* Set usage information (for eviction). */
+        objectSetLRUOrLFU(val,lfu_freq,lru_idle,ls->lru_clock,1000);
+
+        /* call key space notification on key loaded for modules only */
+        moduleNotifyKeyspaceEvent(NOTIFY_LOADED, "loaded", &keyobj, db->id);
+    }
+
+    /* Loading the database more slowly is useful in order to test
+     * certain edge cases. */
+    if (server.key_load_delay)
+        debugDelay(server.key_load_delay);
+    return C_OK;
 }
 
+/* -----------------------------------------------------------------------------
+ * Threaded loading
+ *
+ * When rdb-load-threads is set, the main thread still reads the RDB stream
+ * and parses its opcodes, but instead of decoding the values it only copies
+ * their serialized form into batches (framing). The batches are decoded by
+ * the loading threads with rdbLoadObject() reading from an in memory buffer,
+ * and the main thread adds the decoded keys to the keyspace, in the same
+ * order they appear in the stream, as the batches complete.
+ *
+ * The stream itself is never read by the loading threads: the rio progress
+ * callback processes events, and when loading from the master the same
+ * connection is also written by the main thread. Values of module types are
+ * loaded by the main thread too, since the modules don't expect their
+ * rdb_load callback to be called from other threads.
+ * -------------------------------------------------------------------------- */
+
+typedef struct rdbLoadKey {
+    sds key;
+    int type;
+    size_t offset;          /* Offset of the serialized value in the frames. */
+    long long expiretime;
+    long long lfu_freq;
+    long long lru_idle;
+    robj *val;              /* Decoded value, set by the loading thread. */
+    int error;              /* rdbLoadObject() error if 'val' is NULL. */
+} rdbLoadKey;
+
+typedef struct rdbLoadBatch {
+    siderDb *db;
+    sds frames;             /* Serialized values of all the keys. */
+    int count;
+    int done;               /* Set by the loading thread, under the lock. */
+    rdbLoadKey keys[RDB_LOAD_BATCH_KEYS];
+} rdbLoadBatch;
+
+typedef struct rdbLoadPipeline {
+    int numthreads;
+    pthread_t threads[RDB_LOAD_THREADS_MAX];
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;   /* Signaled when batches are queued. */
+    pthread_cond_t done_cond;   /* Signaled when a batch is decoded. */
+    int stop;
+    list *queued;           /* Batches not yet picked by a thread. */
+    list *inflight;         /* Submitted batches, in stream order. */
+    rdbLoadBatch *cur;      /* Batch being filled by the main thread. */
+} rdbLoadPipeline;
+
+static void rdbLoadBatchFree(rdbLoadBatch *b) {
+    for (int j = 0; j < b->count; j++) {
+        sdsfree(b->keys[j].key);
+        if (b->keys[j].val) decrRefCount(b->keys[j].val);
+    }
+    sdsfree(b->frames);
+    zfree(b);
+}
 
-/* Load an RDB file from the rio stream 'rdb'. On success C_OK is returned,
- * otherwise C_ERR is returned.
- * The rdb_loading_ctx argument holds objects to which the rdb will be loaded to,
- * currently it only allow to set db object and functionLibCtx to which the data
- * will be loaded (in the future it might contains more such objects). */
-int rdbLoadRioWithLoadingCtx(rio *rdb, int rdbflags, rdbSaveInfo *rsi, rdbLoadingCtx *rdb_loading_ctx) {
-    uint64_t dbid = 0;
-    int type, rdbver;
-    siderDb *db = rdb_loading_ctx->dbarray+0;
-    char buf[1024];
-    int error;
-    long long empty_keys_skipped = 0;
+static void *rdbLoadThreadMain(void *arg) {
+    rdbLoadPipeline *p = arg;
+    rio r;
+
+    sider_set_thread_title("rdb_load");
+    pthread_mutex_lock(&p->lock);
+    while (1) {
+        while (listLength(p->queued) == 0 && !p->stop)
+            pthread_cond_wait(&p->work_cond,&p->lock);
+        if (p->stop) break;
+
+        listNode *ln = listFirst(p->queued);
+        rdbLoadBatch *b = listNodeValue(ln);
+        listDelNode(p->queued,ln);
+        pthread_mutex_unlock(&p->lock);
+
+        rioInitWithBuffer(&r,b->frames);
+        for (int j = 0; j < b->count; j++) {
+            rdbLoadKey *k = b->keys+j;
+            r.io.buffer.pos = k->offset;
+            k->val = rdbLoadObject(k->type,&r,k->key,b->db->id,&k->error);
+        }
 
-    rdb->update_cksum = rdbLoadProgressCallback;
-    rdb->max_processing_chunk = server.loading_process_events_interval_bytes;
-    if (rioRead(rdb,buf,9) == 0) goto eoferr;
-    buf[9] = '\0';
-    if (memcmp(buf,"REDIS",5) != 0) {
-        serverLog(LL_WARNING,"Wrong signature trying to load DB from file");
-        return C_ERR;
+        pthread_mutex_lock(&p->lock);
+        b->done = 1;
+        pthread_cond_signal(&p->done_cond);
     }
-    rdbver = atoi(buf+5);
-    if (rdbver < 1 || rdbver > RDB_VERSION) {
-        serverLog(LL_WARNING,"Can't handle RDB format version %d",rdbver);
-        return C_ERR;
+    pthread_mutex_unlock(&p->lock);
+    rdbReleaseThreadCompression();
+    return NULL;
+}
+
+static rdbLoadPipeline *rdbLoadPipelineCreate(int numthreads) {
+    rdbLoadPipeline *p = zcalloc(sizeof(*p));
+    pthread_mutex_init(&p->lock,NULL);
+    pthread_cond_init(&p->work_cond,NULL);
+    pthread_cond_init(&p->done_cond,NULL);
+    p->queued = listCreate();
+    p->inflight = listCreate();
+    for (int j = 0; j < numthreads; j++) {
+        if (pthread_create(&p->threads[j],NULL,rdbLoadThreadMain,p) != 0) {
+            serverLog(LL_WARNING,"Fatal: Can't initialize RDB loading threads.");
+            exit(1);
+        }
+        p->numthreads++;
     }
+    serverLog(LL_NOTICE,"Decoding the RDB values with %d threads", numthreads);
+    return p;
+}
 
-    /* Key-specific attributes, set by opcodes before the key type. */
-    long long lru_idle = -1, lfu_freq = -1, expiretime = -1, now = mstime();
-    long long lru_clock = LRU_CLOCK();
+/* Stop the loading threads and release the batches that were not added to
+ * the keyspace, if the loading failed. */
+static void rdbLoadPipelineRelease(rdbLoadPipeline *p) {
+    listNode *ln;
+    listIter li;
 
-    while(1) {
-        sds key;
-        robj *val;
+    pthread_mutex_lock(&p->lock);
+    p->stop = 1;
+    pthread_cond_broadcast(&p->work_cond);
+    pthread_mutex_unlock(&p->lock);
+    for (int j = 0; j < p->numthreads; j++)
+        pthread_join(p->threads[j],NULL);
+
+    listRewind(p->inflight,&li);
+    while ((ln = listNext(&li)) != NULL)
+        rdbLoadBatchFree(listNodeValue(ln));
+    if (p->cur) rdbLoadBatchFree(p->cur);
+    listRelease(p->queued);
+    listRelease(p->inflight);
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->work_cond);
+    pthread_cond_destroy(&p->done_cond);
+    zfree(p);
+}
 
-        /* Read type. */
-        if ((type = rdbLoadType(rdb)) == -1) goto eoferr;
+/* Hand the batch being filled to the loading threads. */
+static void rdbLoadPipelineSubmit(rdbLoadPipeline *p) {
+    if (p->cur == NULL) return;
+    listAddNodeTail(p->inflight,p->cur);
+    pthread_mutex_lock(&p->lock);
+    listAddNodeTail(p->queued,p->cur);
+    pthread_cond_signal(&p->work_cond);
+    pthread_mutex_unlock(&p->lock);
+    p->cur = NULL;
+}
 
-        /* Handle special types. */
-        if (type == RDB_OPCODE_EXPIRETIME) {
-            /* EXPIRETIME: load an expire associated with the next key
-             * to load. Note that after loading an expire we need to
-             * load the actual type, and continue. */
-            expiretime = rdbLoadTime(rdb);
-            expiretime *= 1000;
-            if (rioGetReadError(rdb)) goto eoferr;
-            continue; /* Read next opcode. */
-        } else if (type == RDB_OPCODE_EXPIRETIME_MS) {
-            /* EXPIRETIME_MS: milliseconds precision expire times introduced
-             * with RDB v3. Like EXPIRETIME but no with more precision. */
-            expiretime = rdbLoadMillisecondTime(rdb,rdbver);
-            if (rioGetReadError(rdb)) goto eoferr;
-            continue; /* Read next opcode. */
-        } else if (type == RDB_OPCODE_FREQ) {
-            /* FREQ: LFU frequency. */
-            uint8_t byte;
-            if (rioRead(rdb,&byte,1) == 0) goto eoferr;
-            lfu_freq = byte;
-            continue; /* Read next opcode. */
-        } else if (type == RDB_OPCODE_IDLE) {
-            /* IDLE: LRU idle time. */
-            uint64_t qword;
-            if ((qword = rdbLoadLen(rdb,NULL)) == RDB_LENERR) goto eoferr;
-            lru_idle = qword;
-            continue; /* Read next opcode. */
-        } else if (type == RDB_OPCODE_EOF) {
+/* Add the keys of the decoded batches to the keyspace, in stream order,
+ * waiting for the loading threads as long as more than 'max_inflight'
+ * batches are pending. Returns C_ERR if a value could not be decoded. */
+static int rdbLoadPipelineReap(rdbLoadPipeline *p, rdbLoadState *ls, unsigned long max_inflight) {
+    listNode *ln;
+
+    while ((ln = listFirst(p->inflight)) != NULL) {
+        rdbLoadBatch *b = listNodeValue(ln);
+
+        pthread_mutex_lock(&p->lock);
+        if (!b->done && listLength(p->inflight) <= max_inflight) {
+            pthread_mutex_unlock(&p->lock);
+            break;
+        }
+        while (!b->done) pthread_cond_wait(&p->done_cond,&p->lock);
+        pthread_mutex_unlock(&p->lock);
+
+        listDelNode(p->inflight,ln);
+        for (int j = 0; j < b->count; j++) {
+            rdbLoadKey *k = b->keys+j;
+            robj *val = k->val;
+            sds key = k->key;
+
+            /* Ownership of the key and the value moves to the keyspace. */
+            k->key = NULL;
+            k->val = NULL;
+            if (rdbLoadAddKey(ls,b->db,key,val,k->error,
+                              k->expiretime,k->lfu_freq,k->lru_idle) == C_ERR)
+            {
+                rdbLoadBatchFree(b);
+                return C_ERR;
+            }
+        }
+        rdbLoadBatchFree(b);
+    }
+    return C_OK;
+}
+
+/* Append 'len' bytes read from 'rdb' to 'frames'. The bytes are read in
+ * chunks, so that a corrupted length fails with a short read instead of
+ * allocating the whole length at once. */
+static int rdbFrameRead(rio *rdb, sds *frames, size_t len) {
+    while (len) {
+        size_t chunk = len < PROTO_IOBUF_LEN*16 ? len : PROTO_IOBUF_LEN*16;
+        size_t used = sdslen(*frames);
+
+        *frames = sdsMakeRoomFor(*frames,chunk);
+        if (rioRead(rdb,*frames+used,chunk) == 0) return -1;
+        sdsIncrLen(*frames,chunk);
+        len -= chunk;
+    }
+    return 0;
+}
+
+/* Like rdbLoadLenByRef() but also copies the length to 'frames'. */
+static int rdbFrameLen(rio *rdb, sds *frames, int *isencoded, uint64_t *lenptr) {
+    size_t pos = sdslen(*frames);
+    unsigned char *p;
+    int type;
+
+    if (rdbFrameRead(rdb,frames,1) == -1) return -1;
+    p = (unsigned char*)*frames+pos;
+    type = (p[0]&0xC0)>>6;
+    if (isencoded) *isencoded = (type == RDB_ENCVAL);
+    if (type == RDB_ENCVAL || type == RDB_6BITLEN) {
+        *lenptr = p[0]&0x3F;
+    } else if (type == RDB_14BITLEN) {
+        if (rdbFrameRead(rdb,frames,1) == -1) return -1;
+        p = (unsigned char*)*frames+pos;
+        *lenptr = ((p[0]&0x3F)<<8)|p[1];
+    } else if (p[0] == RDB_32BITLEN) {
+        uint32_t len;
+        if (rdbFrameRead(rdb,frames,4) == -1) return -1;
+        memcpy(&len,*frames+pos+1,4);
+        *lenptr = ntohl(len);
+    } else if (p[0] == RDB_64BITLEN) {
+        uint64_t len;
+        if (rdbFrameRead(rdb,frames,8) == -1) return -1;
+        memcpy(&len,*frames+pos+1,8);
+        *lenptr = ntohu64(len);
+    } else {
+        rdbReportCorruptRDB(
+            "Unknown length encoding %d in rdbLoadLen()",type);
+        return -1; /* Never reached. */
+    }
+    return 0;
+}
+
+/* Copy a length to 'frames', returning RDB_LENERR on error. */
+static uint64_t rdbFrameCount(rio *rdb, sds *frames) {
+    uint64_t len;
+
+    if (rdbFrameLen(rdb,frames,NULL,&len) == -1) return RDB_LENERR;
+    return len;
+}
+
+/* Copy a string, as read by rdbGenericLoadStringObject(), to 'frames'. */
+static int rdbFrameString(rio *rdb, sds *frames) {
+    int isencoded;
+    uint64_t len, clen;
+
+    if (rdbFrameLen(rdb,frames,&isencoded,&len) == -1) return -1;
+    if (!isencoded) return rdbFrameRead(rdb,frames,len);
+
+    switch(len) {
+    case RDB_ENC_INT8: return rdbFrameRead(rdb,frames,1);
+    case RDB_ENC_INT16: return rdbFrameRead(rdb,frames,2);
+    case RDB_ENC_INT32: return rdbFrameRead(rdb,frames,4);
+    case RDB_ENC_LZF:
+    case RDB_ENC_LZ4:
+    case RDB_ENC_ZSTD:
+        if ((clen = rdbFrameCount(rdb,frames)) == RDB_LENERR) return -1;
+        if (rdbFrameCount(rdb,frames) == RDB_LENERR) return -1;
+        return rdbFrameRead(rdb,frames,clen);
+    default:
+        rdbReportCorruptRDB("Unknown RDB string encoding type %llu",
+                            (unsigned long long)len);
+        return -1;
+    }
+}
+
+/* Copy a double in the format of rdbSaveDoubleValue() to 'frames'. */
+static int rdbFrameDouble(rio *rdb, sds *frames) {
+    size_t pos = sdslen(*frames);
+    unsigned char len;
+
+    if (rdbFrameRead(rdb,frames,1) == -1) return -1;
+    len = (*frames)[pos];
+    if (len >= 253) return 0; /* Infinities and NaN. */
+    return rdbFrameRead(rdb,frames,len);
+}
+
+/* Copy the consumer groups of a stream of type 'rdbtype' to 'frames'. */
+static int rdbFrameStreamGroups(rio *rdb, int rdbtype, sds *frames) {
+    uint64_t cgroups, pel_size, consumers, id;
+
+    if ((cgroups = rdbFrameCount(rdb,frames)) == RDB_LENERR) return -1;
+    while (cgroups--) {
+        /* Name, last delivered ID and, since v2, the entries read, which
+         * is UINT64_MAX when unknown. */
+        if (rdbFrameString(rdb,frames) == -1) return -1;
+        for (int j = 0; j < (rdbtype >= RDB_TYPE_STREAM_LISTPACKS_2 ? 3 : 2); j++)
+            if (rdbFrameLen(rdb,frames,NULL,&id) == -1) return -1;
+
+        /* Global PEL: raw ID, delivery time and delivery count. */
+        if ((pel_size = rdbFrameCount(rdb,frames)) == RDB_LENERR) return -1;
+        while (pel_size--) {
+            if (rdbFrameRead(rdb,frames,sizeof(streamID)+8) == -1) return -1;
+            if (rdbFrameLen(rdb,frames,NULL,&id) == -1) return -1;
+        }
+
+        /* Consumers: name, seen time, since v3 active time, and PEL IDs. */
+        if ((consumers = rdbFrameCount(rdb,frames)) == RDB_LENERR) return -1;
+        while (consumers--) {
+            if (rdbFrameString(rdb,frames) == -1) return -1;
+            if (rdbFrameRead(rdb,frames,
+                    rdbtype >= RDB_TYPE_STREAM_LISTPACKS_3 ? 16 : 8) == -1)
+                return -1;
+            if ((pel_size = rdbFrameCount(rdb,frames)) == RDB_LENERR) return -1;
+            if (rdbFrameRead(rdb,frames,pel_size*sizeof(streamID)) == -1) return -1;
+        }
+    }
+    return 0;
+}
+
+/* Copy the serialized value of type 'rdbtype' to 'frames', without decoding
+ * it, following the layout rdbLoadObject() reads. Returns -1 on error. */
+static int rdbFrameObject(rio *rdb, int rdbtype, sds *frames) {
+    uint64_t len, id;
+
+    switch(rdbtype) {
+    case RDB_TYPE_STRING:
+        return rdbFrameString(rdb,frames);
+    case RDB_TYPE_LIST:
+    case RDB_TYPE_SET:
+    case RDB_TYPE_LIST_QUICKLIST:
+        if ((len = rdbFrameCount(rdb,frames)) == RDB_LENERR) return -1;
+        while (len--)
+            if (rdbFrameString(rdb,frames) == -1) return -1;
+        return 0;
+    case RDB_TYPE_LIST_QUICKLIST_2:
+        if ((len = rdbFrameCount(rdb,frames)) == RDB_LENERR) return -1;
+        while (len--) {
+            if (rdbFrameCount(rdb,frames) == RDB_LENERR) return -1;
+            if (rdbFrameString(rdb,frames) == -1) return -1;
+        }
+        return 0;
+    case RDB_TYPE_ZSET:
+    case RDB_TYPE_ZSET_2:
+        if ((len = rdbFrameCount(rdb,frames)) == RDB_LENERR) return -1;
+        while (len--) {
+            if (rdbFrameString(rdb,frames) == -1) return -1;
+            if (rdbtype == RDB_TYPE_ZSET_2) {
+                if (rdbFrameRead(rdb,frames,sizeof(double)) == -1) return -1;
+            } else {
+                if (rdbFrameDouble(rdb,frames) == -1) return -1;
+            }
+        }
+        return 0;
+    case RDB_TYPE_HASH:
+        if ((len = rdbFrameCount(rdb,frames)) == RDB_LENERR) return -1;
+        while (len--) {
+            if (rdbFrameString(rdb,frames) == -1) return -1;
+            if (rdbFrameString(rdb,frames) == -1) return -1;
+        }
+        return 0;
+    case RDB_TYPE_HASH_ZIPMAP:
+    case RDB_TYPE_LIST_ZIPLIST:
+    case RDB_TYPE_SET_INTSET:
+    case RDB_TYPE_SET_LISTPACK:
+    case RDB_TYPE_ZSET_ZIPLIST:
+    case RDB_TYPE_ZSET_LISTPACK:
+    case RDB_TYPE_HASH_ZIPLIST:
+    case RDB_TYPE_HASH_LISTPACK:
+        return rdbFrameString(rdb,frames);
+    case RDB_TYPE_STREAM_LISTPACKS:
+    case RDB_TYPE_STREAM_LISTPACKS_2:
+    case RDB_TYPE_STREAM_LISTPACKS_3:
+        /* Master ID and listpack of every node. */
+        if ((len = rdbFrameCount(rdb,frames)) == RDB_LENERR) return -1;
+        while (len--) {
+            if (rdbFrameString(rdb,frames) == -1) return -1;
+            if (rdbFrameString(rdb,frames) == -1) return -1;
+        }
+        /* Length and last ID, plus first ID, max deleted ID and entries
+         * added since v2. IDs and counters may legitimately be UINT64_MAX. */
+        for (int j = 0; j < (rdbtype >= RDB_TYPE_STREAM_LISTPACKS_2 ? 8 : 3); j++)
+            if (rdbFrameLen(rdb,frames,NULL,&id) == -1) return -1;
+        return rdbFrameStreamGroups(rdb,rdbtype,frames);
+    default:
+        return -1;
+    }
+}
+
+/* Returns true if values of type 'rdbtype' can be decoded by the loading
+ * threads. */
+static int rdbLoadPipelineAccepts(int rdbtype) {
+    return rdbIsObjectType(rdbtype) &&
+           rdbtype != RDB_TYPE_MODULE_PRE_GA &&
+           rdbtype != RDB_TYPE_MODULE_2;
+}
+
+/* Read the value of 'key' from 'rdb' and queue it for decoding. The
+ * ownership of 'key' is taken by this function. */
+static int rdbLoadPipelineAdd(rdbLoadPipeline *p, rdbLoadState *ls, rio *rdb, siderDb *db,
+                              int rdbtype, sds key, long long expiretime,
+                              long long lfu_freq, long long lru_idle)
+{
+    if (p->cur && p->cur->db != db) rdbLoadPipelineSubmit(p);
+    if (p->cur == NULL) {
+        p->cur = zmalloc(sizeof(rdbLoadBatch));
+        p->cur->db = db;
+        p->cur->frames = sdsempty();
+        p->cur->count = 0;
+        p->cur->done = 0;
+    }
+
+    rdbLoadBatch *b = p->cur;
+    rdbLoadKey *k = b->keys+b->count++;
+    k->key = key;
+    k->type = rdbtype;
+    k->offset = sdslen(b->frames);
+    k->expiretime = expiretime;
+    k->lfu_freq = lfu_freq;
+    k->lru_idle = lru_idle;
+    k->val = NULL;
+    k->error = 0;
+    if (rdbFrameObject(rdb,rdbtype,&b->frames) == -1) return C_ERR;
+
+    if (b->count == RDB_LOAD_BATCH_KEYS || sdslen(b->frames) >= RDB_LOAD_BATCH_BYTES)
+        rdbLoadPipelineSubmit(p);
+    /* Keep a few batches per thread queued, so that the threads never wait
+     * for the main thread while it adds the keys of a batch. */
+    return rdbLoadPipelineReap(p,ls,p->numthreads*4);
+}
+
+/* Wait for all the queued values and add them to the keyspace. */
+static int rdbLoadPipelineDrain(rdbLoadPipeline *p, rdbLoadState *ls) {
+    rdbLoadPipelineSubmit(p);
+    return rdbLoadPipelineReap(p,ls,0);
+}
+
+/* Load an RDB file from the rio stream 'rdb'. On success C_OK is returned,
+ * otherwise C_ERR is returned and 'errno' is set accordingly. */
+int rdbLoadRio(rio *rdb, int rdbflags, rdbSaveInfo *rsi) {
+    functionsLibCtx* functions_lib_ctx = functionsLibCtxGetCurrent();
+    rdbLoadingCtx loading_ctx = { .dbarray = server.db, .functions_lib_ctx = functions_lib_ctx };
+    int retval = rdbLoadRioWithLoadingCtx(rdb,rdbflags,rsi,&loading_ctx);
+    return retval;
+}
+
+
+/* Load an RDB file from the rio stream 'rdb'. On success C_OK is returned,
+ * otherwise C_ERR is returned.
+ * The rdb_loading_ctx argument holds objects to which the rdb will be loaded to,
+ * currently it only allow to set db object and functionLibCtx to which the data
+ * will be loaded (in the future it might contains more such objects). */
+int rdbLoadRioWithLoadingCtx(rio *rdb, int rdbflags, rdbSaveInfo *rsi, rdbLoadingCtx *rdb_loading_ctx) {
+    uint64_t dbid = 0;
+    int type, rdbver;
+    siderDb *db = rdb_loading_ctx->dbarray+0;
+    char buf[1024];
+    int error;
+    rdbLoadPipeline *pipeline = NULL;
+
+    rdb->update_cksum = rdbLoadProgressCallback;
+    rdb->max_processing_chunk = server.loading_process_events_interval_bytes;
+    if (rioRead(rdb,buf,9) == 0) goto eoferr;
+    buf[9] = '\0';
+    if (memcmp(buf,"REDIS",5) != 0) {
+        serverLog(LL_WARNING,"Wrong signature trying to load DB from file");
+        return C_ERR;
+    }
+    rdbver = atoi(buf+5);
+    if (rdbver < 1 || rdbver > RDB_VERSION) {
+        serverLog(LL_WARNING,"Can't handle RDB format version %d",rdbver);
+        return C_ERR;
+    }
+
+    /* Key-specific attributes, set by opcodes before the key type. */
+    long long lru_idle = -1, lfu_freq = -1, expiretime = -1;
+    rdbLoadState ls = {
+        .rdbflags = rdbflags,
+        .now = mstime(),
+        .lru_clock = LRU_CLOCK(),
+        .empty_keys_skipped = 0
+    };
+
+    if (server.rdb_load_threads > 0 && !rdb_loading_ctx->header_only)
+        pipeline = rdbLoadPipelineCreate(server.rdb_load_threads);
+
+    while(1) {
+        sds key;
+        robj *val;
+
+        /* Read type. */
+        if ((type = rdbLoadType(rdb)) == -1) goto eoferr;
+
+        /* Any opcode other than the key attributes and the keys handled by
+         * the loading threads needs the queued keys to be in the keyspace
+         * first, so that they are processed in stream order. */
+        if (pipeline &&
+            type != RDB_OPCODE_EXPIRETIME && type != RDB_OPCODE_EXPIRETIME_MS &&
+            type != RDB_OPCODE_FREQ && type != RDB_OPCODE_IDLE &&
+            !rdbLoadPipelineAccepts(type))
+        {
+            if (rdbLoadPipelineDrain(pipeline,&ls) == C_ERR) goto eoferr;
+        }
+
+        /* Handle special types. */
+        if (type == RDB_OPCODE_EXPIRETIME) {
+            /* EXPIRETIME: load an expire associated with the next key
+             * to load. Note that after loading an expire we need to
+             * load the actual type, and continue. */
+            expiretime = rdbLoadTime(rdb);
+            expiretime *= 1000;
+            if (rioGetReadError(rdb)) goto eoferr;
+            continue; /* Read next opcode. */
+        } else if (type == RDB_OPCODE_EXPIRETIME_MS) {
+            /* EXPIRETIME_MS: milliseconds precision expire times introduced
+             * with RDB v3. Like EXPIRETIME but no with more precision. */
+            expiretime = rdbLoadMillisecondTime(rdb,rdbver);
+            if (rioGetReadError(rdb)) goto eoferr;
+            continue; /* Read next opcode. */
+        } else if (type == RDB_OPCODE_FREQ) {
+            /* FREQ: LFU frequency. */
+            uint8_t byte;
+            if (rioRead(rdb,&byte,1) == 0) goto eoferr;
+            lfu_freq = byte;
+            continue; /* Read next opcode. */
+        } else if (type == RDB_OPCODE_IDLE) {
+            /* IDLE: LRU idle time. */
+            uint64_t qword;
+            if ((qword = rdbLoadLen(rdb,NULL)) == RDB_LENERR) goto eoferr;
+            lru_idle = qword;
+            continue; /* Read next opcode. */
+        } else if (type == RDB_OPCODE_EOF) {
             /* EOF: End of file, exit the main loop. */
             break;
         } else if (type == RDB_OPCODE_SELECTDB) {
+            /* The keys start here, they are loaded later if the caller
+             * only wants the data before them. */
+            if (rdb_loading_ctx->header_only) return C_OK;
+
             /* SELECTDB: Select the specified database. */
             if ((dbid = rdbLoadLen(rdb,NULL)) == RDB_LENERR) goto eoferr;
             if (dbid >= (unsigned)server.dbnum) {
@@ -3103,8 +5234,13 @@ int rdbLoadRioWithLoadingCtx(rio *rdb, int rdbflags, rdbSaveInfo *rsi, rdbLoadin
                 goto eoferr;
             if ((expires_size = rdbLoadLen(rdb,NULL)) == RDB_LENERR)
                 goto eoferr;
-            dictExpand(db->dict,db_size);
-            dictExpand(db->expires,expires_size);
+            dbExpand(db,db_size,DB_MAIN,0);
+            dbExpand(db,expires_size,DB_EXPIRES,0);
+            continue; /* Read next opcode. */
+        } else if (type == RDB_OPCODE_ZSTD_DICT) {
+            /* ZSTD_DICT: dictionary of the values compressed with ZSTD
+             * that follow. */
+            if (rdbLoadZstdDict(rdb,NULL) == -1) goto eoferr;
             continue; /* Read next opcode. */
         } else if (type == RDB_OPCODE_AUX) {
             /* AUX: generic string-string fields. Use to add state to RDB
@@ -3158,6 +5294,8 @@ int rdbLoadRioWithLoadingCtx(rio *rdb, int rdbflags, rdbSaveInfo *rsi, rdbLoadin
                 if (isbase) serverLog(LL_NOTICE, "RDB is base AOF");
             } else if (!strcasecmp(auxkey->ptr,"sider-bits")) {
                 /* Just ignored. */
+            } else if (!strcasecmp(auxkey->ptr,"index-id")) {
+                /* Used by rdbLoadOnDemand(), see rdbIndexIdOf(). */
             } else {
                 /* We ignore fields we don't understand, as by AUX field
                  * contract. */
@@ -3237,87 +5375,19 @@ int rdbLoadRioWithLoadingCtx(rio *rdb, int rdbflags, rdbSaveInfo *rsi, rdbLoadin
         /* Read key */
         if ((key = rdbGenericLoadStringObject(rdb,RDB_LOAD_SDS,NULL)) == NULL)
             goto eoferr;
-        /* Read value */
-        val = rdbLoadObject(type,rdb,key,db->id,&error);
-
-        /* Check if the key already expired. This function is used when loading
-         * an RDB file from disk, either at startup, or when an RDB was
-         * received from the master. In the latter case, the master is
-         * responsible for key expiry. If we would expire keys here, the
-         * snapshot taken by the master may not be reflected on the slave.
-         * Similarly, if the base AOF is RDB format, we want to load all 
-         * the keys they are, since the log of operations in the incr AOF 
-         * is assumed to work in the exact keyspace state. */
-        if (val == NULL) {
-            /* Since we used to have bug that could lead to empty keys
-             * (See #8453), we rather not fail when empty key is encountered
-             * in an RDB file, instead we will silently discard it and
-             * continue loading. */
-            if (error == RDB_LOAD_ERR_EMPTY_KEY) {
-                if(empty_keys_skipped++ < 10)
-                    serverLog(LL_NOTICE, "rdbLoadObject skipping empty key: %s", key);
-                sdsfree(key);
-            } else {
-                sdsfree(key);
+        if (pipeline && rdbLoadPipelineAccepts(type)) {
+            /* Read the value and let the loading threads decode it. */
+            if (rdbLoadPipelineAdd(pipeline,&ls,rdb,db,type,key,
+                                   expiretime,lfu_freq,lru_idle) == C_ERR)
                 goto eoferr;
-            }
-        } else if (iAmMaster() &&
-            !(rdbflags&RDBFLAGS_AOF_PREAMBLE) &&
-            expiretime != -1 && expiretime < now)
-        {
-            if (rdbflags & RDBFLAGS_FEED_REPL) {
-                /* Caller should have created replication backlog,
-                 * and now this path only works when rebooting,
-                 * so we don't have replicas yet. */
-                serverAssert(server.repl_backlog != NULL && listLength(server.slaves) == 0);
-                robj keyobj;
-                initStaticStringObject(keyobj,key);
-                robj *argv[2];
-                argv[0] = server.lazyfree_lazy_expire ? shared.unlink : shared.del;
-                argv[1] = &keyobj;
-                replicationFeedSlaves(server.slaves,dbid,argv,2);
-            }
-            sdsfree(key);
-            decrRefCount(val);
-            server.rdb_last_load_keys_expired++;
         } else {
-            robj keyobj;
-            initStaticStringObject(keyobj,key);
-
-            /* Add the new object in the hash table */
-            int added = dbAddRDBLoad(db,key,val);
-            server.rdb_last_load_keys_loaded++;
-            if (!added) {
-                if (rdbflags & RDBFLAGS_ALLOW_DUP) {
-                    /* This flag is useful for DEBUG RELOAD special modes.
-                     * When it's set we allow new keys to replace the current
-                     * keys with the same name. */
-                    dbSyncDelete(db,&keyobj);
-                    dbAddRDBLoad(db,key,val);
-                } else {
-                    serverLog(LL_WARNING,
-                        "RDB has duplicated key '%s' in DB %d",key,db->id);
-                    serverPanic("Duplicated key found in RDB file");
-                }
-            }
-
-            /* Set the expire time if needed */
-            if (expiretime != -1) {
-                setExpire(NULL,db,&keyobj,expiretime);
-            }
-
-            /* Set usage information (for eviction). */
-            objectSetLRUOrLFU(val,lfu_freq,lru_idle,lru_clock,1000);
-
-            /* call key space notification on key loaded for modules only */
-            moduleNotifyKeyspaceEvent(NOTIFY_LOADED, "loaded", &keyobj, db->id);
+            /* Read value */
+            val = rdbLoadObject(type,rdb,key,db->id,&error);
+            if (rdbLoadAddKey(&ls,db,key,val,error,
+                              expiretime,lfu_freq,lru_idle) == C_ERR)
+                goto eoferr;
         }
 
-        /* Loading the database more slowly is useful in order to test
-         * certain edge cases. */
-        if (server.key_load_delay)
-            debugDelay(server.key_load_delay);
-
         /* Reset the state that is key-specified and is populated by
          * opcodes before the key, so that we start from scratch again. */
         expiretime = -1;
@@ -3339,15 +5409,16 @@ int rdbLoadRioWithLoadingCtx(rio *rdb, int rdbflags, rdbSaveInfo *rsi, rdbLoadin
                         (unsigned long long)expected,
                         (unsigned long long)cksum);
                 rdbReportCorruptRDB("RDB CRC error");
-                return C_ERR;
+                goto err;
             }
         }
     }
 
-    if (empty_keys_skipped) {
+    if (pipeline) rdbLoadPipelineRelease(pipeline);
+    if (ls.empty_keys_skipped) {
         serverLog(LL_NOTICE,
             "Done loading RDB, keys loaded: %lld, keys expired: %lld, empty keys skipped: %lld.",
-                server.rdb_last_load_keys_loaded, server.rdb_last_load_keys_expired, empty_keys_skipped);
+                server.rdb_last_load_keys_loaded, server.rdb_last_load_keys_expired, ls.empty_keys_skipped);
     } else {
         serverLog(LL_NOTICE,
             "Done loading RDB, keys loaded: %lld, keys expired: %lld.",
@@ -3363,6 +5434,8 @@ eoferr:
     serverLog(LL_WARNING,
         "Short read or OOM loading DB. Unrecoverable error, aborting now.");
     rdbReportReadError("Unexpected EOF reading RDB file");
+err:
+    if (pipeline) rdbLoadPipelineRelease(pipeline);
     return C_ERR;
 }
 
@@ -3407,6 +5480,874 @@ int rdbLoad(char *filename, rdbSaveInfo *rsi, int rdbflags) {
     return (retval==C_OK) ? RDB_OK : RDB_FAILED;
 }
 
+/* Parallel loading of the multi-part snapshots. The first part is loaded by
+ * the main thread with rdbLoadRio(), while one thread for each other part
+ * reads and decodes its keys in batches, like the threads of the loading
+ * pipeline. The main thread adds them to the keyspace once the first part,
+ * that holds all the data that is not a key, is loaded. */
+typedef struct rdbPartReader {
+    int index;
+    rio rdb;
+    size_t reported_bytes;  /* Bytes already added to 'loaded_bytes'. */
+    pthread_t thread;
+    struct rdbPartsLoad *l;
+} rdbPartReader;
+
+typedef struct rdbPartsLoad {
+    pthread_mutex_t lock;
+    pthread_cond_t ready_cond;  /* Signaled when a batch is ready, or a reader exits. */
+    pthread_cond_t space_cond;  /* Signaled when a batch is taken, or on stop. */
+    list *ready;                /* Decoded batches, not yet in the keyspace. */
+    int running;                /* Readers not done yet. */
+    int failed;
+    int stop;
+    siderAtomic long long loaded_bytes;
+    rdbPartReader readers[RDB_SAVE_PARTS_MAX];
+} rdbPartsLoad;
+
+/* Hand a decoded batch to the main thread, waiting if too many are already
+ * pending. Returns C_ERR if the loading is being stopped. */
+static int rdbPartReaderSubmit(rdbPartReader *r, rdbLoadBatch *b) {
+    rdbPartsLoad *l = r->l;
+
+    atomicIncr(l->loaded_bytes,r->rdb.processed_bytes-r->reported_bytes);
+    r->reported_bytes = r->rdb.processed_bytes;
+    pthread_mutex_lock(&l->lock);
+    while (listLength(l->ready) >= RDB_SAVE_PARTS_MAX*4 && !l->stop)
+        pthread_cond_wait(&l->space_cond,&l->lock);
+    if (l->stop) {
+        pthread_mutex_unlock(&l->lock);
+        rdbLoadBatchFree(b);
+        return C_ERR;
+    }
+    b->done = 1;
+    listAddNodeTail(l->ready,b);
+    pthread_cond_signal(&l->ready_cond);
+    pthread_mutex_unlock(&l->lock);
+    return C_OK;
+}
+
+/* Read and decode the keys of a part other than the first one. */
+static int rdbPartReaderLoad(rdbPartReader *r) {
+    rio *rdb = &r->rdb;
+    siderDb *db = server.db;
+    rdbLoadBatch *b = NULL;
+    long long lru_idle = -1, lfu_freq = -1, expiretime = -1;
+    uint64_t dbid;
+    char buf[10];
+    int type, rdbver;
+
+    if (rioRead(rdb,buf,9) == 0) goto eoferr;
+    buf[9] = '\0';
+    rdbver = atoi(buf+5);
+    if (memcmp(buf,"REDIS",5) != 0 || rdbver < 1 || rdbver > RDB_VERSION) {
+        serverLog(LL_WARNING,"Wrong signature or version of the RDB part %d", r->index);
+        return C_ERR;
+    }
+
+    while (1) {
+        if ((type = rdbLoadType(rdb)) == -1) goto eoferr;
+
+        if (type == RDB_OPCODE_EXPIRETIME) {
+            expiretime = rdbLoadTime(rdb);
+            expiretime *= 1000;
+            if (rioGetReadError(rdb)) goto eoferr;
+            continue;
+        } else if (type == RDB_OPCODE_EXPIRETIME_MS) {
+            expiretime = rdbLoadMillisecondTime(rdb,rdbver);
+            if (rioGetReadError(rdb)) goto eoferr;
+            continue;
+        } else if (type == RDB_OPCODE_FREQ) {
+            uint8_t byte;
+            if (rioRead(rdb,&byte,1) == 0) goto eoferr;
+            lfu_freq = byte;
+            continue;
+        } else if (type == RDB_OPCODE_IDLE) {
+            uint64_t qword;
+            if ((qword = rdbLoadLen(rdb,NULL)) == RDB_LENERR) goto eoferr;
+            lru_idle = qword;
+            continue;
+        } else if (type == RDB_OPCODE_EOF) {
+            break;
+        } else if (type == RDB_OPCODE_SELECTDB) {
+            if ((dbid = rdbLoadLen(rdb,NULL)) == RDB_LENERR) goto eoferr;
+            if (dbid >= (unsigned)server.dbnum) {
+                serverLog(LL_WARNING,"The RDB part %d uses the DB %llu, out of range",
+                    r->index, (unsigned long long)dbid);
+                goto err;
+            }
+            db = server.db+dbid;
+            continue;
+        } else if (type == RDB_OPCODE_RESIZEDB) {
+            /* The size hint of the whole DB is in the first part. */
+            if (rdbLoadLen(rdb,NULL) == RDB_LENERR) goto eoferr;
+            if (rdbLoadLen(rdb,NULL) == RDB_LENERR) goto eoferr;
+            continue;
+        } else if (type == RDB_OPCODE_ZSTD_DICT) {
+            if (rdbLoadZstdDict(rdb,NULL) == -1) goto eoferr;
+            continue;
+        } else if (type == RDB_OPCODE_AUX) {
+            /* The AUX fields of the snapshot are in the first part. */
+            robj *auxkey, *auxval;
+            if ((auxkey = rdbLoadStringObject(rdb)) == NULL) goto eoferr;
+            auxval = rdbLoadStringObject(rdb);
+            decrRefCount(auxkey);
+            if (auxval == NULL) goto eoferr;
+            decrRefCount(auxval);
+            continue;
+        } else if (!rdbLoadPipelineAccepts(type)) {
+            serverLog(LL_WARNING,"Unexpected type %d in the RDB part %d", type, r->index);
+            goto err;
+        }
+
+        if (b && (b->db != db || b->count == RDB_LOAD_BATCH_KEYS)) {
+            int retval = rdbPartReaderSubmit(r,b);
+            b = NULL;
+            if (retval == C_ERR) goto err;
+        }
+        if (b == NULL) {
+            b = zmalloc(sizeof(rdbLoadBatch));
+            b->db = db;
+            b->frames = NULL;
+            b->count = 0;
+            b->done = 0;
+        }
+
+        sds key;
+        if ((key = rdbGenericLoadStringObject(rdb,RDB_LOAD_SDS,NULL)) == NULL)
+            goto eoferr;
+        rdbLoadKey *k = b->keys+b->count++;
+        k->key = key;
+        k->type = type;
+        k->offset = 0;
+        k->expiretime = expiretime;
+        k->lfu_freq = lfu_freq;
+        k->lru_idle = lru_idle;
+        k->val = rdbLoadObject(type,rdb,key,db->id,&k->error);
+        if (k->val == NULL && k->error != RDB_LOAD_ERR_EMPTY_KEY) goto eoferr;
+
+        expiretime = -1;
+        lfu_freq = -1;
+        lru_idle = -1;
+    }
+
+    if (rdbver >= 5) {
+        uint64_t cksum, expected = rdb->cksum;
+
+        if (rioRead(rdb,&cksum,8) == 0) goto eoferr;
+        memrev64ifbe(&cksum);
+        if (server.rdb_checksum && !server.skip_checksum_validation &&
+            cksum != 0 && cksum != expected)
+        {
+            serverLog(LL_WARNING,"Wrong RDB checksum of the RDB part %d expected: (%llx) but "
+                "got (%llx).", r->index, (unsigned long long)expected,
+                (unsigned long long)cksum);
+            goto err;
+        }
+    }
+    if (b) return rdbPartReaderSubmit(r,b);
+    return C_OK;
+
+eoferr:
+    serverLog(LL_WARNING,"Short read or corrupted value loading the RDB part %d", r->index);
+err:
+    if (b) rdbLoadBatchFree(b);
+    return C_ERR;
+}
+
+static void *rdbPartReaderThreadMain(void *arg) {
+    rdbPartReader *r = arg;
+    rdbPartsLoad *l = r->l;
+
+    sider_set_thread_title("rdb_load_part");
+    int retval = rdbPartReaderLoad(r);
+    rdbReleaseThreadCompression();
+    pthread_mutex_lock(&l->lock);
+    if (retval == C_ERR) l->failed = 1;
+    l->running--;
+    pthread_cond_signal(&l->ready_cond);
+    pthread_mutex_unlock(&l->lock);
+    return NULL;
+}
+
+/* Refresh the loading progress and process events, like
+ * rdbLoadProgressCallback() does while reading a single file. */
+static void rdbPartsLoadProgress(rdbPartsLoad *l, off_t base) {
+    long long loaded;
+
+    atomicGet(l->loaded_bytes,loaded);
+    loadingAbsProgress(base+loaded);
+    processEventsWhileBlocked();
+    processModuleLoadingProgressEvent(0);
+}
+
+/* Add the keys decoded by the readers to the keyspace as they are ready.
+ * 'base' is the size of the first part, for the loading progress. */
+static int rdbPartsLoadKeys(rdbPartsLoad *l, off_t base, int rdbflags) {
+    rdbLoadState ls = {
+        .rdbflags = rdbflags,
+        .now = mstime(),
+        .lru_clock = LRU_CLOCK(),
+        .empty_keys_skipped = 0
+    };
+    long long interval = server.loading_process_events_interval_bytes;
+    long long loaded, last_progress = 0;
+    listNode *ln;
+
+    pthread_mutex_lock(&l->lock);
+    while (!l->failed) {
+        if ((ln = listFirst(l->ready)) == NULL) {
+            if (l->running == 0) break;
+
+            /* Keep serving the clients while the readers are busy. */
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME,&deadline);
+            deadline.tv_nsec += 100*1000*1000;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+            if (pthread_cond_timedwait(&l->ready_cond,&l->lock,&deadline) == ETIMEDOUT) {
+                pthread_mutex_unlock(&l->lock);
+                rdbPartsLoadProgress(l,base);
+                pthread_mutex_lock(&l->lock);
+            }
+            continue;
+        }
+
+        rdbLoadBatch *b = listNodeValue(ln);
+        listDelNode(l->ready,ln);
+        pthread_cond_signal(&l->space_cond);
+        pthread_mutex_unlock(&l->lock);
+
+        for (int j = 0; j < b->count; j++) {
+            rdbLoadKey *k = b->keys+j;
+            robj *val = k->val;
+            sds key = k->key;
+
+            /* Ownership of the key and the value moves to the keyspace. */
+            k->key = NULL;
+            k->val = NULL;
+            if (rdbLoadAddKey(&ls,b->db,key,val,k->error,
+                              k->expiretime,k->lfu_freq,k->lru_idle) == C_ERR)
+            {
+                rdbLoadBatchFree(b);
+                return C_ERR;
+            }
+        }
+        rdbLoadBatchFree(b);
+
+        atomicGet(l->loaded_bytes,loaded);
+        if (interval && loaded/interval > last_progress/interval) {
+            rdbPartsLoadProgress(l,base);
+            last_progress = loaded;
+        }
+        pthread_mutex_lock(&l->lock);
+    }
+    int failed = l->failed;
+    pthread_mutex_unlock(&l->lock);
+    return failed ? C_ERR : C_OK;
+}
+
+/* Like rdbLoad(), for the multi-part snapshot of 'filename'. Returns
+ * RDB_NOT_EXIST if there is no manifest, so that the caller can load
+ * 'filename' itself. */
+int rdbLoadParts(char *filename, rdbSaveInfo *rsi, int rdbflags) {
+    FILE *fp[RDB_SAVE_PARTS_MAX];
+    struct stat sb;
+    size_t size = 0;
+    long long seq;
+    const char *err;
+    listIter li;
+    listNode *ln;
+    int j, numparts, retval = C_ERR;
+
+    list *parts = rdbLoadManifest(filename,&seq,&err);
+    if (parts == NULL && err == NULL) return RDB_NOT_EXIST;
+    if (parts == NULL || listLength(parts) > RDB_SAVE_PARTS_MAX) {
+        serverLog(LL_WARNING,"Fatal error: can't load the RDB manifest of %s: %s",
+            filename, err ? err : "too many parts");
+        if (parts) listRelease(parts);
+        return RDB_FAILED;
+    }
+
+    numparts = 0;
+    listRewind(parts,&li);
+    while ((ln = listNext(&li)) != NULL) {
+        char *name = listNodeValue(ln);
+        if ((fp[numparts] = fopen(name,"r")) == NULL) {
+            serverLog(LL_WARNING,"Fatal error: can't open the RDB part %s for reading: %s",
+                name, strerror(errno));
+            for (j = 0; j < numparts; j++) fclose(fp[j]);
+            listRelease(parts);
+            return RDB_FAILED;
+        }
+        if (fstat(fileno(fp[numparts]),&sb) == 0) size += sb.st_size;
+        numparts++;
+    }
+
+    serverLog(LL_NOTICE,"Loading the RDB snapshot from %d parts", numparts);
+    startLoadingFile(size,NULL,rdbflags);
+
+    rdbPartsLoad *l = zcalloc(sizeof(*l));
+    pthread_mutex_init(&l->lock,NULL);
+    pthread_cond_init(&l->ready_cond,NULL);
+    pthread_cond_init(&l->space_cond,NULL);
+    l->ready = listCreate();
+    for (j = 1; j < numparts; j++) {
+        rdbPartReader *r = l->readers+j;
+        r->index = j;
+        r->l = l;
+        rioInitWithFile(&r->rdb,fp[j]);
+        if (server.rdb_checksum)
+            r->rdb.update_cksum = rioGenericUpdateChecksum;
+        if (pthread_create(&r->thread,NULL,rdbPartReaderThreadMain,r) != 0) {
+            serverLog(LL_WARNING,"Fatal: Can't initialize RDB loading threads.");
+            exit(1);
+        }
+        l->running++;
+    }
+
+    rio rdb;
+    rioInitWithFile(&rdb,fp[0]);
+    if (rdbLoadRio(&rdb,rdbflags,rsi) == C_OK &&
+        rdbPartsLoadKeys(l,rdb.processed_bytes,rdbflags) == C_OK)
+    {
+        retval = C_OK;
+    }
+
+    /* Stop the readers that are still running if the loading failed. */
+    pthread_mutex_lock(&l->lock);
+    l->stop = 1;
+    pthread_cond_broadcast(&l->space_cond);
+    pthread_mutex_unlock(&l->lock);
+    for (j = 1; j < numparts; j++) pthread_join(l->readers[j].thread,NULL);
+    listRewind(l->ready,&li);
+    while ((ln = listNext(&li)) != NULL) rdbLoadBatchFree(listNodeValue(ln));
+    listRelease(l->ready);
+    pthread_mutex_destroy(&l->lock);
+    pthread_cond_destroy(&l->ready_cond);
+    pthread_cond_destroy(&l->space_cond);
+    zfree(l);
+
+    for (j = 0; j < numparts; j++) fclose(fp[j]);
+    stopLoading(retval == C_OK);
+    if (retval == C_OK) {
+        serverLog(LL_NOTICE,
+            "Done loading the RDB parts, keys loaded: %lld, keys expired: %lld.",
+                server.rdb_last_load_keys_loaded, server.rdb_last_load_keys_expired);
+        /* Reclaim the cache backed by the parts */
+        if (!(rdbflags & RDBFLAGS_KEEP_CACHE)) {
+            listRewind(parts,&li);
+            while ((ln = listNext(&li)) != NULL) {
+                int rdb_fd = open(listNodeValue(ln),O_RDONLY);
+                if (rdb_fd > 0) bioCreateCloseJob(rdb_fd,0,1);
+            }
+        }
+    }
+    listRelease(parts);
+    return (retval == C_OK) ? RDB_OK : RDB_FAILED;
+}
+
+/* -----------------------------------------------------------------------------
+ * On-demand loading
+ *
+ * When rdb-load-on-demand is enabled, SAVE and BGSAVE write next to the RDB an
+ * index of its keys, <dbfilename>.idx, with the offset and the length of the
+ * record of every key in the file. At startup, if the index matches the RDB,
+ * only the data before the keys (aux fields, ZSTD dictionaries, module data,
+ * functions) is loaded: the RDB and the index are mapped in memory, and the
+ * server starts serving the clients right away.
+ *
+ * A key is loaded from the mapped file the first time it's looked up, while
+ * the keys not accessed yet are loaded a few at a time at every iteration of
+ * the event loop, in the order of the file. A key created or deleted before
+ * it's loaded is just marked as loaded. The commands that need the whole
+ * keyspace (KEYS, SCAN, DBSIZE, ...) are refused with -LOADING until this
+ * background pass is done, and what replaces or saves the whole keyspace
+ * (FLUSHALL, SWAPDB, SAVE, a fork, ...) loads or discards the keys left first.
+ *
+ * The index is made of a header, the entries of the keys in the order of the
+ * file, and a hash table of the entries (the position of the entry plus one,
+ * zero for the empty slots) with linear probing on the CRC64 of the key name.
+ * Its id, random at every save, is stored in the RDB as the "index-id" aux
+ * field, so that an index is never used with an RDB it wasn't created for.
+ * Both are in the byte order of the host that saved them.
+ * -------------------------------------------------------------------------- */
+
+#define RDB_INDEX_MAGIC "SIDERIDX"
+#define RDB_INDEX_VERSION 1
+
+typedef struct rdbIndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t dbnum;         /* Highest DB id of the keys, plus one. */
+    uint64_t id;            /* The "index-id" aux field of the RDB. */
+    uint64_t rdb_size;      /* Size of the RDB file. */
+    uint64_t keys;          /* Number of entries. */
+    uint64_t slots;         /* Size of the hash table, a power of two. */
+} rdbIndexHeader;
+
+typedef struct rdbIndexEntry {
+    uint64_t offset;        /* Start of the record of the key in the RDB. */
+    uint64_t len;           /* Length of the record, key attributes included. */
+    uint64_t hash;          /* crc64() of the key name. */
+    uint32_t dbid;
+    uint32_t reserved;
+} rdbIndexEntry;
+
+/* The index built by rdbSave() while saving the keys. */
+static struct {
+    int active;             /* rdbIndexCreate() was called. */
+    rio *rdb;               /* The RDB the keys are saved to. */
+    uint64_t id;
+    int invalid;            /* The RDB has data the index can't describe. */
+    uint32_t dbnum;
+    rdbIndexEntry *entries;
+    uint64_t count, alloc;
+} rdb_index;
+
+static void rdbIndexCreate(void) {
+    rdbIndexRelease();
+    rdb_index.active = 1;
+    do {
+        getRandomBytes((unsigned char*)&rdb_index.id,sizeof(rdb_index.id));
+        rdb_index.id &= INT64_MAX; /* Saved as a long long aux field. */
+    } while (rdb_index.id == 0);
+}
+
+static void rdbIndexRelease(void) {
+    zfree(rdb_index.entries);
+    memset(&rdb_index,0,sizeof(rdb_index));
+}
+
+/* Called by rdbSaveRio() before the keys: the first RDB saved after
+ * rdbIndexCreate() is the one indexed. Returns -1 on write errors. */
+static int rdbIndexStart(rio *rdb) {
+    if (!rdb_index.active || rdb_index.rdb != NULL) return 0;
+    rdb_index.rdb = rdb;
+    return rdbSaveAuxFieldStrInt(rdb,"index-id",(long long)rdb_index.id) == -1 ? -1 : 0;
+}
+
+static void rdbIndexAddKey(rio *rdb, int dbid, sds key, size_t offset, size_t len) {
+    if (rdb_index.rdb != rdb || rdb_index.invalid) return;
+    if (rdb_index.count == UINT32_MAX-1) {
+        rdb_index.invalid = 1; /* The hash table holds 32 bit positions. */
+        return;
+    }
+    if (rdb_index.count == rdb_index.alloc) {
+        rdb_index.alloc = rdb_index.alloc ? rdb_index.alloc*2 : 1024;
+        rdb_index.entries = zrealloc(rdb_index.entries,
+                                     sizeof(rdbIndexEntry)*rdb_index.alloc);
+    }
+    rdbIndexEntry *e = rdb_index.entries+rdb_index.count++;
+    e->offset = offset;
+    e->len = len;
+    e->hash = crc64(0,(unsigned char*)key,sdslen(key));
+    e->dbid = dbid;
+    e->reserved = 0;
+    if ((uint32_t)dbid >= rdb_index.dbnum) rdb_index.dbnum = dbid+1;
+}
+
+static void rdbIndexInvalidate(rio *rdb) {
+    if (rdb_index.rdb == rdb) rdb_index.invalid = 1;
+}
+
+/* Write the index of the RDB just saved as 'filename' and release it. If there
+ * is no valid index the one of the previous RDB, if any, is removed. Failing
+ * to save the index is not an error, the RDB is just loaded as usual. */
+static void rdbIndexSave(const char *filename) {
+    char tmpfile[256];
+    sds idxfile = sdscatfmt(sdsempty(),"%s%s",filename,RDB_INDEX_SUFFIX);
+    uint32_t *table = NULL;
+    FILE *fp = NULL;
+    struct stat sb;
+
+    snprintf(tmpfile,sizeof(tmpfile),"temp-%d%s",(int)getpid(),RDB_INDEX_SUFFIX);
+    if (!rdb_index.active || rdb_index.rdb == NULL || rdb_index.invalid) {
+        unlink(idxfile);
+        goto cleanup;
+    }
+    if (stat(filename,&sb) == -1) goto werr;
+
+    rdbIndexHeader hdr = {
+        .version = RDB_INDEX_VERSION,
+        .dbnum = rdb_index.dbnum,
+        .id = rdb_index.id,
+        .rdb_size = sb.st_size,
+        .keys = rdb_index.count,
+        .slots = 16
+    };
+    memcpy(hdr.magic,RDB_INDEX_MAGIC,sizeof(hdr.magic));
+    while (hdr.slots < hdr.keys*2) hdr.slots <<= 1;
+    table = zcalloc(sizeof(uint32_t)*hdr.slots);
+    for (uint64_t j = 0; j < hdr.keys; j++) {
+        uint64_t idx = rdb_index.entries[j].hash & (hdr.slots-1);
+        while (table[idx]) idx = (idx+1) & (hdr.slots-1);
+        table[idx] = j+1;
+    }
+
+    if ((fp = fopen(tmpfile,"w")) == NULL ||
+        fwrite(&hdr,sizeof(hdr),1,fp) != 1 ||
+        (hdr.keys && fwrite(rdb_index.entries,sizeof(rdbIndexEntry)*hdr.keys,1,fp) != 1) ||
+        fwrite(table,sizeof(uint32_t)*hdr.slots,1,fp) != 1 ||
+        fflush(fp) == EOF || fsync(fileno(fp)) == -1)
+    {
+        goto werr;
+    }
+    fclose(fp);
+    fp = NULL;
+    if (rename(tmpfile,idxfile) == -1 || fsyncFileDir(idxfile) != 0) goto werr;
+    goto cleanup;
+
+werr:
+    serverLog(LL_WARNING,"Can't save the index of the RDB keys %s: %s",
+        idxfile, strerror(errno));
+    if (fp) fclose(fp);
+    unlink(tmpfile);
+    unlink(idxfile);
+cleanup:
+    zfree(table);
+    sdsfree(idxfile);
+    rdbIndexRelease();
+}
+
+/* Returns the "index-id" aux field of the RDB mapped at 'rdb', or 0 if the
+ * aux fields at the start of the file don't have it. */
+static uint64_t rdbIndexIdOf(const unsigned char *rdb, size_t size) {
+    uint64_t id = 0;
+    rio r;
+
+    if (size < 9 || memcmp(rdb,"REDIS",5) != 0) return 0;
+    rioInitWithMemory(&r,rdb+9,size-9);
+    while (id == 0 && rdbLoadType(&r) == RDB_OPCODE_AUX) {
+        sds auxkey, auxval;
+        if ((auxkey = rdbGenericLoadStringObject(&r,RDB_LOAD_SDS,NULL)) == NULL) break;
+        if ((auxval = rdbGenericLoadStringObject(&r,RDB_LOAD_SDS,NULL)) == NULL) {
+            sdsfree(auxkey);
+            break;
+        }
+        if (!strcasecmp(auxkey,"index-id")) id = strtoull(auxval,NULL,10);
+        sdsfree(auxkey);
+        sdsfree(auxval);
+    }
+    return id;
+}
+
+/* The RDB loaded on demand. */
+static struct {
+    unsigned char *rdb;     /* The RDB file mapped in memory. */
+    size_t rdb_size;
+    void *index;            /* The index mapped in memory. */
+    size_t index_size;
+    rdbIndexEntry *entries;
+    uint32_t *table;
+    uint64_t keys, mask;
+    unsigned char *loaded;  /* Bitmap of the entries loaded or discarded. */
+    uint64_t left;          /* Entries not loaded yet. */
+    uint64_t cursor;        /* Next entry of the background pass. */
+    int rdbver;
+    sds filename;
+} rdb_ondemand;
+
+static void rdbOnDemandRelease(void) {
+    if (rdb_ondemand.rdb) munmap(rdb_ondemand.rdb,rdb_ondemand.rdb_size);
+    if (rdb_ondemand.index) munmap(rdb_ondemand.index,rdb_ondemand.index_size);
+    zfree(rdb_ondemand.loaded);
+    sdsfree(rdb_ondemand.filename);
+    memset(&rdb_ondemand,0,sizeof(rdb_ondemand));
+    server.loading_on_demand = 0;
+    /* Unless a new RDB is being loaded, that may have its own dictionaries. */
+    if (!server.loading) rdbReleaseZstdDicts();
+}
+
+static inline int rdbOnDemandIsLoaded(uint64_t j) {
+    return rdb_ondemand.loaded[j>>3] & (1<<(j&7));
+}
+
+static void rdbOnDemandSetLoaded(uint64_t j) {
+    rdb_ondemand.loaded[j>>3] |= 1<<(j&7);
+    rdb_ondemand.left--;
+}
+
+static void rdbOnDemandFinish(void) {
+    serverLog(LL_NOTICE,
+        "Done loading the RDB on demand, keys loaded: %lld.",
+        server.rdb_last_load_keys_loaded);
+    rdbOnDemandRelease();
+}
+
+/* Reads the attributes, the type and the name of the key of the entry 'j',
+ * leaving 'r' at the start of the value. Returns the name of the key, or NULL
+ * if the record is invalid. */
+static sds rdbOnDemandReadKey(uint64_t j, rio *r, int *type, long long *expiretime,
+                              long long *lru_idle, long long *lfu_freq)
+{
+    rdbIndexEntry *e = rdb_ondemand.entries+j;
+
+    if (e->offset > rdb_ondemand.rdb_size || e->len > rdb_ondemand.rdb_size-e->offset)
+        return NULL;
+    rioInitWithMemory(r,rdb_ondemand.rdb+e->offset,e->len);
+    while (1) {
+        if ((*type = rdbLoadType(r)) == -1) return NULL;
+        if (*type == RDB_OPCODE_EXPIRETIME_MS) {
+            *expiretime = rdbLoadMillisecondTime(r,rdb_ondemand.rdbver);
+            if (rioGetReadError(r)) return NULL;
+        } else if (*type == RDB_OPCODE_IDLE) {
+            uint64_t qword;
+            if ((qword = rdbLoadLen(r,NULL)) == RDB_LENERR) return NULL;
+            *lru_idle = qword;
+        } else if (*type == RDB_OPCODE_FREQ) {
+            uint8_t byte;
+            if (rioRead(r,&byte,1) == 0) return NULL;
+            *lfu_freq = byte;
+        } else {
+            break;
+        }
+    }
+    if (!rdbIsObjectType(*type)) return NULL;
+    return rdbGenericLoadStringObject(r,RDB_LOAD_SDS,NULL);
+}
+
+/* Returns the entry of 'key' in 'db' not loaded yet, or -1. */
+static int64_t rdbOnDemandFind(siderDb *db, sds key) {
+    uint64_t hash = crc64(0,(unsigned char*)key,sdslen(key));
+    uint64_t idx = hash & rdb_ondemand.mask;
+    uint32_t pos;
+
+    while ((pos = rdb_ondemand.table[idx]) != 0) {
+        uint64_t j = pos-1;
+        rdbIndexEntry *e = rdb_ondemand.entries+j;
+        if (j < rdb_ondemand.keys && e->hash == hash && e->dbid == (uint32_t)db->id &&
+            !rdbOnDemandIsLoaded(j))
+        {
+            long long expiretime = -1, lru_idle = -1, lfu_freq = -1;
+            int type;
+            rio r;
+            sds name = rdbOnDemandReadKey(j,&r,&type,&expiretime,&lru_idle,&lfu_freq);
+            int match = name && sdscmp(name,key) == 0;
+            sdsfree(name);
+            if (match) return j;
+        }
+        idx = (idx+1) & rdb_ondemand.mask;
+    }
+    return -1;
+}
+
+static void rdbOnDemandLoadEntry(uint64_t j) {
+    rdbIndexEntry *e = rdb_ondemand.entries+j;
+    long long expiretime = -1, lru_idle = -1, lfu_freq = -1;
+    char *prev_filename = rdbFileBeingLoaded;
+    robj *val = NULL;
+    int type, error;
+    rio r;
+
+    rdbOnDemandSetLoaded(j);
+    /* Corrupted records terminate the server after checking the file, like
+     * when the whole RDB is loaded at startup. */
+    rdbFileBeingLoaded = rdb_ondemand.filename;
+    sds key = rdbOnDemandReadKey(j,&r,&type,&expiretime,&lru_idle,&lfu_freq);
+    if (key) val = rdbLoadObject(type,&r,key,e->dbid,&error);
+    if (key == NULL || (val == NULL && error != RDB_LOAD_ERR_EMPTY_KEY)) {
+        rdbReportCorruptRDB("Invalid key at offset %llu of the RDB loaded on demand",
+            (unsigned long long)e->offset);
+        sdsfree(key);
+    } else if (val == NULL) {
+        sdsfree(key);
+    } else {
+        siderDb *db = server.db+e->dbid;
+        robj keyobj;
+        initStaticStringObject(keyobj,key);
+
+        /* Expired keys are loaded too, and deleted as usual on access or by
+         * the active expire cycle, so that the deletion is propagated. */
+        if (dbAddRDBLoad(db,key,val)) {
+            if (expiretime != -1) setExpire(NULL,db,&keyobj,expiretime);
+            objectSetLRUOrLFU(val,lfu_freq,lru_idle,LRU_CLOCK(),1000);
+            moduleNotifyKeyspaceEvent(NOTIFY_LOADED,"loaded",&keyobj,db->id);
+            server.rdb_last_load_keys_loaded++;
+        } else {
+            sdsfree(key);
+            decrRefCount(val);
+        }
+    }
+    rdbFileBeingLoaded = prev_filename;
+    loadingIncrProgress(e->len);
+}
+
+/* Open the RDB 'filename' for on-demand loading, loading just the data before
+ * the keys. Returns RDB_NOT_EXIST if it can't be loaded on demand, so that
+ * the caller loads it as usual, otherwise RDB_OK or RDB_FAILED. */
+int rdbLoadOnDemand(char *filename, rdbSaveInfo *rsi, int rdbflags) {
+    sds idxfile;
+    int rdb_fd = -1, idx_fd = -1;
+    struct stat rdb_sb, idx_sb;
+    void *rdb_map = MAP_FAILED, *idx_map = MAP_FAILED;
+    const char *err = NULL;
+
+    if (!server.rdb_load_on_demand || server.cluster_enabled) return RDB_NOT_EXIST;
+
+    idxfile = sdscatfmt(sdsempty(),"%s%s",filename,RDB_INDEX_SUFFIX);
+    if ((idx_fd = open(idxfile,O_RDONLY)) == -1) {
+        if (errno != ENOENT) err = strerror(errno);
+        goto notexist;
+    }
+    if ((rdb_fd = open(filename,O_RDONLY)) == -1 ||
+        fstat(rdb_fd,&rdb_sb) == -1 || fstat(idx_fd,&idx_sb) == -1)
+    {
+        err = strerror(errno);
+        goto notexist;
+    }
+    if ((size_t)idx_sb.st_size < sizeof(rdbIndexHeader) || rdb_sb.st_size == 0) {
+        err = "file too short";
+        goto notexist;
+    }
+    if ((idx_map = mmap(NULL,idx_sb.st_size,PROT_READ,MAP_SHARED,idx_fd,0)) == MAP_FAILED ||
+        (rdb_map = mmap(NULL,rdb_sb.st_size,PROT_READ,MAP_SHARED,rdb_fd,0)) == MAP_FAILED)
+    {
+        err = strerror(errno);
+        goto notexist;
+    }
+
+    rdbIndexHeader *hdr = idx_map;
+    if (memcmp(hdr->magic,RDB_INDEX_MAGIC,sizeof(hdr->magic)) != 0 ||
+        hdr->version != RDB_INDEX_VERSION)
+    {
+        err = "unknown format";
+    } else if (hdr->rdb_size != (uint64_t)rdb_sb.st_size) {
+        err = "the size of the RDB changed";
+    } else if (hdr->keys >= UINT32_MAX || hdr->slots < 16 ||
+               (hdr->slots & (hdr->slots-1)) || hdr->slots < hdr->keys ||
+               (uint64_t)idx_sb.st_size != sizeof(*hdr)+hdr->keys*sizeof(rdbIndexEntry)+
+                                           hdr->slots*sizeof(uint32_t))
+    {
+        err = "invalid index";
+    } else if (hdr->dbnum > (uint32_t)server.dbnum) {
+        /* Loaded as usual, failing with the right error. */
+        err = "not enough databases";
+    } else if (rdbIndexIdOf(rdb_map,rdb_sb.st_size) != hdr->id) {
+        err = "the index was saved with another RDB";
+    }
+    if (err) goto notexist;
+    close(idx_fd);
+    close(rdb_fd);
+    sdsfree(idxfile);
+
+    rdb_ondemand.rdb = rdb_map;
+    rdb_ondemand.rdb_size = rdb_sb.st_size;
+    rdb_ondemand.index = idx_map;
+    rdb_ondemand.index_size = idx_sb.st_size;
+    rdb_ondemand.entries = (rdbIndexEntry*)(hdr+1);
+    rdb_ondemand.table = (uint32_t*)(rdb_ondemand.entries+hdr->keys);
+    rdb_ondemand.keys = hdr->keys;
+    rdb_ondemand.mask = hdr->slots-1;
+    rdb_ondemand.loaded = zcalloc((hdr->keys+7)/8);
+    rdb_ondemand.left = hdr->keys;
+    rdb_ondemand.rdbver = atoi((char*)rdb_ondemand.rdb+5);
+    rdb_ondemand.filename = sdsnew(filename);
+    server.loading_on_demand = 1;
+
+    /* Load what precedes the keys as a regular RDB. */
+    rio rdb;
+    rdbLoadingCtx loading_ctx = {
+        .dbarray = server.db,
+        .functions_lib_ctx = functionsLibCtxGetCurrent(),
+        .header_only = 1
+    };
+    rioInitWithMemory(&rdb,rdb_ondemand.rdb,rdb_ondemand.rdb_size);
+    startLoadingFile(rdb_ondemand.rdb_size,filename,rdbflags);
+    int retval = rdbLoadRioWithLoadingCtx(&rdb,rdbflags,rsi,&loading_ctx);
+    stopLoading(retval == C_OK);
+    if (retval != C_OK) {
+        rdbOnDemandRelease();
+        return RDB_FAILED;
+    }
+
+    serverLog(LL_NOTICE,"RDB %s opened for on-demand loading, %llu keys to load",
+        filename, (unsigned long long)rdb_ondemand.keys);
+    if (rdb_ondemand.left == 0) rdbOnDemandFinish();
+    return RDB_OK;
+
+notexist:
+    if (err) serverLog(LL_WARNING,"Can't load the RDB %s on demand (%s), loading it entirely",
+        filename, err);
+    if (rdb_map != MAP_FAILED) munmap(rdb_map,rdb_sb.st_size);
+    if (idx_map != MAP_FAILED) munmap(idx_map,idx_sb.st_size);
+    if (rdb_fd != -1) close(rdb_fd);
+    if (idx_fd != -1) close(idx_fd);
+    sdsfree(idxfile);
+    return RDB_NOT_EXIST;
+}
+
+/* Load 'key' if it's one of the keys of 'db' not loaded yet. Called before a
+ * key is looked up. */
+void rdbOnDemandLoadKey(siderDb *db, sds key) {
+    /* The temporary DBs of the replication are not loaded on demand. */
+    if (db != server.db+db->id) return;
+    int64_t j = rdbOnDemandFind(db,key);
+    if (j == -1) return;
+    rdbOnDemandLoadEntry(j);
+    if (rdb_ondemand.left == 0) rdbOnDemandFinish();
+}
+
+/* Forget 'key' if it's one of the keys of 'db' not loaded yet, since it's
+ * being created with a new value. */
+void rdbOnDemandDiscardKey(siderDb *db, sds key) {
+    if (db != server.db+db->id) return;
+    int64_t j = rdbOnDemandFind(db,key);
+    if (j == -1) return;
+    rdbOnDemandSetLoaded(j);
+    if (rdb_ondemand.left == 0) rdbOnDemandFinish();
+}
+
+/* Load the keys not accessed yet for about RDB_ONDEMAND_CYCLE_US, called at
+ * every iteration of the event loop. */
+void rdbOnDemandLoadCycle(void) {
+    monotime start = getMonotonicUs();
+    int count = 0;
+
+    while (rdb_ondemand.left) {
+        uint64_t j = rdb_ondemand.cursor++;
+        if (rdbOnDemandIsLoaded(j)) continue;
+        rdbOnDemandLoadEntry(j);
+        /* Loading the keys more slowly is useful in order to test the
+         * commands executed meanwhile. */
+        if (server.key_load_delay) debugDelay(server.key_load_delay);
+        if (((++count & 15) == 0 || server.key_load_delay) &&
+            getMonotonicUs()-start >= RDB_ONDEMAND_CYCLE_US) break;
+    }
+    if (rdb_ondemand.left == 0) rdbOnDemandFinish();
+}
+
+/* Load all the keys left, before the whole keyspace is needed. */
+void rdbOnDemandLoadAll(void) {
+    while (rdb_ondemand.left) {
+        uint64_t j = rdb_ondemand.cursor++;
+        if (!rdbOnDemandIsLoaded(j)) rdbOnDemandLoadEntry(j);
+    }
+    rdbOnDemandFinish();
+}
+
+/* Discard the keys left of the DB 'dbid', or of all the DBs if it's -1, since
+ * they are being flushed or replaced. */
+void rdbOnDemandDiscard(int dbid) {
+    if (dbid != -1) {
+        for (uint64_t j = rdb_ondemand.cursor; j < rdb_ondemand.keys; j++) {
+            if (rdb_ondemand.entries[j].dbid == (uint32_t)dbid && !rdbOnDemandIsLoaded(j))
+                rdbOnDemandSetLoaded(j);
+        }
+        if (rdb_ondemand.left == 0) rdbOnDemandFinish();
+        return;
+    }
+    serverLog(LL_NOTICE,"Discarding the %llu keys of the RDB not loaded yet",
+        (unsigned long long)rdb_ondemand.left);
+    rdbOnDemandRelease();
+}
+
+unsigned long long rdbOnDemandKeysLeft(void) {
+    return rdb_ondemand.left;
+}
+
 /* A background saving child (BGSAVE) terminated its work. Handle this.
  * This function covers the case of actual BGSAVEs. */
 static void backgroundSaveDoneHandlerDisk(int exitcode, int bysignal) {
@@ -3490,6 +6431,10 @@ void backgroundSaveDoneHandler(int exitcode, int bysignal) {
  * the child did not exit for an error, but because we wanted), and performs
  * the cleanup needed. */
 void killRDBChild(void) {
+    if (rdbForklessSaveInProgress()) {
+        rdbForklessSaveAbort();
+        return;
+    }
     kill(server.child_pid, SIGUSR1);
     /* Because we are not using here waitpid (like we have in killAppendOnlyChild
      * and TerminateModuleForkChild), all the cleanup operations is done by
@@ -68,6 +68,8 @@
 #define RDB_ENC_INT16 1       /* 16 bit signed integer */
 #define RDB_ENC_INT32 2       /* 32 bit signed integer */
 #define RDB_ENC_LZF 3         /* string compressed with FASTLZ */
+#define RDB_ENC_LZ4 4         /* string compressed with LZ4 */
+#define RDB_ENC_ZSTD 5        /* string compressed with ZSTD */
 
 /* Map object types to RDB object types. Macros starting with OBJ_ are for
  * memory storage and may change. Instead RDB types must be fixed because
@@ -103,6 +105,7 @@
 #define rdbIsObjectType(t) (((t) >= 0 && (t) <= 7) || ((t) >= 9 && (t) <= 21))
 
 /* Special RDB opcodes (saved/loaded with rdbSaveType/rdbLoadType). */
+#define RDB_OPCODE_ZSTD_DICT  244   /* ZSTD dictionary of the values. */
 #define RDB_OPCODE_FUNCTION2  245   /* function library data */
 #define RDB_OPCODE_FUNCTION_PRE_GA   246   /* old function library data for 7.0 rc1 and rc2 */
 #define RDB_OPCODE_MODULE_AUX 247   /* Module auxiliary data. */
@@ -136,12 +139,34 @@
 #define RDBFLAGS_ALLOW_DUP (1<<2)       /* Allow duplicated keys when loading.*/
 #define RDBFLAGS_FEED_REPL (1<<3)       /* Feed replication stream when loading.*/
 #define RDBFLAGS_KEEP_CACHE (1<<4)      /* Don't reclaim cache after rdb file is generated */
+#define RDBFLAGS_SINGLE_FILE (1<<5)     /* Save a single file even if rdb-save-parts > 1. */
 
 /* When rdbLoadObject() returns NULL, the err flag is
  * set to hold the type of error that occurred */
 #define RDB_LOAD_ERR_EMPTY_KEY  1   /* Error of empty key */
 #define RDB_LOAD_ERR_OTHER      2   /* Any other errors */
 
+/* Threaded loading: values are decoded by up to RDB_LOAD_THREADS_MAX threads
+ * in batches of RDB_LOAD_BATCH_KEYS keys or RDB_LOAD_BATCH_BYTES bytes of
+ * serialized values, whichever comes first. */
+#define RDB_LOAD_THREADS_MAX 16
+#define RDB_LOAD_BATCH_KEYS 128
+#define RDB_LOAD_BATCH_BYTES (1024*1024)
+
+/* Max number of files of a multi-part snapshot (rdb-save-parts). */
+#define RDB_SAVE_PARTS_MAX 16
+
+/* On-demand loading (rdb-load-on-demand): suffix of the index of the keys
+ * saved after the RDB, and time spent loading the keys not accessed yet at
+ * every iteration of the event loop. */
+#define RDB_INDEX_SUFFIX ".idx"
+#define RDB_ONDEMAND_CYCLE_US 1000
+
+/* Max number of ZSTD dictionaries known while loading, and max size of the
+ * values sampled to train a dictionary. */
+#define RDB_ZSTD_DICTS_MAX 16
+#define RDB_ZSTD_DICT_SAMPLE_MAX (16*1024)
+
 ssize_t rdbWriteRaw(rio *rdb, void *p, size_t len);
 int rdbSaveType(rio *rdb, unsigned char type);
 int rdbLoadType(rio *rdb);
@@ -159,6 +184,22 @@ int rdbSaveToSlavesSockets(int req, rdbSaveInfo *rsi);
 void rdbRemoveTempFile(pid_t childpid, int from_signal);
 int rdbSaveToFile(const char *filename);
 int rdbSave(int req, char *filename, rdbSaveInfo *rsi, int rdbflags);
+int rdbLoadParts(char *filename, rdbSaveInfo *rsi, int rdbflags);
+void rdbRemoveParts(const char *filename);
+int rdbForklessSaveInProgress(void);
+int rdbForklessSaveDone(int *exitcode, int *bysignal);
+void rdbForklessSaveAbort(void);
+size_t rdbForklessSaveMemory(void);
+void rdbForklessKeyWrite(siderDb *db, sds key);
+void rdbForklessKeyRead(siderDb *db, sds key);
+void rdbForklessCommandKeys(client *c);
+int rdbLoadOnDemand(char *filename, rdbSaveInfo *rsi, int rdbflags);
+void rdbOnDemandLoadKey(siderDb *db, sds key);
+void rdbOnDemandDiscardKey(siderDb *db, sds key);
+void rdbOnDemandLoadCycle(void);
+void rdbOnDemandLoadAll(void);
+void rdbOnDemandDiscard(int dbid);
+unsigned long long rdbOnDemandKeysLeft(void);
 ssize_t rdbSaveObject(rio *rdb, robj *o, robj *key, int dbid);
 size_t rdbSavedObjectLen(robj *o, robj *key, int dbid);
 robj *rdbLoadObject(int rdbtype, rio *rdb, sds key, int dbid, int *error);
@@ -170,6 +211,7 @@ robj *rdbLoadStringObject(rio *rdb);
 ssize_t rdbSaveStringObject(rio *rdb, robj *obj);
 ssize_t rdbSaveRawString(rio *rdb, unsigned char *s, size_t len);
 void *rdbGenericLoadStringObject(rio *rdb, int flags, size_t *lenptr);
+int rdbLoadZstdDict(rio *rdb, size_t *lenptr);
 int rdbSaveBinaryDoubleValue(rio *rdb, double val);
 int rdbLoadBinaryDoubleValue(rio *rdb, double *val);
 int rdbSaveBinaryFloatValue(rio *rdb, float val);
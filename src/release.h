@@ -0,0 +1,5 @@
+#define REDIS_GIT_SHA1 "03ee602a"
+#define REDIS_GIT_DIRTY "267"
+#define REDIS_BUILD_ID "vm-1792228664"
+#include "version.h"
+#define REDIS_BUILD_ID_RAW REDIS_VERSION REDIS_BUILD_ID REDIS_GIT_DIRTY REDIS_GIT_SHA1
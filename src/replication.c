@@ -48,6 +48,11 @@ void replicationSendAck(void);
 int replicaPutOnline(client *slave);
 void replicaStartCommandStream(client *slave);
 int cancelReplicationHandshake(int reconnect);
+int replicationStreamConnect(void);
+void replicationStreamClose(void);
+void replicationStreamSendAck(void);
+static void replicationStreamFallback(int dbid);
+static void replicationStreamReplay(void);
 
 /* We take a global flag to remember if this instance generated an RDB
  * because of replication, so that we can remove the RDB file in case
@@ -151,13 +156,15 @@ void freeReplicationBacklog(void) {
     if (server.repl_backlog->ref_repl_buf_node) {
         replBufBlock *o = listNodeValue(
             server.repl_backlog->ref_repl_buf_node);
-        serverAssert(o->refcount == 1); /* Last reference. */
+        serverAssert(o->refcount >= 1);
         o->refcount--;
     }
 
     /* Replication buffer blocks are completely released when we free the
      * backlog, since the backlog is released only when there are no replicas
-     * and the backlog keeps the last reference of all blocks. */
+     * and the backlog keeps the last reference of all blocks, except the
+     * ones the kernel is still sending to freed replicas. */
+    replicaDetachZerocopyOrphans();
     freeReplicationBacklogRefMemAsync(server.repl_buffer_blocks,
                             server.repl_backlog->blocks_index);
     resetReplicationBuffer();
@@ -722,8 +729,14 @@ int replicationSetupSlaveForFullResync(client *slave, long long offset) {
     /* Don't send this reply to slaves that approached us with
      * the old SYNC command. */
     if (!(slave->flags & CLIENT_PRE_PSYNC)) {
-        buflen = snprintf(buf,sizeof(buf),"+FULLRESYNC %s %lld\r\n",
-                          server.replid,offset);
+        /* An RDB channel also needs its client ID, to be named by the
+         * connection of the replica requesting the replication stream. */
+        if (slave->flags & CLIENT_REPL_RDB_CHANNEL)
+            buflen = snprintf(buf,sizeof(buf),"+FULLRESYNC %s %lld %llu\r\n",
+                              server.replid,offset,(unsigned long long)slave->id);
+        else
+            buflen = snprintf(buf,sizeof(buf),"+FULLRESYNC %s %lld\r\n",
+                              server.replid,offset);
         if (connWrite(slave->conn,buf,buflen) != buflen) {
             freeClientAsync(slave);
             return C_ERR;
@@ -732,6 +745,20 @@ int replicationSetupSlaveForFullResync(client *slave, long long offset) {
     return C_OK;
 }
 
+/* Called when the replica 'c' doing a dual channel sync requested the
+ * replication stream with PSYNC: its RDB channel no longer needs to keep
+ * the replication stream from the offset of the snapshot in the backlog,
+ * since 'c' refers to it now. */
+static void releaseRdbChannelReplBuffer(client *c) {
+    client *rdb_client = lookupClientByID(c->rdb_client_id);
+
+    c->rdb_client_id = 0;
+    if (rdb_client == NULL || !(rdb_client->flags & CLIENT_SLAVE) ||
+        !(rdb_client->flags & CLIENT_REPL_RDB_CHANNEL)) return;
+    rdb_client->flags |= CLIENT_REPL_RDBONLY;
+    freeReplicaReferencedReplBuffer(rdb_client);
+}
+
 /* This function handles the PSYNC command from the point of view of a
  * master receiving a request for partial resynchronization.
  *
@@ -793,6 +820,7 @@ int masterTryPartialResynchronization(client *c, long long psync_offset) {
      * 2) Inform the client we can continue with +CONTINUE
      * 3) Send the backlog data (from the offset to the end) to the slave. */
     c->flags |= CLIENT_SLAVE;
+    c->flags &= ~CLIENT_REPL_RDB_CHANNEL;
     c->replstate = SLAVE_STATE_ONLINE;
     c->repl_ack_time = server.unixtime;
     c->repl_start_cmd_stream_on_ack = 0;
@@ -814,6 +842,7 @@ int masterTryPartialResynchronization(client *c, long long psync_offset) {
         "Partial resynchronization request from %s accepted. Sending %lld bytes of backlog starting from offset %lld.",
             replicationGetSlaveName(c),
             psync_len, psync_offset);
+    if (c->rdb_client_id) releaseRdbChannelReplBuffer(c);
     /* Note that we don't need to set the selected DB at server.slaveseldb
      * to -1 to force the master to emit SELECT, since the slave already
      * has this state from the previous connection with the master. */
@@ -878,7 +907,7 @@ int startBgsaveForReplication(int mincapa, int req) {
             retval = rdbSaveToSlavesSockets(req,rsiptr);
         else {
             /* Keep the page cache since it'll get used soon */
-            retval = rdbSaveBackground(req,server.rdb_filename,rsiptr,RDBFLAGS_KEEP_CACHE);
+            retval = rdbSaveBackground(req,server.rdb_filename,rsiptr,RDBFLAGS_KEEP_CACHE|RDBFLAGS_SINGLE_FILE);
         }
     } else {
         serverLog(LL_WARNING,"BGSAVE for replication: replication information not available, can't generate the RDB file right now. Try later.");
@@ -1023,6 +1052,14 @@ void syncCommand(client *c) {
              * resync on purpose when they are not able to partially
              * resync. */
             if (master_replid[0] != '?') server.stat_sync_partial_err++;
+
+            /* The replication stream of a dual channel sync is useless
+             * without the RDB it follows: the replica will retry. */
+            if (c->rdb_client_id) {
+                c->rdb_client_id = 0;
+                addReplyError(c,"Replication stream not available for the RDB channel");
+                return;
+            }
         }
     } else {
         /* If a slave uses SYNC, we are dealing with an old implementation
@@ -1162,7 +1199,14 @@ void syncCommand(client *c) {
  * - rdb-filter-only <include-filters>
  * Define "include" filters for the RDB snapshot. Currently we only support
  * a single include filter: "functions". Passing an empty string "" will
- * result in an empty RDB. */
+ * result in an empty RDB.
+ *
+ * - rdb-channel <0|1>
+ * In case of full sync, only send the RDB to this connection: the replica
+ * requests the replication stream on another one (dual channel sync).
+ *
+ * - rdb-client-id <id>
+ * The client ID of the RDB channel of this replica, in a dual channel sync. */
 void replconfCommand(client *c) {
     int j;
 
@@ -1271,6 +1315,31 @@ void replconfCommand(client *c) {
                 }
             }
             sdsfreesplitres(filters, filter_count);
+        } else if (!strcasecmp(c->argv[j]->ptr,"rdb-channel")) {
+            long rdb_channel = 0;
+            if (getRangeLongFromObjectOrReply(c,c->argv[j+1],
+                    0,1,&rdb_channel,NULL) != C_OK)
+                return;
+            if (rdb_channel == 1 && !server.repl_dual_channel) {
+                addReplyError(c,"Dual channel replication is disabled");
+                return;
+            }
+            if (rdb_channel == 1) c->flags |= CLIENT_REPL_RDB_CHANNEL;
+            else c->flags &= ~CLIENT_REPL_RDB_CHANNEL;
+        } else if (!strcasecmp(c->argv[j]->ptr,"rdb-client-id")) {
+            long long id;
+            client *rdb_client;
+
+            if (getLongLongFromObjectOrReply(c,c->argv[j+1],&id,NULL) != C_OK)
+                return;
+            rdb_client = lookupClientByID(id);
+            if (!rdb_client || !(rdb_client->flags & CLIENT_SLAVE) ||
+                !(rdb_client->flags & CLIENT_REPL_RDB_CHANNEL))
+            {
+                addReplyErrorFormat(c,"Unknown RDB channel client ID %lld",id);
+                return;
+            }
+            c->rdb_client_id = id;
         } else {
             addReplyErrorFormat(c,"Unrecognized REPLCONF option: %s",
                 (char*)c->argv[j]->ptr);
@@ -1291,7 +1360,7 @@ void replconfCommand(client *c) {
  * the return value indicates that the replica should be disconnected.
  * */
 int replicaPutOnline(client *slave) {
-    if (slave->flags & CLIENT_REPL_RDBONLY) {
+    if (slave->flags & (CLIENT_REPL_RDBONLY|CLIENT_REPL_RDB_CHANNEL)) {
         slave->replstate = SLAVE_STATE_RDB_TRANSMITTED;
         /* The client asked for RDB only so we should close it ASAP */
         serverLog(LL_NOTICE,
@@ -1745,6 +1814,7 @@ void replicationSendNewlineToMaster(void) {
         /* Pinging back in this stage is best-effort. */
         if (server.repl_transfer_s) connWrite(server.repl_transfer_s, "\n", 1);
     }
+    replicationStreamSendAck();
 }
 
 /* Callback used by emptyDb() while flushing away old data to load
@@ -2224,6 +2294,8 @@ void readSyncBulkPayload(connection *conn) {
             cancelReplicationHandshake(1);
             return;
         }
+        /* The RDB from the master replaces our own multi-part snapshot too. */
+        rdbRemoveParts(server.rdb_filename);
 
         if (rdbLoad(server.rdb_filename,&rsi,RDBFLAGS_REPLICATION) != RDB_OK) {
             serverLog(LL_WARNING,
@@ -2255,6 +2327,21 @@ void readSyncBulkPayload(connection *conn) {
         server.repl_transfer_tmpfile = NULL;
     }
 
+    /* In a dual channel sync the link with the master is the stream
+     * connection, the RDB channel is no longer needed. */
+    if (server.repl_rdb_channel) {
+        connClose(server.repl_transfer_s);
+        server.repl_transfer_s = NULL;
+        if (server.repl_stream_state != REPL_STREAM_BUFFERING) {
+            replicationStreamClose();
+            replicationStreamFallback(rsi.repl_stream_db);
+            return;
+        }
+        server.repl_transfer_s = server.repl_stream_s;
+        server.repl_stream_s = NULL;
+        server.repl_stream_state = REPL_STREAM_NONE;
+    }
+
     /* Final setup of the connected slave <- master link */
     replicationCreateMasterClient(server.repl_transfer_s,rsi.repl_stream_db);
     server.repl_state = REPL_STATE_CONNECTED;
@@ -2290,6 +2377,9 @@ void readSyncBulkPayload(connection *conn) {
      * will trigger an AOF rewrite, and when done will start appending
      * to the new file. */
     if (server.aof_enabled) restartAOFAfterSYNC();
+
+    /* Apply what the master sent on the stream connection meanwhile. */
+    if (server.repl_stream_buf) replicationStreamReplay();
     return;
 
 error:
@@ -2388,6 +2478,37 @@ char *sendCommandArgv(connection *conn, int argc, char **argv, size_t *argv_lens
     return NULL;
 }
 
+/* Send AUTH with masteruser (if set) and masterauth to the master. */
+static char *sendAuthToMaster(connection *conn) {
+    char *args[3] = {"AUTH",NULL,NULL};
+    size_t lens[3] = {4,0,0};
+    int argc = 1;
+    if (server.masteruser) {
+        args[argc] = server.masteruser;
+        lens[argc] = strlen(server.masteruser);
+        argc++;
+    }
+    args[argc] = server.masterauth;
+    lens[argc] = sdslen(server.masterauth);
+    argc++;
+    return sendCommandArgv(conn, argc, args, lens);
+}
+
+/* Send REPLCONF listening-port with the port the replica is reachable at. */
+static char *sendListeningPortToMaster(connection *conn) {
+    int port;
+    if (server.slave_announce_port)
+        port = server.slave_announce_port;
+    else if (server.tls_replication && server.tls_port)
+        port = server.tls_port;
+    else
+        port = server.port;
+    sds portstr = sdsfromlonglong(port);
+    char *err = sendCommand(conn,"REPLCONF","listening-port",portstr,NULL);
+    sdsfree(portstr);
+    return err;
+}
+
 /* Try a partial resynchronization with the master if we are about to reconnect.
  * If there is no cached master structure, at least try to issue a
  * "PSYNC ? -1" command in order to trigger a full resync using the PSYNC
@@ -2521,6 +2642,7 @@ int slaveTryPartialResynchronization(connection *conn, int read_reply) {
              * format seems wrong. To stay safe we blank the master
              * replid to make sure next PSYNCs will fail. */
             memset(server.master_replid,0,CONFIG_RUN_ID_SIZE+1);
+            server.repl_rdb_channel = 0;
         } else {
             memcpy(server.master_replid, replid, offset-replid-1);
             server.master_replid[CONFIG_RUN_ID_SIZE] = '\0';
@@ -2528,6 +2650,11 @@ int slaveTryPartialResynchronization(connection *conn, int read_reply) {
             serverLog(LL_NOTICE,"Full resync from master: %s:%lld",
                 server.master_replid,
                 server.master_initial_offset);
+            /* The client ID of our RDB channel follows in a dual channel
+             * sync. */
+            char *id = strchr(offset,' ');
+            server.repl_rdb_client_id = id ? strtoull(id+1,NULL,10) : 0;
+            if (server.repl_rdb_client_id == 0) server.repl_rdb_channel = 0;
         }
         sdsfree(reply);
         return PSYNC_FULLRESYNC;
@@ -2680,37 +2807,14 @@ void syncWithMaster(connection *conn) {
     if (server.repl_state == REPL_STATE_SEND_HANDSHAKE) {
         /* AUTH with the master if required. */
         if (server.masterauth) {
-            char *args[3] = {"AUTH",NULL,NULL};
-            size_t lens[3] = {4,0,0};
-            int argc = 1;
-            if (server.masteruser) {
-                args[argc] = server.masteruser;
-                lens[argc] = strlen(server.masteruser);
-                argc++;
-            }
-            args[argc] = server.masterauth;
-            lens[argc] = sdslen(server.masterauth);
-            argc++;
-            err = sendCommandArgv(conn, argc, args, lens);
+            err = sendAuthToMaster(conn);
             if (err) goto write_error;
         }
 
         /* Set the slave port, so that Master's INFO command can list the
          * slave listening port correctly. */
-        {
-            int port;
-            if (server.slave_announce_port)
-                port = server.slave_announce_port;
-            else if (server.tls_replication && server.tls_port)
-                port = server.tls_port;
-            else
-                port = server.port;
-            sds portstr = sdsfromlonglong(port);
-            err = sendCommand(conn,"REPLCONF",
-                    "listening-port",portstr, NULL);
-            sdsfree(portstr);
-            if (err) goto write_error;
-        }
+        err = sendListeningPortToMaster(conn);
+        if (err) goto write_error;
 
         /* Set the slave ip, so that Master's INFO command can list the
          * slave IP address port correctly in case of port forwarding or NAT.
@@ -2727,8 +2831,15 @@ void syncWithMaster(connection *conn) {
          * PSYNC2: supports PSYNC v2, so understands +CONTINUE <new repl ID>.
          *
          * The master will ignore capabilities it does not understand. */
-        err = sendCommand(conn,"REPLCONF",
-                "capa","eof","capa","psync2",NULL);
+        if (server.repl_dual_channel) {
+            /* Ask to receive only the RDB here in case of full sync, see
+             * the dual channel sync section. */
+            err = sendCommand(conn,"REPLCONF",
+                    "capa","eof","capa","psync2","rdb-channel","1",NULL);
+        } else {
+            err = sendCommand(conn,"REPLCONF",
+                    "capa","eof","capa","psync2",NULL);
+        }
         if (err) goto write_error;
 
         server.repl_state = REPL_STATE_RECEIVE_AUTH_REPLY;
@@ -2791,11 +2902,13 @@ void syncWithMaster(connection *conn) {
         err = receiveSynchronousResponse(conn);
         if (err == NULL) goto no_response_error;
         /* Ignore the error if any, not all the Sider versions support
-         * REPLCONF capa. */
+         * REPLCONF capa. The capabilities are set by the master even if it
+         * refused the RDB channel, since they come first. */
         if (err[0] == '-') {
             serverLog(LL_NOTICE,"(Non critical) Master does not understand "
                                   "REPLCONF capa: %s", err);
         }
+        server.repl_rdb_channel = server.repl_dual_channel && err[0] != '-';
         sdsfree(err);
         err = NULL;
         server.repl_state = REPL_STATE_SEND_PSYNC;
@@ -2860,6 +2973,7 @@ void syncWithMaster(connection *conn) {
      * and the server.master_replid and master_initial_offset are
      * already populated. */
     if (psync_result == PSYNC_NOT_SUPPORTED) {
+        server.repl_rdb_channel = 0;
         serverLog(LL_NOTICE,"Retrying with SYNC...");
         if (connSyncWrite(conn,"SYNC\r\n",6,server.repl_syncio_timeout*1000) == -1) {
             serverLog(LL_WARNING,"I/O error writing to MASTER: %s",
@@ -2885,8 +2999,12 @@ void syncWithMaster(connection *conn) {
         server.repl_transfer_fd = dfd;
     }
 
-    /* Setup the non blocking download of the bulk file. */
-    if (connSetReadHandler(conn, readSyncBulkPayload)
+    /* Setup the non blocking download of the bulk file. In a dual channel
+     * sync, it starts once the master accepted to send the replication
+     * stream on the second connection. */
+    if (server.repl_rdb_channel) {
+        if (replicationStreamConnect() == C_ERR) goto error;
+    } else if (connSetReadHandler(conn, readSyncBulkPayload)
             == C_ERR)
     {
         char conninfo[CONN_INFO_LEN];
@@ -2926,6 +3044,282 @@ write_error: /* Handle sendCommand() errors. */
     goto error;
 }
 
+/* --------------------------- DUAL CHANNEL SYNC ----------------------------
+ * With dual-channel-replication-enabled, the connection used for the
+ * handshake only receives the RDB in case of full sync: it is the "RDB
+ * channel" of the replica for the master. Once the master replied with
+ * +FULLRESYNC and the offset of the snapshot, a second connection asks for
+ * the replication stream with PSYNC at the next offset, and the replica
+ * buffers it while the RDB is transferred and loaded. This way the master
+ * does not accumulate the stream in the output buffer of the replica during
+ * the whole transfer, and the replica starts applying the stream as soon as
+ * the RDB is loaded. The RDB channel keeps the stream in the backlog of the
+ * master, from the offset of the snapshot, until the PSYNC is accepted.
+ *
+ * If the stream connection fails, the RDB is still loaded, and the replica
+ * continues with a partial resynchronization from the offset of the
+ * snapshot, like after a disconnection.
+ * ------------------------------------------------------------------------- */
+
+/* Max size of a block of the buffered replication stream. */
+#define REPL_STREAM_BLOCK_SIZE (1024*1024)
+
+/* Close the stream connection and free the buffered stream. */
+void replicationStreamClose(void) {
+    if (server.repl_stream_s) {
+        connClose(server.repl_stream_s);
+        server.repl_stream_s = NULL;
+    }
+    server.repl_stream_state = REPL_STREAM_NONE;
+    if (server.repl_stream_buf) {
+        listRelease(server.repl_stream_buf);
+        server.repl_stream_buf = NULL;
+    }
+    server.repl_stream_buf_size = 0;
+}
+
+/* Give up on the stream connection: the RDB is still transferred on the
+ * RDB channel, and we'll PSYNC again once it is loaded. */
+static void replicationStreamAbort(const char *reason) {
+    int buffering = server.repl_stream_state == REPL_STREAM_BUFFERING;
+
+    serverLog(LL_WARNING,"MASTER <-> REPLICA sync: replication stream "
+        "connection failed (%s), continuing with the RDB only", reason);
+    replicationStreamClose();
+    /* The transfer of the RDB starts with the buffering of the stream. */
+    if (!buffering &&
+        connSetReadHandler(server.repl_transfer_s,readSyncBulkPayload) == C_ERR)
+    {
+        cancelReplicationHandshake(1);
+    }
+}
+
+/* Send REPLCONF ACK with the offset of the snapshot on the stream
+ * connection, so that the master does not time it out while we buffer the
+ * stream. It is called from the cron and while loading, at most once per
+ * second. */
+void replicationStreamSendAck(void) {
+    if (server.repl_stream_state != REPL_STREAM_BUFFERING ||
+        server.repl_stream_ack_time == server.unixtime) return;
+    server.repl_stream_ack_time = server.unixtime;
+
+    char offset[LONG_STR_SIZE];
+    ll2string(offset,sizeof(offset),server.master_initial_offset);
+    char *err = sendCommand(server.repl_stream_s,"REPLCONF","ACK",offset,NULL);
+    if (err) {
+        serverLog(LL_WARNING,"Sending ACK on the replication stream: %s", err);
+        sdsfree(err);
+    }
+}
+
+/* Read handler of the stream connection once the master accepted the PSYNC:
+ * append what we read to the buffered stream, up to the configured limit. */
+static void replicationStreamReadBuffer(connection *conn) {
+    listNode *ln = listLast(server.repl_stream_buf);
+    sds block = ln ? listNodeValue(ln) : NULL;
+
+    if (block == NULL || sdslen(block) >= REPL_STREAM_BLOCK_SIZE) {
+        block = sdsempty();
+        listAddNodeTail(server.repl_stream_buf,block);
+        ln = listLast(server.repl_stream_buf);
+    }
+    if (sdsavail(block) < PROTO_IOBUF_LEN) {
+        block = sdsMakeRoomForNonGreedy(block,PROTO_IOBUF_LEN);
+        listNodeValue(ln) = block;
+    }
+
+    int nread = connRead(conn,block+sdslen(block),sdsavail(block));
+    if (nread <= 0) {
+        if (nread == -1 && connGetState(conn) == CONN_STATE_CONNECTED) return;
+        replicationStreamAbort(nread == 0 ? "connection lost" :
+                                            connGetLastError(conn));
+        return;
+    }
+    sdsIncrLen(block,nread);
+    server.repl_stream_buf_size += nread;
+    if (server.repl_stream_buf_size > server.repl_stream_buf_peak)
+        server.repl_stream_buf_peak = server.repl_stream_buf_size;
+
+    unsigned long long limit = server.repl_stream_buf_limit ?
+        server.repl_stream_buf_limit :
+        server.client_obuf_limits[CLIENT_TYPE_SLAVE].hard_limit_bytes;
+    if (limit && server.repl_stream_buf_size >= limit) {
+        /* Stop reading: the rest of the stream waits in the socket and in
+         * the output buffer of the master until the RDB is loaded. */
+        serverLog(LL_NOTICE,"MASTER <-> REPLICA sync: replication stream "
+            "buffer reached its limit of %llu bytes", limit);
+        connSetReadHandler(conn,NULL);
+    }
+    replicationStreamSendAck();
+}
+
+/* Read handler of the stream connection during its handshake: the replies
+ * to AUTH and REPLCONF, and then to PSYNC. */
+static void replicationStreamReadHandshake(connection *conn) {
+    char *reply = receiveSynchronousResponse(conn);
+    if (reply == NULL) {
+        replicationStreamAbort("no reply from master");
+        return;
+    }
+
+    if (server.repl_stream_state == REPL_STREAM_RECEIVE_HANDSHAKE_REPLY) {
+        if (reply[0] == '-') {
+            serverLog(LL_WARNING,"Master refused the replication stream "
+                "connection: %s", reply);
+            sdsfree(reply);
+            replicationStreamAbort("handshake error");
+            return;
+        }
+        sdsfree(reply);
+        if (--server.repl_stream_replies > 0) return;
+
+        /* Ask for the stream right after the snapshot. */
+        char offset[LONG_STR_SIZE];
+        ll2string(offset,sizeof(offset),server.master_initial_offset+1);
+        char *err = sendCommand(conn,"PSYNC",server.master_replid,offset,NULL);
+        if (err) {
+            serverLog(LL_WARNING,"Sending PSYNC on the replication stream "
+                "connection: %s", err);
+            sdsfree(err);
+            replicationStreamAbort("write error");
+            return;
+        }
+        server.repl_stream_state = REPL_STREAM_RECEIVE_PSYNC_REPLY;
+        return;
+    }
+
+    /* Newlines are sent by the master to keep the connection alive. */
+    if (sdslen(reply) == 0) {
+        sdsfree(reply);
+        return;
+    }
+    if (strncmp(reply,"+CONTINUE",9) ||
+        (reply[9] == ' ' && strncmp(reply+10,server.master_replid,
+                                    CONFIG_RUN_ID_SIZE)))
+    {
+        serverLog(LL_WARNING,"Master did not accept the replication stream "
+            "PSYNC: %s", reply);
+        sdsfree(reply);
+        replicationStreamAbort("PSYNC error");
+        return;
+    }
+    sdsfree(reply);
+
+    server.repl_stream_state = REPL_STREAM_BUFFERING;
+    server.repl_stream_buf = listCreate();
+    listSetFreeMethod(server.repl_stream_buf,(void (*)(void*))sdsfree);
+    server.repl_stream_buf_size = 0;
+    server.repl_stream_buf_peak = 0;
+    server.repl_stream_ack_time = 0;
+    if (connSetReadHandler(conn,replicationStreamReadBuffer) == C_ERR) {
+        replicationStreamAbort("can't create readable event");
+        return;
+    }
+    if (connSetReadHandler(server.repl_transfer_s,readSyncBulkPayload) == C_ERR) {
+        serverLog(LL_WARNING,"Can't create readable event for SYNC: %s",
+            strerror(errno));
+        cancelReplicationHandshake(1);
+        return;
+    }
+    serverLog(LL_NOTICE,"MASTER <-> REPLICA sync: buffering the replication "
+        "stream from offset %lld while receiving the RDB",
+        server.master_initial_offset+1);
+}
+
+/* Connect handler of the stream connection: authenticate and name our RDB
+ * channel, the replies are read by replicationStreamReadHandshake(). */
+static void replicationStreamConnected(connection *conn) {
+    char *err = NULL;
+
+    if (connGetState(conn) != CONN_STATE_CONNECTED) {
+        replicationStreamAbort(connGetLastError(conn));
+        return;
+    }
+
+    server.repl_stream_replies = 0;
+    if (server.masterauth) {
+        if ((err = sendAuthToMaster(conn)) != NULL) goto write_error;
+        server.repl_stream_replies++;
+    }
+    if ((err = sendListeningPortToMaster(conn)) != NULL) goto write_error;
+    server.repl_stream_replies++;
+    if (server.slave_announce_ip) {
+        err = sendCommand(conn,"REPLCONF",
+                "ip-address",server.slave_announce_ip,NULL);
+        if (err) goto write_error;
+        server.repl_stream_replies++;
+    }
+    char id[LONG_STR_SIZE];
+    ull2string(id,sizeof(id),server.repl_rdb_client_id);
+    err = sendCommand(conn,"REPLCONF","capa","eof","capa","psync2",
+            "rdb-client-id",id,NULL);
+    if (err) goto write_error;
+    server.repl_stream_replies++;
+
+    server.repl_stream_state = REPL_STREAM_RECEIVE_HANDSHAKE_REPLY;
+    connSetReadHandler(conn,replicationStreamReadHandshake);
+    connSetWriteHandler(conn,NULL);
+    return;
+
+write_error:
+    serverLog(LL_WARNING,"Sending command to master on the replication "
+        "stream connection: %s", err);
+    sdsfree(err);
+    replicationStreamAbort("write error");
+}
+
+/* Called by syncWithMaster() after the master replied +FULLRESYNC to the
+ * RDB channel: start connecting the stream connection. */
+int replicationStreamConnect(void) {
+    server.repl_stream_s = connCreate(connTypeOfReplication());
+    if (connConnect(server.repl_stream_s,server.masterhost,server.masterport,
+                server.bind_source_addr,replicationStreamConnected) == C_ERR)
+    {
+        serverLog(LL_WARNING,"Unable to connect to MASTER for the "
+            "replication stream: %s", connGetLastError(server.repl_stream_s));
+        connClose(server.repl_stream_s);
+        server.repl_stream_s = NULL;
+        return C_ERR;
+    }
+    server.repl_stream_state = REPL_STREAM_CONNECTING;
+    return C_OK;
+}
+
+/* Called when the RDB was loaded but the stream connection was lost: make
+ * the master of the snapshot our cached master, so that we reconnect and
+ * continue from the offset of the snapshot with PSYNC. */
+static void replicationStreamFallback(int dbid) {
+    replicationCreateMasterClient(NULL,dbid);
+    memcpy(server.replid,server.master->replid,sizeof(server.replid));
+    server.master_repl_offset = server.master->reploff;
+    clearReplicationId2();
+    if (server.repl_backlog == NULL) createReplicationBacklog();
+    serverLog(LL_NOTICE,"MASTER <-> REPLICA sync: RDB loaded without the "
+        "replication stream, trying a partial resynchronization");
+    if (server.aof_enabled) restartAOFAfterSYNC();
+    replicationCacheMaster(server.master);
+}
+
+/* Apply the stream buffered while the RDB was transferred and loaded, as if
+ * it was read by the master client. */
+static void replicationStreamReplay(void) {
+    list *buf = server.repl_stream_buf;
+    size_t size = server.repl_stream_buf_size;
+
+    server.repl_stream_buf = NULL;
+    server.repl_stream_buf_size = 0;
+    serverLog(LL_NOTICE,"MASTER <-> REPLICA sync: applying %zu bytes of "
+        "buffered replication stream", size);
+    while (listLength(buf) && server.master) {
+        listNode *ln = listFirst(buf);
+        sds block = listNodeValue(ln);
+        listNodeValue(ln) = NULL;
+        listDelNode(buf,ln);
+        feedClientQueryBuffer(server.master,block);
+    }
+    listRelease(buf);
+}
+
 int connectWithMaster(void) {
     server.repl_transfer_s = connCreate(connTypeOfReplication());
     if (connConnect(server.repl_transfer_s, server.masterhost, server.masterport,
@@ -2940,6 +3334,7 @@ int connectWithMaster(void) {
 
     server.repl_transfer_lastio = server.unixtime;
     server.repl_state = REPL_STATE_CONNECTING;
+    server.repl_rdb_channel = 0;
     serverLog(LL_NOTICE,"MASTER <-> REPLICA sync started");
     return C_OK;
 }
@@ -2951,6 +3346,7 @@ int connectWithMaster(void) {
 void undoConnectWithMaster(void) {
     connClose(server.repl_transfer_s);
     server.repl_transfer_s = NULL;
+    replicationStreamClose();
 }
 
 /* Abort the async download of the bulk dataset while SYNC-ing with master.
@@ -3308,7 +3704,7 @@ void replicationCacheMaster(client *c) {
      * we want to discard the non processed query buffers and non processed
      * offsets, including pending transactions, already populated arguments,
      * pending outputs to the master. */
-    sdsclear(server.master->querybuf);
+    if (server.master->querybuf) sdsclear(server.master->querybuf);
     server.master->qb_pos = 0;
     server.master->repl_applied = 0;
     server.master->read_reploff = server.master->reploff;
@@ -3756,6 +4152,9 @@ void replicationCron(void) {
         !(server.master->flags & CLIENT_PRE_PSYNC))
         replicationSendAck();
 
+    /* Same for the stream buffered during a dual channel sync. */
+    replicationStreamSendAck();
+
     /* If we have attached slaves, PING them from time to time.
      * So slaves can implement an explicit timeout to masters, and will
      * be able to detect a link disconnection even if the TCP connection
@@ -0,0 +1,197 @@
+/* Tests and benchmark of the vectorized RESP request parser helpers.
+ *
+ * Copyright (c) 2024, Sider Contributors
+ * All rights reserved.
+ *
+ * Sidertribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Sidertributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Sidertributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Sider nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "respscan.h"
+
+#ifdef REDIS_TEST
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include "sds.h"
+#include "testhelp.h"
+
+#define UNUSED(x) (void)(x)
+
+static long long usec(void) {
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000000)+tv.tv_usec;
+}
+
+/* Parse all the pipelined commands in 'buf' the way processMultibulkBuffer()
+ * did before the scanner: strchr() and string2ll() for every header. Returns
+ * the number of arguments, or -1 on protocol errors. */
+static long parseStrchr(const char *buf, size_t len) {
+    const char *p = buf, *end = buf + len;
+    long args = 0;
+    long long count, bulklen;
+
+    while (p < end) {
+        const char *nl = strchr(p, '\r');
+        if (!nl || !string2ll(p + 1, nl - p - 1, &count)) return -1;
+        p = nl + 2;
+        while (count--) {
+            nl = strchr(p, '\r');
+            if (!nl || !string2ll(p + 1, nl - p - 1, &bulklen)) return -1;
+            p = nl + 2 + bulklen + 2;
+            args++;
+        }
+    }
+    return args;
+}
+
+/* Same as parseStrchr() but using the scanner. */
+static long parseScanner(const char *buf, size_t len) {
+    const char *p = buf, *end = buf + len;
+    long args = 0;
+    long long count, bulklen;
+    respScanner scanner;
+
+    respScannerReset(&scanner);
+    while (p < end) {
+        const char *nl = respScanFindCR(&scanner, p, end);
+        if (!nl || !respParseLength(p + 1, nl - p - 1, &count)) return -1;
+        p = nl + 2;
+        while (count--) {
+            nl = respScanFindCR(&scanner, p, end);
+            if (!nl || !respParseLength(p + 1, nl - p - 1, &bulklen)) return -1;
+            p = nl + 2 + bulklen + 2;
+            args++;
+        }
+    }
+    return args;
+}
+
+/* Build a buffer with 'count' pipelined SET commands, the value is 'vlen'
+ * bytes long. */
+static sds buildPipeline(long count, size_t vlen) {
+    sds buf = sdsempty();
+    sds value = sdsnewlen(NULL, vlen);
+    memset(value, 'v', vlen);
+    for (long j = 0; j < count; j++) {
+        char key[32];
+        int klen = snprintf(key, sizeof(key), "key:%ld", j);
+        buf = sdscatprintf(buf, "*3\r\n$3\r\nSET\r\n$%d\r\n%s\r\n$%zu\r\n",
+                           klen, key, vlen);
+        buf = sdscatsds(buf, value);
+        buf = sdscatlen(buf, "\r\n", 2);
+    }
+    sdsfree(value);
+    return buf;
+}
+
+/* ./sider-server test respscan [--accurate] */
+int respScanTest(int argc, char *argv[], int flags) {
+    UNUSED(argc);
+    UNUSED(argv);
+    int accurate = (flags & REDIS_TEST_ACCURATE);
+
+    {
+        char buf[200];
+        memset(buf, 'x', sizeof(buf));
+        int positions[] = {0, 1, 31, 32, 63, 64, 65, 127, 150, 199};
+        for (size_t j = 0; j < sizeof(positions)/sizeof(int); j++)
+            buf[positions[j]] = '\r';
+
+        respScanner scanner;
+        respScannerReset(&scanner);
+        const char *p = buf, *end = buf + sizeof(buf);
+        int found = 0, ok = 1;
+        while ((p = respScanFindCR(&scanner, p, end)) != NULL) {
+            if (p - buf != positions[found++]) ok = 0;
+            p++;
+        }
+        test_cond("Find all the CR bytes across blocks",
+            ok && found == sizeof(positions)/sizeof(int));
+
+        ok = 1;
+        for (size_t len = 0; len <= sizeof(buf); len++) {
+            for (size_t start = 0; start < len; start++) {
+                respScannerReset(&scanner);
+                const char *cr = respScanFindCR(&scanner, buf + start, buf + len);
+                const char *expected = memchr(buf + start, '\r', len - start);
+                if (cr != expected) ok = 0;
+            }
+        }
+        test_cond("Search is bounded by the end of the buffer", ok);
+    }
+
+    {
+        const char *valid[] = {"0", "1", "9", "10", "3", "16384", "999999999999999999",
+                               "1234567890123456789", "-1", "-100", "+5"};
+        const char *invalid[] = {"", "01", "00", "1a", "a", " 1", "1 ", "-",
+                                 "99999999999999999999", "1\r"};
+        int ok = 1;
+        for (size_t j = 0; j < sizeof(valid)/sizeof(char*); j++) {
+            long long v1 = 0, v2 = 0;
+            int ok1 = respParseLength(valid[j], strlen(valid[j]), &v1);
+            int ok2 = string2ll(valid[j], strlen(valid[j]), &v2);
+            if (ok1 != ok2 || v1 != v2) ok = 0;
+        }
+        for (size_t j = 0; j < sizeof(invalid)/sizeof(char*); j++) {
+            long long v;
+            if (respParseLength(invalid[j], strlen(invalid[j]), &v) !=
+                string2ll(invalid[j], strlen(invalid[j]), &v)) ok = 0;
+        }
+        test_cond("Length parsing matches string2ll()", ok);
+    }
+
+    {
+        size_t vlens[] = {3, 10, 100, 1000};
+        long count = accurate ? 100000 : 10000;
+        int rounds = accurate ? 200 : 20;
+
+        for (size_t j = 0; j < sizeof(vlens)/sizeof(size_t); j++) {
+            sds buf = buildPipeline(count, vlens[j]);
+            long long start, elapsed_strchr, elapsed_scanner;
+            long args1 = 0, args2 = 0;
+
+            start = usec();
+            for (int r = 0; r < rounds; r++) args1 += parseStrchr(buf, sdslen(buf));
+            elapsed_strchr = usec() - start;
+            start = usec();
+            for (int r = 0; r < rounds; r++) args2 += parseScanner(buf, sdslen(buf));
+            elapsed_scanner = usec() - start;
+
+            printf("Parse %ld pipelined SET with %zu bytes values: "
+                   "strchr %.1f ns/cmd, scanner %.1f ns/cmd\n",
+                   count, vlens[j],
+                   (double)elapsed_strchr*1000/(count*rounds),
+                   (double)elapsed_scanner*1000/(count*rounds));
+            test_cond("Both parsers find the same arguments",
+                args1 == args2 && args1 == count*3*rounds);
+            sdsfree(buf);
+        }
+    }
+
+    test_report();
+    return 0;
+}
+#endif
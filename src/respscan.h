@@ -0,0 +1,159 @@
+/* Vectorized helpers for the RESP request parser.
+ *
+ * Copyright (c) 2024, Sider Contributors
+ * All rights reserved.
+ *
+ * Sidertribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Sidertributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Sidertributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Sider nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RESPSCAN_H
+#define __RESPSCAN_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "util.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#define RESPSCAN_NEON
+#endif
+
+/* The headers of a RESP request ("*<count>\r\n" and "$<len>\r\n") are short
+ * and close to each other: a small command like "SET key value" has all of
+ * them within 64 bytes. So instead of searching every '\r' on its own, the
+ * parser computes once the bitmap of the '\r' bytes of a 64 bytes block, and
+ * then resolves all the headers falling in the block with bit operations.
+ *
+ * The block bitmap is computed with AVX2 or SSE2 on x86 (SSE2 is part of the
+ * x86-64 baseline, AVX2 is used when the compiler targets it), NEON on ARM,
+ * and a scalar loop elsewhere, or when less than 64 bytes are left. */
+
+#define RESPSCAN_BLOCK 64
+
+typedef struct respScanner {
+    const char *base;   /* Start of the scanned block, NULL if none. */
+    uint64_t mask;      /* Bit N is set if base[N] is '\r'. */
+} respScanner;
+
+/* Bitmap of the '\r' bytes in the 'len' bytes at 'p', only the first
+ * RESPSCAN_BLOCK bytes are considered. */
+static inline uint64_t respScanBlockScalar(const char *p, size_t len) {
+    uint64_t mask = 0;
+    if (len > RESPSCAN_BLOCK) len = RESPSCAN_BLOCK;
+    for (size_t j = 0; j < len; j++)
+        if (p[j] == '\r') mask |= (uint64_t)1 << j;
+    return mask;
+}
+
+static inline uint64_t respScanBlock(const char *p, size_t len) {
+    if (len < RESPSCAN_BLOCK) return respScanBlockScalar(p, len);
+#if defined(__AVX2__)
+    const __m256i cr = _mm256_set1_epi8('\r');
+    __m256i lo = _mm256_loadu_si256((const __m256i *)p);
+    __m256i hi = _mm256_loadu_si256((const __m256i *)(p + 32));
+    uint32_t mlo = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, cr));
+    uint32_t mhi = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, cr));
+    return (uint64_t)mlo | ((uint64_t)mhi << 32);
+#elif defined(__SSE2__)
+    const __m128i cr = _mm_set1_epi8('\r');
+    uint64_t mask = 0;
+    for (int j = 0; j < 4; j++) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + j*16));
+        uint64_t m = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, cr));
+        mask |= m << (j*16);
+    }
+    return mask;
+#elif defined(RESPSCAN_NEON)
+    /* NEON has no movemask: narrow every 16 bytes comparison to 4 bits per
+     * byte, then keep one bit per byte. */
+    const uint8x16_t cr = vdupq_n_u8('\r');
+    uint64_t mask = 0;
+    for (int j = 0; j < 4; j++) {
+        uint8x16_t eq = vceqq_u8(vld1q_u8((const uint8_t *)p + j*16), cr);
+        uint64_t nibbles = vget_lane_u64(vreinterpret_u64_u8(
+            vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+        nibbles &= 0x1111111111111111ULL;
+        uint64_t m = 0;
+        while (nibbles) {
+            m |= (uint64_t)1 << (__builtin_ctzll(nibbles) / 4);
+            nibbles &= nibbles - 1;
+        }
+        mask |= m << (j*16);
+    }
+    return mask;
+#else
+    return respScanBlockScalar(p, len);
+#endif
+}
+
+/* Reset the scanner, to be called every time the scanned buffer changes. */
+static inline void respScannerReset(respScanner *s) {
+    s->base = NULL;
+    s->mask = 0;
+}
+
+/* Return a pointer to the first '\r' in [p, end), or NULL if there is none.
+ * Blocks are scanned only once as long as the following searches start
+ * inside the last scanned block. */
+static inline const char *respScanFindCR(respScanner *s, const char *p, const char *end) {
+    while (p < end) {
+        if (s->base == NULL || p < s->base || p >= s->base + RESPSCAN_BLOCK) {
+            s->base = p;
+            s->mask = respScanBlock(p, end - p);
+        }
+        uint64_t mask = s->mask >> (p - s->base);
+        if (mask) return p + __builtin_ctzll(mask);
+        p = s->base + RESPSCAN_BLOCK;
+    }
+    return NULL;
+}
+
+/* Parse the length of a RESP header, with the same semantics of string2ll().
+ * Lengths are almost always a few digits long, so they are decoded here
+ * without the generic sign and overflow handling, which is left to the
+ * slow path. */
+static inline int respParseLength(const char *p, size_t len, long long *value) {
+    if (len == 0 || len > 18 || (p[0] == '0' && len > 1))
+        return string2ll(p, len, value);
+
+    unsigned long long v = 0;
+    for (size_t j = 0; j < len; j++) {
+        unsigned int digit = (unsigned char)p[j] - '0';
+        if (digit > 9) return string2ll(p, len, value);
+        v = v*10 + digit;
+    }
+    *value = (long long)v;
+    return 1;
+}
+
+#ifdef REDIS_TEST
+int respScanTest(int argc, char *argv[], int flags);
+#endif
+
+#endif
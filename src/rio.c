@@ -105,6 +105,53 @@ void rioInitWithBuffer(rio *r, sds s) {
     r->io.buffer.pos = 0;
 }
 
+/* ---------------------- Read-only memory implementation -------------------- */
+
+static size_t rioMemoryRead(rio *r, void *buf, size_t len) {
+    if (r->io.memory.len-r->io.memory.pos < len)
+        return 0; /* not enough memory to return len bytes. */
+    memcpy(buf,r->io.memory.ptr+r->io.memory.pos,len);
+    r->io.memory.pos += len;
+    return 1;
+}
+
+static size_t rioMemoryWrite(rio *r, const void *buf, size_t len) {
+    UNUSED(r);
+    UNUSED(buf);
+    UNUSED(len);
+    return 0; /* Read-only. */
+}
+
+static off_t rioMemoryTell(rio *r) {
+    return r->io.memory.pos;
+}
+
+static int rioMemoryFlush(rio *r) {
+    UNUSED(r);
+    return 1;
+}
+
+static const rio rioMemoryIO = {
+    rioMemoryRead,
+    rioMemoryWrite,
+    rioMemoryTell,
+    rioMemoryFlush,
+    NULL,           /* update_checksum */
+    0,              /* current checksum */
+    0,              /* flags */
+    0,              /* bytes read or written */
+    0,              /* read/write chunk size */
+    { { NULL, 0 } } /* union for io-specific vars */
+};
+
+/* Read 'len' bytes at 'ptr', for instance a file mapped in memory. */
+void rioInitWithMemory(rio *r, const void *ptr, size_t len) {
+    *r = rioMemoryIO;
+    r->io.memory.ptr = ptr;
+    r->io.memory.len = len;
+    r->io.memory.pos = 0;
+}
+
 /* --------------------- Stdio file pointer implementation ------------------- */
 
 /* Returns 1 or 0 for success/failure. */
@@ -76,6 +76,12 @@ struct _rio {
             sds ptr;
             off_t pos;
         } buffer;
+        /* Read-only memory target (used to read mapped files). */
+        struct {
+            const unsigned char *ptr;
+            size_t len;
+            off_t pos;
+        } memory;
         /* Stdio file pointer target. */
         struct {
             FILE *fp;
@@ -164,6 +170,7 @@ static inline void rioClearErrors(rio *r) {
 
 void rioInitWithFile(rio *r, FILE *fp);
 void rioInitWithBuffer(rio *r, sds s);
+void rioInitWithMemory(rio *r, const void *ptr, size_t len);
 void rioInitWithConn(rio *r, connection *conn, size_t read_limit);
 void rioInitWithFd(rio *r, int fd);
 
@@ -393,25 +393,25 @@ int dictExpandAllowed(size_t moreMem, double usedRatio) {
     }
 }
 
-/* Returns the size of the DB dict entry metadata in bytes. In cluster mode, the
- * metadata is used for constructing a doubly linked list of the dict entries
- * belonging to the same cluster slot. See the Slot to Key API in cluster.c. */
-size_t dbDictEntryMetadataSize(dict *d) {
-    UNUSED(d);
-    /* NOTICE: this also affects overhead_ht_slot_to_keys in getMemoryOverheadData.
-     * If we ever add non-cluster related data here, that code must be modified too. */
-    return server.cluster_enabled ? sizeof(clusterDictEntryMetadata) : 0;
+/* Returns the size of the metadata of the keyspace dicts, see dbDictMetadata. */
+size_t dbDictMetadataSize(void) {
+    return sizeof(dbDictMetadata);
 }
 
-/* Returns the size of the DB dict metadata in bytes. In cluster mode, we store
- * a pointer to the db in the main db dict, used for updating the slot-to-key
- * mapping when a dictEntry is reallocated. */
-size_t dbDictMetadataSize(void) {
-    return server.cluster_enabled ? sizeof(clusterDictMetadata) : 0;
+/* Track the keyspace dicts being rehashed: in cluster mode there is a dict
+ * per slot, too many to look for the ones to rehash in the cron. */
+void dbDictRehashingStarted(dict *d) {
+    dbDictMetadata *meta = dictMetadata(d);
+    listAddNodeTail(server.rehashing, d);
+    meta->rehashing_node = listLast(server.rehashing);
 }
 
-void dbDictAfterReplaceEntry(dict *d, dictEntry *de) {
-    if (server.cluster_enabled) slotToKeyReplaceEntry(d, de);
+void dbDictRehashingCompleted(dict *d) {
+    dbDictMetadata *meta = dictMetadata(d);
+    if (meta->rehashing_node) {
+        listDelNode(server.rehashing, meta->rehashing_node);
+        meta->rehashing_node = NULL;
+    }
 }
 
 /* Generic hash table type where keys are Sider Objects, Values
@@ -469,9 +469,9 @@ dictType dbDictType = {
     dictSdsDestructor,          /* key destructor */
     dictObjectDestructor,       /* val destructor */
     dictExpandAllowed,          /* allow to expand */
-    .dictEntryMetadataBytes = dbDictEntryMetadataSize,
     .dictMetadataBytes = dbDictMetadataSize,
-    .afterReplaceEntry = dbDictAfterReplaceEntry
+    .rehashingStarted = dbDictRehashingStarted,
+    .rehashingCompleted = dbDictRehashingCompleted
 };
 
 /* Db->expires */
@@ -482,7 +482,10 @@ dictType dbExpiresDictType = {
     dictSdsKeyCompare,          /* key compare */
     NULL,                       /* key destructor */
     NULL,                       /* val destructor */
-    dictExpandAllowed           /* allow to expand */
+    dictExpandAllowed,          /* allow to expand */
+    .dictMetadataBytes = dbDictMetadataSize,
+    .rehashingStarted = dbDictRehashingStarted,
+    .rehashingCompleted = dbDictRehashingCompleted
 };
 
 /* Command table. sds string -> command struct pointer. */
@@ -600,33 +603,46 @@ int htNeedsResize(dict *dict) {
 }
 
 /* If the percentage of used slots in the HT reaches HASHTABLE_MIN_FILL
- * we resize the hash table to save memory */
+ * we resize the hash table to save memory. In cluster mode a DB has a dict
+ * per slot: only CRON_DICTS_PER_DB of them are checked at every call. */
 void tryResizeHashTables(int dbid) {
-    if (htNeedsResize(server.db[dbid].dict))
-        dictResize(server.db[dbid].dict);
-    if (htNeedsResize(server.db[dbid].expires))
-        dictResize(server.db[dbid].expires);
+    siderDb *db = &server.db[dbid];
+    for (dbKeyType keyType = DB_MAIN; keyType <= DB_EXPIRES; keyType++) {
+        dbDictState *state = &db->sub_dict[keyType];
+        for (int i = 0; i < CRON_DICTS_PER_DB && i < db->dict_count; i++) {
+            dict *d = dbGetDict(db, state->resize_cursor, keyType);
+            state->resize_cursor = (state->resize_cursor + 1) % db->dict_count;
+            if (htNeedsResize(d)) dictResize(d);
+        }
+    }
 }
 
 /* Our hash table implementation performs rehashing incrementally while
  * we write/read from the hash table. Still if the server is idle, the hash
  * table will use two tables for a long time. So we try to use 1 millisecond
- * of CPU time at every call of this function to perform some rehashing.
+ * of CPU time at every call of this function to perform some rehashing,
+ * in the keyspace dicts of all the DBs, in the order they started
+ * rehashing (see server.rehashing).
  *
  * The function returns 1 if some rehashing was performed, otherwise 0
  * is returned. */
-int incrementallyRehash(int dbid) {
-    /* Keys dictionary */
-    if (dictIsRehashing(server.db[dbid].dict)) {
-        dictRehashMilliseconds(server.db[dbid].dict,1);
-        return 1; /* already used our millisecond for this loop... */
-    }
-    /* Expires */
-    if (dictIsRehashing(server.db[dbid].expires)) {
-        dictRehashMilliseconds(server.db[dbid].expires,1);
-        return 1; /* already used our millisecond for this loop... */
+int incrementallyRehash(void) {
+    if (listLength(server.rehashing) == 0) return 0;
+
+    long long start = ustime();
+    listIter li;
+    listNode *ln;
+    listRewind(server.rehashing,&li);
+    while ((ln = listNext(&li)) != NULL) {
+        dict *d = listNodeValue(ln);
+        /* Note that the node is removed from the list when the rehashing
+         * completes, the iterator already points to the next one. */
+        while (d->pauserehash == 0 && dictRehash(d,100)) {
+            if (ustime()-start >= 1000) return 1;
+        }
+        if (ustime()-start >= 1000) break;
     }
-    return 0;
+    return 1;
 }
 
 /* This function is called once a background process of some kind terminates,
@@ -638,7 +654,7 @@ int incrementallyRehash(int dbid) {
 void updateDictResizePolicy(void) {
     if (server.in_fork_child != CHILD_TYPE_NONE)
         dictSetResizeEnabled(DICT_RESIZE_FORBID);
-    else if (hasActiveChildProcess())
+    else if (hasActiveChildProcess() && !rdbForklessSaveInProgress())
         dictSetResizeEnabled(DICT_RESIZE_AVOID);
     else
         dictSetResizeEnabled(DICT_RESIZE_ENABLE);
@@ -661,6 +677,9 @@ int hasActiveChildProcess(void) {
 }
 
 void resetChildState(void) {
+    /* A fork-less snapshot has the pid of this process, see rdb.c. */
+    int forked = server.child_pid != server.pid;
+
     server.child_type = CHILD_TYPE_NONE;
     server.child_pid = -1;
     server.stat_current_cow_peak = 0;
@@ -671,9 +690,10 @@ void resetChildState(void) {
     server.stat_current_save_keys_total = 0;
     updateDictResizePolicy();
     closeChildInfoPipe();
-    moduleFireServerEvent(REDISMODULE_EVENT_FORK_CHILD,
-                          REDISMODULE_SUBEVENT_FORK_CHILD_DIED,
-                          NULL);
+    if (forked)
+        moduleFireServerEvent(REDISMODULE_EVENT_FORK_CHILD,
+                              REDISMODULE_SUBEVENT_FORK_CHILD_DIED,
+                              NULL);
 }
 
 /* Return if child type is mutually exclusive with other fork children */
@@ -729,9 +749,27 @@ long long getInstantaneousMetric(int metric) {
  *
  * The function always returns 0 as it never terminates the client. */
 int clientsCronResizeQueryBuffer(client *c) {
-    size_t querybuf_size = sdsalloc(c->querybuf);
     time_t idletime = server.unixtime - c->lastinteraction;
 
+    /* Idle clients don't need the argument objects kept for reuse. */
+    if (idletime > 2) freeClientArgvPool(c);
+
+    /* The client has no pending input and borrows the query buffer of the
+     * thread when reading, see takeReusableQueryBuf(). */
+    if (c->querybuf == NULL) return 0;
+
+    /* An idle client with no pending input can go back to borrowing the
+     * query buffer of the thread. */
+    size_t querybuf_size = sdsalloc(c->querybuf);
+    if (idletime > 2 && !(c->flags & CLIENT_MASTER) &&
+        sdslen(c->querybuf) == 0 && c->bulklen == -1)
+    {
+        sdsfree(c->querybuf);
+        c->querybuf = NULL;
+        c->querybuf_peak = 0;
+        return 0;
+    }
+
     /* Only resize the query buffer if the buffer is actually wasting at least a
      * few kbytes */
     if (sdsavail(c->querybuf) > 1024*4) {
@@ -804,10 +842,14 @@ int clientsCronResizeOutputBuffer(client *c, mstime_t now_ms) {
     }
 
     if (new_buffer_size) {
+        size_t old_usable_size = c->buf_usable_size;
         oldbuf = c->buf;
-        c->buf = zmalloc_usable(new_buffer_size, &c->buf_usable_size);
+        if (new_buffer_size == PROTO_REPLY_CHUNK_BYTES)
+            c->buf = replyPoolAlloc(REPLY_POOL_BUF, &c->buf_usable_size);
+        else
+            c->buf = zmalloc_usable(new_buffer_size, &c->buf_usable_size);
         memcpy(c->buf,oldbuf,c->bufpos);
-        zfree(oldbuf);
+        replyPoolRelease(REPLY_POOL_BUF, oldbuf, old_usable_size);
     }
     return 0;
 }
@@ -829,7 +871,7 @@ size_t ClientsPeakMemInput[CLIENTS_PEAK_MEM_USAGE_SLOTS] = {0};
 size_t ClientsPeakMemOutput[CLIENTS_PEAK_MEM_USAGE_SLOTS] = {0};
 
 int clientsCronTrackExpansiveClients(client *c, int time_idx) {
-    size_t in_usage = sdsZmallocSize(c->querybuf) + c->argv_len_sum +
+    size_t in_usage = (c->querybuf ? sdsZmallocSize(c->querybuf) : 0) + c->argv_len_sum +
 	              (c->argv ? zmalloc_size(c->argv) : 0);
     size_t out_usage = getClientOutputBufferMemoryUsage(c);
 
@@ -1067,7 +1109,6 @@ void databasesCron(void) {
          * DB we'll be able to start from the successive in the next
          * cron loop iteration. */
         static unsigned int resize_db = 0;
-        static unsigned int rehash_db = 0;
         int dbs_per_call = CRON_DBS_PER_CALL;
         int j;
 
@@ -1081,20 +1122,7 @@ void databasesCron(void) {
         }
 
         /* Rehash */
-        if (server.activerehashing) {
-            for (j = 0; j < dbs_per_call; j++) {
-                int work_done = incrementallyRehash(rehash_db);
-                if (work_done) {
-                    /* If the function did some work, stop here, we'll do
-                     * more at the next cron loop. */
-                    break;
-                } else {
-                    /* If this db didn't need rehash, we'll try the next one. */
-                    rehash_db++;
-                    rehash_db %= server.dbnum;
-                }
-            }
-        }
+        if (server.activerehashing) incrementallyRehash();
     }
 }
 
@@ -1156,6 +1184,19 @@ void checkChildrenDone(void) {
     int statloc = 0;
     pid_t pid;
 
+    /* A fork-less snapshot is not a process, it's reaped here too. */
+    if (rdbForklessSaveInProgress()) {
+        int exitcode, bysignal;
+
+        if (rdbForklessSaveDone(&exitcode,&bysignal)) {
+            backgroundSaveDoneHandler(exitcode,bysignal);
+            resetChildState();
+            replicationStartPendingFork();
+            return;
+        }
+        if (!ldbPendingChildren()) return;
+    }
+
     if ((pid = waitpid(-1, &statloc, WNOHANG)) != 0) {
         int exitcode = WIFEXITED(statloc) ? WEXITSTATUS(statloc) : -1;
         int bysignal = 0;
@@ -1347,12 +1388,13 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
     if (server.verbosity <= LL_VERBOSE) {
         run_with_period(5000) {
             for (j = 0; j < server.dbnum; j++) {
-                long long size, used, vkeys;
+                long long size = 0, used, vkeys;
 
-                size = dictSlots(server.db[j].dict);
-                used = dictSize(server.db[j].dict);
-                vkeys = dictSize(server.db[j].expires);
+                used = dbSize(&server.db[j], DB_MAIN);
+                vkeys = dbSize(&server.db[j], DB_EXPIRES);
                 if (used || vkeys) {
+                    for (int slot = 0; slot < server.db[j].dict_count; slot++)
+                        size += dictSlots(server.db[j].dict[slot]);
                     serverLog(LL_VERBOSE,"DB %d: %lld keys (%lld volatile) in %lld slots HT.",j,used,vkeys,size);
                 }
             }
@@ -1469,6 +1511,9 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
         run_with_period(1000) replicationCron();
     }
 
+    /* Release the blocks the kernel sent to the freed replicas. */
+    if (listLength(server.repl_zerocopy_orphans)) replicaReapZerocopyOrphans();
+
     /* Run the Sider Cluster cron. */
     run_with_period(100) {
         if (server.cluster_enabled) clusterCron();
@@ -1482,6 +1527,9 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
         migrateCloseTimedoutSockets();
     }
 
+    /* Shrink the reply buffer pools after a burst of clients. */
+    run_with_period(1000) replyPoolsCron();
+
     /* Stop the I/O threads if we don't have enough pending work. */
     stopThreadedIOIfNeeded();
 
@@ -1643,6 +1691,7 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
         processed += handleClientsWithPendingWrites();
         processed += freeClientsInAsyncFreeQueue();
         server.events_processed_while_blocked += processed;
+        bioFlushLazyFreeJobs();
         return;
     }
 
@@ -1655,6 +1704,17 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
     /* If any connection type(typical TLS) still has pending unread data don't sleep at all. */
     aeSetDontWait(server.el, connTypeHasPendingData());
 
+    /* Load some of the keys of the RDB not accessed yet, without sleeping
+     * until they are all loaded. */
+    if (server.loading_on_demand) {
+        rdbOnDemandLoadCycle();
+        if (server.loading_on_demand) aeSetDontWait(server.el, 1);
+    }
+
+    /* Free a bit of the big values deleted with lazyfree-incremental, without
+     * sleeping until they are all freed. */
+    if (incrementalFreeCycle()) aeSetDontWait(server.el, 1);
+
     /* Call the Sider Cluster before sleep function. Note that this function
      * may change the state of Sider Cluster (from ok to fail or vice versa),
      * so it's a good idea to call it before serving the unblocked clients
@@ -1751,6 +1811,9 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
     /* Disconnect some clients if they are consuming too much memory. */
     evictClients();
 
+    /* Hand the objects released in this iteration to the lazyfree threads. */
+    bioFlushLazyFreeJobs();
+
     /* Record cron time in beforeSleep. */
     monotime duration_after_write = getMonotonicUs() - cron_start_time_after_write;
 
@@ -2038,6 +2101,8 @@ void initServerConfig(void) {
     server.aof_rewrite_scheduled = 0;
     server.aof_flush_sleep = 0;
     server.aof_last_fsync = time(NULL);
+    server.aof_fed_offset = 0;
+    server.aof_fsynced_offset = 0;
     server.aof_cur_timestamp = 0;
     atomicSet(server.aof_bio_fsync_status,C_OK);
     server.aof_rewrite_time_last = -1;
@@ -2086,6 +2151,14 @@ void initServerConfig(void) {
     server.repl_transfer_tmpfile = NULL;
     server.repl_transfer_fd = -1;
     server.repl_transfer_s = NULL;
+    server.repl_rdb_channel = 0;
+    server.repl_rdb_client_id = 0;
+    server.repl_stream_s = NULL;
+    server.repl_stream_state = REPL_STREAM_NONE;
+    server.repl_stream_buf = NULL;
+    server.repl_stream_buf_size = 0;
+    server.repl_stream_buf_peak = 0;
+    server.repl_stream_ack_time = 0;
     server.repl_syncio_timeout = CONFIG_REPL_SYNCIO_TIMEOUT;
     server.repl_down_since = 0; /* Never connected, repl is down since EVER. */
     server.master_repl_offset = 0;
@@ -2497,8 +2570,10 @@ void resetServerStats(void) {
     server.stat_expiredkeys = 0;
     server.stat_expired_stale_perc = 0;
     server.stat_expired_time_cap_reached_count = 0;
+    server.stat_expire_index_lag_max = 0;
     server.stat_expire_cycle_time_used = 0;
     server.stat_evictedkeys = 0;
+    server.stat_evictedkeys_background = 0;
     server.stat_evictedclients = 0;
     server.stat_total_eviction_exceeded_time = 0;
     server.stat_last_eviction_exceeded_time = 0;
@@ -2521,6 +2596,14 @@ void resetServerStats(void) {
     server.stat_io_reads_processed = 0;
     atomicSet(server.stat_total_reads_processed, 0);
     server.stat_io_writes_processed = 0;
+    server.stat_io_commands_processed = 0;
+    atomicSet(server.stat_io_threads_spin_usec, 0);
+    atomicSet(server.stat_io_threads_wakeups, 0);
+    server.stat_io_threads_main_wait_usec = 0;
+    server.stat_io_threads_main_wakeups = 0;
+    server.stat_repl_zerocopy_sends = 0;
+    server.stat_repl_zerocopy_bytes = 0;
+    server.stat_repl_zerocopy_copied = 0;
     atomicSet(server.stat_total_writes_processed, 0);
     for (j = 0; j < STATS_METRIC_COUNT; j++) {
         server.inst_metric[j].idx = 0;
@@ -2538,13 +2621,21 @@ void resetServerStats(void) {
     atomicSet(server.stat_net_repl_output_bytes, 0);
     server.stat_unexpected_error_replies = 0;
     server.stat_total_error_replies = 0;
-    server.stat_dump_payload_sanitizations = 0;
+    atomicSet(server.stat_dump_payload_sanitizations, 0);
     server.aof_delayed_fsync = 0;
+    server.stat_aof_writer_batches = 0;
+    server.stat_aof_writer_bytes = 0;
+    server.stat_aof_writer_queue_usec = 0;
+    server.stat_aof_writer_write_usec = 0;
+    server.stat_aof_writer_fsync_usec = 0;
     server.stat_reply_buffer_shrinks = 0;
     server.stat_reply_buffer_expands = 0;
+    server.stat_reply_pool_hits = 0;
+    server.stat_reply_pool_misses = 0;
     memset(server.duration_stats, 0, sizeof(durationStats) * EL_DURATION_TYPE_NUM);
     server.el_cmd_cnt_max = 0;
     lazyfreeResetStats();
+    bioResetLazyFreeStats();
 }
 
 /* Make the thread killable at any time, so that kill threads functions
@@ -2582,8 +2673,10 @@ void initServer(void) {
     server.clients_index = raxNew();
     server.clients_to_close = listCreate();
     server.slaves = listCreate();
+    server.repl_zerocopy_orphans = listCreate();
     server.monitors = listCreate();
     server.clients_pending_write = listCreate();
+    initReplyPools();
     server.clients_pending_read = listCreate();
     server.clients_timeout_table = raxNew();
     server.replication_allowed = 1;
@@ -2628,10 +2721,28 @@ void initServer(void) {
     }
     server.db = zmalloc(sizeof(siderDb)*server.dbnum);
 
+    server.rehashing = listCreate();
+
+    /* Select the hash table implementation of the keyspace. */
+    dbDictType.open_addressing = dbExpiresDictType.open_addressing =
+        server.db_hashtable_type == DB_HASHTABLE_OPEN_ADDRESSING;
+
+    /* The SLRU lists of allkeys-slru link the keyspace entries through their
+     * metadata, which the open addressing tables don't have. */
+    if (server.maxmemory_policy & MAXMEMORY_FLAG_SLRU) {
+        if (dbDictType.open_addressing) {
+            serverLog(LL_WARNING,
+                "The allkeys-slru maxmemory policy requires db-hashtable-type chained.");
+            exit(1);
+        }
+        server.slru_links = 1;
+        dbDictType.dictEntryMetadataBytes = slruEntryMetadataSize;
+        dbDictType.afterReplaceEntry = slruReplaceEntry;
+    }
+
     /* Create the Sider databases, and initialize other internal state. */
     for (j = 0; j < server.dbnum; j++) {
-        server.db[j].dict = dictCreate(&dbDictType);
-        server.db[j].expires = dictCreate(&dbExpiresDictType);
+        dbInitDicts(&server.db[j]);
         server.db[j].expires_cursor = 0;
         server.db[j].blocking_keys = dictCreate(&keylistDictType);
         server.db[j].blocking_keys_unblock_on_nokey = dictCreate(&objectKeyPointerValueDictType);
@@ -2640,7 +2751,6 @@ void initServer(void) {
         server.db[j].id = j;
         server.db[j].avg_ttl = 0;
         server.db[j].defrag_later = listCreate();
-        server.db[j].slots_to_keys = NULL; /* Set by clusterInit later on if necessary. */
         listSetFreeMethod(server.db[j].defrag_later,(void (*)(void*))sdsfree);
     }
     evictionPoolAlloc(); /* Initialize the LRU keys pool. */
@@ -2665,6 +2775,8 @@ void initServer(void) {
     server.child_info_pipe[1] = -1;
     server.child_info_nread = 0;
     server.aof_buf = sdsempty();
+    server.aof_block = sdsempty();
+    server.aof_binary = 0;
     server.lastsave = time(NULL); /* At startup we consider the DB saved. */
     server.lastbgsave_try = 0;    /* At startup we never tried to BGSAVE. */
     server.rdb_save_time_last = -1;
@@ -2682,6 +2794,7 @@ void initServer(void) {
     server.stat_current_save_keys_processed = 0;
     server.stat_current_save_keys_total = 0;
     server.stat_rdb_cow_bytes = 0;
+    server.stat_rdb_forkless_preserved_keys = 0;
     server.stat_aof_cow_bytes = 0;
     server.stat_module_cow_bytes = 0;
     server.stat_module_progress = 0;
@@ -3516,6 +3629,11 @@ void call(client *c, int flags) {
     if (monotonicGetType() == MONOTONIC_CLOCK_HW)
         monotonic_start = getMonotonicUs();
 
+    /* A fork-less snapshot must save the keys of the command before they
+     * are changed, see rdbForklessCommandKeys(). */
+    if (server.rdb_forkless_tracking && c->cmd->flags & CMD_WRITE)
+        rdbForklessCommandKeys(c);
+
     c->cmd->proc(c);
 
     exitExecutionUnit();
@@ -3682,6 +3800,10 @@ void call(client *c, int flags) {
     if (old_master_repl_offset != server.master_repl_offset)
         c->woff = server.master_repl_offset;
 
+    /* Remember the AOF offset the reply may depend on, which includes the
+     * writes observed by read only commands. */
+    c->aof_woff = server.aof_fed_offset;
+
     /* Client pause takes effect after a transaction has finished. This needs
      * to be located after everything is propagated. */
     if (!server.in_exec && server.client_pause_in_transaction) {
@@ -4105,6 +4227,17 @@ int processCommand(client *c) {
         return C_OK;
     }
 
+    /* While the RDB is loaded on demand only the keys of the command are
+     * loaded before it's executed, so the keyspace commands without keys
+     * (KEYS, SCAN, DBSIZE...) must wait for all the keys to be loaded. */
+    if (server.loading_on_demand && is_denyloading_command && !obey_client &&
+        (c->cmd->acl_categories & ACL_CATEGORY_KEYSPACE) &&
+        !doesCommandHaveKeys(c->cmd))
+    {
+        rejectCommand(c, shared.loadingerr);
+        return C_OK;
+    }
+
     /* when a busy job is being done (script / module)
      * Only allow a limited number of commands.
      * Note that we need to allow the transactions commands, otherwise clients
@@ -4179,6 +4312,16 @@ void incrementErrorCount(const char *fullerr, size_t namelen) {
 
 /*================================== Shutdown =============================== */
 
+/* Close a listening socket. With the io_uring backend the poll request in
+ * flight keeps the socket listening after close(2) until the event is
+ * deleted. A forked child must not touch the event loop it shares with the
+ * parent, and only closes its copy of the fd. */
+static void closeListeningSocket(int fd) {
+    if (fd == -1) return;
+    if (!server.in_fork_child) aeDeleteFileEvent(server.el, fd, AE_READABLE);
+    close(fd);
+}
+
 /* Close listening sockets. Also unlink the unix domain socket if
  * unlink_unix_socket is non-zero. */
 void closeListeningSockets(int unlink_unix_socket) {
@@ -4189,11 +4332,11 @@ void closeListeningSockets(int unlink_unix_socket) {
         if (listener->ct == NULL)
             continue;
 
-        for (j = 0; j < listener->count; j++) close(listener->fd[j]);
+        for (j = 0; j < listener->count; j++) closeListeningSocket(listener->fd[j]);
     }
 
     if (server.cluster_enabled)
-        for (j = 0; j < server.clistener.count; j++) close(server.clistener.fd[j]);
+        for (j = 0; j < server.clistener.count; j++) closeListeningSocket(server.clistener.fd[j]);
     if (unlink_unix_socket && server.unixsocket) {
         serverLog(LL_NOTICE,"Removing the unix socket file.");
         if (unlink(server.unixsocket) != 0)
@@ -5665,10 +5808,13 @@ sds genSiderInfoString(dict *section_dict, int all_sections, int everything) {
             "mem_clients_normal:%zu\r\n"
             "mem_cluster_links:%zu\r\n"
             "mem_aof_buffer:%zu\r\n"
+            "mem_reply_buffer_pools:%zu\r\n"
             "mem_allocator:%s\r\n"
             "active_defrag_running:%d\r\n"
             "lazyfree_pending_objects:%zu\r\n"
-            "lazyfreed_objects:%zu\r\n",
+            "lazyfreed_objects:%zu\r\n"
+            "lazyfree_incremental_pending_objects:%zu\r\n"
+            "lazyfree_incremental_freed_objects:%zu\r\n",
             zmalloc_used,
             hmem,
             server.cron_malloc_stats.process_rss,
@@ -5719,10 +5865,13 @@ sds genSiderInfoString(dict *section_dict, int all_sections, int everything) {
             mh->clients_normal,
             mh->cluster_links,
             mh->aof_buffer,
+            mh->reply_pools,
             ZMALLOC_LIB,
             server.active_defrag_running,
             lazyfreeGetPendingObjectsCount(),
-            lazyfreeGetFreedObjectsCount()
+            lazyfreeGetFreedObjectsCount(),
+            incrementalFreeGetPendingObjectsCount(),
+            incrementalFreeGetFreedObjectsCount()
         );
         freeMemoryOverheadData(mh);
     }
@@ -5743,6 +5892,7 @@ sds genSiderInfoString(dict *section_dict, int all_sections, int everything) {
             "# Persistence\r\n"
             "loading:%d\r\n"
             "async_loading:%d\r\n"
+            "loading_on_demand:%d\r\n"
             "current_cow_peak:%zu\r\n"
             "current_cow_size:%zu\r\n"
             "current_cow_size_age:%lu\r\n"
@@ -5757,6 +5907,7 @@ sds genSiderInfoString(dict *section_dict, int all_sections, int everything) {
             "rdb_current_bgsave_time_sec:%jd\r\n"
             "rdb_saves:%lld\r\n"
             "rdb_last_cow_size:%zu\r\n"
+            "rdb_forkless_preserved_keys:%lld\r\n"
             "rdb_last_load_keys_expired:%lld\r\n"
             "rdb_last_load_keys_loaded:%lld\r\n"
             "aof_enabled:%d\r\n"
@@ -5773,6 +5924,7 @@ sds genSiderInfoString(dict *section_dict, int all_sections, int everything) {
             "module_fork_last_cow_size:%zu\r\n",
             (int)(server.loading && !server.async_loading),
             (int)server.async_loading,
+            server.loading_on_demand,
             server.stat_current_cow_peak,
             server.stat_current_cow_bytes,
             server.stat_current_cow_updated ? (unsigned long) elapsedMs(server.stat_current_cow_updated) / 1000 : 0,
@@ -5788,6 +5940,7 @@ sds genSiderInfoString(dict *section_dict, int all_sections, int everything) {
                 -1 : time(NULL)-server.rdb_save_time_start),
             server.stat_rdb_saves,
             server.stat_rdb_cow_bytes,
+            server.stat_rdb_forkless_preserved_keys,
             server.rdb_last_load_keys_expired,
             server.rdb_last_load_keys_loaded,
             server.aof_state != AOF_OFF,
@@ -5812,16 +5965,26 @@ sds genSiderInfoString(dict *section_dict, int all_sections, int everything) {
                 "aof_pending_rewrite:%d\r\n"
                 "aof_buffer_length:%zu\r\n"
                 "aof_pending_bio_fsync:%lu\r\n"
-                "aof_delayed_fsync:%lu\r\n",
+                "aof_delayed_fsync:%lu\r\n"
+                "aof_writer_batches:%lld\r\n"
+                "aof_writer_bytes:%lld\r\n"
+                "aof_writer_queue_usec:%lld\r\n"
+                "aof_writer_write_usec:%lld\r\n"
+                "aof_writer_fsync_usec:%lld\r\n",
                 (long long) server.aof_current_size,
                 (long long) server.aof_rewrite_base_size,
                 server.aof_rewrite_scheduled,
-                sdslen(server.aof_buf),
+                sdslen(server.aof_buf)+sdslen(server.aof_block),
                 bioPendingJobsOfType(BIO_AOF_FSYNC),
-                server.aof_delayed_fsync);
+                server.aof_delayed_fsync,
+                server.stat_aof_writer_batches,
+                server.stat_aof_writer_bytes,
+                server.stat_aof_writer_queue_usec,
+                server.stat_aof_writer_write_usec,
+                server.stat_aof_writer_fsync_usec);
         }
 
-        if (server.loading) {
+        if (server.loading || server.loading_on_demand) {
             double perc = 0;
             time_t eta, elapsed;
             off_t remaining_bytes = 1;
@@ -5859,6 +6022,11 @@ sds genSiderInfoString(dict *section_dict, int all_sections, int everything) {
                 perc,
                 (intmax_t)eta
             );
+            if (server.loading_on_demand) {
+                info = sdscatprintf(info,
+                    "loading_on_demand_keys_left:%llu\r\n",
+                    rdbOnDemandKeysLeft());
+            }
         }
     }
 
@@ -5867,6 +6035,8 @@ sds genSiderInfoString(dict *section_dict, int all_sections, int everything) {
         long long stat_total_reads_processed, stat_total_writes_processed;
         long long stat_net_input_bytes, stat_net_output_bytes;
         long long stat_net_repl_input_bytes, stat_net_repl_output_bytes;
+        long long stat_io_threads_spin_usec, stat_io_threads_wakeups;
+        long long stat_dump_payload_sanitizations;
         long long current_eviction_exceeded_time = server.stat_last_eviction_exceeded_time ?
             (long long) elapsedUs(server.stat_last_eviction_exceeded_time): 0;
         long long current_active_defrag_time = server.stat_last_active_defrag_time ?
@@ -5877,6 +6047,9 @@ sds genSiderInfoString(dict *section_dict, int all_sections, int everything) {
         atomicGet(server.stat_net_output_bytes, stat_net_output_bytes);
         atomicGet(server.stat_net_repl_input_bytes, stat_net_repl_input_bytes);
         atomicGet(server.stat_net_repl_output_bytes, stat_net_repl_output_bytes);
+        atomicGet(server.stat_io_threads_spin_usec, stat_io_threads_spin_usec);
+        atomicGet(server.stat_io_threads_wakeups, stat_io_threads_wakeups);
+        atomicGet(server.stat_dump_payload_sanitizations, stat_dump_payload_sanitizations);
 
         if (sections++) info = sdscat(info,"\r\n");
         info = sdscatprintf(info,
@@ -5900,7 +6073,11 @@ sds genSiderInfoString(dict *section_dict, int all_sections, int everything) {
             "expired_stale_perc:%.2f\r\n"
             "expired_time_cap_reached_count:%lld\r\n"
             "expire_cycle_cpu_milliseconds:%lld\r\n"
+            "expire_index_keys:%llu\r\n"
+            "expire_index_lag_ms:%lld\r\n"
+            "expire_index_lag_max_ms:%lld\r\n"
             "evicted_keys:%lld\r\n"
+            "evicted_keys_background:%lld\r\n"
             "evicted_clients:%lld\r\n"
             "total_eviction_exceeded_time:%lld\r\n"
             "current_eviction_exceeded_time:%lld\r\n"
@@ -5929,8 +6106,19 @@ sds genSiderInfoString(dict *section_dict, int all_sections, int everything) {
             "total_writes_processed:%lld\r\n"
             "io_threaded_reads_processed:%lld\r\n"
             "io_threaded_writes_processed:%lld\r\n"
+            "io_threaded_commands_processed:%lld\r\n"
+            "io_threads_spin_usec:%lld\r\n"
+            "io_threads_wakeups:%lld\r\n"
+            "io_threads_main_wait_usec:%lld\r\n"
+            "io_threads_main_wakeups:%lld\r\n"
+            "repl_zerocopy_sends:%lld\r\n"
+            "repl_zerocopy_bytes:%lld\r\n"
+            "repl_zerocopy_copied:%lld\r\n"
+            "repl_zerocopy_orphaned_sends:%lu\r\n"
             "reply_buffer_shrinks:%lld\r\n"
             "reply_buffer_expands:%lld\r\n"
+            "reply_buffer_pool_hits:%lld\r\n"
+            "reply_buffer_pool_misses:%lld\r\n"
             "eventloop_cycles:%llu\r\n"
             "eventloop_duration_sum:%llu\r\n"
             "eventloop_duration_cmd_sum:%llu\r\n"
@@ -5955,7 +6143,11 @@ sds genSiderInfoString(dict *section_dict, int all_sections, int everything) {
             server.stat_expired_stale_perc*100,
             server.stat_expired_time_cap_reached_count,
             server.stat_expire_cycle_time_used/1000,
+            expireIndexSize(),
+            expireIndexLag(),
+            server.stat_expire_index_lag_max,
             server.stat_evictedkeys,
+            server.stat_evictedkeys_background,
             server.stat_evictedclients,
             (server.stat_total_eviction_exceeded_time + current_eviction_exceeded_time) / 1000,
             current_eviction_exceeded_time / 1000,
@@ -5979,18 +6171,30 @@ sds genSiderInfoString(dict *section_dict, int all_sections, int everything) {
             (unsigned long long) trackingGetTotalPrefixes(),
             server.stat_unexpected_error_replies,
             server.stat_total_error_replies,
-            server.stat_dump_payload_sanitizations,
+            stat_dump_payload_sanitizations,
             stat_total_reads_processed,
             stat_total_writes_processed,
             server.stat_io_reads_processed,
             server.stat_io_writes_processed,
+            server.stat_io_commands_processed,
+            stat_io_threads_spin_usec,
+            stat_io_threads_wakeups,
+            server.stat_io_threads_main_wait_usec,
+            server.stat_io_threads_main_wakeups,
+            server.stat_repl_zerocopy_sends,
+            server.stat_repl_zerocopy_bytes,
+            server.stat_repl_zerocopy_copied,
+            replicaZerocopyOrphanedSends(),
             server.stat_reply_buffer_shrinks,
             server.stat_reply_buffer_expands,
+            server.stat_reply_pool_hits,
+            server.stat_reply_pool_misses,
             server.duration_stats[EL_DURATION_TYPE_EL].cnt,
             server.duration_stats[EL_DURATION_TYPE_EL].sum,
             server.duration_stats[EL_DURATION_TYPE_CMD].sum,
             getInstantaneousMetric(STATS_METRIC_EL_CYCLE),
             getInstantaneousMetric(STATS_METRIC_EL_DURATION));
+        info = bioGenLazyFreeInfoString(info);
         info = genSiderInfoStringACLStats(info);
     }
 
@@ -6057,6 +6261,11 @@ sds genSiderInfoString(dict *section_dict, int all_sections, int everything) {
                     server.repl_down_since ?
                     (intmax_t)(server.unixtime-server.repl_down_since) : -1);
             }
+            info = sdscatprintf(info,
+                "replica_full_sync_buffer_size:%zu\r\n"
+                "replica_full_sync_buffer_peak:%zu\r\n",
+                server.repl_stream_buf_size,
+                server.repl_stream_buf_peak);
             info = sdscatprintf(info,
                 "slave_priority:%d\r\n"
                 "slave_read_only:%d\r\n"
@@ -6216,8 +6425,8 @@ sds genSiderInfoString(dict *section_dict, int all_sections, int everything) {
         for (j = 0; j < server.dbnum; j++) {
             long long keys, vkeys;
 
-            keys = dictSize(server.db[j].dict);
-            vkeys = dictSize(server.db[j].expires);
+            keys = dbSize(&server.db[j], DB_MAIN);
+            vkeys = dbSize(&server.db[j], DB_EXPIRES);
             if (keys || vkeys) {
                 info = sdscatprintf(info,
                     "db%d:keys=%lld,expires=%lld,avg_ttl=%lld\r\n",
@@ -6586,6 +6795,9 @@ void closeChildUnusedResourceAfterFork(void) {
 
 /* purpose is one of CHILD_TYPE_ types */
 int siderFork(int purpose) {
+    /* The child must see the keys not loaded yet. */
+    if (server.loading_on_demand) rdbOnDemandLoadAll();
+
     if (isMutuallyExclusiveChildType(purpose)) {
         if (hasActiveChildProcess()) {
             errno = EEXIST;
@@ -6687,7 +6899,7 @@ void dismissMemory(void* ptr, size_t size_hint) {
 void dismissClientMemory(client *c) {
     /* Dismiss client query buffer and static reply buffer. */
     dismissMemory(c->buf, c->buf_usable_size);
-    dismissSds(c->querybuf);
+    if (c->querybuf) dismissSds(c->querybuf);
     /* Dismiss argv array only if we estimate it contains a big buffer. */
     if (c->argc && c->argv_len_sum/c->argc >= server.page_size) {
         for (int i = 0; i < c->argc; i++) {
@@ -6708,7 +6920,7 @@ void dismissClientMemory(client *c) {
             clientReplyBlock *bulk = listNodeValue(ln);
             /* Default bulk size is 16k, actually it has extra data, maybe it
              * occupies 20k according to jemalloc bin size if using jemalloc. */
-            if (bulk) dismissMemory(bulk, bulk->size);
+            if (bulk && !bulk->obj) dismissMemory(bulk, bulk->size);
         }
     }
 }
@@ -6777,7 +6989,11 @@ void loadDataFromDisk(void) {
             createReplicationBacklog();
             rdb_flags |= RDBFLAGS_FEED_REPL;
         }
-        int rdb_load_ret = rdbLoad(server.rdb_filename, &rsi, rdb_flags);
+        int rdb_load_ret = rdbLoadParts(server.rdb_filename, &rsi, rdb_flags);
+        if (rdb_load_ret == RDB_NOT_EXIST)
+            rdb_load_ret = rdbLoadOnDemand(server.rdb_filename, &rsi, rdb_flags);
+        if (rdb_load_ret == RDB_NOT_EXIST)
+            rdb_load_ret = rdbLoad(server.rdb_filename, &rsi, rdb_flags);
         if (rdb_load_ret == RDB_OK) {
             serverLog(LL_NOTICE,"DB loaded from disk: %.3f seconds",
                 (float)(ustime()-start)/1000000);
@@ -6994,6 +7210,7 @@ int iAmMaster(void) {
 #ifdef REDIS_TEST
 #include "testhelp.h"
 #include "intset.h"  /* Compact integer set structure */
+#include "respscan.h"
 
 int __failed_tests = 0;
 int __test_num = 0;
@@ -7018,7 +7235,8 @@ struct siderTest {
     {"zmalloc", zmalloc_test},
     {"sds", sdsTest},
     {"dict", dictTest},
-    {"listpack", listpackTest}
+    {"listpack", listpackTest},
+    {"respscan", respScanTest}
 };
 siderTestProc *getTestProcByName(const char *name) {
     int numtests = sizeof(siderTests)/sizeof(struct siderTest);
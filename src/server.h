@@ -116,6 +116,7 @@ struct hdr_histogram;
 #define CONFIG_MAX_HZ            500
 #define MAX_CLIENTS_PER_CLOCK_TICK 200          /* HZ is adapted based on that. */
 #define CRON_DBS_PER_CALL 16
+#define CRON_DICTS_PER_DB 16
 #define NET_MAX_WRITES_PER_EVENT (1024*64)
 #define PROTO_SHARED_SELECT_CMDS 10
 #define OBJ_SHARED_INTEGERS 10000
@@ -175,10 +176,15 @@ struct hdr_histogram;
 /* Protocol and I/O related defines */
 #define PROTO_IOBUF_LEN         (1024*16)  /* Generic I/O buffer size */
 #define PROTO_REPLY_CHUNK_BYTES (16*1024) /* 16k output buffer */
+#define PROTO_REPLY_REF_MIN_BYTES (64*1024) /* Bulk replies referenced instead of copied */
 #define PROTO_INLINE_MAX_SIZE   (1024*64) /* Max size of inline reads */
 #define PROTO_MBULK_BIG_ARG     (1024*32)
+#define CLIENT_ARGV_POOL_SIZE   16        /* Argument objects kept for reuse. */
+#define CLIENT_ARGV_POOL_MAX_LEN 1024     /* Max string size of reused arguments. */
+#define CLIENT_ARGV_KEEP_LEN    64        /* Max argv array size kept across commands. */
 #define PROTO_RESIZE_THRESHOLD  (1024*32) /* Threshold for determining whether to resize query buffer */
 #define PROTO_REPLY_MIN_BYTES   (1024) /* the lower limit on reply buffer size */
+#define REPLY_POOL_MAX_LEN      256       /* Max free buffers kept in a reply pool. */
 #define REDIS_AUTOSYNC_BYTES (1024*1024*4) /* Sync file every 4MB. */
 
 #define REPLY_BUFFER_DEFAULT_PEAK_RESET_TIME 5000 /* 5 seconds */
@@ -400,6 +406,11 @@ extern int configOOMScoreAdjValuesDefaults[CONFIG_OOM_COUNT];
                                                     auth had been authenticated from the Module. */
 #define CLIENT_MODULE_PREVENT_AOF_PROP (1ULL<<48) /* Module client do not want to propagate to AOF */
 #define CLIENT_MODULE_PREVENT_REPL_PROP (1ULL<<49) /* Module client do not want to propagate to replica */
+#define CLIENT_REUSABLE_QUERYBUFFER (1ULL<<50) /* The client borrowed the query buffer of
+                                                  the thread, see takeReusableQueryBuf(). */
+#define CLIENT_REPL_RDB_CHANNEL (1ULL<<51) /* This client is a replica that receives the
+                                              RDB of a full sync on a connection of its own,
+                                              while the replication stream is sent to another. */
 
 /* Client block type (btype field in client structure)
  * if CLIENT_BLOCKED flag is set. */
@@ -452,6 +463,16 @@ typedef enum {
     REPL_STATE_CONNECTED,       /* Connected to master */
 } repl_state;
 
+/* State of the connection receiving the replication stream in a dual channel
+ * sync, while the RDB is transferred on the handshake connection. */
+typedef enum {
+    REPL_STREAM_NONE = 0,               /* No replication stream connection */
+    REPL_STREAM_CONNECTING,             /* Connecting to master */
+    REPL_STREAM_RECEIVE_HANDSHAKE_REPLY,/* Wait for AUTH and REPLCONF replies */
+    REPL_STREAM_RECEIVE_PSYNC_REPLY,    /* Wait for PSYNC reply */
+    REPL_STREAM_BUFFERING,              /* Buffering the replication stream */
+} repl_stream_state;
+
 /* The state of an in progress coordinated failover */
 typedef enum {
     NO_FAILOVER = 0,        /* No failover in progress */
@@ -516,6 +537,10 @@ typedef enum {
 #define SUPERVISED_SYSTEMD 2
 #define SUPERVISED_UPSTART 3
 
+/* Hash table implementations of the keyspace, see db-hashtable-type. */
+#define DB_HASHTABLE_CHAINED 0
+#define DB_HASHTABLE_OPEN_ADDRESSING 1
+
 /* Anti-warning macro... */
 #define UNUSED(V) ((void) V)
 
@@ -527,11 +552,25 @@ typedef enum {
 #define AOF_FSYNC_ALWAYS 1
 #define AOF_FSYNC_EVERYSEC 2
 
+/* Formats of the INCR AOF files, and compression of the blocks of the binary
+ * format (AOF_COMPRESSION_* is also the type byte of the blocks). */
+#define AOF_FORMAT_RESP 0
+#define AOF_FORMAT_BINARY 1
+#define AOF_COMPRESSION_NO 0
+#define AOF_COMPRESSION_LZF 1
+#define AOF_COMPRESSION_LZ4 2
+#define AOF_COMPRESSION_ZSTD 3
+
 /* Replication diskless load defines */
 #define REPL_DISKLESS_LOAD_DISABLED 0
 #define REPL_DISKLESS_LOAD_WHEN_DB_EMPTY 1
 #define REPL_DISKLESS_LOAD_SWAPDB 2
 
+/* RDB compression algorithms */
+#define RDB_COMPRESSION_LZF 0
+#define RDB_COMPRESSION_LZ4 1
+#define RDB_COMPRESSION_ZSTD 2
+
 /* TLS Client Authentication */
 #define TLS_CLIENT_AUTH_NO 0
 #define TLS_CLIENT_AUTH_YES 1
@@ -563,6 +602,7 @@ typedef enum {
 #define MAXMEMORY_FLAG_LRU (1<<0)
 #define MAXMEMORY_FLAG_LFU (1<<1)
 #define MAXMEMORY_FLAG_ALLKEYS (1<<2)
+#define MAXMEMORY_FLAG_SLRU (1<<3)
 #define MAXMEMORY_FLAG_NO_SHARED_INTEGERS \
     (MAXMEMORY_FLAG_LRU|MAXMEMORY_FLAG_LFU)
 
@@ -574,6 +614,7 @@ typedef enum {
 #define MAXMEMORY_ALLKEYS_LFU ((5<<8)|MAXMEMORY_FLAG_LFU|MAXMEMORY_FLAG_ALLKEYS)
 #define MAXMEMORY_ALLKEYS_RANDOM ((6<<8)|MAXMEMORY_FLAG_ALLKEYS)
 #define MAXMEMORY_NO_EVICTION (7<<8)
+#define MAXMEMORY_ALLKEYS_SLRU ((8<<8)|MAXMEMORY_FLAG_SLRU|MAXMEMORY_FLAG_ALLKEYS)
 
 /* Units */
 #define UNIT_SECONDS 0
@@ -889,6 +930,10 @@ struct SiderModuleDigest {
 #define OBJ_ENCODING_STREAM 10 /* Encoded as a radix tree of listpacks */
 #define OBJ_ENCODING_LISTPACK 11 /* Encoded as a listpack */
 
+/* Strings up to this size are created with the EMBSTR encoding, see
+ * createStringObject(). */
+#define OBJ_ENCODING_EMBSTR_SIZE_LIMIT 44
+
 #define LRU_BITS 24
 #define LRU_CLOCK_MAX ((1<<LRU_BITS)-1) /* Max value of obj->lru */
 #define LRU_CLOCK_RESOLUTION 1000 /* LRU clock resolution in ms */
@@ -925,12 +970,34 @@ char *getObjectTypeName(robj*);
 struct evictionPoolEntry; /* Defined in evict.c */
 
 /* This structure is used in order to represent the output buffer of a client,
- * which is actually a linked list of blocks like that, that is: client->reply. */
+ * which is actually a linked list of blocks like that, that is: client->reply.
+ *
+ * Instead of owning its payload in 'buf', a block may reference a large
+ * string object: the value is then sent directly from the sds of 'obj', and
+ * 'size' and 'used' are both its length. See addReplyBulk(). */
 typedef struct clientReplyBlock {
     size_t size, used;
+    robj *obj;
     char buf[];
 } clientReplyBlock;
 
+/* Return the payload of a reply block. */
+#define replyBlockData(o) ((o)->obj ? (char*)(o)->obj->ptr : (o)->buf)
+
+/* Free lists of the standard sized reply buffers, shared by all the clients.
+ * There is a pool for the static client buffer 'c->buf' and one for the
+ * PROTO_REPLY_CHUNK_BYTES reply list blocks. See replyPoolAlloc(). */
+#define REPLY_POOL_BUF 0
+#define REPLY_POOL_BLOCK 1
+#define REPLY_POOL_CLASSES 2
+
+typedef struct replyBufferPool {
+    void *free;         /* Free buffers, linked through their first word. */
+    size_t usable;      /* Usable size of every buffer of the pool. */
+    int len;            /* Number of buffers in the free list. */
+    int min_len;        /* Lowest 'len' since the last replyPoolsCron(). */
+} replyBufferPool;
+
 /* Replication buffer blocks is the list of replBufBlock.
  *
  * +--------------+       +--------------+       +--------------+
@@ -958,15 +1025,54 @@ typedef struct replBufBlock {
     char buf[];
 } replBufBlock;
 
-/* Opaque type for the Slot to Key API. */
-typedef struct clusterSlotToKeyMapping clusterSlotToKeyMapping;
+/* The two kinds of keyspace dictionaries of a database. */
+typedef enum dbKeyType {
+    DB_MAIN,
+    DB_EXPIRES
+} dbKeyType;
+
+/* Bookkeeping of the keyspace dictionaries of one kind, see siderDb. */
+typedef struct dbDictState {
+    unsigned long long key_count;       /* Total number of keys in the dicts. */
+    int non_empty_dicts;                /* Number of dicts holding keys. */
+    unsigned long long *slot_size_index; /* Binary indexed tree of the number
+                                          * of keys per slot, used to pick a
+                                          * slot or to find the next non empty
+                                          * one. Only used in cluster mode. */
+    int resize_cursor;                  /* Next dict to check for a resize. */
+} dbDictState;
+
+/* Segments of the segmented LRU of the keys, see allkeys-slru. */
+#define SLRU_PROBATION 0
+#define SLRU_PROTECTED 1
+
+/* Segmented LRU lists of the keys of a DB, linking the entries of the
+ * keyspace dicts through their metadata. Most recently used keys first. */
+typedef struct dbSlru {
+    dictEntry *head[2], *tail[2];   /* Indexed by SLRU_PROBATION/PROTECTED. */
+    unsigned long len[2];
+} dbSlru;
+
+/* Metadata of every keyspace dict. */
+typedef struct dbDictMetadata {
+    listNode *rehashing_node;   /* Node in server.rehashing, if rehashing. */
+    dbSlru *slru;               /* Lists of the entries of the dict, shared by
+                                 * the dicts of the DB. */
+} dbDictMetadata;
 
 /* Sider database representation. There are multiple databases identified
  * by integers from 0 (the default database) up to the max configured
  * database. The database number is the 'id' field in the structure. */
 typedef struct siderDb {
-    dict *dict;                 /* The keyspace for this DB */
-    dict *expires;              /* Timeout of keys with a timeout set */
+    dict **dict;                /* The keyspace for this DB, one dict per
+                                 * cluster slot in cluster mode. */
+    dict **expires;             /* Timeout of keys with a timeout set, with
+                                 * the same layout as 'dict'. */
+    int dict_count;             /* Number of dicts in 'dict' and 'expires'. */
+    rax *expires_index;         /* Keys with a timeout ordered by expire time,
+                                 * NULL unless active-expire-index is on. */
+    dbSlru *slru;               /* Segmented LRU of the keys, NULL unless the
+                                 * keyspace entries have SLRU links. */
     dict *blocking_keys;        /* Keys with clients waiting for data (BLPOP)*/
     dict *blocking_keys_unblock_on_nokey;   /* Keys with clients waiting for
                                              * data, and should be unblocked if key is deleted (XREADEDGROUP).
@@ -975,9 +1081,10 @@ typedef struct siderDb {
     dict *watched_keys;         /* WATCHED keys for MULTI/EXEC CAS */
     int id;                     /* Database ID */
     long long avg_ttl;          /* Average TTL, just for stats */
-    unsigned long expires_cursor; /* Cursor of the active expire cycle. */
+    unsigned long long expires_cursor; /* Cursor of the active expire cycle. */
     list *defrag_later;         /* List of key names to attempt to defrag one by one, gradually. */
-    clusterSlotToKeyMapping *slots_to_keys; /* Array of slots to keys. Only used in cluster mode (db 0). */
+    dbDictState sub_dict[2];    /* Stats of 'dict' and 'expires', indexed by
+                                 * dbKeyType. */
 } siderDb;
 
 /* forward declaration for functions ctx */
@@ -991,6 +1098,7 @@ typedef struct functionsLibCtx functionsLibCtx;
 typedef struct rdbLoadingCtx {
     siderDb* dbarray;
     functionsLibCtx* functions_lib_ctx;
+    int header_only;        /* Stop before the keys (on-demand loading). */
 }rdbLoadingCtx;
 
 /* Client MULTI/EXEC state */
@@ -1168,6 +1276,9 @@ typedef struct client {
     int original_argc;      /* Num of arguments of original command if arguments were rewritten. */
     robj **original_argv;   /* Arguments of original command if arguments were rewritten. */
     size_t argv_len_sum;    /* Sum of lengths of objects in argv list. */
+    robj *argv_pool[CLIENT_ARGV_POOL_SIZE]; /* Released argument objects to reuse,
+                                               see createClientArgvObject(). */
+    int argv_pool_len;      /* Number of objects in argv_pool. */
     struct siderCommand *cmd, *lastcmd;  /* Last command executed. */
     struct siderCommand *realcmd; /* The original command that was executed by the client,
                                      Used to update error stats in case the c->cmd was modified
@@ -1211,9 +1322,12 @@ typedef struct client {
     char *slave_addr;       /* Optionally given by REPLCONF ip-address */
     int slave_capa;         /* Slave capabilities: SLAVE_CAPA_* bitwise OR. */
     int slave_req;          /* Slave requirements: SLAVE_REQ_* */
+    uint64_t rdb_client_id; /* The RDB channel of this replica, as set with
+                               REPLCONF rdb-client-id. */
     multiState mstate;      /* MULTI/EXEC state */
     blockingState bstate;     /* blocking state */
     long long woff;         /* Last write global replication offset. */
+    long long aof_woff;     /* AOF offset the replies of the client depend on. */
     list *watched_keys;     /* Keys WATCHED for MULTI/EXEC CAS */
     dict *pubsub_channels;  /* channels a client is interested in (SUBSCRIBE) */
     dict *pubsub_patterns;  /* patterns a client is interested in (PSUBSCRIBE) */
@@ -1223,6 +1337,9 @@ typedef struct client {
     listNode *client_list_node; /* list node in client list */
     listNode *postponed_list_node; /* list node within the postponed list */
     listNode *pending_read_list_node; /* list node in clients pending read list */
+    int io_thread;          /* I/O thread event loop reading from the client,
+                               0 if served by the main thread. */
+    sds io_thread_pending;  /* Data read by the I/O thread while protected. */
     void *module_blocked_client; /* Pointer to the SiderModuleBlockedClient associated with this
                                   * client. This is set in case of module authentication before the
                                   * unblocked client is reprocessed to handle reply callbacks. */
@@ -1261,6 +1378,11 @@ typedef struct client {
                                   * see the definition of replBufBlock. */
     size_t ref_block_pos;        /* Access position of referenced buffer block,
                                   * i.e. the next offset to send. */
+    int repl_zerocopy;           /* 1 if MSG_ZEROCOPY is enabled on the replica
+                                  * connection, -1 if it's not supported. */
+    uint32_t repl_zerocopy_id;   /* Id of the next MSG_ZEROCOPY send. */
+    list *repl_zerocopy_blocks;  /* Blocks of the MSG_ZEROCOPY sends the kernel
+                                  * is not done with, in order of id. */
 
     /* list node in clients_pending_write list */
     listNode clients_pending_write_node;
@@ -1396,6 +1518,7 @@ struct siderMemOverhead {
     size_t clients_normal;
     size_t cluster_links;
     size_t aof_buffer;
+    size_t reply_pools;
     size_t lua_caches;
     size_t functions_caches;
     size_t overhead_total;
@@ -1417,7 +1540,6 @@ struct siderMemOverhead {
         size_t dbid;
         size_t overhead_ht_main;
         size_t overhead_ht_expires;
-        size_t overhead_ht_slot_to_keys;
     } *db;
 };
 
@@ -1494,8 +1616,17 @@ typedef struct {
     sds           file_name;  /* file name */
     long long     file_seq;   /* file sequence */
     aof_file_type file_type;  /* file type */
+    int           file_format; /* AOF_FORMAT_* of INCR files */
 } aofInfo;
 
+/* A block of a binary INCR AOF, being decoded. */
+typedef struct aofBinaryBlock {
+    sds payload;        /* Decompressed commands of the block. */
+    size_t pos;         /* Offset of the next command in the payload. */
+    sds *names;         /* Command names defined so far in the block. */
+    int numnames;
+} aofBinaryBlock;
+
 typedef struct {
     aofInfo     *base_aof_info;       /* BASE file information. NULL if there is no BASE file. */
     list        *incr_aof_list;       /* INCR AOFs list. We may have multiple INCR AOF when rewrite fails. */
@@ -1556,6 +1687,9 @@ struct siderServer {
     int last_sig_received;      /* Indicates the last SIGNAL received, if any (e.g., SIGINT or SIGTERM). */
     int shutdown_flags;         /* Flags passed to prepareForShutdown(). */
     int activerehashing;        /* Incremental rehash in serverCron() */
+    list *rehashing;            /* Keyspace dicts being rehashed, see
+                                 * incrementallyRehash() */
+    int db_hashtable_type;      /* See DB_HASHTABLE_* */
     int active_defrag_running;  /* Active defragmentation running (holds current scan aggressiveness) */
     char *pidfile;              /* PID file path */
     int arch_bits;              /* 32 or 64 depending on sizeof(long) */
@@ -1595,6 +1729,7 @@ struct siderServer {
     list *clients;              /* List of active clients */
     list *clients_to_close;     /* Clients to close asynchronously */
     list *clients_pending_write; /* There is to write or install handler. */
+    replyBufferPool reply_pool[REPLY_POOL_CLASSES]; /* Free reply buffers. */
     list *clients_pending_read;  /* Client has pending read socket buffers. */
     list *slaves, *monitors;    /* List of slaves and MONITORs */
     client *current_client;     /* The client that triggered the command execution (External or AOF). */
@@ -1622,6 +1757,9 @@ struct siderServer {
     int protected_mode;         /* Don't accept external connections. */
     int io_threads_num;         /* Number of IO threads to use. */
     int io_threads_do_reads;    /* Read and parse from IO threads? */
+    int io_threads_do_commands; /* Execute read-only commands from IO threads? */
+    int io_threads_spin_us;     /* Spin time of idle threads before sleeping. */
+    int io_threads_event_loops; /* IO threads run their own event loops? */
     int io_threads_active;      /* Is IO threads currently active? */
     long long events_processed_while_blocked; /* processEventsWhileBlocked() */
     int enable_protected_configs;    /* Enable the modification of protected configs, see PROTECTED_ACTION_ALLOWED_* */
@@ -1644,7 +1782,10 @@ struct siderServer {
     double stat_expired_stale_perc; /* Percentage of keys probably expired */
     long long stat_expired_time_cap_reached_count; /* Early expire cycle stops.*/
     long long stat_expire_cycle_time_used; /* Cumulative microseconds used. */
+    long long stat_expire_index_lag_max; /* Max ms between the expire time of
+                                          * a key and its active expiration. */
     long long stat_evictedkeys;     /* Number of evicted keys (maxmemory) */
+    long long stat_evictedkeys_background; /* Keys evicted ahead of maxmemory */
     long long stat_evictedclients;  /* Number of evicted clients */
     long long stat_total_eviction_exceeded_time;  /* Total time over the memory limit, unit us */
     monotime stat_last_eviction_exceeded_time;  /* Timestamp of current eviction start, unit us */
@@ -1690,9 +1831,17 @@ struct siderServer {
     size_t stat_cluster_links_memory; /* Mem usage by cluster links */
     long long stat_unexpected_error_replies; /* Number of unexpected (aof-loading, replica to master, etc.) error replies */
     long long stat_total_error_replies; /* Total number of issued error replies ( command + rejected errors ) */
-    long long stat_dump_payload_sanitizations; /* Number deep dump payloads integrity validations. */
+    siderAtomic long long stat_dump_payload_sanitizations; /* Number deep dump payloads integrity validations. */
     long long stat_io_reads_processed; /* Number of read events processed by IO / Main threads */
     long long stat_io_writes_processed; /* Number of write events processed by IO / Main threads */
+    long long stat_io_commands_processed; /* Number of commands executed by IO / Main threads during threaded reads */
+    siderAtomic long long stat_io_threads_spin_usec; /* Time IO threads spent spinning waiting for jobs */
+    siderAtomic long long stat_io_threads_wakeups; /* Number of times a sleeping IO thread was woken up */
+    long long stat_io_threads_main_wait_usec; /* Time the main thread spent waiting for IO threads */
+    long long stat_io_threads_main_wakeups; /* Number of times the main thread slept waiting for IO threads */
+    long long stat_repl_zerocopy_sends; /* Writes to replicas with MSG_ZEROCOPY */
+    long long stat_repl_zerocopy_bytes; /* Bytes written to replicas with MSG_ZEROCOPY */
+    long long stat_repl_zerocopy_copied; /* MSG_ZEROCOPY writes the kernel copied anyway */
     siderAtomic long long stat_total_reads_processed; /* Total number of read events processed */
     siderAtomic long long stat_total_writes_processed; /* Total number of write events processed */
     /* The following two are used to track instantaneous metrics, like
@@ -1705,6 +1854,8 @@ struct siderServer {
     } inst_metric[STATS_METRIC_COUNT];
     long long stat_reply_buffer_shrinks; /* Total number of output buffer shrinks */
     long long stat_reply_buffer_expands; /* Total number of output buffer expands */
+    long long stat_reply_pool_hits;     /* Reply buffers taken from the pools */
+    long long stat_reply_pool_misses;   /* Reply buffers the pools could not serve */
     monotime el_start;
     /* The following two are used to record the max number of commands executed in one eventloop.
      * Note that commands in transactions are also counted. */
@@ -1721,6 +1872,8 @@ struct siderServer {
     int tcpkeepalive;               /* Set SO_KEEPALIVE if non-zero. */
     int active_expire_enabled;      /* Can be disabled for testing purposes. */
     int active_expire_effort;       /* From 1 (default) to 10, active effort. */
+    int active_expire_index;        /* Keep the volatile keys ordered by expire
+                                     * time and expire them from the index. */
     int lazy_expire_disabled;       /* If > 0, don't trigger lazy expire */
     int active_defrag_enabled;
     int sanitize_dump_payload;      /* Enables deep sanitization for ziplist and listpack in RDB and RESTORE. */
@@ -1782,6 +1935,18 @@ struct siderServer {
     aofManifest *aof_manifest;       /* Used to track AOFs. */
     int aof_disable_auto_gc;         /* If disable automatically deleting HISTORY type AOFs?
                                         default no. (for testings). */
+    int aof_writer_thread;           /* Write and fsync the AOF in a dedicated thread. */
+    int aof_incr_format;             /* AOF_FORMAT_* of new INCR files. */
+    int aof_binary_compression;      /* AOF_COMPRESSION_* of binary blocks. */
+    int aof_binary;                  /* The open INCR file is in binary format. */
+    sds aof_block;                   /* Commands of the next binary block. */
+    long long aof_fed_offset;        /* Bytes fed to the AOF buffer since startup. */
+    long long aof_fsynced_offset;    /* Part of aof_fed_offset replies can depend on. */
+    long long stat_aof_writer_batches;     /* Batches written by the AOF writer. */
+    long long stat_aof_writer_bytes;       /* Bytes written by the AOF writer. */
+    long long stat_aof_writer_queue_usec;  /* Time batches waited for the writer. */
+    long long stat_aof_writer_write_usec;  /* Time the writer spent in write(2). */
+    long long stat_aof_writer_fsync_usec;  /* Time the writer spent in fsync. */
 
     /* RDB persistence */
     long long dirty;                /* Changes to DB from the last save */
@@ -1792,9 +1957,27 @@ struct siderServer {
     int saveparamslen;              /* Number of saving points */
     char *rdb_filename;             /* Name of RDB file */
     int rdb_compression;            /* Use compression in RDB? */
+    int rdb_compression_algorithm;  /* RDB_COMPRESSION_* of the values. */
+    int rdb_compression_zstd_level; /* ZSTD compression level. */
+    size_t rdb_compression_zstd_dict_size; /* Size of the ZSTD dictionary trained
+                                              for every snapshot, 0 for none. */
     int rdb_checksum;               /* Use RDB checksum? */
     int rdb_del_sync_files;         /* Remove RDB files used only for SYNC if
                                        the instance does not use persistence. */
+    int rdb_load_threads;           /* Threads decoding values while loading
+                                       an RDB, 0 to decode in the main thread. */
+    int rdb_save_parts;             /* Files (and threads) of the RDB snapshots
+                                       saved on disk, 1 for a single file. */
+    int rdb_save_forkless;          /* Save BGSAVE snapshots from a thread of
+                                       this process instead of a child. */
+    int rdb_forkless_tracking;      /* A fork-less snapshot must see the writes
+                                       to the keyspace, see rdb.c. */
+    long long stat_rdb_forkless_preserved_keys; /* Keys saved before a write by
+                                                   the last fork-less snapshot. */
+    int rdb_load_on_demand;         /* Save an index of the keys with the RDB
+                                       snapshots, to load them on demand. */
+    int loading_on_demand;          /* Keys of the RDB are still loaded on
+                                       demand, see rdb.c. */
     time_t lastsave;                /* Unix time of last successful save */
     time_t lastbgsave_try;          /* Unix time of last attempted bgsave */
     time_t rdb_save_time_last;      /* Time used by last RDB save run. */
@@ -1852,6 +2035,10 @@ struct siderServer {
     int repl_ping_slave_period;     /* Master pings the slave every N seconds */
     replBacklog *repl_backlog;      /* Replication backlog for partial syncs */
     long long repl_backlog_size;    /* Backlog circular buffer size */
+    long long repl_zerocopy_threshold; /* Send the replication buffer blocks
+                                          with MSG_ZEROCOPY from this size. */
+    list *repl_zerocopy_orphans;    /* MSG_ZEROCOPY sends of freed replicas
+                                       the kernel didn't complete yet. */
     time_t repl_backlog_time_limit; /* Time without slaves after the backlog
                                        gets released. */
     time_t repl_no_slaves_since;    /* We have no slaves since that time.
@@ -1865,6 +2052,7 @@ struct siderServer {
     int repl_diskless_sync_delay;   /* Delay to start a diskless repl BGSAVE. */
     int repl_diskless_sync_max_replicas;/* Max replicas for diskless repl BGSAVE
                                          * delay (start sooner if they all connect). */
+    int repl_dual_channel;          /* Full syncs use a second connection for the RDB. */
     size_t repl_buffer_mem;         /* The memory of replication buffer. */
     list *repl_buffer_blocks;       /* Replication buffers blocks list
                                      * (serving replica clients and repl backlog) */
@@ -1885,6 +2073,17 @@ struct siderServer {
     int repl_transfer_fd;    /* Slave -> Master SYNC temp file descriptor */
     char *repl_transfer_tmpfile; /* Slave-> master SYNC temp file name */
     time_t repl_transfer_lastio; /* Unix time of the latest read, for timeout */
+    int repl_rdb_channel;    /* repl_transfer_s is the RDB channel of a dual channel sync. */
+    uint64_t repl_rdb_client_id; /* Client ID of the RDB channel on the master. */
+    connection *repl_stream_s;   /* Connection receiving the replication stream
+                                  * during a dual channel sync. */
+    int repl_stream_state;       /* REPL_STREAM_* */
+    int repl_stream_replies;     /* Handshake replies still to read. */
+    list *repl_stream_buf;       /* Replication stream read during the sync. */
+    size_t repl_stream_buf_size; /* Bytes in repl_stream_buf. */
+    size_t repl_stream_buf_peak; /* Peak of repl_stream_buf_size. */
+    unsigned long long repl_stream_buf_limit; /* Max repl_stream_buf_size. */
+    time_t repl_stream_ack_time; /* Last REPLCONF ACK sent on repl_stream_s. */
     int repl_serve_stale_data; /* Serve stale data when link is down? */
     int repl_slave_ro;          /* Slave is read only? */
     int repl_slave_ignore_maxmemory;    /* If true slaves do not evict. */
@@ -1912,8 +2111,12 @@ struct siderServer {
     unsigned long long maxmemory;   /* Max number of memory bytes to use */
     ssize_t maxmemory_clients;       /* Memory limit for total client buffers */
     int maxmemory_policy;           /* Policy for key eviction */
+    int slru_links;                 /* The keyspace entries are linked in SLRU
+                                     * lists, see allkeys-slru. */
     int maxmemory_samples;          /* Precision of random sampling */
     int maxmemory_eviction_tenacity;/* Aggressiveness of eviction processing */
+    int maxmemory_eviction_watermark_high; /* Background eviction start and */
+    int maxmemory_eviction_watermark_low;  /* stop, in percent of maxmemory. */
     int lfu_log_factor;             /* LFU logarithmic counter factor. */
     int lfu_decay_time;             /* LFU counter decay factor. */
     long long proto_max_bulk_len;   /* Protocol bulk length maximum size. */
@@ -2006,6 +2209,8 @@ struct siderServer {
     int lazyfree_lazy_server_del;
     int lazyfree_lazy_user_del;
     int lazyfree_lazy_user_flush;
+    int lazyfree_threads;           /* Number of threads of the lazyfree pool. */
+    int lazyfree_incremental;       /* Free big values in steps when not lazy. */
     /* Latency monitor */
     long long latency_monitor_threshold;
     dict *latency_events;
@@ -2451,6 +2656,7 @@ extern dictType stringSetDictType;
 extern dictType externalStringType;
 extern dictType sdsHashDictType;
 extern dictType dbExpiresDictType;
+void dbDictRehashingCompleted(dict *d);
 extern dictType modulesDictType;
 extern dictType sdsReplyDictType;
 extern dict *modules;
@@ -2541,6 +2747,13 @@ void clearClientConnectionState(client *c);
 void resetClient(client *c);
 void freeClientOriginalArgv(client *c);
 void freeClientArgv(client *c);
+void freeClientArgvPool(client *c);
+void initReplyPools(void);
+void *replyPoolAlloc(int class, size_t *usable);
+void replyPoolRelease(int class, void *buf, size_t usable);
+size_t replyPoolsMemory(void);
+size_t emptyReplyPools(void);
+void replyPoolsCron(void);
 void sendReplyToClient(connection *conn);
 void *addReplyDeferredLen(client *c);
 void setDeferredArrayLen(client *c, void *node, long length);
@@ -2592,6 +2805,7 @@ void addReplyHelp(client *c, const char **help);
 void addReplySubcommandSyntaxError(client *c);
 void addReplyLoadedModules(client *c);
 void copyReplicaOutputBuffer(client *dst, client *src);
+void unshareClientsReplyObjects(void);
 void addListRangeReply(client *c, robj *o, long start, long end, int reverse);
 void deferredAfterErrorReply(client *c, list *errors);
 size_t sdsZmallocSize(sds s);
@@ -2632,16 +2846,22 @@ int handleClientsWithPendingWrites(void);
 int handleClientsWithPendingWritesUsingThreads(void);
 int handleClientsWithPendingReadsUsingThreads(void);
 int stopThreadedIOIfNeeded(void);
+void ioThreadTouchValue(robj *val);
 int clientHasPendingReplies(client *c);
 int updateClientMemUsageAndBucket(client *c);
 void removeClientFromMemUsageBucket(client *c, int allow_eviction);
 void unlinkClient(client *c);
 int writeToClient(client *c, int handler_installed);
+void replicaReleaseZerocopy(client *c);
+void replicaReapZerocopyOrphans(void);
+void replicaDetachZerocopyOrphans(void);
+unsigned long replicaZerocopyOrphanedSends(void);
 void linkClient(client *c);
 void protectClient(client *c);
 void unprotectClient(client *c);
 void initThreadedIO(void);
 client *lookupClientByID(uint64_t id);
+void feedClientQueryBuffer(client *c, sds data);
 int authRequired(client *c);
 void putClientInPendingWriteQueue(client *c);
 
@@ -2851,6 +3071,11 @@ int bg_unlink(const char *filename);
 
 /* AOF persistence */
 void flushAppendOnlyFile(int force);
+int aofClientWaitsFsync(client *c);
+int aofBinaryReadMagic(FILE *fp);
+int aofBinaryReadBlock(FILE *fp, aofBinaryBlock *b);
+int aofBinaryNextCommand(aofBinaryBlock *b, int *argc, sds **argv);
+void aofBinaryBlockFree(aofBinaryBlock *b);
 void feedAppendOnlyFile(int dictid, robj **argv, int argc);
 void aofRemoveTempFile(pid_t childpid);
 int rewriteAppendOnlyFileBackground(void);
@@ -2973,6 +3198,7 @@ typedef struct {
 
 zskiplist *zslCreate(void);
 void zslFree(zskiplist *zsl);
+int zslReleaseStep(zskiplist *zsl, unsigned long nodes);
 zskiplistNode *zslInsert(zskiplist *zsl, double score, sds ele);
 unsigned char *zzlInsert(unsigned char *zl, sds ele, double score);
 int zslDelete(zskiplist *zsl, double score, sds ele, zskiplistNode **node);
@@ -3228,6 +3454,7 @@ int keyIsExpired(siderDb *db, robj *key);
 long long getExpire(siderDb *db, robj *key);
 void setExpire(client *c, siderDb *db, robj *key, long long when);
 int checkAlreadyExpired(long long when);
+void updateLFU(robj *val);
 robj *lookupKeyRead(siderDb *db, robj *key);
 robj *lookupKeyWrite(siderDb *db, robj *key);
 robj *lookupKeyReadOrReply(client *c, robj *key, robj *reply);
@@ -3238,6 +3465,8 @@ robj *objectCommandLookup(client *c, robj *key);
 robj *objectCommandLookupOrReply(client *c, robj *key, robj *reply);
 int objectSetLRUOrLFU(robj *val, long long lfu_freq, long long lru_idle,
                        long long lru_clock, int lru_multiplier);
+#define OBJ_COMPUTE_SIZE_DEF_SAMPLES 5 /* Default sample size. */
+size_t objectComputeSize(robj *key, robj *o, size_t sample_size, int dbid);
 #define LOOKUP_NONE 0
 #define LOOKUP_NOTOUCH (1<<0)  /* Don't update LRU. */
 #define LOOKUP_NONOTIFY (1<<1) /* Don't trigger keyspace event on key misses. */
@@ -3257,6 +3486,35 @@ void dbReplaceValue(siderDb *db, robj *key, robj *val);
 #define SETKEY_ADD_OR_UPDATE 16 /* Key most likely doesn't exists */
 void setKey(client *c, siderDb *db, robj *key, robj *val, int flags);
 robj *dbRandomKey(siderDb *db);
+int getKeySlot(sds key);
+dict *dbGetDict(siderDb *db, int slot, dbKeyType keyType);
+dictEntry *dbFind(siderDb *db, void *key);
+dictEntry *dbFindExpires(siderDb *db, void *key);
+unsigned long long dbSize(siderDb *db, dbKeyType keyType);
+int dbExpand(siderDb *db, uint64_t db_size, dbKeyType keyType, int try_expand);
+int getFairRandomSlot(siderDb *db, dbKeyType keyType);
+int dbGetNextNonEmptySlot(siderDb *db, int slot, dbKeyType keyType);
+unsigned long long dbScan(siderDb *db, dbKeyType keyType, unsigned long long cursor,
+                          dictScanFunction *scan_cb, void *privdata);
+unsigned long long dbScanDefrag(siderDb *db, dbKeyType keyType, unsigned long long cursor,
+                                dictScanFunction *scan_cb, dictDefragFunctions *defragfns,
+                                void *privdata);
+void dbInitDicts(siderDb *db);
+void dbReleaseDicts(siderDb *db);
+void dbResetDictState(siderDb *db);
+void dbUnlinkRehashingDicts(siderDb *db);
+
+/* Iterator over the keys of the dicts of one kind of a database. */
+typedef struct dbIterator {
+    siderDb *db;
+    dbKeyType keyType;
+    int slot;
+    dictIterator di;
+} dbIterator;
+void dbInitIterator(dbIterator *dbit, siderDb *db, dbKeyType keyType);
+dictEntry *dbIteratorNext(dbIterator *dbit);
+dict *dbIteratorDict(dbIterator *dbit);
+void dbResetIterator(dbIterator *dbit);
 int dbGenericDelete(siderDb *db, robj *key, int async, int flags);
 int dbSyncDelete(siderDb *db, robj *key);
 int dbDelete(siderDb *db, robj *key);
@@ -3284,6 +3542,11 @@ size_t lazyfreeGetPendingObjectsCount(void);
 size_t lazyfreeGetFreedObjectsCount(void);
 void lazyfreeResetStats(void);
 void freeObjAsync(robj *key, robj *obj, int dbid);
+int lazyfreeWouldFreeAsync(robj *key, robj *obj, int dbid);
+void freeObjIncremental(robj *key, robj *obj, int dbid);
+size_t incrementalFreeCycle(void);
+size_t incrementalFreeGetPendingObjectsCount(void);
+size_t incrementalFreeGetFreedObjectsCount(void);
 void freeReplicationBacklogRefMemAsync(list *blocks, rax *index);
 
 /* API to get key arguments from commands */
@@ -3396,6 +3659,11 @@ int clientsCronHandleTimeout(client *c, mstime_t now_ms);
 
 /* expire.c -- Handling of expired keys */
 void activeExpireCycle(int type);
+void expireIndexInsert(siderDb *db, sds key, long long when);
+void expireIndexRemove(siderDb *db, sds key, long long when);
+void expireIndexUpdate(siderDb *db);
+unsigned long long expireIndexSize(void);
+long long expireIndexLag(void);
 void expireSlaveKeys(void);
 void rememberSlaveKeyWithExpire(siderDb *db, robj *key);
 void flushSlaveKeysWithExpireList(void);
@@ -3411,6 +3679,11 @@ unsigned long LFUDecrAndReturn(robj *o);
 #define EVICT_RUNNING 1
 #define EVICT_FAIL 2
 int performEvictions(void);
+size_t slruEntryMetadataSize(dict *d);
+void slruReplaceEntry(dict *d, dictEntry *de);
+void slruAddEntry(siderDb *db, dictEntry *de);
+void slruDelEntry(siderDb *db, dictEntry *de);
+void slruTouchEntry(siderDb *db, dictEntry *de);
 void startEvictionTimeProc(void);
 
 /* Keys hashing / comparison functions for dict.c hash tables. */
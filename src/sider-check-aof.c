@@ -214,14 +214,57 @@ int processAnnotations(FILE *fp, char *filename, int last_file) {
     return 1;
 }
 
+/* Used to check a block of a binary INCR AOF (see aofBinaryReadBlock() for
+ * the format). A transaction can't span over several blocks, so the MULTI
+ * commands of the block must be closed by an EXEC in the same block. Returns
+ * 0 at the end of the file, or if the block is not valid. */
+int processBinaryBlock(FILE *fp, char *filename) {
+    aofBinaryBlock block = {0};
+    int argc, multi = 0, res;
+    sds *argv;
+
+    epos = ftello(fp);
+    res = aofBinaryReadBlock(fp, &block);
+    if (res == 0) return 0;
+    if (res == -1) {
+        ERROR("%s block in AOF %s", feof(fp) ? "Truncated" : "Invalid", filename);
+        return 0;
+    }
+
+    while ((res = aofBinaryNextCommand(&block, &argc, &argv)) == 1) {
+        if (!strcasecmp(argv[0], "multi") && multi++) {
+            ERROR("Unexpected MULTI in AOF %s", filename);
+            res = -1;
+        } else if (!strcasecmp(argv[0], "exec") && --multi) {
+            ERROR("Unexpected EXEC in AOF %s", filename);
+            res = -1;
+        }
+        for (int j = 0; j < argc; j++) sdsfree(argv[j]);
+        zfree(argv);
+        line++;
+        if (res == -1) break;
+    }
+    aofBinaryBlockFree(&block);
+
+    if (res == -1) {
+        if (strlen(error) == 0) ERROR("Invalid command in AOF %s", filename);
+        return 0;
+    }
+    if (multi) {
+        ERROR("Unclosed MULTI in a block of AOF %s", filename);
+        return 0;
+    }
+    return 1;
+}
+
 /* Used to check the validity of a single AOF file. The AOF file can be:
  * 1. Old-style AOF
  * 2. Old-style RDB-preamble AOF
- * 3. BASE or INCR in Multi Part AOF 
+ * 3. BASE or INCR in Multi Part AOF, the latter being possibly binary
  * */
 int checkSingleAof(char *aof_filename, char *aof_filepath, int last_file, int fix, int preamble) {
     off_t pos = 0, diff;
-    int multi = 0;
+    int multi = 0, binary;
     char buf[2];
 
     FILE *fp = fopen(aof_filepath, "r+");
@@ -251,8 +294,15 @@ int checkSingleAof(char *aof_filename, char *aof_filepath, int last_file, int fi
         }
     }
 
+    binary = !preamble && aofBinaryReadMagic(fp);
+    if (binary) printf("AOF %s is in binary format\n", aof_filename);
+
     while(1) {
         if (!multi) pos = ftello(fp);
+        if (binary) {
+            if (!processBinaryBlock(fp, aof_filepath)) break;
+            continue;
+        }
         if (fgets(buf, sizeof(buf), fp) == NULL) {
             if (feof(fp)) {
                 break;
@@ -64,6 +64,7 @@ struct {
 #define RDB_CHECK_DOING_READ_AUX 7
 #define RDB_CHECK_DOING_READ_MODULE_AUX 8
 #define RDB_CHECK_DOING_READ_FUNCTIONS 9
+#define RDB_CHECK_DOING_READ_ZSTD_DICT 10
 
 char *rdb_check_doing_string[] = {
     "start",
@@ -75,7 +76,8 @@ char *rdb_check_doing_string[] = {
     "read-len",
     "read-aux",
     "read-module-aux",
-    "read-functions"
+    "read-functions",
+    "read-zstd-dict"
 };
 
 char *rdb_type_string[] = {
@@ -314,6 +316,12 @@ int sider_check_rdb(char *rdbfilename, FILE *fp) {
             robj *o = rdbLoadCheckModuleValue(&rdb,name);
             decrRefCount(o);
             continue; /* Read type again. */
+        } else if (type == RDB_OPCODE_ZSTD_DICT) {
+            size_t len;
+            rdbstate.doing = RDB_CHECK_DOING_READ_ZSTD_DICT;
+            if (rdbLoadZstdDict(&rdb,&len) == -1) goto eoferr;
+            rdbCheckInfo("ZSTD dictionary of %zu bytes", len);
+            continue; /* Read type again. */
         } else if (type == RDB_OPCODE_FUNCTION_PRE_GA) {
             rdbCheckError("Pre-release function format not supported %d",rdbver);
             goto err;
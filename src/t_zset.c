@@ -117,6 +117,25 @@ void zslFree(zskiplist *zsl) {
     zfree(zsl);
 }
 
+/* Release a skiplist in steps, freeing up to 'nodes' nodes per call. Returns
+ * 1 when the skiplist was released, 0 if more calls are needed. Only the
+ * first level of the skiplist is still valid until it is released. */
+int zslReleaseStep(zskiplist *zsl, unsigned long nodes) {
+    zskiplistNode *node = zsl->header->level[0].forward, *next;
+
+    while(node && nodes--) {
+        next = node->level[0].forward;
+        zslFreeNode(node);
+        node = next;
+    }
+    zsl->header->level[0].forward = node;
+    if (node) return 0;
+
+    zfree(zsl->header);
+    zfree(zsl);
+    return 1;
+}
+
 /* Returns a random level for the new skiplist node we are going to create.
  * The return value of this function is between 1 and ZSKIPLIST_MAXLEVEL
  * (both inclusive), with a powerlaw-alike distribution where higher
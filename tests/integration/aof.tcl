@@ -275,6 +275,98 @@ tags {"aof external:skip"} {
         }
     }
 
+    start_server {overrides {appendonly {yes} appendfsync always aof-writer-thread yes}} {
+        test {AOF writer thread: replies wait for the fsync} {
+            set rd [sider_deferring_client]
+            # Same as the barrier test above: with the write happening in
+            # the writer thread the reply must still wait for it.
+            for {set i 0} {$i < 5} {incr i} {
+                r debug aof-flush-sleep 0
+                r del x
+                r setrange x [expr {int(rand()*5000000)+10000000}] x
+                r debug aof-flush-sleep 300000
+                set aof [get_last_incr_aof_path r]
+                set size1 [file size $aof]
+                $rd get x
+                after [expr {int(rand()*30)}]
+                $rd incr new_value
+                $rd read
+                $rd read
+                set size2 [file size $aof]
+                assert {$size1 != $size2}
+            }
+            r debug aof-flush-sleep 0
+            $rd close
+            assert {[s aof_writer_batches] > 0}
+        }
+
+        test {AOF writer thread: group commit} {
+            r debug aof-flush-sleep 100000
+            set batches [s aof_writer_batches]
+            set clients {}
+            for {set j 0} {$j < 10} {incr j} {
+                lappend clients [sider_deferring_client]
+            }
+            for {set k 0} {$k < 5} {incr k} {
+                foreach rd $clients {$rd incr counter}
+                foreach rd $clients {$rd read}
+            }
+            foreach rd $clients {$rd close}
+            r debug aof-flush-sleep 0
+            assert_equal 50 [r get counter]
+            # Commands of different clients were written together.
+            assert {[s aof_writer_batches] - $batches < 50}
+
+            r debug loadaof
+            assert_equal 50 [r get counter]
+        }
+
+        test {AOF writer thread can be disabled at runtime} {
+            r config set aof-writer-thread no
+            r incr counter
+            r debug loadaof
+            r get counter
+        } {51}
+    }
+
+    start_server {overrides {appendonly {yes} appendfsync always aof-writer-thread yes
+                             io-threads 2 io-threads-do-reads yes io-threads-do-commands yes}} {
+        test {AOF writer thread: replies of commands executed by IO threads wait for the fsync} {
+            r incr counter
+            set aof [get_last_incr_aof_path r]
+            set size [file size $aof]
+            # Every further INCR appends the same amount of bytes.
+            set cmdlen [string length [formatCommand incr counter]]
+            r config resetstat
+            r debug aof-flush-sleep 20000
+
+            set wr [sider_deferring_client]
+            set clients {}
+            for {set i 0} {$i < 8} {incr i} {
+                lappend clients [sider_deferring_client]
+            }
+            # A reader must never see a value the AOF doesn't contain yet,
+            # even when the GET didn't go through call().
+            for {set j 0} {$j < 50} {incr j} {
+                $wr incr counter
+                $wr flush
+                foreach rd $clients { $rd get counter; $rd get counter }
+                foreach rd $clients {
+                    foreach _ {1 2} {
+                        set val [$rd read]
+                        set synced [expr {([file size $aof]-$size)/$cmdlen+1}]
+                        assert {$val <= $synced}
+                    }
+                }
+                $wr read
+            }
+            r debug aof-flush-sleep 0
+            assert_morethan [s io_threaded_commands_processed] 0
+            $wr close
+            foreach rd $clients { $rd close }
+        }
+    }
+
     start_server {overrides {appendonly {yes}}} {
         test {GETEX should not append to AOF} {
             set aof [get_last_incr_aof_path r]
@@ -678,4 +770,98 @@ tags {"aof external:skip"} {
             }
         }
     }
+
+    start_server {overrides {appendonly yes aof-incr-format binary aof-use-rdb-preamble no}} {
+        set dir [lindex [r config get dir] 1]
+        set manifest [file join $dir appendonlydir appendonly.aof$::manifest_suffix]
+
+        test {Binary INCR AOF is written and loaded} {
+            r set foo bar
+            r incrby counter -42
+            r rpush list a b c
+            r select 10
+            r set other 1
+            r expire other 1000
+            r select 9
+            r multi
+            r set t1 x
+            r incr counter
+            r exec
+            r set [string repeat x 100] [string repeat y 1000]
+            set digest [r debug digest]
+
+            assert_match "*format binary*" [exec cat $manifest]
+            set fp [open [get_last_incr_aof_path r] r]
+            fconfigure $fp -translation binary
+            assert_equal "SDRBAOF1" [read $fp 8]
+            close $fp
+
+            r debug loadaof
+            assert_equal $digest [r debug digest]
+            assert_equal -41 [r get counter]
+            r select 10
+            assert_range [r ttl other] 900 1000
+            r select 9
+        }
+
+        test {Binary INCR AOF blocks are compressed} {
+            set aof [get_last_incr_aof_path r]
+            set size [file size $aof]
+            r multi
+            for {set j 0} {$j < 100} {incr j} {
+                r set key:$j [string repeat abcd 250]
+            }
+            r exec
+            assert {[file size $aof] - $size < 100*1000/4}
+
+            r config set aof-binary-compression no
+            set size [file size $aof]
+            r set raw [string repeat abcd 250]
+            assert {[file size $aof] - $size > 1000}
+            r config set aof-binary-compression lzf
+
+            set digest [r debug digest]
+            r debug loadaof
+            assert_equal $digest [r debug digest]
+        }
+
+        test {sider-check-aof checks and fixes binary INCR AOF} {
+            assert_match "*binary format*All AOF files and manifest are valid*" [exec src/sider-check-aof $manifest]
+
+            # A block that was not fully written.
+            set aof [get_last_incr_aof_path r]
+            set size [file size $aof]
+            set fp [open $aof a]
+            fconfigure $fp -translation binary
+            puts -nonewline $fp "\x00\x20\x20abc"
+            close $fp
+            catch {exec src/sider-check-aof $manifest} e
+            assert_match "*Truncated block*" $e
+
+            assert_match "*Successfully truncated AOF*" [exec src/sider-check-aof --fix $manifest << "y\n"]
+            assert_equal $size [file size $aof]
+            set digest [r debug digest]
+            r debug loadaof
+            assert_equal $digest [r debug digest]
+        }
+
+        test {AOF switches to the binary format on rewrite} {
+            r config set aof-incr-format resp
+            r bgrewriteaof
+            waitForBgrewriteaof r
+            r set after resp
+            assert_no_match "*format*" [exec cat $manifest]
+
+            r config set aof-incr-format binary
+            r bgrewriteaof
+            waitForBgrewriteaof r
+            r set after binary
+            assert_match "*format binary*" [exec cat $manifest]
+
+            set digest [r debug digest]
+            r debug loadaof
+            assert_equal $digest [r debug digest]
+            r get after
+        } {binary}
+    }
 }
@@ -0,0 +1,98 @@
+foreach mdl {no yes} {
+    start_server {tags {"repl external:skip"}} {
+        set master [srv 0 client]
+        set master_host [srv 0 host]
+        set master_port [srv 0 port]
+        $master config set repl-diskless-sync $mdl
+        $master config set repl-diskless-sync-delay 0
+        $master config set dual-channel-replication-enabled yes
+        $master debug populate 2000 key 100
+
+        start_server {} {
+            set replica [srv 0 client]
+            $replica config set dual-channel-replication-enabled yes
+
+            test "Dual channel sync buffers the stream during the transfer (diskless: $mdl)" {
+                # Make the snapshot last a few seconds.
+                $master config set rdb-key-save-delay 1000
+                $replica replicaof $master_host $master_port
+                wait_for_log_messages 0 {"*buffering the replication stream from offset*"} 0 100 100
+
+                for {set j 0} {$j < 1000} {incr j} {
+                    $master incr counter
+                    $master set "new:$j" $j
+                }
+                $master config set rdb-key-save-delay 0
+
+                wait_for_sync $replica
+                wait_for_ofs_sync $master $replica
+                assert_equal [$master debug digest] [$replica debug digest]
+                assert_equal 1000 [$replica get counter]
+                assert {[status $replica replica_full_sync_buffer_peak] > 0}
+                assert_equal 0 [status $replica replica_full_sync_buffer_size]
+                verify_log_message 0 "*applying * bytes of buffered replication stream*" 0
+
+                # Only the stream connection remains once the RDB was sent.
+                wait_for_condition 50 100 {
+                    [status $master connected_slaves] == 1
+                } else {
+                    fail "The RDB channel was not closed"
+                }
+            }
+
+            test "Dual channel sync continues after the transfer (diskless: $mdl)" {
+                $master set after sync
+                wait_for_ofs_sync $master $replica
+                assert_equal sync [$replica get after]
+                assert_equal [$master debug digest] [$replica debug digest]
+            }
+
+            test "Dual channel sync recovers from the loss of the stream connection (diskless: $mdl)" {
+                $replica replicaof no one
+                $master config set rdb-key-save-delay 1000
+                set loglines [count_log_lines 0]
+                set partial_ok [status $master sync_partial_ok]
+                $replica replicaof $master_host $master_port
+                wait_for_log_messages 0 {"*buffering the replication stream from offset*"} $loglines 100 100
+
+                # The stream connection is the most recent replica client.
+                set ids {}
+                foreach line [split [$master client list type replica] "\n"] {
+                    if {[regexp {id=([0-9]+)} $line -> id]} {lappend ids $id}
+                }
+                $master client kill id [lindex [lsort -integer $ids] end]
+                $master incr counter
+                $master config set rdb-key-save-delay 0
+
+                wait_for_log_messages 0 {"*RDB loaded without the replication stream*"} $loglines 100 100
+                wait_for_sync $replica
+                wait_for_ofs_sync $master $replica
+                assert_equal [$master debug digest] [$replica debug digest]
+                assert_equal 1001 [$replica get counter]
+                # One PSYNC for the stream, and one after loading the RDB.
+                assert_equal [expr {$partial_ok+2}] [status $master sync_partial_ok]
+            }
+        }
+    }
+}
+
+start_server {tags {"repl external:skip"}} {
+    set master [srv 0 client]
+    set master_host [srv 0 host]
+    set master_port [srv 0 port]
+    $master debug populate 1000 key 100
+
+    start_server {} {
+        set replica [srv 0 client]
+        $replica config set dual-channel-replication-enabled yes
+
+        test "Dual channel sync falls back to a single connection" {
+            $replica replicaof $master_host $master_port
+            wait_for_sync $replica
+            wait_for_ofs_sync $master $replica
+            assert_equal [$master debug digest] [$replica debug digest]
+            assert_equal 0 [status $replica replica_full_sync_buffer_peak]
+            verify_log_message 0 "*Master does not understand REPLCONF capa*" 0
+        }
+    }
+}
@@ -416,4 +416,438 @@ start_server {} {
     } {OK}
 }
 
+set server_path [tmpdir "server.rdb-load-threads-test"]
+exec cp tests/assets/encodings.rdb $server_path
+
+start_server [list overrides [list "dir" $server_path "dbfilename" "encodings.rdb" save ""]] {
+    test {Loading threads: RDB encoding loading test} {
+        r select 0
+        set expected [csvdump r]
+        r config set rdb-load-threads 4
+        r debug reload nosave
+        assert_equal $expected [csvdump r]
+    } {} {needs:debug}
+}
+
+start_server {overrides {save ""}} {
+    test {Loading threads: same dataset digest after reload} {
+        r config set rdb-load-threads 3
+        createComplexDataset r 10000
+        r xadd stream 1-1 a 1
+        r xadd stream 2-1 b 2
+        r xgroup create stream g1 0
+        r xreadgroup group g1 consumer1 count 1 streams stream >
+        r select 10
+        createComplexDataset r 1000
+        r set bigstring [string repeat x 3000000]
+        for {set j 0} {$j < 5000} {incr j} {
+            r hset bighash field$j [string repeat v [expr {$j % 100}]]
+        }
+        r select 9
+
+        set digest [debug_digest]
+        r debug reload
+        assert_equal $digest [debug_digest]
+        assert_equal 1 [llength [r xpending stream g1 - + 10]]
+        r select 10
+        assert_equal 3000000 [r strlen bigstring]
+        assert_equal 5000 [r hlen bighash]
+    } {} {needs:debug}
+
+    test {Loading threads: expire and LFU info after reload} {
+        r flushall
+        r config set maxmemory-policy allkeys-lfu
+        r debug set-active-expire 0
+        for {set j 0} {$j < 1000} {incr j} {
+            r set volatile$j $j px 100
+            r set persistent$j $j ex 1000
+        }
+        r set hot 1
+        for {set j 0} {$j < 100} {incr j} {
+            r get hot
+        }
+        set freq [r object freq hot]
+        after 200
+
+        r debug reload
+        assert_equal 1001 [r dbsize]
+        assert_equal 1000 [s rdb_last_load_keys_expired]
+        assert_equal $freq [r object freq hot]
+        assert_range [r ttl persistent999] 900 1000
+        r debug set-active-expire 1
+        r config set maxmemory-policy noeviction
+    } {OK} {needs:debug}
+
+    test {Loading threads: DEBUG RELOAD MERGE replaces existing keys} {
+        r flushall
+        r config set rdb-load-threads 2
+        for {set j 0} {$j < 1000} {incr j} {
+            r set key$j old
+        }
+        r save
+        for {set j 0} {$j < 1000} {incr j} {
+            r set key$j new
+        }
+        r debug reload nosave noflush merge
+        assert_equal 1000 [r dbsize]
+        assert_equal old [r get key999]
+    } {} {needs:debug}
+}
+
+
+set server_path [tmpdir "server.rdb-parts-test"]
+
+start_server [list overrides [list "dir" $server_path save "" rdb-save-parts 4] keep_persistence true] {
+    test {Multi-part snapshot: same dataset digest after reload} {
+        createComplexDataset r 10000
+        r xadd stream 1-1 a 1
+        r xgroup create stream g1 0
+        r function load {#!lua name=parts
+            sider.register_function('f1', function() return 1 end)
+        }
+        r select 10
+        createComplexDataset r 1000
+        r set bigstring [string repeat x 3000000]
+        r select 9
+
+        set digest [debug_digest]
+        r debug reload
+        assert_equal $digest [debug_digest]
+        assert_equal {parts} [dict get [lindex [r function list] 0] library_name]
+        assert_equal 1 [file exists $server_path/dump.rdb.manifest]
+        for {set j 0} {$j < 4} {incr j} {
+            assert_equal 1 [file exists $server_path/dump.rdb.1.part$j]
+        }
+        assert_equal 0 [file exists $server_path/dump.rdb.1.part4]
+    } {} {needs:debug}
+
+    test {Multi-part snapshot: restart with expires loads all the parts} {
+        r flushall
+        r debug set-active-expire 0
+        for {set j 0} {$j < 1000} {incr j} {
+            r set volatile$j $j px 100
+            r set persistent$j $j ex 1000
+        }
+        after 200
+        r bgsave
+        waitForBgsave r
+        restart_server 0 true false
+        wait_done_loading r
+        assert_equal 1000 [r dbsize]
+        assert_equal 1000 [s rdb_last_load_keys_expired]
+        assert_equal 1000 [s rdb_last_load_keys_loaded]
+        assert_range [r ttl persistent999] 900 1000
+        verify_log_message 0 "*Loading the RDB snapshot from 4 parts*" 0
+    }
+
+    test {Multi-part snapshot: a new save replaces the previous parts} {
+        assert_equal 1 [file exists $server_path/dump.rdb.2.part0]
+        r set newkey 1
+        r save
+        assert_equal 0 [file exists $server_path/dump.rdb.2.part0]
+        assert_equal 1 [file exists $server_path/dump.rdb.3.part0]
+        r debug reload nosave
+        assert_equal 1001 [r dbsize]
+    } {} {needs:debug}
+
+    test {Multi-part snapshot: killed BGSAVE leaves no temp parts} {
+        r config set rdb-key-save-delay 1000
+        r bgsave
+        wait_for_condition 50 100 {
+            [llength [glob -nocomplain $server_path/temp-*.part*.rdb]] == 4
+        } else {
+            fail "The temp parts were not created"
+        }
+        catch {exec kill -9 [get_child_pid 0]}
+        wait_for_condition 50 100 {
+            [s rdb_bgsave_in_progress] == 0 &&
+            [llength [glob -nocomplain $server_path/temp-*]] == 0
+        } else {
+            fail "The temp parts were not removed"
+        }
+        r config set rdb-key-save-delay 0
+        assert_equal 1 [file exists $server_path/dump.rdb.3.part0]
+    }
+
+    test {Multi-part snapshot: saving a single file removes the parts} {
+        r config set rdb-save-parts 1
+        r save
+        assert_equal 1 [file exists $server_path/dump.rdb]
+        assert_equal 0 [file exists $server_path/dump.rdb.manifest]
+        assert_equal {} [glob -nocomplain $server_path/dump.rdb.*]
+        restart_server 0 true false
+        wait_done_loading r
+        assert_equal 1001 [r dbsize]
+    }
+}
+
+set server_path [tmpdir "server.rdb-load-on-demand"]
+start_server [list overrides [list "dir" $server_path save "" rdb-load-on-demand yes key-load-delay 200]] {
+    test {On-demand loading: keys are served before they are all loaded} {
+        for {set j 0} {$j < 5000} {incr j} {
+            r set string$j $j
+            r rpush list$j a b $j
+        }
+        r set volatile 1 ex 10000
+        r select 10
+        r set other 10
+        r select 9
+        r function load {#!lua name=ondemand
+            sider.register_function('f1', function() return 1 end)
+        }
+        set digest [debug_digest]
+        r bgsave
+        waitForBgsave r
+        assert_equal 1 [file exists $server_path/dump.rdb.idx]
+
+        restart_server 0 true false
+        assert_equal 1 [s loading_on_demand]
+        assert_equal {ondemand} [dict get [lindex [r function list] 0] library_name]
+        assert_equal 4999 [r get string4999]
+        assert_equal {a b 4999} [r lrange list4999 0 -1]
+        assert_range [r ttl volatile] 9000 10000
+        r set string4998 new
+        r del list4997
+        r select 10
+        assert_equal 10 [r get other]
+        r select 9
+        assert_error {LOADING*} {r dbsize}
+        assert_error {LOADING*} {r keys *}
+        assert {[s loading_on_demand_keys_left] > 0}
+
+        wait_for_condition 100 100 {
+            [s loading_on_demand] == 0
+        } else {
+            fail "The keys were not loaded"
+        }
+        assert_equal new [r get string4998]
+        assert_equal 0 [r exists list4997]
+        assert_equal 10000 [r dbsize]
+        r set string4998 4998
+        r rpush list4997 a b 4997
+        assert_equal $digest [debug_digest]
+        verify_log_message 0 "*opened for on-demand loading, 10002 keys to load*" 0
+    }
+
+    test {On-demand loading: saving loads the keys left first} {
+        r save
+        restart_server 0 true false
+        assert_equal 1 [s loading_on_demand]
+        r debug reload
+        assert_equal 0 [s loading_on_demand]
+        assert_equal $digest [debug_digest]
+    } {} {needs:debug}
+
+    test {On-demand loading: an index of another RDB is not used} {
+        file copy -force $server_path/dump.rdb.idx $server_path/old.idx
+        r set newkey 1
+        r save
+        file rename -force $server_path/old.idx $server_path/dump.rdb.idx
+        restart_server 0 true false
+        wait_done_loading r
+        assert_equal 0 [s loading_on_demand]
+        assert_equal 10002 [r dbsize]
+        verify_log_message 0 "*on demand (*), loading it entirely*" 0
+    }
+
+    test {On-demand loading: the index is removed once disabled} {
+        r config set rdb-load-on-demand no
+        r save
+        assert_equal 0 [file exists $server_path/dump.rdb.idx]
+        assert_equal {} [glob -nocomplain $server_path/temp-*]
+    }
+}
+
+set server_path [tmpdir "server.rdb-load-on-demand-io-threads"]
+start_server [list overrides [list "dir" $server_path save "" rdb-load-on-demand yes key-load-delay 500 \
+                                   io-threads 2 io-threads-do-reads yes io-threads-do-commands yes]] {
+    test {On-demand loading: keys are only loaded by the main thread} {
+        for {set j 0} {$j < 5000} {incr j} {
+            r set string$j $j
+        }
+        r bgsave
+        waitForBgsave r
+
+        restart_server 0 true false
+        assert_equal 1 [s loading_on_demand]
+        set clients {}
+        for {set i 0} {$i < 8} {incr i} {
+            lappend clients [sider_deferring_client]
+        }
+        for {set k 0} {$k < 10} {incr k} {
+            foreach rd $clients {
+                for {set j $k} {$j < 5000} {incr j 500} { $rd get string$j }
+            }
+            foreach rd $clients {
+                for {set j $k} {$j < 5000} {incr j 500} { assert_equal $j [$rd read] }
+            }
+        }
+        foreach rd $clients { $rd close }
+        assert_equal 1 [s loading_on_demand]
+        assert_equal 0 [s io_threaded_commands_processed]
+    }
+}
+
+set server_path [tmpdir "server.rdb-forkless"]
+start_server [list overrides [list "dir" $server_path save "" rdb-save-forkless yes]] {
+    test {Fork-less snapshot: keys written while saving keep their old value} {
+        for {set j 0} {$j < 2000} {incr j} {
+            r set string$j $j
+            r rpush list$j a b c $j
+            r hset hash$j field $j
+            if {$j % 2} {r expire string$j 10000}
+        }
+        r sadd set a b c
+        r zadd zset 1 a 2 b
+        r xadd stream 1-1 field value
+        r xgroup create stream group 0
+        set digest [debug_digest]
+
+        r config set rdb-key-save-delay 100
+        r bgsave
+        assert_equal 1 [s rdb_bgsave_in_progress]
+        assert_match "*Background saving started without fork*" [exec tail -5 [srv 0 stdout]]
+        for {set j 0} {$j < 2000} {incr j 7} {
+            r set string$j changed
+            r del list$j
+            r hset hash$j field changed other field
+            r append string[expr {$j+1}] suffix
+            r persist string[expr {$j+3}]
+            r set new$j value
+        }
+        r rename list1 renamed
+        r sadd set d
+        r zincrby zset 10 a
+        r xreadgroup group group consumer streams stream >
+        waitForBgsave r
+        r config set rdb-key-save-delay 0
+
+        assert_equal ok [s rdb_last_bgsave_status]
+        assert_morethan [s rdb_forkless_preserved_keys] 0
+        r debug reload nosave
+        assert_equal $digest [debug_digest]
+    } {} {needs:debug}
+
+    test {Fork-less snapshot: the dict can be resized while saving} {
+        r config set rdb-key-save-delay 100
+        r bgsave
+        for {set j 0} {$j < 20000} {incr j} {
+            r set grow$j $j
+        }
+        for {set j 0} {$j < 20000} {incr j} {
+            r del grow$j
+        }
+        set digest [debug_digest]
+        waitForBgsave r
+        r config set rdb-key-save-delay 0
+        assert_equal ok [s rdb_last_bgsave_status]
+        r debug reload nosave
+        assert_equal $digest [debug_digest]
+    } {} {needs:debug}
+
+    test {Fork-less snapshot: FLUSHALL aborts it} {
+        r config set rdb-key-save-delay 1000
+        r bgsave
+        assert_equal 1 [s rdb_bgsave_in_progress]
+        r flushall
+        wait_for_condition 50 100 {
+            [s rdb_bgsave_in_progress] == 0 &&
+            [llength [glob -nocomplain $server_path/temp-*]] == 0
+        } else {
+            fail "The snapshot was not aborted"
+        }
+        r config set rdb-key-save-delay 0
+        assert_equal ok [s rdb_last_bgsave_status]
+        verify_log_message 0 "*Background saving terminated by signal 10*" 0
+    }
+}
+
+foreach algo {lz4 zstd} {
+set server_path [tmpdir "server.rdb-compression-$algo"]
+start_server [list overrides [list "dir" $server_path save ""]] {
+    # Only the algorithms Sider was built with can be tested.
+    if {![catch {r config set rdbcompression-algorithm $algo}]} {
+        test "RDB compression with $algo: values are restored on reload" {
+            r debug populate 1000 key 200
+            for {set j 0} {$j < 100} {incr j} {
+                r hset hash$j name "user:$j" email "user$j@example.com"
+                r rpush list$j {*}[lrepeat 100 "element:$j"]
+                r set string$j [string repeat "abcd:$j:" 20]
+            }
+            set digest [debug_digest]
+            r debug reload
+            assert_equal $digest [debug_digest]
+            assert_equal 1300 [r dbsize]
+        } {} {needs:debug}
+
+        test "RDB compression with $algo: sider-check-rdb" {
+            r save
+            set result [exec src/sider-check-rdb $server_path/dump.rdb]
+            assert_match "*RDB looks OK*" $result
+        }
+
+        test "RDB compression with $algo: DUMP / RESTORE" {
+            set dump [r dump string1]
+            r del string1
+            r restore string1 0 $dump
+            assert_equal [string repeat "abcd:1:" 20] [r get string1]
+        }
+
+        if {$algo eq {zstd}} {
+            test {RDB compression with zstd: smaller than with lzf} {
+                set words {alpha beta gamma delta epsilon zeta eta theta iota kappa
+                           lambda mu nu xi omicron pi rho sigma tau upsilon}
+                for {set j 0} {$j < 100} {incr j} {
+                    set text {}
+                    for {set k 0} {$k < 300} {incr k} {
+                        lappend text [lindex $words [randomInt [llength $words]]]
+                    }
+                    r set text$j $text
+                }
+                r config set rdbcompression-algorithm lzf
+                r save
+                set lzf_size [file size $server_path/dump.rdb]
+                r config set rdbcompression-algorithm zstd
+                r save
+                assert_lessthan [file size $server_path/dump.rdb] $lzf_size
+            }
+
+            test {RDB compression with zstd: trained dictionary} {
+                r flushall
+                for {set j 0} {$j < 5000} {incr j} {
+                    r set doc:$j "{\"id\":$j,\"name\":\"user $j\",\"email\":\"user$j@example.com\",\"active\":true}"
+                }
+                r save
+                set size [file size $server_path/dump.rdb]
+
+                r config set rdbcompression-zstd-dict-size 16kb
+                r save
+                verify_log_message 0 "*Trained a ZSTD dictionary of*" 0
+                assert_lessthan [file size $server_path/dump.rdb] $size
+                set result [exec src/sider-check-rdb $server_path/dump.rdb]
+                assert_match "*ZSTD dictionary of*RDB looks OK*" $result
+
+                set digest [debug_digest]
+                r debug reload nosave
+                assert_equal $digest [debug_digest]
+                r config set rdb-load-threads 2
+                r debug reload nosave
+                assert_equal $digest [debug_digest]
+            } {} {needs:debug}
+
+            test {RDB compression with zstd: dictionary in a multi-part snapshot} {
+                r config set rdb-save-parts 3
+                set digest [debug_digest]
+                r debug reload
+                r config set rdb-save-parts 1
+                r config set rdb-load-threads 0
+                assert_equal $digest [debug_digest]
+                assert_equal 5000 [r dbsize]
+                assert_equal 1 [file exists $server_path/dump.rdb.manifest]
+            } {} {needs:debug}
+        }
+    }
+}
+}
+
 } ;# tags
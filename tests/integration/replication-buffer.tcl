@@ -305,3 +305,107 @@ test {Replica client-output-buffer size is limited to backlog_limit/16 when no r
     }
 }
 
+
+start_server {tags {"repl external:skip"}} {
+start_server {} {
+start_server {} {
+start_server {} {
+    set replica1 [srv -3 client]
+    set replica2 [srv -2 client]
+    set replica3 [srv -1 client]
+    set replica1_pid [srv -3 pid]
+
+    set master [srv 0 client]
+    set master_host [srv 0 host]
+    set master_port [srv 0 port]
+    $master config set save ""
+
+    foreach replica [list $replica1 $replica2 $replica3] {
+        $replica replicaof $master_host $master_port
+        wait_for_sync $replica
+    }
+
+    test {Replicas receive the pending blocks with a single writev} {
+        # The stream accumulates many blocks while replica1 doesn't read.
+        pause_process $replica1_pid
+        for {set j 0} {$j < 2000} {incr j} {
+            $master set key$j [string repeat x 100]
+        }
+        resume_process $replica1_pid
+        foreach replica [list $replica1 $replica2 $replica3] {
+            wait_for_ofs_sync $master $replica
+            assert_equal [$master debug digest] [$replica debug digest]
+        }
+        assert_equal 0 [s repl_zerocopy_sends]
+    }
+
+    test {Big writes are sent to the replicas with MSG_ZEROCOPY} {
+        $master config set repl-zerocopy-threshold 16kb
+        for {set j 0} {$j < 100} {incr j} {
+            $master set big$j [string repeat y 65536]
+        }
+        $master set small 1
+        foreach replica [list $replica1 $replica2 $replica3] {
+            wait_for_ofs_sync $master $replica
+            assert_equal [$master debug digest] [$replica debug digest]
+        }
+        if {$::tcl_platform(os) eq "Linux"} {
+            assert_morethan [s repl_zerocopy_sends] 0
+            assert_morethan [s repl_zerocopy_bytes] [expr {16384*[s repl_zerocopy_sends]-1}]
+        }
+
+        # Once the kernel is done with the data, the backlog is trimmed as usual.
+        $master config set repl-zerocopy-threshold 0
+        for {set j 0} {$j < 100} {incr j} {
+            $master set big$j small
+        }
+        wait_for_condition 50 100 {
+            [s mem_total_replication_buffers] < 2*1024*1024
+        } else {
+            fail "The replication buffer was not trimmed"
+        }
+    }
+
+    test {The blocks sent with MSG_ZEROCOPY outlive the replica freed meanwhile} {
+        regexp {laddr=([^ ]+) [^\n]*flags=M} [$replica1 client list] -> replica1_addr
+        $master config set repl-zerocopy-threshold 16kb
+
+        # replica1 doesn't read, so the kernel keeps the data it was sent.
+        pause_process $replica1_pid
+        for {set j 0} {$j < 100} {incr j} {
+            $master set big$j [string repeat z 65536]
+        }
+        wait_for_ofs_sync $master $replica2
+        assert_equal 1 [$master client kill addr $replica1_addr]
+        if {$::tcl_platform(os) eq "Linux"} {
+            assert_morethan [s repl_zerocopy_orphaned_sends] 0
+        }
+
+        # The blocks are not reused while the kernel may still send them.
+        $master config set repl-zerocopy-threshold 0
+        for {set j 0} {$j < 100} {incr j} {
+            $master set big$j [string repeat w 65536]
+        }
+        foreach replica [list $replica2 $replica3] {
+            wait_for_ofs_sync $master $replica
+            assert_equal [$master debug digest] [$replica debug digest]
+        }
+
+        resume_process $replica1_pid
+        wait_for_condition 50 100 {
+            [s repl_zerocopy_orphaned_sends] == 0
+        } else {
+            fail "The sends to the freed replica were not completed"
+        }
+        wait_for_condition 50 100 {
+            [status $replica1 master_link_status] eq {up}
+        } else {
+            fail "replica1 didn't reconnect"
+        }
+        wait_for_ofs_sync $master $replica1
+        assert_equal [$master debug digest] [$replica1 debug digest]
+    }
+}
+}
+}
+}
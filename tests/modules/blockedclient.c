@@ -94,6 +94,47 @@ int acquire_gil(SiderModuleCtx *ctx, SiderModuleString **argv, int argc)
     return REDISMODULE_OK;
 }
 
+typedef struct {
+    SiderModuleBlockedClient *bc;
+    long long count;
+} tsctx_loop_data;
+
+/* Create and free detached thread safe contexts without holding the GIL,
+ * while the main thread serves other clients. */
+void *tsctx_loop_worker(void *arg) {
+    tsctx_loop_data *data = arg;
+
+    for (long long j = 0; j < data->count; j++) {
+        SiderModuleCtx *tsctx = SiderModule_GetThreadSafeContext(NULL);
+        SiderModule_FreeThreadSafeContext(tsctx);
+    }
+
+    SiderModuleCtx *ctx = SiderModule_GetThreadSafeContext(data->bc);
+    SiderModule_ReplyWithLongLong(ctx, data->count);
+    SiderModule_UnblockClient(data->bc, NULL);
+    SiderModule_FreeThreadSafeContext(ctx);
+    SiderModule_Free(data);
+    return NULL;
+}
+
+int tsctx_loop(SiderModuleCtx *ctx, SiderModuleString **argv, int argc) {
+    if (argc != 2) return SiderModule_WrongArity(ctx);
+
+    long long count;
+    if (SiderModule_StringToLongLong(argv[1], &count) != REDISMODULE_OK)
+        return SiderModule_ReplyWithError(ctx, "ERR invalid count");
+
+    tsctx_loop_data *data = SiderModule_Alloc(sizeof(*data));
+    data->bc = SiderModule_BlockClient(ctx, NULL, NULL, NULL, 0);
+    data->count = count;
+
+    pthread_t tid;
+    int res = pthread_create(&tid, NULL, tsctx_loop_worker, data);
+    assert(res == 0);
+    pthread_detach(tid);
+    return REDISMODULE_OK;
+}
+
 typedef struct {
     SiderModuleString **argv;
     int argc;
@@ -649,6 +690,9 @@ int SiderModule_OnLoad(SiderModuleCtx *ctx, SiderModuleString **argv, int argc)
     if (SiderModule_Init(ctx, "blockedclient", 1, REDISMODULE_APIVER_1)== REDISMODULE_ERR)
         return REDISMODULE_ERR;
 
+    if (SiderModule_CreateCommand(ctx, "tsctx_loop", tsctx_loop, "", 0, 0, 0) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
     if (SiderModule_CreateCommand(ctx, "acquire_gil", acquire_gil, "", 0, 0, 0) == REDISMODULE_ERR)
         return REDISMODULE_ERR;
 
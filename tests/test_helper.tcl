@@ -48,6 +48,7 @@ set ::all_tests {
     integration/replication-4
     integration/replication-psync
     integration/replication-buffer
+    integration/dual-channel-replication
     integration/shutdown
     integration/aof
     integration/aof-race
@@ -102,6 +103,7 @@ set ::all_tests {
     unit/cluster/multi-slot-operations
     unit/cluster/slot-ownership
     unit/cluster/links
+    unit/cluster/sharded-keyspace
     unit/cluster/cluster-response-tls
 }
 # Index to the next test to run in the ::all_tests list.
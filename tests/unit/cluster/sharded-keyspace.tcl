@@ -0,0 +1,199 @@
+# Tests for the keyspace being split into one dict per hash slot.
+
+start_cluster 1 0 {tags {external:skip cluster}} {
+
+    test "Keys are counted per slot" {
+        R 0 flushall
+        for {set j 0} {$j < 100} {incr j} {
+            R 0 set "{foo}$j" $j
+            R 0 set "{bar}$j" $j
+            R 0 set "key:$j" $j
+        }
+        assert_equal 300 [R 0 dbsize]
+        assert_equal 100 [R 0 cluster countkeysinslot [R 0 cluster keyslot foo]]
+        assert_equal 100 [R 0 cluster countkeysinslot [R 0 cluster keyslot bar]]
+        assert_equal 100 [llength [R 0 cluster getkeysinslot [R 0 cluster keyslot foo] 1000]]
+        assert_match "*keys=300,*" [R 0 info keyspace]
+
+        for {set j 0} {$j < 50} {incr j} {
+            R 0 del "{foo}$j"
+        }
+        assert_equal 250 [R 0 dbsize]
+        assert_equal 50 [R 0 cluster countkeysinslot [R 0 cluster keyslot foo]]
+    }
+
+    test "SCAN returns every key across slots" {
+        R 0 flushall
+        for {set j 0} {$j < 1000} {incr j} {
+            R 0 set "key:$j" $j
+        }
+        set cur 0
+        set keys {}
+        while 1 {
+            set res [R 0 scan $cur count 10]
+            set cur [lindex $res 0]
+            lappend keys {*}[lindex $res 1]
+            if {$cur == 0} break
+        }
+        assert_equal 1000 [llength [lsort -unique $keys]]
+
+        # A cursor that starts in the middle of the slot range is valid too.
+        set res [R 0 scan [R 0 cluster keyslot "key:0"] count 1000]
+        assert {[llength [lindex $res 1]] > 0}
+    }
+
+    test "RANDOMKEY picks keys from different slots" {
+        R 0 flushall
+        for {set j 0} {$j < 100} {incr j} {
+            R 0 set "key:$j" $j
+        }
+        set slots {}
+        for {set j 0} {$j < 100} {incr j} {
+            lappend slots [R 0 cluster keyslot [R 0 randomkey]]
+        }
+        assert {[llength [lsort -unique $slots]] > 10}
+
+        R 0 flushall
+        R 0 set "{foo}1" 1
+        assert_equal "{foo}1" [R 0 randomkey]
+    }
+
+    test "Keys with an expire are actively expired across slots" {
+        R 0 flushall
+        R 0 debug set-active-expire 1
+        for {set j 0} {$j < 200} {incr j} {
+            R 0 set "key:$j" $j px 50
+        }
+        R 0 set persistent 1
+        wait_for_condition 50 100 {
+            [R 0 dbsize] eq 1
+        } else {
+            fail "Keys with an expire were not actively expired"
+        }
+        assert_equal 0 [R 0 cluster countkeysinslot [R 0 cluster keyslot "key:0"]]
+    } {} {needs:debug}
+
+    test "Eviction samples keys from every slot" {
+        R 0 flushall
+        R 0 config set maxmemory-policy allkeys-lru
+        set limit [expr {[s 0 used_memory] + 1024*1024}]
+        R 0 config set maxmemory $limit
+        for {set j 0} {$j < 20000} {incr j} {
+            R 0 set "key:$j" [string repeat x 100]
+        }
+        assert {[s 0 evicted_keys] > 0}
+        assert {[s 0 used_memory] < $limit + 100*1024}
+        assert {[R 0 dbsize] > 1000}
+
+        # Only keys with an expire are candidates for the volatile policies.
+        R 0 flushall
+        R 0 config set maxmemory 0
+        R 0 config set maxmemory-policy volatile-ttl
+        for {set j 0} {$j < 1000} {incr j} {
+            R 0 set "persistent:$j" [string repeat x 100]
+            R 0 set "volatile:$j" [string repeat x 100] ex [expr {1000 + $j}]
+        }
+        R 0 config set maxmemory [expr {[s 0 used_memory] - 32*1024}]
+        R 0 set "persistent:new" 1
+        assert {[s 0 evicted_keys] > 0}
+        for {set j 0} {$j < 1000} {incr j} {
+            assert_equal 1 [R 0 exists "persistent:$j"]
+        }
+        R 0 config set maxmemory 0
+        R 0 config set maxmemory-policy noeviction
+    }
+
+    test "FLUSHALL while slot dicts are rehashing" {
+        foreach mode {sync async} {
+            R 0 flushall
+            R 0 config set save ""
+            R 0 config set rdb-key-save-delay 1000000
+            for {set j 0} {$j < 1024} {incr j} {
+                R 0 set "{foo}$j" $j
+            }
+
+            # Start the rehashing and a child process in the same transaction,
+            # so that the dict is left rehashing while the child is alive.
+            R 0 multi
+            R 0 set "{foo}1024" 1024
+            R 0 bgsave
+            R 0 exec
+            assert_match "*rehashing dicts: 1*" [R 0 debug HTSTATS 0]
+
+            R 0 flushall $mode
+            assert_match "*rehashing dicts: 0*" [R 0 debug HTSTATS 0]
+            assert_equal 0 [R 0 dbsize]
+
+            # FLUSHALL also kills the child process.
+            wait_for_condition 50 100 {
+                [s 0 rdb_bgsave_in_progress] eq 0
+            } else {
+                fail "bgsave did not stop in time"
+            }
+            R 0 config set rdb-key-save-delay 0
+            for {set j 0} {$j < 2000} {incr j} {
+                R 0 set "{foo}$j" $j
+            }
+            assert_equal 2000 [R 0 dbsize]
+        }
+    } {} {needs:debug}
+
+    test "Multi-part snapshot splits the slots across the parts" {
+        R 0 flushall
+        R 0 config set rdb-save-parts 3
+        for {set j 0} {$j < 1000} {incr j} {
+            R 0 set "key:$j" $j
+            R 0 set "{foo}$j" $j ex 1000
+        }
+        set digest [R 0 debug digest]
+        R 0 debug reload
+        R 0 config set rdb-save-parts 1
+        assert_equal $digest [R 0 debug digest]
+        assert_equal 1000 [R 0 cluster countkeysinslot [R 0 cluster keyslot foo]]
+        assert_match "*keys=2000,expires=1000,*" [R 0 info keyspace]
+    } {} {needs:debug}
+}
+
+start_cluster 1 0 {tags {external:skip cluster} overrides {db-hashtable-type open-addressing lazyfree-threads 4}} {
+
+    test "Open addressing keyspace in cluster mode" {
+        for {set j 0} {$j < 1000} {incr j} {
+            R 0 set "key:$j" $j
+        }
+        R 0 set "{foo}a" 1 px 50
+        assert_equal 1001 [R 0 dbsize]
+        assert_equal 1 [R 0 cluster countkeysinslot [R 0 cluster keyslot foo]]
+        wait_for_condition 50 100 {
+            [R 0 dbsize] eq 1000
+        } else {
+            fail "Key with an expire was not actively expired"
+        }
+        R 0 debug reload
+        assert_equal 1000 [R 0 dbsize]
+        assert_equal 500 [R 0 get "key:500"]
+    } {} {needs:debug}
+
+    test "FLUSHALL ASYNC splits the slot dicts across the lazyfree threads" {
+        R 0 flushall
+        R 0 debug populate 20000
+        for {set j 0} {$j < 1000} {incr j} {
+            R 0 set "{foo}$j" $j ex 1000
+        }
+        R 0 config resetstat
+        R 0 flushall async
+        wait_for_condition 50 100 {
+            [s 0 lazyfree_pending_objects] == 0
+        } else {
+            fail "lazyfree isn't done"
+        }
+        assert_equal 21000 [s 0 lazyfreed_objects]
+
+        set busy 0
+        for {set j 0} {$j < 4} {incr j} {
+            regexp {processed=([0-9]+)} [s 0 lazyfree_thread_$j] -> processed
+            if {$processed > 0} { incr busy }
+        }
+        assert_morethan $busy 1
+        assert_equal 0 [R 0 dbsize]
+    } {} {needs:debug}
+}
@@ -832,4 +832,68 @@ start_server {tags {"expire"}} {
         close_replication_stream $repl
         assert_equal [r debug set-active-expire 1] {OK}
     } {} {needs:debug}
+
+    test {Active expire index reclaims the keys that are due} {
+        r flushall
+        r config set active-expire-index yes
+        r config resetstat
+        r debug set-active-expire 0
+        for {set j 0} {$j < 1000} {incr j} {
+            r psetex short:$j 100 x
+            r set long:$j x ex 1000
+            r set persistent:$j x
+        }
+        # Expire times that are updated, removed, or moved to other keys.
+        r set moved x px 100
+        r rename moved renamed
+        r set extended x px 100
+        r pexpire extended 100000
+        r set persisted x px 100
+        r persist persisted
+        assert_equal 2002 [s expire_index_keys]
+
+        after 200
+        assert_morethan [s expire_index_lag_ms] 0
+        r debug set-active-expire 1
+        wait_for_condition 50 100 {
+            [r dbsize] == 2002
+        } else {
+            fail "Keys did not actively expire."
+        }
+        assert_equal 1001 [s expire_index_keys]
+        assert_equal 0 [s expire_index_lag_ms]
+        assert_morethan [s expire_index_lag_max_ms] 0
+        assert_equal 1001 [s expired_keys]
+        assert_equal 3 [r exists extended persisted long:0]
+        assert_equal 0 [r exists renamed]
+    } {} {needs:debug}
+
+    test {Active expire index is built and released with the config} {
+        r config set active-expire-index no
+        assert_equal 0 [s expire_index_keys]
+        r debug set-active-expire 0
+        r psetex short 100 x
+        r config set active-expire-index yes
+        assert_equal 1002 [s expire_index_keys]
+        r debug set-active-expire 1
+        wait_for_condition 50 100 {
+            [r exists short] == 0
+        } else {
+            fail "Key did not actively expire."
+        }
+        assert_equal 1001 [s expire_index_keys]
+    } {} {needs:debug}
+
+    test {Active expire index follows SWAPDB and FLUSHDB} {
+        r select 10
+        r set other x px 100000
+        r swapdb 9 10
+        assert_equal 1002 [s expire_index_keys]
+        r flushdb
+        assert_equal 1 [s expire_index_keys]
+        r flushall async
+        assert_equal 0 [s expire_index_keys]
+        r select 9
+        r config set active-expire-index no
+    } {OK} {singledb:skip}
 }
@@ -311,6 +311,27 @@ start_server {tags {"info" "external:skip"}} {
             assert_lessthan $value 22000 ;# default hz is 10, so duration < 1000 / 10, allow some tolerance
         }
 
+        test {stats: reply buffer pool} {
+            r config resetstat
+            # New clients take their reply buffer from the pool, where the
+            # previous ones gave it back when they were closed.
+            for {set j 0} {$j < 10} {incr j} {
+                set rd [sider_client]
+                $rd ping
+                $rd close
+            }
+            assert_morethan_equal [s reply_buffer_pool_hits] 5
+
+            # Replies larger than the static buffer use pooled blocks, that
+            # the first reply gives back to the pool if it was trimmed.
+            r rpush biglist {*}[lrepeat 2000 [string repeat x 20]]
+            assert_equal 2000 [llength [r lrange biglist 0 -1]]
+            set hits [s reply_buffer_pool_hits]
+            assert_equal 2000 [llength [r lrange biglist 0 -1]]
+            assert_morethan [s reply_buffer_pool_hits] $hits
+            r del biglist
+        }
+
         test {stats: debug metrics} {
             # make sure debug info is hidden
             set info [r info]
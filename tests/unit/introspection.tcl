@@ -359,6 +359,7 @@ start_server {tags {"introspection"}} {
             rdbchecksum
             daemonize
             io-threads-do-reads
+            io-threads-event-loops
             tcp-backlog
             always-show-logo
             syslog-enabled
@@ -373,7 +374,9 @@ start_server {tags {"introspection"}} {
             supervised
             syslog-facility
             databases
+            db-hashtable-type
             io-threads
+            lazyfree-threads
             logfile
             unixsocketperm
             replicaof
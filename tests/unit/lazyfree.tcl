@@ -88,3 +88,112 @@ start_server {tags {"lazyfree"}} {
         assert_equal [s lazyfreed_objects] 0
     } {} {needs:config-resetstat}
 }
+
+start_server {tags {"lazyfree"} overrides {lazyfree-threads 4}} {
+    test "lazy free spreads the objects across the lazyfree threads" {
+        r config resetstat
+        r eval {
+            for j = 1, 200 do
+                for i = 1, 200 do
+                    sider.call('sadd', 'set:' .. j, 'e' .. i)
+                end
+            end
+        } 0
+        r unlink {*}[r keys set:*]
+
+        wait_for_condition 50 100 {
+            [s lazyfree_pending_objects] == 0
+        } else {
+            fail "lazyfree isn't done"
+        }
+        assert_equal 200 [s lazyfreed_objects]
+
+        # The jobs of a single command are batched and spread evenly.
+        set total 0
+        for {set j 0} {$j < 4} {incr j} {
+            assert_match {processed=*,stolen=*,pending=0} [s lazyfree_thread_$j]
+            regexp {processed=([0-9]+)} [s lazyfree_thread_$j] -> processed
+            assert_morethan $processed 0
+            incr total $processed
+        }
+        assert_equal 200 $total
+        assert_equal {} [s lazyfree_thread_4]
+    } {} {needs:config-resetstat}
+
+    test "FLUSHALL ASYNC releases a big database with all the lazyfree threads" {
+        r flushall
+        r debug populate 50000
+        r eval {
+            for i = 1, 10000 do
+                sider.call('expire', 'key:' .. i, 1000)
+            end
+        } 0
+        r config resetstat
+        r flushall async
+
+        wait_for_condition 50 100 {
+            [s lazyfree_pending_objects] == 0
+        } else {
+            fail "lazyfree isn't done"
+        }
+        assert_equal 50000 [s lazyfreed_objects]
+
+        set busy 0
+        for {set j 0} {$j < 4} {incr j} {
+            regexp {processed=([0-9]+)} [s lazyfree_thread_$j] -> processed
+            if {$processed > 0} { incr busy }
+        }
+        assert_morethan $busy 1
+        assert_equal 0 [r dbsize]
+    } {} {needs:debug needs:config-resetstat}
+}
+
+start_server {tags {"lazyfree"} overrides {lazyfree-incremental yes}} {
+    test "lazyfree-incremental frees big values in steps" {
+        r config resetstat
+        set orig_mem [s used_memory]
+        r eval {
+            for i = 1, 10000 do
+                sider.call('rpush', 'list', string.rep('x', 100))
+                sider.call('sadd', 'set', 'e' .. i)
+                sider.call('hset', 'hash', 'f' .. i, i)
+                sider.call('zadd', 'zset', i, 'e' .. i)
+            end
+        } 0
+        assert_morethan [s used_memory] [expr {$orig_mem+2000000}]
+        r set small foo
+
+        assert_equal 5 [r del list set hash zset small]
+        assert_equal 0 [r exists list set hash zset small]
+        # The key may be reused while its old value is being freed.
+        r sadd set foo
+        assert_equal {foo} [r smembers set]
+        r del set
+
+        wait_for_condition 50 100 {
+            [s lazyfree_incremental_pending_objects] == 0
+        } else {
+            fail "incremental free isn't done"
+        }
+        assert_equal 4 [s lazyfree_incremental_freed_objects]
+        assert_equal 0 [s lazyfreed_objects]
+        assert_lessthan [s used_memory] [expr {$orig_mem+500000}]
+    } {} {needs:config-resetstat}
+
+    test "lazyfree-incremental frees overwritten values in steps" {
+        r config resetstat
+        r eval {
+            for i = 1, 1000 do
+                sider.call('hset', 'hash', 'f' .. i, i)
+            end
+        } 0
+        r set hash foo
+        assert_equal foo [r get hash]
+        wait_for_condition 50 100 {
+            [s lazyfree_incremental_pending_objects] == 0
+        } else {
+            fail "incremental free isn't done"
+        }
+        assert_equal 1 [s lazyfree_incremental_freed_objects]
+    } {} {needs:config-resetstat}
+}
@@ -475,7 +475,9 @@ start_server {tags {"maxmemory external:skip"}} {
         # we need to make sure to evict keynames of a total size of more than
         # 16kb since the (PROTO_REPLY_CHUNK_BYTES), only after that the
         # invalidation messages have a chance to trigger further eviction.
-        set used [s used_memory]
+        # the idle reply buffer pools are released before evicting keys.
+        set info [r info memory]
+        set used [expr {[getInfoProperty $info used_memory] - [getInfoProperty $info mem_reply_buffer_pools]}]
         set limit [expr {$used - 40000}]
         r config set maxmemory $limit
 
@@ -588,3 +590,124 @@ start_server {tags {"maxmemory" "external:skip"}} {
         assert {[r object freq foo] == 5}
     }
 }
+
+start_server {tags {"maxmemory" "external:skip"}} {
+    test {allkeys-slru can't be enabled at runtime} {
+        catch {r config set maxmemory-policy allkeys-slru} e
+        set e
+    } {*set when the server started*}
+}
+
+start_server {tags {"maxmemory" "external:skip"} overrides {maxmemory-policy allkeys-slru}} {
+    test {allkeys-slru evicts the keys accessed once before the keys accessed again} {
+        for {set j 0} {$j < 500} {incr j} {
+            r set cold:$j [string repeat x 1000]
+        }
+        for {set j 0} {$j < 100} {incr j} {
+            r set hot:$j [string repeat x 1000]
+            r get hot:$j
+        }
+        set used [s used_memory]
+        r config set maxmemory [expr {$used+200*1024}]
+
+        # A scan through many keys accessed once.
+        for {set j 500} {$j < 2500} {incr j} {
+            r set cold:$j [string repeat x 1000]
+        }
+        assert_morethan [s evicted_keys] 1000
+        for {set j 0} {$j < 100} {incr j} {
+            assert_equal 1 [r exists hot:$j]
+        }
+        assert_equal 0 [r exists cold:0]
+        assert_equal 1 [r exists cold:2499]
+    }
+
+    test {allkeys-slru evicts the least recently used protected keys last} {
+        r config set maxmemory 0
+        r flushall
+        for {set j 0} {$j < 100} {incr j} {
+            r set key:$j [string repeat x 1000]
+            r get key:$j
+        }
+        r get key:0
+        set used [s used_memory]
+        r config set maxmemory [expr {$used-20*1024}]
+        r set new x
+        # The first keys were demoted to the probation list while the
+        # protected list was filling up, but key:0 was accessed again.
+        assert_equal 0 [r exists key:1]
+        assert_equal 1 [r exists key:0]
+        assert_equal 1 [r exists key:99]
+    }
+
+    test {allkeys-slru lists follow the keyspace changes} {
+        r config set maxmemory 0
+        r flushall async
+        r select 10
+        r set other x
+        r swapdb 9 10
+        r select 9
+        r debug reload
+        r rename other renamed
+        r get renamed
+        for {set j 0} {$j < 100} {incr j} {
+            r set key:$j [string repeat x 1000]
+        }
+        set used [s used_memory]
+        r config set maxmemory [expr {$used-20*1024}]
+        r set new x
+        assert_equal 1 [r exists renamed]
+        assert_equal 0 [r exists key:0]
+        r config set maxmemory 0
+    } {OK} {needs:debug singledb:skip}
+}
+
+start_server {tags {"maxmemory external:skip"}} {
+    test {Background eviction keeps the used memory below the high watermark} {
+        r config set maxmemory-policy allkeys-lru
+        r config set maxmemory-eviction-watermark-high 90
+        r config set maxmemory-eviction-watermark-low 80
+        set used [s used_memory]
+        set limit [expr {$used+4*1024*1024}]
+        r config set maxmemory $limit
+
+        # Strings are freed synchronously, while the lists are handed to
+        # the lazyfree thread.
+        for {set j 0} {$j < 6000} {incr j} {
+            r set str:$j [string repeat x 1000]
+            if {$j % 10 == 0} {
+                r eval {
+                    for i = 1, 100 do
+                        sider.call('rpush', KEYS[1], string.rep('y', 100))
+                    end
+                } 1 list:$j
+            }
+        }
+
+        # The keys were evicted before reaching the limit.
+        set info [r info stats]
+        assert_morethan [getInfoProperty $info evicted_keys_background] 0
+        assert_equal [getInfoProperty $info evicted_keys] \
+                     [getInfoProperty $info evicted_keys_background]
+        wait_for_condition 50 100 {
+            [s used_memory] < $limit*0.9
+        } else {
+            fail "Background eviction didn't get below the high watermark"
+        }
+        assert_morethan [r dbsize] 0
+    }
+
+    test {Background eviction is disabled with a high watermark of 0} {
+        r flushall
+        r config resetstat
+        r config set maxmemory-eviction-watermark-high 0
+        set used [s used_memory]
+        r config set maxmemory [expr {$used+1024*1024}]
+        for {set j 0} {$j < 2000} {incr j} {
+            r set str:$j [string repeat x 1000]
+        }
+        assert_morethan [s evicted_keys] 0
+        assert_equal 0 [s evicted_keys_background]
+        r config set maxmemory 0
+    }
+}
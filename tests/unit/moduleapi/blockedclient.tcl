@@ -17,6 +17,21 @@ start_server {tags {"modules"}} {
     	assert_equal {Blocked client is not allowed} [r do_rm_call acquire_gil]
     }
 
+    test {Thread safe contexts are created and freed from a thread without the GIL} {
+        set rd [sider_deferring_client]
+        $rd tsctx_loop 100000
+        # Meanwhile the main thread allocates and frees reply buffers for the
+        # clients it creates and serves.
+        for {set j 0} {$j < 200} {incr j} {
+            set rr [sider_client]
+            assert_equal PONG [$rr ping]
+            $rr close
+        }
+        assert_equal 100000 [$rd read]
+        $rd close
+        assert_equal PONG [r ping]
+    }
+
     test {Blocking command are not block the client on RM_Call} {
     	r lpush l test
     	assert_equal [r do_rm_call blpop l 0] {l test}
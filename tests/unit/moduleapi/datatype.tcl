@@ -90,6 +90,19 @@ start_server {tags {"modules"}} {
         $rd close
     }
 
+    test {DataType: module keys in a multi-part snapshot} {
+        r flushdb
+        r config set rdb-save-parts 3
+        populate 1000
+        for {set j 0} {$j < 100} {incr j} {
+            r datatype.set dtkey$j $j val$j
+        }
+        r debug reload
+        r config set rdb-save-parts 1
+        assert_equal 1100 [r dbsize]
+        assert_equal {99 val99} [r datatype.get dtkey99]
+    } {} {needs:debug}
+
     test {DataType: check the type name} {
         r flushdb
         r datatype.set foo 111 bar
@@ -170,3 +170,250 @@ start_server {config "minimal.conf" tags {"external:skip"}} {
         }
     }
 }
+
+start_server {tags {"network external:skip"} overrides {io-threads 2 io-threads-do-reads yes io-threads-do-commands yes}} {
+    # I/O threads are only activated when there are enough clients with
+    # pending replies, so keep pipelining from many clients until some
+    # of the commands get executed by the I/O threads.
+    proc io_threads_pipeline {clients cmds} {
+        foreach rd $clients {
+            foreach cmd $cmds { $rd {*}$cmd }
+        }
+        set replies {}
+        foreach rd $clients {
+            set reply {}
+            foreach cmd $cmds {
+                if {[catch {$rd read} e]} { set e "ERR: $e" }
+                lappend reply $e
+            }
+            lappend replies $reply
+        }
+        return $replies
+    }
+
+    test {IO threads execute read-only commands} {
+        r set foo bar
+        r mset a 1 b 2
+        r hset h f1 v1 f2 v2
+        r sadd s m1 m2
+        r zadd z 1.5 m1
+        r config resetstat
+
+        set clients {}
+        for {set i 0} {$i < 8} {incr i} {
+            lappend clients [sider_deferring_client]
+        }
+        set cmds {
+            {get foo} {mget a b nokey} {strlen foo} {exists foo a nokey}
+            {hget h f1} {hmget h f1 nofield} {hexists h f2} {hstrlen h f1}
+            {sismember s m1} {smismember s m1 nom} {zscore z m1} {zmscore z m1 nom}
+            {set foo bar} {get foo} {incr a} {get a} {decr a}
+        }
+        set expected {
+            bar {1 2 {}} 3 2
+            v1 {v1 {}} 1 2
+            1 {1 0} 1.5 {1.5 {}}
+            OK bar 2 2 1
+        }
+        wait_for_condition 100 10 {
+            [lsort -unique [io_threads_pipeline $clients $cmds]] eq [list [list {*}$expected]] &&
+            [s io_threaded_commands_processed] > 0
+        } else {
+            fail "No command was executed by IO threads"
+        }
+
+        # The commands executed by the IO threads are accounted as usual.
+        set info [r info stats commandstats]
+        set calls 0
+        foreach {_ n} [regexp -all -inline {cmdstat_[^:]+:calls=([0-9]+)} $info] {
+            incr calls $n
+        }
+        assert_equal [getInfoProperty $info total_commands_processed] $calls
+        assert_morethan [getInfoProperty $info keyspace_misses] 0
+        assert_equal 0 [getInfoProperty $info total_error_replies]
+
+        foreach rd $clients { $rd close }
+    }
+
+    test {IO threads leave type errors and expired keys to the main thread} {
+        r set foo bar
+        r set expired val px 1
+        after 10
+        r config resetstat
+
+        set clients {}
+        for {set i 0} {$i < 8} {incr i} {
+            lappend clients [sider_deferring_client]
+        }
+        set cmds {{hget foo f} {get expired} {get foo}}
+        wait_for_condition 100 10 {
+            [lsort -unique [io_threads_pipeline $clients $cmds]] eq
+                [list {{ERR: WRONGTYPE Operation against a key holding the wrong kind of value} {} bar}] &&
+            [s io_threaded_commands_processed] > 0
+        } else {
+            fail "No command was executed by IO threads"
+        }
+        assert_equal 0 [r exists expired]
+        assert_equal "count=[s total_error_replies]" [errorrstat WRONGTYPE r]
+
+        foreach rd $clients { $rd close }
+    }
+
+    test {IO threads sleep while idle and are woken up by the main thread} {
+        r config resetstat
+        set clients {}
+        for {set i 0} {$i < 8} {incr i} {
+            lappend clients [sider_deferring_client]
+        }
+        # Leave the threads idle between the batches, so that they go to sleep.
+        wait_for_condition 100 10 {
+            [lsort -unique [io_threads_pipeline $clients {{get foo}}]] eq {bar} &&
+            [s io_threads_wakeups] > 0
+        } else {
+            fail "IO threads were never woken up"
+        }
+        assert_morethan_equal [s io_threads_main_wait_usec] 0
+        foreach rd $clients { $rd close }
+    }
+
+    test {IO threads write large values referenced by the output buffers} {
+        set value [string repeat z 200000]
+        r set big $value
+        set clients {}
+        for {set i 0} {$i < 8} {incr i} {
+            lappend clients [sider_deferring_client]
+        }
+        for {set i 0} {$i < 10} {incr i} {
+            assert_equal [list [list $value $value]] \
+                [lsort -unique [io_threads_pipeline $clients {{get big} {get big}}]]
+        }
+        # The references held by the output buffers were all released.
+        assert_equal 1 [r object refcount big]
+        foreach rd $clients { $rd close }
+    }
+
+    test {IO threads update the access time of the keys they read} {
+        r config set maxmemory-policy allkeys-lfu
+        r config set lfu-log-factor 0
+        r set hot v
+        r config resetstat
+        set clients {}
+        for {set i 0} {$i < 8} {incr i} {
+            lappend clients [sider_deferring_client]
+        }
+        wait_for_condition 20 10 {
+            [lsort -unique [io_threads_pipeline $clients {{get hot} {get hot}}]] eq {{v v}} &&
+            [s io_threaded_commands_processed] > 0
+        } else {
+            fail "No command was executed by IO threads"
+        }
+        # With a log factor of 0 every access increments the counter.
+        regexp {calls=([0-9]+)} [cmdrstat get r] -> calls
+        assert_equal [expr {min(255,5+$calls)}] [r object freq hot]
+        foreach rd $clients { $rd close }
+        r config set maxmemory-policy noeviction
+    } {OK} {needs:config-maxmemory}
+}
+
+start_server {tags {"network external:skip"} overrides {io-threads 4 io-threads-do-reads yes io-threads-do-commands yes io-threads-spin-us 0}} {
+    test {IO threads and the main thread sleep without spinning} {
+        r set foo bar
+        r config resetstat
+        set clients {}
+        for {set i 0} {$i < 16} {incr i} {
+            lappend clients [sider_deferring_client]
+        }
+        # Every wait goes straight to sleep, a lost wakeup would hang here.
+        for {set j 0} {$j < 500} {incr j} {
+            foreach rd $clients { $rd get foo; $rd incr counter }
+            foreach rd $clients {
+                assert_equal bar [$rd read]
+                $rd read
+            }
+        }
+        assert_equal [expr {500*16}] [r get counter]
+        assert_morethan [s io_threads_wakeups] 0
+        assert_morethan [s io_threads_main_wakeups] 0
+        foreach rd $clients { $rd close }
+    }
+}
+
+start_server {tags {"network external:skip"} overrides {io-threads 3 io-threads-event-loops yes}} {
+    test {IO threads event loops serve the clients} {
+        r config resetstat
+        set clients {}
+        for {set i 0} {$i < 8} {incr i} {
+            set rd [sider_deferring_client]
+            $rd set key:$i $i
+            lappend clients $rd
+        }
+        foreach rd $clients { assert_equal OK [$rd read] }
+
+        # Pipelines, large arguments and transactions.
+        set big [string repeat x 1000000]
+        foreach rd $clients {
+            for {set j 0} {$j < 100} {incr j} { $rd incr counter }
+            $rd set big $big
+            $rd multi
+            $rd get big
+            $rd exec
+            $rd flush
+        }
+        foreach rd $clients {
+            for {set j 0} {$j < 100} {incr j} { $rd read }
+            assert_equal OK [$rd read]
+            assert_equal OK [$rd read]
+            assert_equal QUEUED [$rd read]
+            assert_equal [list $big] [$rd read]
+        }
+        assert_equal 800 [r get counter]
+        assert_morethan [s io_threaded_reads_processed] 0
+
+        foreach rd $clients { $rd close }
+    }
+
+    test {IO threads event loops: clients can be blocked, killed and closed} {
+        set rd [sider_deferring_client]
+        $rd client id
+        set id [$rd read]
+        $rd blpop mylist 0
+        wait_for_blocked_clients_count 1
+        r rpush mylist a
+        assert_equal {mylist a} [$rd read]
+
+        assert_equal 1 [r client kill id $id]
+        assert_error "*I/O error*" {$rd ping; $rd read}
+        $rd close
+
+        set rd [sider_deferring_client]
+        $rd quit
+        assert_equal OK [$rd read]
+        $rd close
+
+        wait_for_condition 50 100 {
+            [s connected_clients] == 1
+        } else {
+            fail "Clients were not released"
+        }
+        assert_equal PONG [r ping]
+    }
+
+    test {IO threads event loops: commands sent during a busy script} {
+        set rd [sider_deferring_client]
+        r config set lua-time-limit 10
+        $rd eval {while true do end} 0
+        after 200
+        catch {r ping} e
+        assert_match {BUSY*} $e
+
+        # The thread reads the command while the client is protected, it
+        # must be processed once the script is done.
+        $rd ping
+        $rd flush
+        after 100
+        r script kill
+        assert_error {*killed by user*} {$rd read}
+        assert_equal PONG [$rd read]
+        $rd close
+    }
+}
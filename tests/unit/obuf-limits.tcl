@@ -122,7 +122,12 @@ start_server {tags {"obuf-limits external:skip logreqres:skip"}} {
         for {set i 0} {$i < 150} {incr i} {
             r lpush mylist $item
         }
-        set orig_mem [s used_memory]
+        # Reply buffers given back to the pools are not held by any client.
+        proc used_memory_no_pools {} {
+            set info [r info memory]
+            expr {[getInfoProperty $info used_memory] - [getInfoProperty $info mem_reply_buffer_pools]}
+        }
+        set orig_mem [used_memory_no_pools]
         # Set client name and get all items
         set rd [sider_deferring_client]
         $rd client setname mybiglist
@@ -134,7 +139,7 @@ start_server {tags {"obuf-limits external:skip logreqres:skip"}} {
         # Before we read reply, sider will close this client.
         set clients [r client list]
         assert_no_match "*name=mybiglist*" $clients
-        set cur_mem [s used_memory]
+        set cur_mem [used_memory_no_pools]
         # 10k just is a deviation threshold
         assert {$cur_mem < 10000 + $orig_mem}
 
@@ -228,3 +233,55 @@ start_server {tags {"obuf-limits external:skip logreqres:skip"}} {
         reconnect
     }
 }
+
+start_server {tags {"obuf-limits external:skip"}} {
+    # Send 'count' GET of the key 'big' without reading the replies, and wait
+    # for the server to execute them all and fill the socket.
+    proc pending_big_replies {rd count} {
+        $rd client id
+        set id [$rd read]
+        r config resetstat
+        for {set j 0} {$j < $count} {incr j} {
+            $rd get big
+        }
+        $rd flush
+        wait_for_condition 50 100 {
+            [string match "*cmdstat_get:calls=$count,*" [r info commandstats]]
+        } else {
+            fail "The GET commands were not executed"
+        }
+        assert_match {*omem=[1-9]*} [r client list id $id]
+    }
+
+    test {Large values are not copied in the output buffer} {
+        set value [string repeat x 1000000]
+        r set big $value
+        set rd [sider_deferring_client]
+        set used [s used_memory]
+        pending_big_replies $rd 20
+
+        # The queued replies reference the value instead of holding a copy.
+        assert_lessthan [expr {[s used_memory] - $used}] 5000000
+
+        # Changing the key doesn't affect the replies already queued.
+        r append big y
+        r set big z
+        r del big
+        for {set j 0} {$j < 20} {incr j} {
+            assert_equal $value [$rd read]
+        }
+        $rd close
+    }
+
+    test {Large values referenced by the output buffer survive FLUSHALL ASYNC} {
+        set value [string repeat y 1000000]
+        r set big $value
+        set rd [sider_deferring_client]
+        pending_big_replies $rd 20
+        r flushall async
+        for {set j 0} {$j < 20} {incr j} {
+            assert_equal $value [$rd read]
+        }
+        $rd close
+    }
+}
@@ -382,6 +382,118 @@ start_server {tags {"other external:skip"}} {
     } {} {needs:debug needs:local-process}
 }
 
+start_server {tags {"other external:skip"} overrides {db-hashtable-type open-addressing}} {
+    proc scan_all_keys {} {
+        set cur 0
+        set keys {}
+        while 1 {
+            set res [r scan $cur]
+            set cur [lindex $res 0]
+            lappend keys {*}[lindex $res 1]
+            if {$cur == 0} break
+        }
+        lsort -unique $keys
+    }
+
+    test {Open addressing keyspace: basic operations} {
+        assert_equal {db-hashtable-type open-addressing} [r config get db-hashtable-type]
+        r select 9
+        for {set j 0} {$j < 1000} {incr j} {
+            r set key:$j $j
+        }
+        assert_equal 1000 [r dbsize]
+        for {set j 0} {$j < 1000} {incr j} {
+            assert_equal $j [r get key:$j]
+        }
+        for {set j 0} {$j < 1000} {incr j 2} {
+            r del key:$j
+        }
+        assert_equal 500 [r dbsize]
+        assert_equal 0 [r exists key:0]
+        assert_equal 1 [r exists key:1]
+        assert_equal 500 [llength [scan_all_keys]]
+        assert_match "*slots:*(3 per bucket)*" [r debug HTSTATS 9 full]
+    } {} {needs:debug}
+
+    test {Open addressing keyspace: expires, RANDOMKEY and reload} {
+        r flushall
+        for {set j 0} {$j < 1000} {incr j} {
+            r set key:$j $j
+            if {$j % 2} {r expire key:$j 1000}
+        }
+        assert_equal 500 [scan [regexp -inline {expires=(\d+)} [r info keyspace]] expires=%d]
+        for {set j 0} {$j < 100} {incr j} {
+            assert_equal 1 [r exists [r randomkey]]
+        }
+        r debug reload
+        assert_equal 1000 [r dbsize]
+        assert_equal -1 [r ttl key:0]
+        assert_range [r ttl key:1] 900 1000
+        for {set j 0} {$j < 1000} {incr j 2} {
+            r pexpire key:$j 1
+        }
+        wait_for_condition 50 100 {
+            [r dbsize] == 500
+        } else {
+            fail "Keys with an expire were not actively expired"
+        }
+    } {} {needs:debug}
+
+    test {Open addressing keyspace: SCAN and lookups while rehashing} {
+        r flushall
+        r config set save ""
+        r config set rdb-key-save-delay 1000000
+        populate 4000 "" 1
+        r bgsave
+        wait_for_condition 10 100 {
+            [s rdb_bgsave_in_progress] eq 1
+        } else {
+            fail "bgsave did not start in time"
+        }
+
+        # The table still grows while there is a child process, but the keys
+        # are not moved to the new table.
+        populate 4000 "x" 1
+        assert_match "*rehashing target*" [r debug HTSTATS 9]
+        assert_equal 8000 [r dbsize]
+        assert_equal 8000 [llength [scan_all_keys]]
+        for {set j 0} {$j < 4000} {incr j 100} {
+            assert_equal 2 [r exists $j x$j]
+            r del $j
+        }
+        assert_equal 7960 [llength [scan_all_keys]]
+
+        exec kill -9 [get_child_pid 0]
+        waitForBgsave r
+        r config set rdb-key-save-delay 0
+        wait_for_condition 50 100 {
+            ![string match "*rehashing target*" [r debug HTSTATS 9]]
+        } else {
+            fail "Rehashing did not complete"
+        }
+        assert_equal 7960 [llength [scan_all_keys]]
+    } {} {needs:debug needs:local-process}
+
+    test {Open addressing keyspace: keys churn} {
+        r flushall
+        for {set j 0} {$j < 20000} {incr j} {
+            set k [randomInt 2000]
+            if {[randomInt 2]} {
+                r set $k $j
+                set model($k) $j
+            } else {
+                r del $k
+                unset -nocomplain model($k)
+            }
+        }
+        assert_equal [array size model] [r dbsize]
+        foreach k [array names model] {
+            assert_equal $model($k) [r get $k]
+        }
+        assert_equal [lsort [array names model]] [scan_all_keys]
+    }
+}
+
 proc read_proc_title {pid} {
     set fd [open "/proc/$pid/cmdline" "r"]
     set cmdline [read $fd 1024]
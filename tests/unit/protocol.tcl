@@ -230,6 +230,36 @@ start_server {tags {"protocol network"}} {
         assert_equal [r exec] 2
     }
 
+    test "Reused argument objects are not shared with stored values" {
+        # Argument objects not retained by a command are reused to parse the
+        # following ones: values and keys retained by previous commands must
+        # never be overwritten.
+        r flushdb
+        set rd [sider_deferring_client]
+        for {set j 0} {$j < 300} {incr j} {
+            set val [string repeat [format %c [expr {97 + $j % 26}]] [expr {($j * 7) % 200}]]
+            $rd set key:$j $val
+            $rd watch key:$j
+            $rd get key:$j
+        }
+        for {set j 0} {$j < 300} {incr j} {
+            set val [string repeat [format %c [expr {97 + $j % 26}]] [expr {($j * 7) % 200}]]
+            assert_equal OK [$rd read]
+            assert_equal OK [$rd read]
+            assert_equal $val [$rd read]
+        }
+        $rd close
+        for {set j 0} {$j < 300} {incr j} {
+            set val [string repeat [format %c [expr {97 + $j % 26}]] [expr {($j * 7) % 200}]]
+            assert_equal $val [r get key:$j]
+            if {[string length $val] <= 44} {
+                assert_encoding embstr key:$j
+            } else {
+                assert_encoding raw key:$j
+            }
+        }
+    }
+
 }
 
 start_server {tags {"regression"}} {
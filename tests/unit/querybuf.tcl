@@ -21,11 +21,35 @@ start_server {tags {"querybuf slow"}} {
     # increase the execution frequency of clientsCron
     r config set hz 100
 
+    test "Client executes small argv commands using reusable query buffer" {
+        set rd [sider_deferring_client]
+        $rd client setname test_reusable_client
+        $rd read
+        set res [r client list]
+
+        # The client has no query buffer once its input was processed.
+        assert_match {*name=test_reusable_client * qbuf=0 qbuf-free=0 * cmd=client|setname *} $res
+
+        # The client executing the command is borrowing the query buffer of
+        # the thread, which is given back after the command is processed.
+        assert_match {*qbuf=26 qbuf-free=* cmd=client|list *} $res
+        $rd close
+    }
+
     # The test will run at least 2s to check if client query
     # buffer will be resized when client idle 2s.
     test "query buffer resized correctly" {
         set rd [sider_client]
         $rd client setname test_client
+
+        # A partial command makes the client keep the query buffer.
+        $rd write "*3\r\n\$3\r\nset\r\n\$1\r\na\r\n\$1\r\nb"
+        $rd flush
+        wait_for_condition 100 10 {
+            [client_query_buffer test_client] > 0
+        } else {
+            fail "client has no query buffer"
+        }
         set orig_test_client_qbuf [client_query_buffer test_client]
         # Make sure query buff has less than the peak resize threshold (PROTO_RESIZE_THRESHOLD) 32k
         # but at least the basic IO reading buffer size (PROTO_IOBUF_LEN) 16k
@@ -33,10 +57,20 @@ start_server {tags {"querybuf slow"}} {
 
         # Check that the initial query buffer is resized after 2 sec
         wait_for_condition 1000 10 {
-            [client_idle_sec test_client] >= 3 && [client_query_buffer test_client] == 0
+            [client_idle_sec test_client] >= 3 && [client_query_buffer test_client] < 1024
         } else {
             fail "query buffer was not resized"
         }
+
+        # Once the command is complete the buffer is released when idle.
+        $rd write "\r\n"
+        $rd flush
+        assert_equal OK [$rd read]
+        wait_for_condition 1000 10 {
+            [client_idle_sec test_client] >= 3 && [client_query_buffer test_client] == 0
+        } else {
+            fail "query buffer was not released"
+        }
         $rd close
     }
 
@@ -0,0 +1,168 @@
+#!/usr/bin/env tclsh
+# Released under the BSD license like Sider itself
+#
+# Compare the hit ratio of the eviction policies replaying the same trace of
+# key accesses against a running server used as a cache: every access is a
+# GET, followed by a SET of the key on a miss, executed atomically by a
+# script so that the replay can be pipelined.
+#
+# The trace is a text file with a key name per line. It can be generated with
+# --generate: the keys are then picked with a Zipf distribution, and a scan
+# of keys that are never accessed again is inserted from time to time, which
+# is the access pattern where a segmented LRU helps the most.
+#
+# Every policy starts from an empty dataset and replays the whole trace. The
+# server must be started with "maxmemory-policy allkeys-slru" to compare it
+# with the other policies, since its lists can't be allocated at runtime.
+#
+# WARNING: the dataset of the target server is flushed.
+#
+# Usage: tclsh utils/lru/trace-bench.tcl [options]
+#
+#   --host <host>        Server host (default 127.0.0.1)
+#   --port <port>        Server port (default 6379)
+#   --trace <file>       Trace to replay (default /tmp/lru-trace.txt)
+#   --generate <count>   Write a trace of <count> accesses first
+#   --keys <count>       Distinct keys of the generated trace (default 100000)
+#   --skew <s>           Zipf exponent of the generated trace (default 0.9)
+#   --scan-every <n>     Accesses between scans (default 50000, 0 disables)
+#   --scan-len <n>       Keys read by every scan (default 20000)
+#   --size <bytes>       Size of the values (default 100)
+#   --maxmemory <bytes>  Memory limit of the dataset (default 10mb worth of
+#                        values above the memory used by the empty server)
+#   --policies <list>    Policies to compare
+#                        (default "allkeys-lru allkeys-lfu allkeys-random allkeys-slru")
+
+source [file join [file dirname [info script]] ../../tests/support/sider.tcl]
+
+set ::host 127.0.0.1
+set ::port 6379
+set ::trace /tmp/lru-trace.txt
+set ::generate 0
+set ::keys 100000
+set ::skew 0.9
+set ::scan_every 50000
+set ::scan_len 20000
+set ::size 100
+set ::maxmemory 0
+set ::policies {allkeys-lru allkeys-lfu allkeys-random allkeys-slru}
+
+foreach {opt val} $argv {
+    switch -- $opt {
+        --host {set ::host $val}
+        --port {set ::port $val}
+        --trace {set ::trace $val}
+        --generate {set ::generate $val}
+        --keys {set ::keys $val}
+        --skew {set ::skew $val}
+        --scan-every {set ::scan_every $val}
+        --scan-len {set ::scan_len $val}
+        --size {set ::size $val}
+        --maxmemory {set ::maxmemory $val}
+        --policies {set ::policies $val}
+        default {
+            puts "Unknown option $opt"
+            exit 1
+        }
+    }
+}
+
+# Write a trace of 'count' accesses to the file ::trace.
+proc generate_trace {count} {
+    # Cumulative distribution of the Zipf ranks.
+    set sum 0.0
+    for {set j 1} {$j <= $::keys} {incr j} {
+        set sum [expr {$sum + 1.0/pow($j,$::skew)}]
+        lappend cdf $sum
+    }
+
+    set fd [open $::trace w]
+    set scan_id 0
+    for {set n 1} {$n <= $count} {incr n} {
+        # Binary search of the rank of a uniform random point of the CDF.
+        set x [expr {rand()*$sum}]
+        set lo 0
+        set hi [expr {$::keys-1}]
+        while {$lo < $hi} {
+            set mid [expr {($lo+$hi)/2}]
+            if {[lindex $cdf $mid] < $x} {set lo [expr {$mid+1}]} else {set hi $mid}
+        }
+        puts $fd "key:$lo"
+
+        if {$::scan_every && $n % $::scan_every == 0} {
+            for {set j 0} {$j < $::scan_len} {incr j} {
+                puts $fd "scan:$scan_id:$j"
+            }
+            incr scan_id
+        }
+    }
+    close $fd
+}
+
+# Replay the trace with the given policy, returning the number of accesses
+# and of hits.
+proc replay {r policy sha} {
+    $r flushall
+    $r config set maxmemory-policy $policy
+    $r config set maxmemory $::limit
+    $r config resetstat
+
+    set rd [sider $::host $::port 1]
+    set value [string repeat x $::size]
+    set fd [open $::trace r]
+    set accesses 0
+    set hits 0
+    set pipeline 1000
+    while {1} {
+        set count 0
+        while {$count < $pipeline && [gets $fd key] >= 0} {
+            $rd evalsha $sha 1 $key $value
+            incr count
+        }
+        for {set j 0} {$j < $count} {incr j} {
+            incr hits [$rd read]
+        }
+        incr accesses $count
+        if {$count < $pipeline} break
+    }
+    close $fd
+    $rd close
+    $r config set maxmemory 0
+    return [list $accesses $hits]
+}
+
+if {$::generate} {
+    puts "Generating $::generate accesses to $::trace..."
+    generate_trace $::generate
+}
+
+set r [sider $::host $::port]
+set old_policy [lindex [$r config get maxmemory-policy] 1]
+set old_maxmemory [lindex [$r config get maxmemory] 1]
+
+$r flushall
+if {$::maxmemory} {
+    set ::limit $::maxmemory
+} else {
+    regexp {used_memory:([0-9]+)} [$r info memory] -> used
+    set ::limit [expr {$used + 10*1024*1024}]
+}
+
+set sha [$r script load {
+    if sider.call('get',KEYS[1]) then return 1 end
+    sider.call('set',KEYS[1],ARGV[1])
+    return 0
+}]
+
+puts [format "%-16s %12s %12s %10s %10s" policy accesses hits "hit ratio" "time (s)"]
+foreach policy $::policies {
+    set start [clock milliseconds]
+    lassign [replay $r $policy $sha] accesses hits
+    set elapsed [expr {([clock milliseconds]-$start)/1000.0}]
+    puts [format "%-16s %12d %12d %9.2f%% %10.1f" $policy $accesses $hits \
+        [expr {$accesses ? 100.0*$hits/$accesses : 0}] $elapsed]
+}
+
+$r config set maxmemory-policy $old_policy
+$r config set maxmemory $old_maxmemory
+$r close
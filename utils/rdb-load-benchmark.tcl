@@ -0,0 +1,162 @@
+#!/usr/bin/env tclsh
+# Released under the BSD license like Sider itself
+#
+# Measure how long a running server takes to load a large synthetic RDB with
+# a different number of loading threads (the rdb-load-threads option), and
+# to save and load it as a multi-part snapshot (the rdb-save-parts option).
+#
+# The dataset is created with pipelined commands and saved once for every
+# number of parts, then it is loaded with DEBUG RELOAD NOSAVE a few times for
+# every thread count. The server must have the DEBUG command enabled.
+#
+# WARNING: the dataset of the target server is flushed.
+#
+# Usage: tclsh utils/rdb-load-benchmark.tcl [options]
+#
+#   --host <host>        Server host (default 127.0.0.1)
+#   --port <port>        Server port (default 6379)
+#   --keys <count>       Number of keys to create (default 1000000)
+#   --type <type>        string, list, set, zset, hash or mixed (default mixed)
+#   --elements <count>   Elements of every list, set, zset and hash (default 64)
+#   --size <bytes>       Size of strings and elements (default 32)
+#   --threads <list>     Thread counts to compare (default "0 1 2 4 8")
+#   --parts <list>       Snapshot parts to compare (default 1)
+#   --runs <count>       Loads for every thread count (default 3)
+
+source [file join [file dirname [info script]] ../tests/support/sider.tcl]
+
+set ::host 127.0.0.1
+set ::port 6379
+set ::keys 1000000
+set ::type mixed
+set ::elements 64
+set ::size 32
+set ::threads {0 1 2 4 8}
+set ::parts {1}
+set ::runs 3
+
+foreach {opt val} $argv {
+    switch -- $opt {
+        --host {set ::host $val}
+        --port {set ::port $val}
+        --keys {set ::keys $val}
+        --type {set ::type $val}
+        --elements {set ::elements $val}
+        --size {set ::size $val}
+        --threads {set ::threads $val}
+        --parts {set ::parts $val}
+        --runs {set ::runs $val}
+        default {
+            puts "Unknown option $opt"
+            exit 1
+        }
+    }
+}
+
+# A pool of random values, so that the strings are not all compressed to a
+# few bytes by the RDB LZF compression.
+proc random_value {} {
+    set s {}
+    for {set j 0} {$j < $::size} {incr j} {
+        append s [format %c [expr {97 + int(rand()*26)}]]
+    }
+    return $s
+}
+for {set j 0} {$j < 1024} {incr j} {
+    lappend ::values [random_value]
+}
+
+proc value {n} {
+    lindex $::values [expr {$n % 1024}]
+}
+
+# Return the command creating the key number 'n' of type 'type'.
+proc key_command {type n} {
+    set key "key:$n"
+    switch -- $type {
+        string {return [list set $key [value $n]]}
+        list {
+            set cmd [list rpush $key]
+            for {set j 0} {$j < $::elements} {incr j} {lappend cmd [value [expr {$n+$j}]]}
+        }
+        set {
+            set cmd [list sadd $key]
+            for {set j 0} {$j < $::elements} {incr j} {lappend cmd "$j:[value $n]"}
+        }
+        zset {
+            set cmd [list zadd $key]
+            for {set j 0} {$j < $::elements} {incr j} {lappend cmd $j "$j:[value $n]"}
+        }
+        hash {
+            set cmd [list hset $key]
+            for {set j 0} {$j < $::elements} {incr j} {lappend cmd "field:$j" [value [expr {$n+$j}]]}
+        }
+        mixed {
+            return [key_command [lindex {string list set zset hash} [expr {$n % 5}]] $n]
+        }
+        default {
+            puts "Unknown type $type"
+            exit 1
+        }
+    }
+    return $cmd
+}
+
+proc populate {} {
+    set r [sider $::host $::port 1]
+    set pipeline 1000
+    for {set n 0} {$n < $::keys} {incr n $pipeline} {
+        set count 0
+        for {set j $n} {$j < $n+$pipeline && $j < $::keys} {incr j} {
+            $r {*}[key_command $::type $j]
+            incr count
+        }
+        for {set j 0} {$j < $count} {incr j} {$r read}
+        puts -nonewline "\rCreating the dataset: [expr {$n+$count}] keys"
+        flush stdout
+    }
+    puts ""
+    $r close
+}
+
+set r [sider $::host $::port]
+set old_threads [lindex [$r config get rdb-load-threads] 1]
+set old_parts [lindex [$r config get rdb-save-parts] 1]
+
+$r flushall
+populate
+set dir [lindex [$r config get dir] 1]
+set dbfilename [lindex [$r config get dbfilename] 1]
+
+puts [format "%-8s %-10s %12s %12s" parts threads "best (ms)" "avg (ms)"]
+foreach parts $::parts {
+    $r config set rdb-save-parts $parts
+    set start [clock milliseconds]
+    $r save
+    set elapsed [expr {[clock milliseconds]-$start}]
+    set size 0
+    set files [file join $dir $dbfilename]
+    if {$parts > 1} {set files [glob [file join $dir $dbfilename].*.part*]}
+    foreach f $files {
+        incr size [file size $f]
+    }
+    puts [format "%-8s %-10s %12d    (SAVE, [$r dbsize] keys, %.2f MB)" $parts - $elapsed [expr {$size/1024.0/1024.0}]]
+
+    foreach t $::threads {
+        $r config set rdb-load-threads $t
+        set best 0
+        set total 0
+        for {set run 0} {$run < $::runs} {incr run} {
+            set start [clock milliseconds]
+            $r debug reload nosave
+            set elapsed [expr {[clock milliseconds]-$start}]
+            if {$run == 0 || $elapsed < $best} {set best $elapsed}
+            incr total $elapsed
+        }
+        puts [format "%-8s %-10s %12d %12d" $parts $t $best [expr {$total/$::runs}]]
+    }
+}
+
+$r config set rdb-load-threads $old_threads
+$r config set rdb-save-parts $old_parts
+$r close